@@ -38,11 +38,14 @@ enum {
   US_IN_ONE_SECOND = 1000000,
   MS_IN_ONE_SECOND = 1000,
   MAX_HOST_LEN = 128,
+  NOT_READY_RETRY_US = 100000,
+  NOT_READY_MAX_RETRIES = 300,
 };
 
 static void create_socket(Client* client);
 static double now_sec(void);
 static void terminate(const char* msg, unsigned use_perr);
+static void read_fully(Client* client, void* buf, unsigned len, const char* what);
 static unsigned action_to_index(char action);
 static void client_send_request(Client* client, uint8_t action, uint8_t table_id, uint8_t index_id, const uint8_t* key, unsigned key_len);
 static json_t* client_describe_schema(Client* client);
@@ -53,10 +56,32 @@ static uint32_t read_le32(const uint8_t *buf);
 static uint64_t read_le64(const uint8_t *buf);
 static unsigned parse_fetch_args(Client* client, int argc, char* argv[], int start);
 static int resolve_adhoc_fetch(Client* client, json_t* schema, unsigned* out_table_id, unsigned* out_index_id, const char** out_index_type);
+static json_t* find_schema_table(Client* client, json_t* schema);
 static void print_row_json(ClientRow* row);
+static int client_fetch_by_column(Client* client, unsigned table_id);
 static void client_run_adhoc_fetch(Client* client);
+static unsigned parse_nearest_args(Client* client, int argc, char* argv[], int start);
+static void write_le64(uint8_t* buf, uint64_t v);
+static void client_run_nearest(Client* client);
+static unsigned parse_search_args(Client* client, int argc, char* argv[], int start);
+static unsigned parse_index_arg(Client* client, int argc, char* argv[], int* i);
+static unsigned check_index_args(Client* client, const char* subcmd);
+static void resolve_ranked_index(Client* client, const char* type, unsigned* table_id, unsigned* index_id);
+static void print_ranked_rows(Client* client, const char* unit);
+static unsigned report_split(Client* client, unsigned table_id, const char* what);
+static void client_run_search(Client* client);
+static unsigned parse_group_args(Client* client, int argc, char* argv[], int start);
+static void client_run_group(Client* client);
+static unsigned parse_ingest_args(Client* client, int argc, char* argv[], int start);
+static unsigned encode_json_row(json_t* obj, uint8_t* buf, unsigned size);
+static void ingest_send(Client* client, unsigned table_id, uint8_t* payload, unsigned len);
+static void client_run_ingest(Client* client);
+static unsigned parse_export_args(Client* client, int argc, char* argv[], int start);
+static void client_run_export(Client* client);
 static void client_run_schema(Client* client);
 static void client_run_adhoc_stats(Client* client);
+static void client_hello(Client* client);
+static void client_run_clients(Client* client);
 static void client_run_bench(Client* client);
 
 Client* client_build(void) {
@@ -66,17 +91,22 @@ Client* client_build(void) {
   client->options.unix = MELIAN_DEFAULT_SOCKET_PATH;
   client->options.fetch.table_id = -1;
   client->options.fetch.index_id = -1;
+  client->rcap = INITIAL_RESPONSE_LEN;
+  client->rbuf = malloc(client->rcap);
+  if (!client->rbuf) terminate("allocate response buffer", 1);
 
   return client;
 }
 
 void client_destroy(Client* client) {
+  if (!client) return;
+  free(client->rbuf);
   free(client);
 }
 
 unsigned client_configure(Client* client, int argc, char* argv[]) {
   int opt = 0;
-  while ((opt = getopt(argc, argv, "h:p:u:UCHOsqv")) != -1) {
+  while ((opt = getopt(argc, argv, "h:p:u:n:d:P:UCHOsqv")) != -1) {
     switch (opt) {
       case 'h':
         client->options.host = optarg;
@@ -87,6 +117,19 @@ unsigned client_configure(Client* client, int argc, char* argv[]) {
       case 'u':
         client->options.unix = optarg;
         break;
+      case 'n':
+        client->options.name = optarg;
+        break;
+      case 'd':
+        client->options.deadline_us = strtoul(optarg, NULL, 10);
+        break;
+      case 'P':
+        client->options.priority = strtoul(optarg, NULL, 10);
+        if (client->options.priority > 255) {
+          fprintf(stderr, "Priority must be between 0 and 255\n");
+          return 0;
+        }
+        break;
       case MELIAN_ACTION_QUERY_TABLE1_BY_ID:
         client->options.fetches[action_to_index(opt)] = 1;
         break;
@@ -121,6 +164,24 @@ unsigned client_configure(Client* client, int argc, char* argv[]) {
     } else if (strcmp(subcmd, "stats") == 0) {
       client->options.mode = CLIENT_MODE_STATS;
       return 1;
+    } else if (strcmp(subcmd, "clients") == 0) {
+      client->options.mode = CLIENT_MODE_CLIENTS;
+      return 1;
+    } else if (strcmp(subcmd, "nearest") == 0) {
+      client->options.mode = CLIENT_MODE_NEAREST;
+      return parse_nearest_args(client, argc, argv, optind + 1);
+    } else if (strcmp(subcmd, "search") == 0) {
+      client->options.mode = CLIENT_MODE_SEARCH;
+      return parse_search_args(client, argc, argv, optind + 1);
+    } else if (strcmp(subcmd, "group") == 0) {
+      client->options.mode = CLIENT_MODE_GROUP;
+      return parse_group_args(client, argc, argv, optind + 1);
+    } else if (strcmp(subcmd, "ingest") == 0) {
+      client->options.mode = CLIENT_MODE_INGEST;
+      return parse_ingest_args(client, argc, argv, optind + 1);
+    } else if (strcmp(subcmd, "export") == 0) {
+      client->options.mode = CLIENT_MODE_EXPORT;
+      return parse_export_args(client, argc, argv, optind + 1);
     }
     fprintf(stderr, "Unknown subcommand: %s\n", subcmd);
     return 0;
@@ -130,13 +191,24 @@ unsigned client_configure(Client* client, int argc, char* argv[]) {
 }
 
 static void client_send_request(Client* client, uint8_t action, uint8_t table_id, uint8_t index_id, const uint8_t* key, unsigned key_len) {
-  MelianRequestHeader hdr;
-  hdr.data.version = MELIAN_HEADER_VERSION;
-  hdr.data.action = action;
-  hdr.data.table_id = table_id;
-  hdr.data.index_id = index_id;
-  hdr.data.length = htonl(key_len);
-  if (write(client->fd, &hdr, sizeof(MelianRequestHeader)) != sizeof(MelianRequestHeader)) terminate("write hdr", 1);
+  struct {
+    MelianRequestHeader hdr;
+    MelianRequestDeadline deadline;
+  } req;
+  unsigned hdr_len = sizeof(MelianRequestHeader);
+  req.hdr.data.version = MELIAN_HEADER_VERSION;
+  req.hdr.data.action = action;
+  req.hdr.data.table_id = table_id;
+  req.hdr.data.index_id = index_id;
+  req.hdr.data.length = htonl(key_len);
+  if (client->options.deadline_us || client->options.priority) {
+    req.hdr.data.version = MELIAN_HEADER_VERSION_DEADLINE;
+    memset(&req.deadline, 0, sizeof(req.deadline));
+    for (unsigned b = 0; b < 4; ++b) req.deadline.bytes[b] = (uint8_t)(client->options.deadline_us >> (8 * b));
+    req.deadline.data.priority = (uint8_t)client->options.priority;
+    hdr_len += sizeof(MelianRequestDeadline);
+  }
+  if (write(client->fd, &req, hdr_len) != (ssize_t)hdr_len) terminate("write hdr", 1);
   if (key_len > 0 && key) {
     if (write(client->fd, key, key_len) != (ssize_t)key_len) terminate("write key", 1);
   }
@@ -145,26 +217,41 @@ static void client_send_request(Client* client, uint8_t action, uint8_t table_id
 int client_read_response(Client* client) {
   /* Read response: LEN(4B BE) + VALUE(LEN) */
   client->rlen = 0;
+  client->status = 0;
   MelianResponseHeader hdr;
   ssize_t n = read(client->fd, &hdr, sizeof(MelianResponseHeader));
   if (n <= 0) return -1;
-  // TODO: do we need to fix this?
-  if (n != sizeof(MelianResponseHeader)) terminate("short read len", 0);
-  client->rlen = ntohl(hdr.data.length);
-  if (client->rlen > 0) {
-    unsigned got = 0;
-    while (got < client->rlen) {
-      ssize_t r = read(client->fd, client->rbuf + got, client->rlen - got);
-      if (r <= 0) terminate("read val", 1);
-      got += r;
-    }
-    // printf("Got %u bytes: [%.*s]\n", got, got, client->rbuf);
-  } else {
-    // printf("Response: <empty>\n");
+  if (n != sizeof(MelianResponseHeader)) {
+    read_fully(client, (uint8_t*)&hdr + n, sizeof(MelianResponseHeader) - n, "read len");
+  }
+  uint32_t len = ntohl(hdr.data.length);
+  if (len & MELIAN_RESPONSE_STATUS) {
+    client->status = len & ~MELIAN_RESPONSE_STATUS;
+    return 0;
   }
+  if (len > client->rcap) {
+    unsigned cap = client->rcap;
+    while (cap < len) cap *= 2;
+    char* rbuf = realloc(client->rbuf, cap);
+    if (!rbuf) terminate("response too large", 1);
+    client->rbuf = rbuf;
+    client->rcap = cap;
+  }
+  client->rlen = len;
+  if (client->rlen > 0) read_fully(client, client->rbuf, client->rlen, "read val");
   return client->rlen;
 }
 
+// Read exactly len bytes, however many reads a large response takes.
+static void read_fully(Client* client, void* buf, unsigned len, const char* what) {
+  unsigned got = 0;
+  while (got < len) {
+    ssize_t r = read(client->fd, (uint8_t*)buf + got, len - got);
+    if (r <= 0) terminate(what, 1);
+    got += r;
+  }
+}
+
 static uint16_t read_le16(const uint8_t *buf) {
   return (uint16_t)(buf[0] | ((uint16_t)buf[1] << 8));
 }
@@ -484,6 +571,8 @@ static unsigned parse_fetch_args(Client* client, int argc, char* argv[], int sta
       client->options.fetch.index_name = argv[++i];
     } else if (strcmp(argv[i], "--index-id") == 0 && i + 1 < argc) {
       client->options.fetch.index_id = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--column") == 0 && i + 1 < argc) {
+      client->options.fetch.column = argv[++i];
     } else if (strcmp(argv[i], "--key") == 0 && i + 1 < argc) {
       client->options.fetch.key = argv[++i];
     } else {
@@ -500,8 +589,14 @@ static unsigned parse_fetch_args(Client* client, int argc, char* argv[], int sta
     fprintf(stderr, "fetch: --table and --table-id are mutually exclusive\n");
     return 0;
   }
-  if (!client->options.fetch.index_name && client->options.fetch.index_id < 0) {
-    fprintf(stderr, "fetch: --index or --index-id is required\n");
+  if (client->options.fetch.column &&
+      (client->options.fetch.index_name || client->options.fetch.index_id >= 0)) {
+    fprintf(stderr, "fetch: --column and --index / --index-id are mutually exclusive\n");
+    return 0;
+  }
+  if (!client->options.fetch.column &&
+      !client->options.fetch.index_name && client->options.fetch.index_id < 0) {
+    fprintf(stderr, "fetch: --index, --index-id or --column is required\n");
     return 0;
   }
   if (client->options.fetch.index_name && client->options.fetch.index_id >= 0) {
@@ -519,32 +614,12 @@ static int resolve_adhoc_fetch(Client* client, json_t* schema,
                                unsigned* out_table_id, unsigned* out_index_id,
                                const char** out_index_type) {
   struct FetchOptions* fo = &client->options.fetch;
-  json_t* tables = json_object_get(schema, "tables");
-  if (!json_is_array(tables)) {
-    fprintf(stderr, "Schema missing 'tables' array\n");
-    return 0;
-  }
-
-  json_t* table = NULL;
+  json_t* table = find_schema_table(client, schema);
+  if (!table) return 0;
   size_t idx;
   json_t* val;
-  json_array_foreach(tables, idx, val) {
-    if (fo->table_name) {
-      const char* name = json_string_value(json_object_get(val, "name"));
-      if (name && strcmp(name, fo->table_name) == 0) { table = val; break; }
-    } else {
-      json_t* tid = json_object_get(val, "id");
-      if (json_is_integer(tid) && json_integer_value(tid) == fo->table_id) { table = val; break; }
-    }
-  }
-  if (!table) {
-    if (fo->table_name)
-      fprintf(stderr, "Table '%s' not found in schema\n", fo->table_name);
-    else
-      fprintf(stderr, "Table ID %d not found in schema\n", fo->table_id);
-    return 0;
-  }
   *out_table_id = (unsigned)json_integer_value(json_object_get(table, "id"));
+  if (fo->column) return 1;
 
   json_t* indexes = json_object_get(table, "indexes");
   if (!json_is_array(indexes)) {
@@ -574,6 +649,36 @@ static int resolve_adhoc_fetch(Client* client, json_t* schema,
   return 1;
 }
 
+// The schema entry of the table named by --table or --table-id.
+static json_t* find_schema_table(Client* client, json_t* schema) {
+  struct FetchOptions* fo = &client->options.fetch;
+  json_t* tables = json_object_get(schema, "tables");
+  if (!json_is_array(tables)) {
+    fprintf(stderr, "Schema missing 'tables' array\n");
+    return NULL;
+  }
+
+  json_t* table = NULL;
+  size_t idx;
+  json_t* val;
+  json_array_foreach(tables, idx, val) {
+    if (fo->table_name) {
+      const char* name = json_string_value(json_object_get(val, "name"));
+      if (name && strcmp(name, fo->table_name) == 0) { table = val; break; }
+    } else {
+      json_t* tid = json_object_get(val, "id");
+      if (json_is_integer(tid) && json_integer_value(tid) == fo->table_id) { table = val; break; }
+    }
+  }
+  if (!table) {
+    if (fo->table_name)
+      fprintf(stderr, "Table '%s' not found in schema\n", fo->table_name);
+    else
+      fprintf(stderr, "Table ID %d not found in schema\n", fo->table_id);
+  }
+  return table;
+}
+
 static void print_row_json(ClientRow* row) {
   json_t* obj = json_object();
   for (uint32_t i = 0; i < row->field_count; i++) {
@@ -618,6 +723,19 @@ static void client_run_adhoc_fetch(Client* client) {
     exit(1);
   }
 
+  if (client->options.fetch.column) {
+    json_decref(schema);
+    if (client_fetch_by_column(client, table_id) <= 0) return;
+    ClientRow* row = client_decode_row((uint8_t*)client->rbuf, client->rlen);
+    if (!row) {
+      fprintf(stderr, "Failed to decode response (%u bytes)\n", client->rlen);
+      exit(1);
+    }
+    print_row_json(row);
+    client_row_free(row);
+    return;
+  }
+
   if (client->options.verbose) {
     fprintf(stderr, "Resolved: table_id=%u, index_id=%u, type=%s\n",
             table_id, index_id, index_type);
@@ -666,6 +784,637 @@ static void client_run_adhoc_fetch(Client* client) {
   client_row_free(row);
 }
 
+// Fetch through a column without a configured index; the server builds one
+// on first use and answers "not ready" until it is done.
+static int client_fetch_by_column(Client* client, unsigned table_id) {
+  const char* column = client->options.fetch.column;
+  const char* key = client->options.fetch.key;
+  size_t column_len = strlen(column);
+  size_t key_len = strlen(key);
+  if (column_len > 255) {
+    fprintf(stderr, "Column name '%s' is too long\n", column);
+    exit(1);
+  }
+  uint8_t payload[1 + 255 + MAX_HOST_LEN];
+  if (key_len > MAX_HOST_LEN) {
+    fprintf(stderr, "Key '%s' is too long\n", key);
+    exit(1);
+  }
+  payload[0] = (uint8_t)column_len;
+  memcpy(payload + 1, column, column_len);
+  memcpy(payload + 1 + column_len, key, key_len);
+
+  for (unsigned tries = 0; ; ++tries) {
+    if (client->options.verbose) {
+      fprintf(stderr, "Fetching: table_id=%u column=%s key=\"%s\"\n", table_id, column, key);
+    }
+    client_send_request(client, MELIAN_ACTION_FETCH, table_id, MELIAN_INDEX_ADHOC,
+                        payload, 1 + column_len + key_len);
+    int bytes = client_read_response(client);
+    if (client->status == MELIAN_STATUS_NO_ROOM) {
+      fprintf(stderr, "No room for an index on column %s, the server indexes too many others\n", column);
+      return 0;
+    }
+    if (client->status != MELIAN_STATUS_NOT_READY) {
+      if (bytes <= 0) {
+        fprintf(stderr, "No row found (table_id=%u, column=%s, key=%s)\n", table_id, column, key);
+      }
+      return bytes;
+    }
+    if (tries >= NOT_READY_MAX_RETRIES) {
+      fprintf(stderr, "Index on column %s is still not ready, giving up\n", column);
+      return 0;
+    }
+    if (client->options.verbose && !tries) {
+      fprintf(stderr, "Index on column %s is being built, waiting\n", column);
+    }
+    usleep(NOT_READY_RETRY_US);
+  }
+}
+
+static unsigned parse_nearest_args(Client* client, int argc, char* argv[], int start) {
+  struct NearestOptions* no = &client->options.nearest;
+  for (int i = start; i < argc; i++) {
+    if (parse_index_arg(client, argc, argv, &i)) {
+      continue;
+    } else if (strcmp(argv[i], "--lat") == 0 && i + 1 < argc) {
+      no->lat = argv[++i];
+    } else if (strcmp(argv[i], "--lon") == 0 && i + 1 < argc) {
+      no->lon = argv[++i];
+    } else if (strcmp(argv[i], "--k") == 0 && i + 1 < argc) {
+      no->k = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--radius") == 0 && i + 1 < argc) {
+      no->radius_km = atof(argv[++i]);
+    } else {
+      fprintf(stderr, "Unknown nearest option: %s\n", argv[i]);
+      return 0;
+    }
+  }
+
+  if (!check_index_args(client, "nearest")) return 0;
+  if (!no->lat || !no->lon) {
+    fprintf(stderr, "nearest: --lat and --lon are required\n");
+    return 0;
+  }
+  return 1;
+}
+
+static unsigned parse_search_args(Client* client, int argc, char* argv[], int start) {
+  struct SearchOptions* so = &client->options.search;
+  so->min_score = 0.3;
+  for (int i = start; i < argc; i++) {
+    if (parse_index_arg(client, argc, argv, &i)) {
+      continue;
+    } else if (strcmp(argv[i], "--query") == 0 && i + 1 < argc) {
+      so->query = argv[++i];
+    } else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+      so->limit = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--min-score") == 0 && i + 1 < argc) {
+      so->min_score = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--substring") == 0) {
+      so->substring = 1;
+    } else {
+      fprintf(stderr, "Unknown search option: %s\n", argv[i]);
+      return 0;
+    }
+  }
+
+  if (!check_index_args(client, "search")) return 0;
+  if (!so->query || !so->query[0]) {
+    fprintf(stderr, "search: --query is required\n");
+    return 0;
+  }
+  if (strlen(so->query) > MELIAN_SEARCH_MAX_QUERY) {
+    fprintf(stderr, "search: --query is longer than %d bytes\n", MELIAN_SEARCH_MAX_QUERY);
+    return 0;
+  }
+  return 1;
+}
+
+// Parse a --table / --table-id / --index / --index-id option at argv[*i].
+static unsigned parse_index_arg(Client* client, int argc, char* argv[], int* i) {
+  struct FetchOptions* fo = &client->options.fetch;
+  if (*i + 1 >= argc) return 0;
+  if (strcmp(argv[*i], "--table") == 0) {
+    fo->table_name = argv[++*i];
+  } else if (strcmp(argv[*i], "--table-id") == 0) {
+    fo->table_id = atoi(argv[++*i]);
+  } else if (strcmp(argv[*i], "--index") == 0) {
+    fo->index_name = argv[++*i];
+  } else if (strcmp(argv[*i], "--index-id") == 0) {
+    fo->index_id = atoi(argv[++*i]);
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+static unsigned check_index_args(Client* client, const char* subcmd) {
+  struct FetchOptions* fo = &client->options.fetch;
+  if (!fo->table_name && fo->table_id < 0) {
+    fprintf(stderr, "%s: --table or --table-id is required\n", subcmd);
+    return 0;
+  }
+  if (fo->table_name && fo->table_id >= 0) {
+    fprintf(stderr, "%s: --table and --table-id are mutually exclusive\n", subcmd);
+    return 0;
+  }
+  if (!fo->index_name && fo->index_id < 0) {
+    fprintf(stderr, "%s: --index or --index-id is required\n", subcmd);
+    return 0;
+  }
+  if (fo->index_name && fo->index_id >= 0) {
+    fprintf(stderr, "%s: --index and --index-id are mutually exclusive\n", subcmd);
+    return 0;
+  }
+  return 1;
+}
+
+static void write_le64(uint8_t* buf, uint64_t v) {
+  for (int i = 0; i < 8; ++i) {
+    buf[i] = (uint8_t)(v >> (8 * i));
+  }
+}
+
+// Resolve the table and index through the schema; exit unless the index is of type.
+static void resolve_ranked_index(Client* client, const char* type, unsigned* table_id, unsigned* index_id) {
+  json_t* schema = client_describe_schema(client);
+  if (!schema) terminate("describe schema", 0);
+
+  const char* index_type;
+  if (!resolve_adhoc_fetch(client, schema, table_id, index_id, &index_type)) {
+    json_decref(schema);
+    exit(1);
+  }
+  if (strcmp(index_type, type) != 0) {
+    fprintf(stderr, "Index %u is a %s index, not a %s index\n", *index_id, index_type, type);
+    json_decref(schema);
+    exit(1);
+  }
+  json_decref(schema);
+}
+
+// Explain a reply with status split; return 1 if that is what it was.
+static unsigned report_split(Client* client, unsigned table_id, const char* what) {
+  if (client->status != MELIAN_STATUS_SPLIT) return 0;
+  fprintf(stderr, "Table %u is split between cluster nodes, which cannot answer %s\n", table_id, what);
+  return 1;
+}
+
+// Print a NEAREST or SEARCH reply: [u32 count] then [f64 value][u32 len][row] per row.
+static void print_ranked_rows(Client* client, const char* unit) {
+  const uint8_t* p = (const uint8_t*)client->rbuf;
+  const uint8_t* end = p + client->rlen;
+  uint32_t count = read_le32(p);
+  p += 4;
+  for (uint32_t i = 0; i < count; ++i) {
+    if (end - p < 12) terminate("truncated response", 0);
+    uint64_t bits = read_le64(p);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    uint32_t row_len = read_le32(p + 8);
+    p += 12;
+    if ((uint32_t)(end - p) < row_len) terminate("truncated response", 0);
+    ClientRow* row = client_decode_row(p, row_len);
+    if (!row) {
+      fprintf(stderr, "Failed to decode row %u (%u bytes)\n", i, row_len);
+      exit(1);
+    }
+    printf("# %.3f %s\n", value, unit);
+    print_row_json(row);
+    client_row_free(row);
+    p += row_len;
+  }
+}
+
+static void client_run_nearest(Client* client) {
+  unsigned table_id, index_id;
+  resolve_ranked_index(client, "geo", &table_id, &index_id);
+
+  struct NearestOptions* no = &client->options.nearest;
+  double lat = atof(no->lat);
+  double lon = atof(no->lon);
+  uint64_t bits;
+  uint8_t payload[MELIAN_NEAREST_REQUEST_LEN];
+  memcpy(&bits, &lat, sizeof(bits));
+  write_le64(payload + 0, bits);
+  memcpy(&bits, &lon, sizeof(bits));
+  write_le64(payload + 8, bits);
+  payload[16] = (uint8_t)(no->k);
+  payload[17] = (uint8_t)(no->k >> 8);
+  payload[18] = (uint8_t)(no->k >> 16);
+  payload[19] = (uint8_t)(no->k >> 24);
+  memcpy(&bits, &no->radius_km, sizeof(bits));
+  write_le64(payload + 20, bits);
+
+  if (client->options.verbose) {
+    fprintf(stderr, "Nearest: table_id=%u index_id=%u lat=%f lon=%f k=%u radius=%f km\n",
+            table_id, index_id, lat, lon, no->k, no->radius_km);
+  }
+  client_send_request(client, MELIAN_ACTION_NEAREST, table_id, index_id,
+                      payload, sizeof(payload));
+  int bytes = client_read_response(client);
+  if (report_split(client, table_id, "NEAREST")) return;
+  if (bytes < 4) {
+    fprintf(stderr, "No rows found (table_id=%u, index_id=%u, status=%u)\n",
+            table_id, index_id, client->status);
+    return;
+  }
+  print_ranked_rows(client, "km");
+}
+
+static void client_run_search(Client* client) {
+  unsigned table_id, index_id;
+  resolve_ranked_index(client, "trigram", &table_id, &index_id);
+
+  struct SearchOptions* so = &client->options.search;
+  unsigned query_len = strlen(so->query);
+  uint8_t payload[MELIAN_SEARCH_PREFIX_LEN + MELIAN_SEARCH_MAX_QUERY];
+  payload[0] = so->substring ? MELIAN_SEARCH_SUBSTRING : MELIAN_SEARCH_SIMILAR;
+  payload[1] = (uint8_t)(so->limit);
+  payload[2] = (uint8_t)(so->limit >> 8);
+  payload[3] = (uint8_t)(so->limit >> 16);
+  payload[4] = (uint8_t)(so->limit >> 24);
+  uint64_t bits;
+  memcpy(&bits, &so->min_score, sizeof(bits));
+  write_le64(payload + 5, bits);
+  memcpy(payload + MELIAN_SEARCH_PREFIX_LEN, so->query, query_len);
+
+  if (client->options.verbose) {
+    fprintf(stderr, "Search: table_id=%u index_id=%u query=\"%s\" %s limit=%u min_score=%f\n",
+            table_id, index_id, so->query, so->substring ? "substring" : "similar",
+            so->limit, so->min_score);
+  }
+  client_send_request(client, MELIAN_ACTION_SEARCH, table_id, index_id,
+                      payload, MELIAN_SEARCH_PREFIX_LEN + query_len);
+  int bytes = client_read_response(client);
+  if (report_split(client, table_id, "SEARCH")) return;
+  if (bytes < 4) {
+    fprintf(stderr, "No rows found (table_id=%u, index_id=%u, status=%u)\n",
+            table_id, index_id, client->status);
+    return;
+  }
+  print_ranked_rows(client, "score");
+}
+
+static unsigned parse_group_args(Client* client, int argc, char* argv[], int start) {
+  struct FetchOptions* fo = &client->options.fetch;
+  struct GroupOptions* go = &client->options.group;
+  for (int i = start; i < argc; i++) {
+    if (parse_index_arg(client, argc, argv, &i)) {
+      continue;
+    } else if (strcmp(argv[i], "--key") == 0 && i + 1 < argc) {
+      fo->key = argv[++i];
+    } else if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+      go->offset = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+      go->limit = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Unknown group option: %s\n", argv[i]);
+      return 0;
+    }
+  }
+
+  if (!check_index_args(client, "group")) return 0;
+  if (!fo->key || !fo->key[0]) {
+    fprintf(stderr, "group: --key is required\n");
+    return 0;
+  }
+  if (strlen(fo->key) > MELIAN_GROUP_MAX_KEY) {
+    fprintf(stderr, "group: --key is longer than %d bytes\n", MELIAN_GROUP_MAX_KEY);
+    return 0;
+  }
+  return 1;
+}
+
+// Print a GROUP reply: [u32 count][u32 total] then [u32 len][row] per row.
+static void client_run_group(Client* client) {
+  unsigned table_id, index_id;
+  resolve_ranked_index(client, "group", &table_id, &index_id);
+
+  struct FetchOptions* fo = &client->options.fetch;
+  struct GroupOptions* go = &client->options.group;
+  unsigned key_len = strlen(fo->key);
+  uint8_t payload[MELIAN_GROUP_PREFIX_LEN + MELIAN_GROUP_MAX_KEY];
+  for (unsigned b = 0; b < 4; ++b) {
+    payload[b] = (uint8_t)(go->offset >> (8 * b));
+    payload[4 + b] = (uint8_t)(go->limit >> (8 * b));
+  }
+  memcpy(payload + MELIAN_GROUP_PREFIX_LEN, fo->key, key_len);
+
+  if (client->options.verbose) {
+    fprintf(stderr, "Group: table_id=%u index_id=%u key=\"%s\" offset=%u limit=%u\n",
+            table_id, index_id, fo->key, go->offset, go->limit);
+  }
+  client_send_request(client, MELIAN_ACTION_GROUP, table_id, index_id,
+                      payload, MELIAN_GROUP_PREFIX_LEN + key_len);
+  int bytes = client_read_response(client);
+  if (report_split(client, table_id, "GROUP by any but its first index")) return;
+  if (bytes < 8) {
+    fprintf(stderr, "No rows found (table_id=%u, index_id=%u, key=%s, status=%u)\n",
+            table_id, index_id, fo->key, client->status);
+    return;
+  }
+  const uint8_t* p = (const uint8_t*)client->rbuf;
+  const uint8_t* end = p + client->rlen;
+  uint32_t count = read_le32(p);
+  uint32_t total = read_le32(p + 4);
+  p += 8;
+  printf("# %u of %u rows from %u\n", count, total, go->offset);
+  for (uint32_t i = 0; i < count; ++i) {
+    if (end - p < 4) terminate("truncated response", 0);
+    uint32_t row_len = read_le32(p);
+    p += 4;
+    if ((uint32_t)(end - p) < row_len) terminate("truncated response", 0);
+    ClientRow* row = client_decode_row(p, row_len);
+    if (!row) {
+      fprintf(stderr, "Failed to decode row %u (%u bytes)\n", i, row_len);
+      exit(1);
+    }
+    print_row_json(row);
+    client_row_free(row);
+    p += row_len;
+  }
+}
+
+static unsigned parse_ingest_args(Client* client, int argc, char* argv[], int start) {
+  struct FetchOptions* fo = &client->options.fetch;
+  struct IngestOptions* io = &client->options.ingest;
+  for (int i = start; i < argc; i++) {
+    if (strcmp(argv[i], "--table") == 0 && i + 1 < argc) {
+      fo->table_name = argv[++i];
+    } else if (strcmp(argv[i], "--table-id") == 0 && i + 1 < argc) {
+      fo->table_id = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--secret") == 0 && i + 1 < argc) {
+      io->secret = argv[++i];
+    } else if (strcmp(argv[i], "--delta") == 0) {
+      io->delta = 1;
+    } else {
+      fprintf(stderr, "Unknown ingest option: %s\n", argv[i]);
+      return 0;
+    }
+  }
+
+  if (!fo->table_name && fo->table_id < 0) {
+    fprintf(stderr, "ingest: --table or --table-id is required\n");
+    return 0;
+  }
+  if (fo->table_name && fo->table_id >= 0) {
+    fprintf(stderr, "ingest: --table and --table-id are mutually exclusive\n");
+    return 0;
+  }
+  if (!io->secret || !io->secret[0]) {
+    fprintf(stderr, "ingest: --secret is required\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Encode a JSON object as a row in the binary row format into buf.
+// Objects and arrays inside it are stored as JSON text.
+// Return the row length; 0 if it does not fit in size bytes.
+static unsigned encode_json_row(json_t* obj, uint8_t* buf, unsigned size) {
+  unsigned pos = 4;
+  uint32_t count = 0;
+  const char* name;
+  json_t* value;
+  json_object_foreach(obj, name, value) {
+    uint8_t scalar[8];
+    const uint8_t* data = scalar;
+    unsigned len = 0;
+    char* text = NULL;
+    uint8_t type = MELIAN_VALUE_NULL;
+    uint64_t bits = 0;
+    switch (json_typeof(value)) {
+      case JSON_INTEGER:
+        type = MELIAN_VALUE_INT64;
+        bits = (uint64_t)json_integer_value(value);
+        len = 8;
+        break;
+      case JSON_REAL: {
+        double d = json_real_value(value);
+        type = MELIAN_VALUE_FLOAT64;
+        memcpy(&bits, &d, sizeof(bits));
+        len = 8;
+        break;
+      }
+      case JSON_STRING:
+        type = MELIAN_VALUE_BYTES;
+        data = (const uint8_t*)json_string_value(value);
+        len = json_string_length(value);
+        break;
+      case JSON_TRUE:
+      case JSON_FALSE:
+        type = MELIAN_VALUE_BOOL;
+        bits = json_is_true(value);
+        len = 1;
+        break;
+      case JSON_OBJECT:
+      case JSON_ARRAY:
+        type = MELIAN_VALUE_BYTES;
+        text = json_dumps(value, JSON_COMPACT | JSON_PRESERVE_ORDER);
+        if (!text) return 0;
+        data = (const uint8_t*)text;
+        len = strlen(text);
+        break;
+      default:
+        break;
+    }
+    if (data == scalar) write_le64(scalar, bits);
+    unsigned name_len = strlen(name);
+    if (pos + 2 + name_len + 1 + 4 + len > size) {
+      free(text);
+      return 0;
+    }
+    buf[pos] = (uint8_t)name_len;
+    buf[pos + 1] = (uint8_t)(name_len >> 8);
+    memcpy(buf + pos + 2, name, name_len);
+    pos += 2 + name_len;
+    buf[pos++] = type;
+    for (unsigned b = 0; b < 4; ++b) buf[pos + b] = (uint8_t)(len >> (8 * b));
+    memcpy(buf + pos + 4, data, len);
+    pos += 4 + len;
+    free(text);
+    ++count;
+  }
+  for (unsigned b = 0; b < 4; ++b) buf[b] = (uint8_t)(count >> (8 * b));
+  return pos;
+}
+
+// Send one INGEST request and exit unless the server took it.
+static void ingest_send(Client* client, unsigned table_id, uint8_t* payload, unsigned len) {
+  while (1) {
+    client_send_request(client, MELIAN_ACTION_INGEST, table_id, 0, payload, len);
+    int bytes = client_read_response(client);
+    if (bytes > 0) {
+      if (client->options.verbose) fprintf(stderr, "Ingest %c: %.*s\n", payload[0], bytes, client->rbuf);
+      return;
+    }
+    if (client->status == MELIAN_STATUS_DENIED) terminate("ingest: wrong secret", 0);
+    if (client->status != MELIAN_STATUS_NOT_READY) {
+      fprintf(stderr, "ingest: server refused request '%c' (status=%u)\n", payload[0], client->status);
+      exit(1);
+    }
+    // Another producer holds the table, or the last commit is not applied yet
+    usleep(100 * 1000);
+  }
+}
+
+static unsigned parse_export_args(Client* client, int argc, char* argv[], int start) {
+  struct FetchOptions* fo = &client->options.fetch;
+  struct ExportOptions* eo = &client->options.export;
+  for (int i = start; i < argc; i++) {
+    if (strcmp(argv[i], "--table") == 0 && i + 1 < argc) {
+      fo->table_name = argv[++i];
+    } else if (strcmp(argv[i], "--table-id") == 0 && i + 1 < argc) {
+      fo->table_id = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      eo->out = argv[++i];
+    } else {
+      fprintf(stderr, "Unknown export option: %s\n", argv[i]);
+      return 0;
+    }
+  }
+
+  if (!fo->table_name && fo->table_id < 0) {
+    fprintf(stderr, "export: --table or --table-id is required\n");
+    return 0;
+  }
+  if (fo->table_name && fo->table_id >= 0) {
+    fprintf(stderr, "export: --table and --table-id are mutually exclusive\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Save a table as an Arrow IPC stream. The server encodes it on the first
+// EXPORT after each load, and answers "not ready" until it is done.
+static void client_run_export(Client* client) {
+  json_t* schema = client_describe_schema(client);
+  if (!schema) terminate("describe schema", 0);
+  json_t* table = find_schema_table(client, schema);
+  if (!table) {
+    json_decref(schema);
+    exit(1);
+  }
+  unsigned table_id = (unsigned)json_integer_value(json_object_get(table, "id"));
+  json_decref(schema);
+
+  int bytes = 0;
+  for (unsigned tries = 0; ; ++tries) {
+    if (client->options.verbose) {
+      fprintf(stderr, "Export: table_id=%u\n", table_id);
+    }
+    client_send_request(client, MELIAN_ACTION_EXPORT, table_id, 0, NULL, 0);
+    bytes = client_read_response(client);
+    if (client->status != MELIAN_STATUS_NOT_READY) break;
+    if (tries >= NOT_READY_MAX_RETRIES) {
+      fprintf(stderr, "Export of table_id=%u is still not ready, giving up\n", table_id);
+      exit(1);
+    }
+    if (client->options.verbose && !tries) {
+      fprintf(stderr, "Export of table_id=%u is being built, waiting\n", table_id);
+    }
+    usleep(NOT_READY_RETRY_US);
+  }
+  if (report_split(client, table_id, "EXPORT")) exit(1);
+  if (bytes <= 0) {
+    fprintf(stderr, "No export (table_id=%u, status=%u)\n", table_id, client->status);
+    exit(1);
+  }
+
+  const char* out = client->options.export.out;
+  FILE* fp = out ? fopen(out, "wb") : stdout;
+  if (!fp) terminate(out, 1);
+  if (fwrite(client->rbuf, 1, client->rlen, fp) != client->rlen) terminate("write export", 1);
+  if (out && fclose(fp) != 0) terminate("close export", 1);
+  if (out) fprintf(stderr, "Wrote %u bytes of Arrow stream to %s\n", client->rlen, out);
+}
+
+static void client_run_ingest(Client* client) {
+  json_t* schema = client_describe_schema(client);
+  if (!schema) terminate("describe schema", 0);
+  json_t* table = find_schema_table(client, schema);
+  if (!table) {
+    json_decref(schema);
+    exit(1);
+  }
+  unsigned table_id = (unsigned)json_integer_value(json_object_get(table, "id"));
+  json_decref(schema);
+
+  struct IngestOptions* io = &client->options.ingest;
+  static uint8_t payload[MELIAN_INGEST_MAX_PAYLOAD];
+  unsigned secret_len = strlen(io->secret);
+  if (secret_len + 2 > sizeof(payload)) terminate("ingest: secret too long", 0);
+  payload[0] = MELIAN_INGEST_BEGIN;
+  payload[1] = io->delta ? MELIAN_INGEST_DELTA : MELIAN_INGEST_SNAPSHOT;
+  memcpy(payload + 2, io->secret, secret_len);
+  ingest_send(client, table_id, payload, 2 + secret_len);
+
+  // Each line of input is a row as a JSON object, or in a delta a key to delete
+  unsigned rows = 0;
+  unsigned keys = 0;
+  unsigned len = 0;
+  char line[MELIAN_INGEST_MAX_PAYLOAD];
+  while (fgets(line, sizeof(line), stdin)) {
+    json_error_t error;
+    json_t* value = json_loads(line, JSON_DECODE_ANY, &error);
+    if (!value) {
+      if (strspn(line, " \t\r\n") == strlen(line)) continue;
+      fprintf(stderr, "ingest: invalid JSON on line %u: %s\n", rows + keys + 1, error.text);
+      exit(1);
+    }
+    uint8_t op = json_is_object(value) ? MELIAN_INGEST_ROWS : MELIAN_INGEST_DELETE;
+    if (op == MELIAN_INGEST_DELETE && !io->delta) terminate("ingest: keys to delete need --delta", 0);
+    if (len && payload[0] != op) {
+      ingest_send(client, table_id, payload, len);
+      len = 0;
+    }
+    for (unsigned attempt = 0; attempt < 2; ++attempt) {
+      if (!len) {
+        payload[0] = op;
+        len = 1;
+      }
+      unsigned entry = 0;
+      if (op == MELIAN_INGEST_ROWS) {
+        entry = len + 4 < sizeof(payload) ? encode_json_row(value, payload + len + 4, sizeof(payload) - len - 4) : 0;
+      } else {
+        char text[32];
+        const char* key = text;
+        unsigned key_len = 0;
+        if (json_is_string(value)) {
+          key = json_string_value(value);
+          key_len = json_string_length(value);
+        } else if (json_is_integer(value)) {
+          key_len = snprintf(text, sizeof(text), "%" JSON_INTEGER_FORMAT, json_integer_value(value));
+        }
+        if (!key_len) terminate("ingest: keys to delete must be non-empty strings or integers", 0);
+        if (len + 4 + key_len <= sizeof(payload)) {
+          memcpy(payload + len + 4, key, key_len);
+          entry = key_len;
+        }
+      }
+      if (entry) {
+        for (unsigned b = 0; b < 4; ++b) payload[len + b] = (uint8_t)(entry >> (8 * b));
+        len += 4 + entry;
+        break;
+      }
+      // Full: send what is there and start a new request
+      if (len == 1) terminate("ingest: row too large for one request", 0);
+      ingest_send(client, table_id, payload, len);
+      len = 0;
+    }
+    if (op == MELIAN_INGEST_ROWS) ++rows;
+    else ++keys;
+    json_decref(value);
+  }
+  if (len) ingest_send(client, table_id, payload, len);
+
+  payload[0] = MELIAN_INGEST_COMMIT;
+  ingest_send(client, table_id, payload, 1);
+  printf("Committed %u rows and %u deleted keys: %.*s\n", rows, keys, (int)client->rlen, client->rbuf);
+}
+
 static void client_run_schema(Client* client) {
   json_t* schema = client_describe_schema(client);
   if (!schema) terminate("describe schema", 0);
@@ -693,6 +1442,31 @@ static void client_run_adhoc_stats(Client* client) {
   json_decref(stats);
 }
 
+static void client_hello(Client* client) {
+  const char* name = client->options.name;
+  client_send_request(client, MELIAN_ACTION_HELLO, 0, 0, (const uint8_t*)name, strlen(name));
+  if (client_read_response(client) <= 0) terminate("hello", 0);
+  if (client->options.verbose) printf("HELLO: %.*s\n", client->rlen, client->rbuf);
+}
+
+static void client_run_clients(Client* client) {
+  client_send_request(client, MELIAN_ACTION_LIST_CLIENTS, 0, 0, NULL, 0);
+  if (client_read_response(client) <= 0) {
+    fprintf(stderr, "Failed to read client list\n");
+    return;
+  }
+  json_error_t error;
+  json_t* list = json_loadb(client->rbuf, client->rlen, JSON_DECODE_ANY, &error);
+  if (!list) {
+    fprintf(stderr, "Failed to parse client list: %s\n", error.text);
+    return;
+  }
+  char* s = json_dumps(list, JSON_INDENT(2) | JSON_PRESERVE_ORDER);
+  printf("%s\n", s);
+  free(s);
+  json_decref(list);
+}
+
 static void client_run_bench(Client* client) {
   json_t* schema = client_describe_schema(client);
   if (!schema) terminate("describe schema", 0);
@@ -715,6 +1489,7 @@ static void client_run_bench(Client* client) {
 void client_run(Client* client) {
   create_socket(client);
   if (client->fd < 0) terminate("create_socket", 0);
+  if (client->options.name) client_hello(client);
 
   switch (client->options.mode) {
     case CLIENT_MODE_FETCH:
@@ -726,6 +1501,24 @@ void client_run(Client* client) {
     case CLIENT_MODE_STATS:
       client_run_adhoc_stats(client);
       break;
+    case CLIENT_MODE_CLIENTS:
+      client_run_clients(client);
+      break;
+    case CLIENT_MODE_NEAREST:
+      client_run_nearest(client);
+      break;
+    case CLIENT_MODE_SEARCH:
+      client_run_search(client);
+      break;
+    case CLIENT_MODE_GROUP:
+      client_run_group(client);
+      break;
+    case CLIENT_MODE_INGEST:
+      client_run_ingest(client);
+      break;
+    case CLIENT_MODE_EXPORT:
+      client_run_export(client);
+      break;
     case CLIENT_MODE_BENCH:
     default:
       client_run_bench(client);
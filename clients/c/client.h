@@ -3,9 +3,8 @@
 #include <stdint.h>
 #include "protocol.h"
 
-// TODO: make these limits dynamic? Arena?
 enum {
-  MAX_RESPONSE_LEN = 10240,
+  INITIAL_RESPONSE_LEN = 10240,  // rbuf grows as larger responses arrive
 };
 
 enum ClientMode {
@@ -13,6 +12,12 @@ enum ClientMode {
   CLIENT_MODE_FETCH,
   CLIENT_MODE_SCHEMA,
   CLIENT_MODE_STATS,
+  CLIENT_MODE_CLIENTS,
+  CLIENT_MODE_NEAREST,
+  CLIENT_MODE_SEARCH,
+  CLIENT_MODE_GROUP,
+  CLIENT_MODE_INGEST,
+  CLIENT_MODE_EXPORT,
 };
 
 struct FetchOptions {
@@ -20,20 +25,62 @@ struct FetchOptions {
   int table_id;
   const char *index_name;
   int index_id;
+  const char *column;
   const char *key;
 };
 
+// Point and limits of a NEAREST request; table and index come from FetchOptions.
+struct NearestOptions {
+  const char *lat;
+  const char *lon;
+  unsigned k;
+  double radius_km;
+};
+
+// Text and ranking of a SEARCH request; table and index come from FetchOptions.
+struct SearchOptions {
+  const char *query;
+  unsigned limit;
+  unsigned substring;
+  double min_score;
+};
+
+// Page of a GROUP request; table, index and key come from FetchOptions.
+struct GroupOptions {
+  unsigned offset;
+  unsigned limit;
+};
+
+// Producer side of INGEST; the table comes from FetchOptions.
+struct IngestOptions {
+  const char *secret;
+  unsigned delta;
+};
+
+// Where EXPORT writes the Arrow stream; the table comes from FetchOptions.
+struct ExportOptions {
+  const char *out;        // file name; stdout if not set
+};
+
 // Options available when running a client.
 struct Options {
   const char *host;
   unsigned port;
   const char *unix;
+  const char *name;       // sent with HELLO on connect, if set
+  unsigned deadline_us;   // sent with every request, with priority, if either is set
+  unsigned priority;
   unsigned fetches[26*2+10]; // lowercase, uppercase, digits
   unsigned stats;
   unsigned quit;
   unsigned verbose;
   enum ClientMode mode;
   struct FetchOptions fetch;
+  struct NearestOptions nearest;
+  struct SearchOptions search;
+  struct GroupOptions group;
+  struct IngestOptions ingest;
+  struct ExportOptions export;
 };
 
 struct TableData {
@@ -63,8 +110,10 @@ typedef struct ClientRow {
 typedef struct Client {
   struct Options options;
   int fd;
+  unsigned status;     // MelianStatus of the last response, 0 for data
   unsigned rlen;
-  char rbuf[MAX_RESPONSE_LEN];
+  unsigned rcap;
+  char* rbuf;
   struct TableData tables[DATA_TABLE_LAST];
 } Client;
 
@@ -8,17 +8,47 @@ static void show_usage(const char* progname) {
   fprintf(stderr, "  -h host    Server host (default: 127.0.0.1)\n");
   fprintf(stderr, "  -p port    Server port (TCP mode)\n");
   fprintf(stderr, "  -u path    UNIX socket path (default: /tmp/melian.sock)\n");
+  fprintf(stderr, "  -n name    Name this connection (HELLO) for the server's client list\n");
+  fprintf(stderr, "  -d usecs   Give every request a deadline: the server drops it unanswered after that long\n");
+  fprintf(stderr, "  -P prio    Shedding priority of every request, 0 (never shed, default) to 255 (shed first)\n");
   fprintf(stderr, "  -v         Verbose logging\n\n");
   fprintf(stderr, "Subcommands:\n");
   fprintf(stderr, "  fetch      Fetch a single row\n");
   fprintf(stderr, "  schema     Show server schema\n");
-  fprintf(stderr, "  stats      Show server statistics\n\n");
+  fprintf(stderr, "  stats      Show server statistics\n");
+  fprintf(stderr, "  clients    List the server's open connections, busiest first\n");
+  fprintf(stderr, "  nearest    Fetch the rows nearest to a point through a geo index\n");
+  fprintf(stderr, "  search     Fetch the rows matching some text through a trigram index\n");
+  fprintf(stderr, "  group      Fetch the rows holding a key, in order, through a group index\n");
+  fprintf(stderr, "  ingest     Push rows read from stdin, one JSON object per line, into a table\n");
+  fprintf(stderr, "  export     Save a whole table as an Arrow IPC stream\n\n");
   fprintf(stderr, "Fetch options:\n");
   fprintf(stderr, "  --table NAME       Table by name\n");
   fprintf(stderr, "  --table-id ID      Table by numeric ID\n");
   fprintf(stderr, "  --index NAME       Index by column name\n");
   fprintf(stderr, "  --index-id ID      Index by numeric ID\n");
+  fprintf(stderr, "  --column NAME      Any column; the server indexes it on first use\n");
   fprintf(stderr, "  --key VALUE        Key to look up\n\n");
+  fprintf(stderr, "Nearest options (and --table / --table-id, --index / --index-id):\n");
+  fprintf(stderr, "  --lat DEGREES      Latitude of the point\n");
+  fprintf(stderr, "  --lon DEGREES      Longitude of the point\n");
+  fprintf(stderr, "  --k N              At most N rows (default: 1024)\n");
+  fprintf(stderr, "  --radius KM        Only rows within KM kilometres (default: any)\n\n");
+  fprintf(stderr, "Search options (and --table / --table-id, --index / --index-id):\n");
+  fprintf(stderr, "  --query TEXT       Text to look for\n");
+  fprintf(stderr, "  --substring        Rows containing TEXT, instead of rows resembling it\n");
+  fprintf(stderr, "  --min-score S      Least similarity, from 0 to 1 (default: 0.3)\n");
+  fprintf(stderr, "  --limit N          At most N rows (default: 1024)\n\n");
+  fprintf(stderr, "Group options (and --table / --table-id, --index / --index-id):\n");
+  fprintf(stderr, "  --key VALUE        Key whose rows to fetch\n");
+  fprintf(stderr, "  --offset N         Skip the first N rows (default: 0)\n");
+  fprintf(stderr, "  --limit N          At most N rows (default: all)\n\n");
+  fprintf(stderr, "Ingest options (and --table / --table-id):\n");
+  fprintf(stderr, "  --secret SECRET    The table's push secret\n");
+  fprintf(stderr, "  --delta            Upsert the rows into the table instead of replacing it;\n");
+  fprintf(stderr, "                     input lines with a JSON string or integer delete that key\n\n");
+  fprintf(stderr, "Export options (and --table / --table-id):\n");
+  fprintf(stderr, "  --out FILE         Write the stream to FILE (default: stdout)\n\n");
   fprintf(stderr, "Benchmark mode (no subcommand):\n");
   fprintf(stderr, "  -U         Benchmark table1 by id\n");
   fprintf(stderr, "  -C         Benchmark table2 by id\n");
@@ -28,8 +58,15 @@ static void show_usage(const char* progname) {
   fprintf(stderr, "Examples:\n");
   fprintf(stderr, "  %s -u /tmp/melian.sock fetch --table table1 --index id --key 42\n", progname);
   fprintf(stderr, "  %s -u /tmp/melian.sock fetch --table-id 1 --index hostname --key host-00002\n", progname);
+  fprintf(stderr, "  %s -u /tmp/melian.sock fetch --table table2 --column hostname --key host-00002\n", progname);
+  fprintf(stderr, "  %s -u /tmp/melian.sock nearest --table cities --index lat/lon --lat 52.52 --lon 13.40 --k 5\n", progname);
+  fprintf(stderr, "  %s -u /tmp/melian.sock search --table table2 --index hostname --query host-0042 --limit 5\n", progname);
+  fprintf(stderr, "  %s -u /tmp/melian.sock group --table prices --index product_id --key 42 --limit 5\n", progname);
+  fprintf(stderr, "  %s -u /tmp/melian.sock ingest --table feed --secret s3cret < rows.jsonl\n", progname);
+  fprintf(stderr, "  %s -u /tmp/melian.sock export --table prices --out prices.arrows\n", progname);
   fprintf(stderr, "  %s -u /tmp/melian.sock schema\n", progname);
   fprintf(stderr, "  %s -u /tmp/melian.sock stats\n", progname);
+  fprintf(stderr, "  %s -u /tmp/melian.sock -n admin clients\n", progname);
   fprintf(stderr, "  %s -u /tmp/melian.sock -UCH\n", progname);
 }
 
@@ -6,6 +6,9 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#ifdef MELBENCH_TLS
+#include <openssl/ssl.h>
+#endif
 
 #if defined(__linux__)
 #include <sys/epoll.h>
@@ -18,6 +21,7 @@ typedef enum {
   C_CONNECTING = 0,
   C_WRITING = 1,
   C_READING = 2,
+  C_HANDSHAKE = 3,
 } conn_state_t;
 
 typedef struct {
@@ -35,6 +39,10 @@ typedef struct {
   // timing
   uint64_t t0_ns;          // request start
   uint64_t deadline_ns;    // timeout deadline
+
+#ifdef MELBENCH_TLS
+  SSL *ssl;                // tls:// targets only
+#endif
 } conn_t;
 
 static int fd_connect_done(int fd) {
@@ -55,6 +63,46 @@ static int ensure_rcap(conn_t *c, size_t need) {
   return 0;
 }
 
+static void conn_drop(conn_t *c) {
+#ifdef MELBENCH_TLS
+  if (c->ssl) SSL_free(c->ssl);
+  c->ssl = NULL;
+#endif
+  close(c->fd);
+  c->fd = -1;
+}
+
+static ssize_t conn_write(conn_t *c, const uint8_t *buf, size_t len) {
+#ifdef MELBENCH_TLS
+  if (c->ssl) {
+    size_t n = 0;
+    if (SSL_write_ex(c->ssl, buf, len, &n) == 1) return (ssize_t)n;
+    int err = SSL_get_error(c->ssl, 0);
+    errno = (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) ? EAGAIN : EIO;
+    return -1;
+  }
+#endif
+  return write(c->fd, buf, len);
+}
+
+// With TLS, drain everything decrypted so far: edge-triggered epoll will not
+// report bytes OpenSSL already pulled off the socket.
+static ssize_t conn_read(conn_t *c, uint8_t *buf, size_t len) {
+#ifdef MELBENCH_TLS
+  if (c->ssl) {
+    size_t got = 0;
+    size_t n = 0;
+    while (got < len && SSL_read_ex(c->ssl, buf + got, len - got, &n) == 1) got += n;
+    if (got) return (ssize_t)got;
+    int err = SSL_get_error(c->ssl, 0);
+    if (err == SSL_ERROR_ZERO_RETURN) return 0;
+    errno = (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) ? EAGAIN : EIO;
+    return -1;
+  }
+#endif
+  return read(c->fd, buf, len);
+}
+
 #if defined(__linux__)
 static int ep_add(int ep, int fd, uint32_t events, void *udata) {
   struct epoll_event ev;
@@ -93,6 +141,22 @@ static int kq_set_rw(int kq, int fd, int want_read, int want_write, void *udata)
 }
 #endif
 
+// Start the first request on a connection that just became ready.
+static void conn_begin(conn_t *c, int evfd, uint64_t timeout_ns, thread_stats_t *stats) {
+  c->st = C_WRITING;
+  c->woff = 0;
+  c->rlen = 0;
+  c->t0_ns = now_ns_monotonic();
+  c->deadline_ns = c->t0_ns + timeout_ns;
+  stats->requests++;
+
+#if defined(__linux__)
+  (void)ep_mod(evfd, c->fd, EPOLLIN | EPOLLOUT | EPOLLET, c);
+#else
+  (void)kq_set_rw(evfd, c->fd, 0, 1, c);
+#endif
+}
+
 int evloop_run_benchmark_thread(
   int thread_index,
   const bench_args_t *args,
@@ -114,6 +178,17 @@ int evloop_run_benchmark_thread(
 #endif
   if (evfd < 0) return -1;
 
+  int tls = dsn.kind == DSN_TLS;
+#ifdef MELBENCH_TLS
+  // Certificates are not verified: this measures the cost of encryption, not trust
+  SSL_CTX *ssl_ctx = NULL;
+  if (tls) {
+    ssl_ctx = SSL_CTX_new(TLS_client_method());
+    if (!ssl_ctx) { close(evfd); return -1; }
+    SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
+  }
+#endif
+
   int n = args->conns_per_thread;
   conn_t *cs = (conn_t*)calloc((size_t)n, sizeof(conn_t));
   if (!cs) { close(evfd); return -1; }
@@ -187,8 +262,7 @@ int evloop_run_benchmark_thread(
       if (c->fd <= 0) continue;
       if (c->deadline_ns && now > c->deadline_ns) {
         out_stats->timeouts++;
-        close(c->fd);
-        c->fd = -1;
+        conn_drop(c);
       }
     }
 
@@ -200,8 +274,7 @@ int evloop_run_benchmark_thread(
       uint32_t mask = ev->events;
       if (mask & (EPOLLERR | EPOLLHUP)) {
         out_stats->errors++;
-        close(c->fd);
-        c->fd = -1;
+        conn_drop(c);
         continue;
       }
 #else
@@ -210,8 +283,7 @@ int evloop_run_benchmark_thread(
       if (!c || c->fd <= 0) continue;
       if (ev->flags & EV_EOF) {
         out_stats->errors++;
-        close(c->fd);
-        c->fd = -1;
+        conn_drop(c);
         continue;
       }
 #endif
@@ -224,24 +296,42 @@ int evloop_run_benchmark_thread(
 #endif
         if (fd_connect_done(c->fd) != 0) {
           out_stats->connect_errors++;
-          close(c->fd);
-          c->fd = -1;
+          conn_drop(c);
           continue;
         }
-        c->st = C_WRITING;
-        c->woff = 0;
-        c->rlen = 0;
-        c->t0_ns = now_ns_monotonic();
-        c->deadline_ns = c->t0_ns + timeout_ns;
-        out_stats->requests++;
-
-#if defined(__linux__)
-        (void)ep_mod(evfd, c->fd, EPOLLIN | EPOLLOUT | EPOLLET, c);
-#else
-        (void)kq_set_rw(evfd, c->fd, 0, 1, c);
+        if (!tls) {
+          conn_begin(c, evfd, timeout_ns, out_stats);
+          continue;
+        }
+#ifdef MELBENCH_TLS
+        c->ssl = SSL_new(ssl_ctx);
+        if (!c->ssl || SSL_set_fd(c->ssl, c->fd) != 1) {
+          out_stats->connect_errors++;
+          conn_drop(c);
+          continue;
+        }
+        SSL_set_connect_state(c->ssl);
+        c->st = C_HANDSHAKE;
+#if !defined(__linux__)
+        (void)kq_set_rw(evfd, c->fd, 1, 1, c);
 #endif
+#endif
+      }
+
+#ifdef MELBENCH_TLS
+      if (c->st == C_HANDSHAKE) {
+        int rc = SSL_do_handshake(c->ssl);
+        if (rc != 1) {
+          int err = SSL_get_error(c->ssl, rc);
+          if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) continue;
+          out_stats->connect_errors++;
+          conn_drop(c);
+          continue;
+        }
+        conn_begin(c, evfd, timeout_ns, out_stats);
         continue;
       }
+#endif
 
       if (c->st == C_WRITING) {
 #if defined(__linux__)
@@ -250,12 +340,11 @@ int evloop_run_benchmark_thread(
         if (ev->filter != EVFILT_WRITE) continue;
 #endif
         while (c->woff < plan->req_len) {
-          ssize_t w = write(c->fd, plan->req + c->woff, plan->req_len - c->woff);
+          ssize_t w = conn_write(c, plan->req + c->woff, plan->req_len - c->woff);
           if (w > 0) { c->woff += (size_t)w; continue; }
           if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
           out_stats->errors++;
-          close(c->fd);
-          c->fd = -1;
+          conn_drop(c);
           break;
         }
         if (c->fd <= 0) continue;
@@ -279,39 +368,34 @@ int evloop_run_benchmark_thread(
 #endif
         if (ensure_rcap(c, c->rlen + 4096) != 0) {
           out_stats->errors++;
-          close(c->fd);
-          c->fd = -1;
+          conn_drop(c);
           continue;
         }
-        ssize_t r = read(c->fd, c->rbuf + c->rlen, c->rcap - c->rlen);
+        ssize_t r = conn_read(c, c->rbuf + c->rlen, c->rcap - c->rlen);
         if (r > 0) {
           c->rlen += (size_t)r;
         } else if (r == 0) {
           out_stats->errors++;
-          close(c->fd);
-          c->fd = -1;
+          conn_drop(c);
           continue;
         } else {
           if (errno == EAGAIN || errno == EWOULDBLOCK) continue;
           out_stats->errors++;
-          close(c->fd);
-          c->fd = -1;
+          conn_drop(c);
           continue;
         }
 
         int fl = plan->frame_len(c->rbuf, c->rlen);
         if (fl < 0) {
           out_stats->errors++;
-          close(c->fd);
-          c->fd = -1;
+          conn_drop(c);
           continue;
         }
         if (fl == 0) continue;
 
         if (plan->validate && plan->validate(c->rbuf, (size_t)fl) != 0) {
           out_stats->errors++;
-          close(c->fd);
-          c->fd = -1;
+          conn_drop(c);
           continue;
         }
 
@@ -340,10 +424,13 @@ int evloop_run_benchmark_thread(
   }
 
   for (int i = 0; i < n; i++) {
-    if (cs[i].fd > 0) close(cs[i].fd);
+    if (cs[i].fd > 0) conn_drop(&cs[i]);
     free(cs[i].rbuf);
   }
   free(cs);
   close(evfd);
+#ifdef MELBENCH_TLS
+  if (ssl_ctx) SSL_CTX_free(ssl_ctx);
+#endif
   return 0;
 }
@@ -80,8 +80,15 @@ int dsn_parse(const char *dsn_str, dsn_t *out) {
     return 0;
   }
 
-  if (!strncmp(dsn_str, "tcp://", 6)) {
-    out->kind = DSN_TCP;
+  int tls = !strncmp(dsn_str, "tls://", 6);
+  if (!strncmp(dsn_str, "tcp://", 6) || tls) {
+#ifndef MELBENCH_TLS
+    if (tls) {
+      fprintf(stderr, "tls:// needs melbench built with TLS=1\n");
+      return -EINVAL;
+    }
+#endif
+    out->kind = tls ? DSN_TLS : DSN_TCP;
     const char *p = dsn_str + 6;
     const char *colon = strrchr(p, ':');
     if (!colon) return -EINVAL;
@@ -1,7 +1,7 @@
 #pragma once
 #include <stdint.h>
 
-typedef enum { DSN_UNIX = 0, DSN_TCP = 1 } dsn_kind_t;
+typedef enum { DSN_UNIX = 0, DSN_TCP = 1, DSN_TLS = 2 } dsn_kind_t; // TLS: TCP, then a TLS handshake
 
 typedef struct {
   dsn_kind_t kind;
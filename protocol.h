@@ -9,13 +9,27 @@
 #define MELIAN_DEFAULT_DB_USER          "melian"
 #define MELIAN_DEFAULT_DB_PASSWORD      "meliansecret"
 #define MELIAN_DEFAULT_SQLITE_FILENAME  "/tmp/melian.db"
+#define MELIAN_DEFAULT_POSTGRESQL_COPY  "false"
 #define MELIAN_DEFAULT_SOCKET_HOST      "127.0.0.1"
 #define MELIAN_DEFAULT_SOCKET_PORT      "0"
 #define MELIAN_DEFAULT_SOCKET_PATH      "/tmp/melian.sock"
+#define MELIAN_DEFAULT_SOCKET_TLS_CERT  ""
+#define MELIAN_DEFAULT_SOCKET_TLS_KEY   ""
 #define MELIAN_DEFAULT_TABLE_PERIOD     "60"
 #define MELIAN_DEFAULT_TABLE_STRIP_NULL "false"
+#define MELIAN_DEFAULT_TABLE_ADHOC_IDLE "600"
+#define MELIAN_DEFAULT_TABLE_TIER_IDLE  "0"
+#define MELIAN_DEFAULT_TABLE_TIER_DIR   "/tmp"
+#define MELIAN_DEFAULT_TABLE_RELOAD_BUDGET "0"
+#define MELIAN_DEFAULT_TABLE_WARM_KEYS  "1024"
+#define MELIAN_DEFAULT_TABLE_PREFAULT   "false"
 #define MELIAN_DEFAULT_TABLE_TABLES     "table1#0|60|id:int,table2#1|60|id:int;hostname:string"
 #define MELIAN_DEFAULT_SERVER_TOKENS    "true"
+#define MELIAN_DEFAULT_SERVER_NUMA_NODE "-1"
+#define MELIAN_DEFAULT_SERVER_LOADER_PROCESS "false"
+#define MELIAN_DEFAULT_SERVER_SHED_LAG  "0"
+#define MELIAN_DEFAULT_CLUSTER_SELF     ""
+#define MELIAN_DEFAULT_CLUSTER_NODES    ""
 #define MELIAN_SERVER_VERSION           "0.5.0"
 
 typedef union MelianRequestHeader {
@@ -29,6 +43,14 @@ typedef union MelianRequestHeader {
   } data;
 } MelianRequestHeader;
 
+// FETCH with this index id looks up by column name instead of a configured index.
+// The key payload is [u8 column_len][column][key]; keys for integer columns are
+// sent as decimal text. The index is built on first use; until it is ready the
+// server replies with MELIAN_STATUS_NOT_READY.
+enum {
+  MELIAN_INDEX_ADHOC = 0xFF,
+};
+
 typedef union MelianResponseHeader {
   uint8_t bytes[4];
   struct {
@@ -38,8 +60,24 @@ typedef union MelianResponseHeader {
 
 enum {
   MELIAN_HEADER_VERSION = 0x11,
+  MELIAN_HEADER_VERSION_DEADLINE = 0x12,  // header followed by a MelianRequestDeadline
 };
 
+// Sent after a version 0x12 header, before the payload, which `length` still
+// counts alone. budget_us (little-endian) is how long the caller waits for the
+// reply, from when the server reads the request; 0 for no limit. A request
+// still waiting when it runs out gets MELIAN_STATUS_EXPIRED instead of being
+// answered. priority 0 is never shed; when the server falls behind, it answers
+// MELIAN_STATUS_SHED to the highest priority numbers first.
+typedef union MelianRequestDeadline {
+  uint8_t bytes[8];
+  struct {
+    uint32_t budget_us;
+    uint8_t priority;
+    uint8_t reserved[3];
+  } data;
+} MelianRequestDeadline;
+
 // Legacy data identifiers (kept for client compatibility; dynamic tables are configured at runtime).
 enum DataTable {
   DATA_TABLE_TABLE1,
@@ -47,12 +85,102 @@ enum DataTable {
   DATA_TABLE_LAST,
 };
 
+// A response length with the top bit set is a status reply: it has no payload
+// and the low bits hold one of the codes below.
+#define MELIAN_RESPONSE_STATUS 0x80000000u
+
+enum MelianStatus {
+  MELIAN_STATUS_NOT_READY = 1,      // the index is being built, retry later
+  MELIAN_STATUS_DENIED    = 2,      // INGEST without the table's secret
+  MELIAN_STATUS_EXPIRED   = 3,      // the request's deadline passed before it was served
+  MELIAN_STATUS_SHED      = 4,      // dropped unserved, as the server is overloaded
+  MELIAN_STATUS_UNAVAILABLE = 5,    // the cluster node holding the rows could not be reached
+  MELIAN_STATUS_NO_ROOM   = 6,      // every ad-hoc index is taken by another column, retry later
+  MELIAN_STATUS_SPLIT     = 7,      // the table is split between cluster nodes, and no one part can answer
+};
+
 // All possible actions for a request.
 enum MelianAction {
   MELIAN_ACTION_FETCH               = 'F',
   MELIAN_ACTION_DESCRIBE_SCHEMA     = 'D',
   MELIAN_ACTION_GET_STATISTICS      = 's',
   MELIAN_ACTION_QUIT                = 'q',
+  MELIAN_ACTION_HELLO               = 'h',  // payload names the client; replies {"id":N}
+  MELIAN_ACTION_LIST_CLIENTS        = 'c',  // JSON array of open connections, busiest first
+  MELIAN_ACTION_NEAREST             = 'N',  // rows nearest to a point, through a geo index
+  MELIAN_ACTION_SEARCH              = 'S',  // rows matching text, through a trigram index
+  MELIAN_ACTION_INGEST              = 'I',  // a producer streams rows into a push table
+  MELIAN_ACTION_GROUP               = 'G',  // rows holding a key, in order, through a group index
+  MELIAN_ACTION_EXPORT              = 'E',  // the whole table as an Arrow IPC stream
+};
+
+// NEAREST payload, little-endian: f64 lat, f64 lon (degrees), u32 k, f64 radius_km.
+// Returns up to k rows (at most 1024; k = 0 means that many), only those within
+// radius_km unless it is 0, nearest first: u32 count, then for each row
+// f64 distance_km, u32 row_len and the row in the binary row format.
+enum {
+  MELIAN_NEAREST_REQUEST_LEN = 28,
+};
+
+// SEARCH payload: u8 mode, u32 limit, f64 min_score (little-endian), then the
+// query text. Returns up to limit rows (at most 1024; 0 means that many), best
+// first: u32 count, then for each row f64 score, u32 row_len and the row.
+// MELIAN_SEARCH_SIMILAR ranks rows by trigram similarity (0 to 1) and keeps
+// those scoring at least min_score; MELIAN_SEARCH_SUBSTRING returns rows that
+// contain the query, ignoring ASCII case, shorter ones first.
+enum MelianSearchMode {
+  MELIAN_SEARCH_SIMILAR   = 0,
+  MELIAN_SEARCH_SUBSTRING = 1,
+};
+
+enum {
+  MELIAN_SEARCH_PREFIX_LEN = 13,
+  MELIAN_SEARCH_MAX_QUERY = 256 - MELIAN_SEARCH_PREFIX_LEN,
+};
+
+// GROUP payload: u32 offset, u32 limit (little-endian), then the key as text
+// (numbers in decimal). Returns the rows holding the key, in the order of the
+// index, skipping offset of them and taking up to limit (0 for all of them):
+// u32 count, u32 total (rows the key has), then for each row u32 row_len and
+// the row. A key without rows gets a zero-length reply.
+enum {
+  MELIAN_GROUP_PREFIX_LEN = 8,
+  MELIAN_GROUP_MAX_KEY = 256 - MELIAN_GROUP_PREFIX_LEN,
+};
+
+// EXPORT has no payload. Returns every row of the table as an Arrow IPC
+// stream: a schema, record batches of up to 65536 rows, and the end-of-stream
+// marker. The stream is built on the first EXPORT after each load; until it
+// is ready the server replies with MELIAN_STATUS_NOT_READY.
+
+// INGEST payload: u8 op, then data depending on op.
+// BEGIN opens a batch for the table in the header: u8 mode, then the table's
+// secret. ROWS adds rows to it, each as u32 row_len (little-endian) and the row
+// in the binary row format; DELETE adds keys a delta removes, each as u32
+// key_len and the key text of the table's first index. COMMIT hands the batch
+// to the loader, which swaps it in like a database reload; ABORT drops it.
+// A SNAPSHOT replaces every row of the table; a DELTA keeps the current rows
+// except those whose key it deletes or whose key one of its rows carries.
+// Replies are {"rows":N,"keys":N} for the batch so far, a zero-length reply
+// for a malformed request or one without an open batch,
+// MELIAN_STATUS_DENIED for a wrong secret, and MELIAN_STATUS_NOT_READY when
+// another connection holds the table's batch, or COMMIT finds the previous
+// one not yet applied; it can be retried.
+enum MelianIngestOp {
+  MELIAN_INGEST_BEGIN  = 'B',
+  MELIAN_INGEST_ROWS   = 'R',
+  MELIAN_INGEST_DELETE = 'X',
+  MELIAN_INGEST_COMMIT = 'C',
+  MELIAN_INGEST_ABORT  = 'A',
+};
+
+enum MelianIngestMode {
+  MELIAN_INGEST_SNAPSHOT = 0,
+  MELIAN_INGEST_DELTA    = 1,
+};
+
+enum {
+  MELIAN_INGEST_MAX_PAYLOAD = 4088,  // INGEST requests are larger than other keys
 };
 
 // Binary row field types for MELIAN_ACTION_FETCH responses.
@@ -1,5 +1,9 @@
+#include <errno.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "util.h"
 #include "log.h"
 #include "arena.h"
@@ -29,9 +33,72 @@ Arena* arena_build(unsigned capacity) {
   return arena;
 }
 
+Arena* arena_build_shared(unsigned capacity) {
+  Arena* arena = 0;
+  unsigned bad = 0;
+  do {
+    arena = calloc(1, sizeof(Arena));
+    if (!arena) {
+      LOG_WARN("Could not allocate Arena object");
+      break;
+    }
+    arena->shared = 1;
+    arena->fd = memfd_create("melian-arena", MFD_CLOEXEC);
+    if (arena->fd < 0) {
+      LOG_WARN("Could not create shared memory file: %s", strerror(errno));
+      ++bad;
+      break;
+    }
+    if (ftruncate(arena->fd, capacity) < 0) {
+      LOG_WARN("Could not size shared memory file to %u bytes: %s", capacity, strerror(errno));
+      ++bad;
+      break;
+    }
+    void* buffer = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, arena->fd, 0);
+    if (buffer == MAP_FAILED) {
+      LOG_WARN("Could not map shared memory file: %s", strerror(errno));
+      ++bad;
+      break;
+    }
+    arena->buffer = buffer;
+    arena->capacity = capacity;
+  } while (0);
+  if (bad) {
+    arena_destroy(arena);
+    arena = 0;
+  }
+  return arena;
+}
+
+Arena* arena_map_fd(int fd, unsigned size, unsigned used) {
+  void* buffer = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (buffer == MAP_FAILED) {
+    LOG_WARN("Could not map %u bytes of shared memory: %s", size, strerror(errno));
+    return NULL;
+  }
+  Arena* arena = calloc(1, sizeof(Arena));
+  if (!arena) {
+    LOG_WARN("Could not allocate Arena object");
+    munmap(buffer, size ? size : 1);
+    return NULL;
+  }
+  arena->buffer = buffer;
+  arena->capacity = size ? size : 1;
+  arena->used = used;
+  arena->mapped = 1;
+  return arena;
+}
+
 void arena_destroy(Arena* arena) {
   if (!arena) return;
-  if (arena->buffer) free(arena->buffer);
+  if (arena->buffer) {
+    if (arena->mapped || arena->shared) {
+      munmap(arena->buffer, arena->capacity);
+    } else {
+      free(arena->buffer);
+    }
+  }
+  if (arena->shared && arena->fd >= 0) close(arena->fd);
   free(arena);
 }
 
@@ -39,12 +106,90 @@ void arena_reset(Arena* arena) {
   arena->used = 0;
 }
 
+Arena* arena_map(const Arena* arena, const char* dir, const char* name) {
+  Arena* mapped = 0;
+  int fd = -1;
+  unsigned bad = 0;
+  do {
+    if (!arena->used) break;
+    char path[1024];
+    int wrote = snprintf(path, sizeof(path), "%s/melian-%s-XXXXXX", dir, name);
+    if (wrote < 0 || (size_t)wrote >= sizeof(path)) {
+      LOG_WARN("Snapshot path for %s in %s is too long", name, dir);
+      break;
+    }
+    fd = mkstemp(path);
+    if (fd < 0) {
+      LOG_WARN("Could not create snapshot file %s: %s", path, strerror(errno));
+      break;
+    }
+    // The mapping keeps the data alive; nobody else needs the name
+    unlink(path);
+
+    unsigned done = 0;
+    while (done < arena->used) {
+      ssize_t n = write(fd, arena->buffer + done, arena->used - done);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        LOG_WARN("Could not write snapshot for %s: %s", name, strerror(errno));
+        ++bad;
+        break;
+      }
+      done += (unsigned)n;
+    }
+    if (bad) break;
+
+    void* buffer = mmap(NULL, arena->used, PROT_READ, MAP_SHARED, fd, 0);
+    if (buffer == MAP_FAILED) {
+      LOG_WARN("Could not map snapshot for %s: %s", name, strerror(errno));
+      break;
+    }
+    madvise(buffer, arena->used, MADV_RANDOM);
+
+    mapped = calloc(1, sizeof(Arena));
+    if (!mapped) {
+      LOG_WARN("Could not allocate Arena object");
+      munmap(buffer, arena->used);
+      break;
+    }
+    mapped->buffer = buffer;
+    mapped->capacity = arena->used;
+    mapped->used = arena->used;
+    mapped->mapped = 1;
+  } while (0);
+  if (fd >= 0) close(fd);
+  return mapped;
+}
+
+void arena_prefault(const Arena* arena) {
+  if (!arena || !arena->buffer) return;
+  // A mapping covers whatever was laid out after the arena too
+  size_t len = arena->mapped ? arena->capacity : arena->used;
+#ifdef MADV_POPULATE_READ
+  if (arena->mapped && madvise(arena->buffer, len, MADV_POPULATE_READ) == 0) return;
+#endif
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  volatile uint8_t sink = 0;
+  for (size_t off = 0; off < len; off += page) sink ^= arena->buffer[off];
+  UNUSED(sink);
+}
+
 static void arena_check_and_grow(Arena* arena, unsigned extra) {
   unsigned total = arena->used + extra;
   if (total <= arena->capacity) return;
 
   unsigned capacity = next_power_of_two(total, arena->capacity);
-  uint8_t *buffer = realloc(arena->buffer, capacity);
+  uint8_t *buffer = 0;
+  if (arena->shared) {
+    // Offsets stay valid when the mapping moves
+    void* moved = MAP_FAILED;
+    if (ftruncate(arena->fd, capacity) == 0) {
+      moved = mremap(arena->buffer, arena->capacity, capacity, MREMAP_MAYMOVE);
+    }
+    buffer = moved == MAP_FAILED ? NULL : moved;
+  } else {
+    buffer = realloc(arena->buffer, capacity);
+  }
   if (!buffer) {
     LOG_FATAL("Arena realloc failed: need %u bytes (cap %u)", total, capacity);
   }
@@ -54,6 +199,10 @@ static void arena_check_and_grow(Arena* arena, unsigned extra) {
 }
 
 unsigned arena_store(Arena* arena, const uint8_t *src, unsigned len) {
+  if (unlikely(arena->mapped)) {
+    LOG_WARN("Cannot store %u bytes in a mapped arena", len);
+    return -1;
+  }
   arena_check_and_grow(arena, len);
   unsigned index = arena->used;
   uint8_t *ptr = arena->buffer + index;
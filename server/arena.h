@@ -6,6 +6,8 @@
 // The arena can be reset in a single intruction by setting used to zero.
 // When allocating, we grow the arena to twice its current size until the needed bytes fit.
 // When allocating, return indexes rather than pointers, so that the values don't change on growth.
+// An arena can also be a read-only copy mapped from a file, which the kernel may page out,
+// or live in an anonymous shared memory file, which another process can map.
 
 #include <stdint.h>
 
@@ -15,12 +17,28 @@ typedef struct Arena {
   uint8_t *buffer;    // contiguous storage
   unsigned capacity;  // total capacity
   unsigned used;      // currently used
+  unsigned mapped;    // buffer is a read-only file mapping; cannot grow
+  unsigned shared;    // buffer is a mapping of fd, which grows with it
+  int fd;
 } Arena;
 
 Arena* arena_build(unsigned capacity);
 void arena_destroy(Arena* arena);
 void arena_reset(Arena* arena);
 
+// Write the used part of arena to an unlinked file in dir and return a mapped, read-only copy.
+Arena* arena_map(const Arena* arena, const char* dir, const char* name);
+
+// Build an arena in a memfd, for handing to another process.
+Arena* arena_build_shared(unsigned capacity);
+
+// Map size bytes of the shared memory file fd, of which used belong to the arena.
+// The mapping is writable, so that data laid out after the arena can be fixed up.
+Arena* arena_map_fd(int fd, unsigned size, unsigned used);
+
+// Read every page of arena, so that none faults when it is queried.
+void arena_prefault(const Arena* arena);
+
 // Store pointer into arena, return index
 unsigned arena_store(Arena* arena, const uint8_t *src, unsigned len);
 
@@ -0,0 +1,664 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "protocol.h"
+#include "row.h"
+#include "arrow.h"
+
+// Arrow format constants, from Schema.fbs and Message.fbs.
+enum {
+  ARROW_METADATA_V5 = 4,
+  ARROW_HEADER_SCHEMA = 1,
+  ARROW_HEADER_RECORD_BATCH = 3,
+  ARROW_TYPE_INT = 2,
+  ARROW_TYPE_FLOATING_POINT = 3,
+  ARROW_TYPE_BINARY = 4,
+  ARROW_TYPE_UTF8 = 5,
+  ARROW_TYPE_BOOL = 6,
+  ARROW_PRECISION_DOUBLE = 2,
+};
+
+// Marks the start of each message in a stream.
+#define ARROW_CONTINUATION 0xFFFFFFFFu
+
+// Column types, narrowest first: a column gets the widest kind among its values.
+typedef enum ArrowKind {
+  ARROW_KIND_NULL,             // no values; sent as utf8, all null
+  ARROW_KIND_BOOL,
+  ARROW_KIND_INT,
+  ARROW_KIND_FLOAT,
+  ARROW_KIND_TEXT,
+  ARROW_KIND_BINARY,
+} ArrowKind;
+
+// A growing buffer; once an allocation fails, writes are dropped and failed is set.
+typedef struct ArrowBuf {
+  uint8_t* data;
+  size_t len;
+  size_t cap;
+  unsigned failed;
+} ArrowBuf;
+
+typedef struct ArrowColumn {
+  const uint8_t* name;         // in the row that has the field first
+  unsigned name_len;
+  ArrowKind kind;
+  unsigned last;               // row of the batch that set the column last, plus one
+  unsigned set;                // rows of the batch with a value
+  unsigned filled;             // rows of the batch with an end offset, for text
+  uint8_t* valid;              // validity bitmap of the batch
+  ArrowBuf values;             // values of the batch, or their bits for bool
+  ArrowBuf offsets;            // text only
+  ArrowBuf bytes;              // text only
+} ArrowColumn;
+
+typedef struct ArrowBuilder {
+  ArrowColumn* columns;
+  unsigned count;
+  unsigned cap;
+  ArrowBuf out;                // the frame being built
+  ArrowBuf meta;               // flatbuffer of the message being built
+  ArrowBuf body;               // body of the record batch being built
+  ArrowBuf nodes;              // its field nodes
+  ArrowBuf buffers;            // and buffers
+  unsigned buffer_count;
+} ArrowBuilder;
+
+static void buf_put(ArrowBuf* buf, const void* data, size_t len);
+static void buf_align(ArrowBuf* buf, size_t align);
+static void buf_free(ArrowBuf* buf);
+static size_t fb_table(ArrowBuf* fb, unsigned count, const unsigned* sizes, size_t* pos);
+static size_t fb_vector(ArrowBuf* fb, unsigned count, unsigned elem_size);
+static size_t fb_string(ArrowBuf* fb, const uint8_t* str, unsigned len);
+static size_t fb_message(ArrowBuf* fb, unsigned header_type, size_t body_len);
+static void fb_set(ArrowBuf* fb, size_t at, uint64_t value, unsigned size);
+static void fb_ref(ArrowBuf* fb, size_t at, size_t target);
+static unsigned arrow_infer(ArrowBuilder* b, unsigned count, ArrowRowFn row_at, void* ctx);
+static ArrowColumn* arrow_find_column(ArrowBuilder* b, const RowField* field, unsigned hint);
+static ArrowKind arrow_value_kind(const RowField* field, unsigned check_utf8);
+static unsigned arrow_fill_batch(ArrowBuilder* b, unsigned first, unsigned n,
+                                 ArrowRowFn row_at, void* ctx);
+static void arrow_column_set(ArrowColumn* col, unsigned k, const RowField* field);
+static void arrow_column_fill(ArrowColumn* col, unsigned k);
+static void arrow_body_buffer(ArrowBuilder* b, const void* data, size_t len);
+static void arrow_put_schema(ArrowBuilder* b);
+static void arrow_put_batch(ArrowBuilder* b, unsigned n);
+static void arrow_put_message(ArrowBuilder* b, const ArrowBuf* body);
+static unsigned arrow_failed(const ArrowBuilder* b);
+static void arrow_builder_free(ArrowBuilder* b);
+static unsigned utf8_valid(const uint8_t* str, unsigned len);
+static uint64_t read_le64(const uint8_t* buf);
+static void write_le32(uint8_t* buf, uint32_t v);
+
+Arrow* arrow_build(unsigned count, ArrowRowFn row_at, void* ctx) {
+  Arrow* arrow = 0;
+  ArrowBuilder b;
+  memset(&b, 0, sizeof(b));
+  unsigned bad = 0;
+  do {
+    arrow = calloc(1, sizeof(Arrow));
+    if (!arrow) {
+      LOG_WARN("Could not allocate Arrow object");
+      break;
+    }
+    if (!arrow_infer(&b, count, row_at, ctx)) {
+      LOG_WARN("Could not allocate the columns of an Arrow export of %u rows", count);
+      ++bad;
+      break;
+    }
+
+    buf_put(&b.out, 0, 4);     // frame length
+    arrow_put_schema(&b);
+    for (unsigned first = 0; first < count; first += ARROW_BATCH_ROWS) {
+      unsigned n = count - first < ARROW_BATCH_ROWS ? count - first : ARROW_BATCH_ROWS;
+      if (!arrow_fill_batch(&b, first, n, row_at, ctx)) {
+        ++bad;
+        break;
+      }
+      arrow_put_batch(&b, n);
+      ++arrow->batches;
+    }
+    if (bad) break;
+    uint8_t eos[8];
+    write_le32(eos, ARROW_CONTINUATION);
+    write_le32(eos + 4, 0);
+    buf_put(&b.out, eos, sizeof(eos));
+    if (arrow_failed(&b)) {
+      LOG_WARN("Could not allocate %zu bytes for an Arrow export of %u rows", b.out.cap, count);
+      ++bad;
+      break;
+    }
+    size_t stream = b.out.len - 4;
+    if (stream >= MELIAN_RESPONSE_STATUS) {
+      LOG_WARN("Arrow export of %u rows is too large at %zu bytes", count, stream);
+      ++bad;
+      break;
+    }
+    b.out.data[0] = (uint8_t)(stream >> 24);
+    b.out.data[1] = (uint8_t)(stream >> 16);
+    b.out.data[2] = (uint8_t)(stream >> 8);
+    b.out.data[3] = (uint8_t)stream;
+    arrow->frame = b.out.data;
+    arrow->frame_len = b.out.len;
+    arrow->rows = count;
+    arrow->columns = b.count;
+    b.out.data = 0;
+  } while (0);
+  arrow_builder_free(&b);
+  if (bad) {
+    arrow_destroy(arrow);
+    arrow = 0;
+  }
+  return arrow;
+}
+
+void arrow_destroy(Arrow* arrow) {
+  if (!arrow) return;
+  free(arrow->frame);
+  free(arrow);
+}
+
+unsigned arrow_holds(const Arrow* arrow, const uint8_t* ptr) {
+  return arrow && ptr >= arrow->frame && ptr < arrow->frame + arrow->frame_len;
+}
+
+// Find the columns and their kinds, going over every row.
+static unsigned arrow_infer(ArrowBuilder* b, unsigned count, ArrowRowFn row_at, void* ctx) {
+  for (unsigned r = 0; r < count; ++r) {
+    const uint8_t* row = 0;
+    unsigned row_len = row_at(ctx, r, &row);
+    unsigned pos = 0;
+    RowField field;
+    for (unsigned f = 0; row_next_field(row, row_len, &pos, &field); ++f) {
+      ArrowColumn* col = arrow_find_column(b, &field, f);
+      if (!col) {
+        if (b->count >= b->cap) {
+          unsigned cap = b->cap ? 2 * b->cap : 16;
+          ArrowColumn* columns = realloc(b->columns, cap * sizeof(ArrowColumn));
+          if (!columns) return 0;
+          b->columns = columns;
+          b->cap = cap;
+        }
+        col = &b->columns[b->count++];
+        memset(col, 0, sizeof(ArrowColumn));
+        col->name = field.name;
+        col->name_len = field.name_len;
+      }
+      if (col->kind == ARROW_KIND_BINARY) continue;
+      ArrowKind kind = arrow_value_kind(&field, 1);
+      if (kind > col->kind) col->kind = kind;
+    }
+  }
+  for (unsigned c = 0; c < b->count; ++c) {
+    b->columns[c].valid = malloc(ARROW_BATCH_ROWS / 8);
+    if (!b->columns[c].valid) return 0;
+  }
+  return 1;
+}
+
+// Rows mostly have the same fields in the same order, so try the column at
+// the field's position first.
+static ArrowColumn* arrow_find_column(ArrowBuilder* b, const RowField* field, unsigned hint) {
+  if (hint < b->count) {
+    ArrowColumn* col = &b->columns[hint];
+    if (col->name_len == field->name_len && memcmp(col->name, field->name, field->name_len) == 0) return col;
+  }
+  for (unsigned c = 0; c < b->count; ++c) {
+    ArrowColumn* col = &b->columns[c];
+    if (col->name_len == field->name_len && memcmp(col->name, field->name, field->name_len) == 0) return col;
+  }
+  return NULL;
+}
+
+static ArrowKind arrow_value_kind(const RowField* field, unsigned check_utf8) {
+  switch (field->type) {
+    case MELIAN_VALUE_BOOL:
+      return ARROW_KIND_BOOL;
+    case MELIAN_VALUE_INT64:
+      return field->value_len == 8 ? ARROW_KIND_INT : ARROW_KIND_NULL;
+    case MELIAN_VALUE_FLOAT64:
+      return field->value_len == 8 ? ARROW_KIND_FLOAT : ARROW_KIND_NULL;
+    case MELIAN_VALUE_DECIMAL:
+      return ARROW_KIND_TEXT;
+    case MELIAN_VALUE_BYTES:
+      if (check_utf8 && !utf8_valid(field->value, field->value_len)) return ARROW_KIND_BINARY;
+      return ARROW_KIND_TEXT;
+    default:
+      return ARROW_KIND_NULL;
+  }
+}
+
+// Gather the values of rows first to first + n into the columns, and lay them
+// out as the body of a record batch.
+static unsigned arrow_fill_batch(ArrowBuilder* b, unsigned first, unsigned n,
+                                 ArrowRowFn row_at, void* ctx) {
+  for (unsigned c = 0; c < b->count; ++c) {
+    ArrowColumn* col = &b->columns[c];
+    memset(col->valid, 0, (n + 7) / 8);
+    col->last = 0;
+    col->set = 0;
+    col->filled = 0;
+    col->values.len = 0;
+    col->offsets.len = 0;
+    col->bytes.len = 0;
+    switch (col->kind) {
+      case ARROW_KIND_BOOL:
+        buf_put(&col->values, 0, (n + 7) / 8);
+        break;
+      case ARROW_KIND_INT:
+      case ARROW_KIND_FLOAT:
+        buf_put(&col->values, 0, (size_t)n * 8);
+        break;
+      default:
+        buf_put(&col->offsets, 0, 4);
+        break;
+    }
+    if (col->values.failed || col->offsets.failed) {
+      LOG_WARN("Could not allocate the values of column %.*s for an Arrow export",
+               (int)col->name_len, col->name);
+      return 0;
+    }
+  }
+
+  for (unsigned k = 0; k < n; ++k) {
+    const uint8_t* row = 0;
+    unsigned row_len = row_at(ctx, first + k, &row);
+    unsigned pos = 0;
+    RowField field;
+    for (unsigned f = 0; row_next_field(row, row_len, &pos, &field); ++f) {
+      ArrowColumn* col = arrow_find_column(b, &field, f);
+      if (!col || col->last == k + 1) continue;  // a field repeated in one row keeps its first value
+      col->last = k + 1;
+      arrow_column_set(col, k, &field);
+    }
+  }
+
+  b->body.len = 0;
+  b->nodes.len = 0;
+  b->buffers.len = 0;
+  b->buffer_count = 0;
+  for (unsigned c = 0; c < b->count; ++c) {
+    ArrowColumn* col = &b->columns[c];
+    if (col->values.failed || col->offsets.failed || col->bytes.failed) {
+      LOG_WARN("Could not allocate the values of column %.*s for an Arrow export",
+               (int)col->name_len, col->name);
+      return 0;
+    }
+    unsigned nulls = n - col->set;
+    uint8_t node[16];
+    write_le32(node, n);
+    write_le32(node + 4, 0);
+    write_le32(node + 8, nulls);
+    write_le32(node + 12, 0);
+    buf_put(&b->nodes, node, sizeof(node));
+
+    // Without nulls the validity bitmap can be left out
+    arrow_body_buffer(b, col->valid, nulls ? (n + 7) / 8 : 0);
+    switch (col->kind) {
+      case ARROW_KIND_BOOL:
+      case ARROW_KIND_INT:
+      case ARROW_KIND_FLOAT:
+        arrow_body_buffer(b, col->values.data, col->values.len);
+        break;
+      default:
+        arrow_column_fill(col, n);
+        if (col->bytes.len > 0x7FFFFFFF) {
+          LOG_WARN("Column %.*s has more than 2 GB of text in %u rows, too much for an Arrow export",
+                   (int)col->name_len, col->name, n);
+          return 0;
+        }
+        arrow_body_buffer(b, col->offsets.data, col->offsets.len);
+        arrow_body_buffer(b, col->bytes.data, col->bytes.len);
+        break;
+    }
+  }
+  return 1;
+}
+
+static void arrow_column_set(ArrowColumn* col, unsigned k, const RowField* field) {
+  ArrowKind kind = arrow_value_kind(field, 0);
+  if (kind == ARROW_KIND_NULL) return;
+  switch (col->kind) {
+    case ARROW_KIND_BOOL:
+      if (field->value_len && field->value[0]) col->values.data[k / 8] |= (uint8_t)(1u << (k % 8));
+      break;
+    case ARROW_KIND_INT: {
+      int64_t value = 0;
+      if (field->type == MELIAN_VALUE_BOOL) {
+        value = field->value_len && field->value[0];
+      } else {
+        value = (int64_t)read_le64(field->value);
+      }
+      // Little-endian, like the rows
+      uint64_t bits = (uint64_t)value;
+      for (unsigned i = 0; i < 8; ++i) col->values.data[8 * k + i] = (uint8_t)(bits >> (8 * i));
+      break;
+    }
+    case ARROW_KIND_FLOAT: {
+      double value = 0;
+      if (field->type == MELIAN_VALUE_BOOL) {
+        value = field->value_len && field->value[0];
+      } else if (field->type == MELIAN_VALUE_INT64) {
+        value = (double)(int64_t)read_le64(field->value);
+      } else {
+        uint64_t bits = read_le64(field->value);
+        memcpy(&value, &bits, sizeof(value));
+      }
+      uint64_t bits = 0;
+      memcpy(&bits, &value, sizeof(bits));
+      for (unsigned i = 0; i < 8; ++i) col->values.data[8 * k + i] = (uint8_t)(bits >> (8 * i));
+      break;
+    }
+    default: {
+      arrow_column_fill(col, k);
+      if (field->type == MELIAN_VALUE_BYTES || field->type == MELIAN_VALUE_DECIMAL) {
+        buf_put(&col->bytes, field->value, field->value_len);
+      } else {
+        char text[64];
+        const uint8_t* bytes = 0;
+        unsigned len = 0;
+        if (row_field_bytes(field, text, sizeof(text), &bytes, &len)) buf_put(&col->bytes, bytes, len);
+      }
+      uint8_t end[4];
+      write_le32(end, (uint32_t)col->bytes.len);
+      buf_put(&col->offsets, end, sizeof(end));
+      ++col->filled;
+      break;
+    }
+  }
+  col->valid[k / 8] |= (uint8_t)(1u << (k % 8));
+  ++col->set;
+}
+
+// Give text rows before k without a value an empty slot.
+static void arrow_column_fill(ArrowColumn* col, unsigned k) {
+  uint8_t end[4];
+  write_le32(end, (uint32_t)col->bytes.len);
+  for (; col->filled < k; ++col->filled) buf_put(&col->offsets, end, sizeof(end));
+}
+
+// Add a buffer to the batch body; each one starts 8-byte aligned.
+static void arrow_body_buffer(ArrowBuilder* b, const void* data, size_t len) {
+  uint8_t buffer[16];
+  write_le32(buffer, (uint32_t)b->body.len);
+  write_le32(buffer + 4, (uint32_t)((uint64_t)b->body.len >> 32));
+  write_le32(buffer + 8, (uint32_t)len);
+  write_le32(buffer + 12, (uint32_t)((uint64_t)len >> 32));
+  buf_put(&b->buffers, buffer, sizeof(buffer));
+  ++b->buffer_count;
+  buf_put(&b->body, data, len);
+  buf_align(&b->body, 8);
+}
+
+static void arrow_put_schema(ArrowBuilder* b) {
+  ArrowBuf* fb = &b->meta;
+  size_t header = fb_message(fb, ARROW_HEADER_SCHEMA, 0);
+  // endianness (little, the default), fields
+  unsigned schema_sizes[2] = { 0, 4 };
+  size_t schema_pos[2];
+  size_t schema = fb_table(fb, 2, schema_sizes, schema_pos);
+  fb_ref(fb, header, schema);
+  size_t fields = fb_vector(fb, b->count, 4);
+  fb_ref(fb, schema_pos[1], fields);
+
+  for (unsigned c = 0; c < b->count; ++c) {
+    const ArrowColumn* col = &b->columns[c];
+    // name, nullable, type_type, type, dictionary, children
+    unsigned field_sizes[6] = { 4, 1, 1, 4, 0, 4 };
+    size_t field_pos[6];
+    size_t field = fb_table(fb, 6, field_sizes, field_pos);
+    fb_ref(fb, fields + 4 + 4 * c, field);
+    fb_set(fb, field_pos[1], 1, 1);
+    size_t name = fb_string(fb, col->name, col->name_len);
+    fb_ref(fb, field_pos[0], name);
+
+    unsigned type_id = ARROW_TYPE_UTF8;
+    size_t type = 0;
+    switch (col->kind) {
+      case ARROW_KIND_BOOL:
+        type_id = ARROW_TYPE_BOOL;
+        type = fb_table(fb, 0, 0, 0);
+        break;
+      case ARROW_KIND_INT: {
+        // bitWidth, is_signed
+        unsigned sizes[2] = { 4, 1 };
+        size_t pos[2];
+        type_id = ARROW_TYPE_INT;
+        type = fb_table(fb, 2, sizes, pos);
+        fb_set(fb, pos[0], 64, 4);
+        fb_set(fb, pos[1], 1, 1);
+        break;
+      }
+      case ARROW_KIND_FLOAT: {
+        // precision
+        unsigned sizes[1] = { 2 };
+        size_t pos[1];
+        type_id = ARROW_TYPE_FLOATING_POINT;
+        type = fb_table(fb, 1, sizes, pos);
+        fb_set(fb, pos[0], ARROW_PRECISION_DOUBLE, 2);
+        break;
+      }
+      case ARROW_KIND_BINARY:
+        type_id = ARROW_TYPE_BINARY;
+        type = fb_table(fb, 0, 0, 0);
+        break;
+      default:
+        type = fb_table(fb, 0, 0, 0);
+        break;
+    }
+    fb_set(fb, field_pos[2], type_id, 1);
+    fb_ref(fb, field_pos[3], type);
+    size_t children = fb_vector(fb, 0, 4);
+    fb_ref(fb, field_pos[5], children);
+  }
+  arrow_put_message(b, 0);
+}
+
+static void arrow_put_batch(ArrowBuilder* b, unsigned n) {
+  ArrowBuf* fb = &b->meta;
+  size_t header = fb_message(fb, ARROW_HEADER_RECORD_BATCH, b->body.len);
+  // length, nodes, buffers
+  unsigned sizes[3] = { 8, 4, 4 };
+  size_t pos[3];
+  size_t batch = fb_table(fb, 3, sizes, pos);
+  fb_ref(fb, header, batch);
+  fb_set(fb, pos[0], n, 8);
+  size_t nodes = fb_vector(fb, b->count, 16);
+  if (!fb->failed && b->nodes.len) memcpy(fb->data + nodes + 4, b->nodes.data, b->nodes.len);
+  fb_ref(fb, pos[1], nodes);
+  size_t buffers = fb_vector(fb, b->buffer_count, 16);
+  if (!fb->failed && b->buffers.len) memcpy(fb->data + buffers + 4, b->buffers.data, b->buffers.len);
+  fb_ref(fb, pos[2], buffers);
+  arrow_put_message(b, &b->body);
+}
+
+// Append the message in meta, and its body if any, to the stream: the
+// continuation marker, the metadata length, the metadata padded so the body
+// starts 8-byte aligned, then the body.
+static void arrow_put_message(ArrowBuilder* b, const ArrowBuf* body) {
+  ArrowBuf* meta = &b->meta;
+  buf_align(meta, 8);
+  uint8_t prefix[8];
+  write_le32(prefix, ARROW_CONTINUATION);
+  write_le32(prefix + 4, (uint32_t)meta->len);
+  buf_put(&b->out, prefix, sizeof(prefix));
+  buf_put(&b->out, meta->data, meta->len);
+  if (body) buf_put(&b->out, body->data, body->len);
+}
+
+static unsigned arrow_failed(const ArrowBuilder* b) {
+  return b->out.failed || b->meta.failed || b->body.failed || b->nodes.failed || b->buffers.failed;
+}
+
+static void arrow_builder_free(ArrowBuilder* b) {
+  for (unsigned c = 0; c < b->count; ++c) {
+    free(b->columns[c].valid);
+    buf_free(&b->columns[c].values);
+    buf_free(&b->columns[c].offsets);
+    buf_free(&b->columns[c].bytes);
+  }
+  free(b->columns);
+  buf_free(&b->out);
+  buf_free(&b->meta);
+  buf_free(&b->body);
+  buf_free(&b->nodes);
+  buf_free(&b->buffers);
+}
+
+// Write a flatbuffer table with fields of the given sizes (0 for a field left
+// out), preceded by its vtable; set pos to where each field goes, zeroed.
+// Fields are placed largest first, from 8 bytes past a multiple of 8, so each
+// is aligned to its size.
+static size_t fb_table(ArrowBuf* fb, unsigned count, const unsigned* sizes, size_t* pos) {
+  buf_align(fb, 2);
+  size_t vtable = fb->len;
+  buf_put(fb, 0, 4 + 2 * count);
+  while (fb->len % 8 != 4 && !fb->failed) buf_put(fb, 0, 1);
+  size_t table = fb->len;
+  buf_put(fb, 0, 4);
+  for (unsigned size = 8; size; size /= 2) {
+    for (unsigned i = 0; i < count; ++i) {
+      if (sizes[i] != size) continue;
+      pos[i] = fb->len;
+      buf_put(fb, 0, size);
+    }
+  }
+  fb_set(fb, vtable, 4 + 2 * count, 2);
+  fb_set(fb, vtable + 2, fb->len - table, 2);
+  for (unsigned i = 0; i < count; ++i) {
+    fb_set(fb, vtable + 4 + 2 * i, sizes[i] ? pos[i] - table : 0, 2);
+  }
+  fb_set(fb, table, table - vtable, 4);
+  return table;
+}
+
+// Write a vector of count zeroed elements; they start right after the
+// returned position, aligned to 8 bytes for elements of 8 bytes or more.
+static size_t fb_vector(ArrowBuf* fb, unsigned count, unsigned elem_size) {
+  buf_align(fb, 4);
+  if (elem_size >= 8 && fb->len % 8 != 4) buf_put(fb, 0, 4);
+  size_t vector = fb->len;
+  buf_put(fb, 0, 4 + (size_t)count * elem_size);
+  fb_set(fb, vector, count, 4);
+  return vector;
+}
+
+static size_t fb_string(ArrowBuf* fb, const uint8_t* str, unsigned len) {
+  buf_align(fb, 4);
+  size_t string = fb->len;
+  uint8_t head[4];
+  write_le32(head, len);
+  buf_put(fb, head, sizeof(head));
+  buf_put(fb, str, len);
+  buf_put(fb, 0, 1);
+  return string;
+}
+
+// Start meta over with a Message of header_type and a body of body_len
+// bytes; return where the offset of its header goes.
+static size_t fb_message(ArrowBuf* fb, unsigned header_type, size_t body_len) {
+  fb->len = 0;
+  buf_put(fb, 0, 4);           // root offset
+  // version, header_type, header, bodyLength
+  unsigned sizes[4] = { 2, 1, 4, 8 };
+  size_t pos[4];
+  size_t message = fb_table(fb, 4, sizes, pos);
+  fb_ref(fb, 0, message);
+  fb_set(fb, pos[0], ARROW_METADATA_V5, 2);
+  fb_set(fb, pos[1], header_type, 1);
+  fb_set(fb, pos[3], body_len, 8);
+  return pos[2];
+}
+
+static void fb_set(ArrowBuf* fb, size_t at, uint64_t value, unsigned size) {
+  if (fb->failed) return;
+  for (unsigned i = 0; i < size; ++i) fb->data[at + i] = (uint8_t)(value >> (8 * i));
+}
+
+// Point the offset at at to target, which comes after it.
+static void fb_ref(ArrowBuf* fb, size_t at, size_t target) {
+  fb_set(fb, at, target - at, 4);
+}
+
+// Append len bytes of data, or zeros if data is 0.
+static void buf_put(ArrowBuf* buf, const void* data, size_t len) {
+  if (buf->failed || !len) return;
+  if (buf->len + len > buf->cap) {
+    size_t cap = buf->cap ? buf->cap : 256;
+    while (cap < buf->len + len) cap *= 2;
+    uint8_t* grown = realloc(buf->data, cap);
+    if (!grown) {
+      buf->failed = 1;
+      return;
+    }
+    buf->data = grown;
+    buf->cap = cap;
+  }
+  if (data) {
+    memcpy(buf->data + buf->len, data, len);
+  } else {
+    memset(buf->data + buf->len, 0, len);
+  }
+  buf->len += len;
+}
+
+static void buf_align(ArrowBuf* buf, size_t align) {
+  if (buf->len % align) buf_put(buf, 0, align - buf->len % align);
+}
+
+static void buf_free(ArrowBuf* buf) {
+  free(buf->data);
+  buf->data = 0;
+  buf->len = 0;
+  buf->cap = 0;
+}
+
+// Reject overlong forms, surrogates and code points past U+10FFFF, as Arrow
+// readers do for utf8 columns.
+static unsigned utf8_valid(const uint8_t* str, unsigned len) {
+  unsigned i = 0;
+  while (i < len) {
+    uint8_t c = str[i];
+    if (c < 0x80) {
+      ++i;
+      continue;
+    }
+    unsigned need = 0;
+    uint32_t cp = 0;
+    if ((c & 0xE0) == 0xC0) {
+      need = 1;
+      cp = c & 0x1F;
+    } else if ((c & 0xF0) == 0xE0) {
+      need = 2;
+      cp = c & 0x0F;
+    } else if ((c & 0xF8) == 0xF0) {
+      need = 3;
+      cp = c & 0x07;
+    } else {
+      return 0;
+    }
+    if (len - i <= need) return 0;
+    for (unsigned j = 1; j <= need; ++j) {
+      if ((str[i + j] & 0xC0) != 0x80) return 0;
+      cp = (cp << 6) | (str[i + j] & 0x3F);
+    }
+    if ((need == 1 && cp < 0x80) || (need == 2 && cp < 0x800) || (need == 3 && cp < 0x10000) ||
+        (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) return 0;
+    i += need + 1;
+  }
+  return 1;
+}
+
+static uint64_t read_le64(const uint8_t* buf) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; --i) {
+    v = (v << 8) | buf[i];
+  }
+  return v;
+}
+
+static void write_le32(uint8_t* buf, uint32_t v) {
+  for (int i = 0; i < 4; ++i) {
+    buf[i] = (uint8_t)((v >> (8 * i)) & 0xFF);
+  }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+// An Arrow export is a table slot encoded as an Arrow IPC stream: a schema
+// message, record batches of up to ARROW_BATCH_ROWS rows, and the end-of-stream
+// marker, so that dataframe libraries read the whole table without decoding
+// rows one by one.
+// Columns are the row fields in the order they first appear. Each gets the
+// narrowest Arrow type holding every value it has: bool, int64, double, utf8,
+// or binary for text that is not valid UTF-8; integers mixed with floats are
+// doubles, and any other mix is text, with numbers in decimal. NULL values and
+// fields a row lacks are nulls.
+// The stream is preceded by its length as a big-endian u32, so that it goes
+// out as an EXPORT reply as it is, like a row frame.
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+  ARROW_BATCH_ROWS = 65536,    // rows per record batch
+};
+
+// Return the length of row r and point row at it.
+typedef unsigned (*ArrowRowFn)(void* ctx, unsigned r, const uint8_t** row);
+
+typedef struct Arrow {
+  uint8_t* frame;              // u32 length (big-endian), then the stream
+  size_t frame_len;
+  unsigned rows;
+  unsigned columns;
+  unsigned batches;
+} Arrow;
+
+// Encode count rows, read through row_at.
+Arrow* arrow_build(unsigned count, ArrowRowFn row_at, void* ctx);
+void arrow_destroy(Arrow* arrow);
+
+// Whether ptr points into the stream of arrow.
+unsigned arrow_holds(const Arrow* arrow, const uint8_t* ptr);
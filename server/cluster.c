@@ -0,0 +1,413 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <event2/event.h>
+#include "util.h"
+#include "log.h"
+#include "data.h"
+#include "protocol.h"
+#include "cluster.h"
+
+enum {
+  CLUSTER_RETRY_SECONDS = 1,        // how long a node that failed is left alone
+  CLUSTER_OUT_INITIAL_CAPACITY = 4096,
+  CLUSTER_READ_SIZE = 65536,
+};
+
+static unsigned node_connect(Cluster* cluster, ClusterNode* node);
+static unsigned node_queue(ClusterNode* node, ClusterJob* job);
+static void node_flush(Cluster* cluster, ClusterNode* node);
+static void node_fail(Cluster* cluster, ClusterNode* node, const char* why);
+static void node_close(ClusterNode* node);
+static void on_node_read(evutil_socket_t fd, short what, void* arg);
+static void on_node_write(evutil_socket_t fd, short what, void* arg);
+static ClusterJob* job_build(const uint8_t* request, unsigned len, void* owner);
+
+Cluster* cluster_build(Config* config, struct event_base* base, ClusterDone on_done, void* ctx) {
+  Cluster* cluster = 0;
+  do {
+    if (config->cluster.self < 0) break;
+    cluster = calloc(1, sizeof(Cluster));
+    if (!cluster) {
+      LOG_WARN("Could not allocate Cluster object");
+      break;
+    }
+    cluster->base = base;
+    cluster->on_done = on_done;
+    cluster->ctx = ctx;
+    cluster->self = (unsigned)config->cluster.self;
+    cluster->node_count = config->cluster.node_count;
+    for (unsigned n = 0; n < cluster->node_count; ++n) {
+      ClusterNode* node = &cluster->nodes[n];
+      memcpy(node->name, config->cluster.nodes[n].name, sizeof(node->name));
+      memcpy(node->address, config->cluster.nodes[n].address, sizeof(node->address));
+      node->fd = -1;
+    }
+    for (unsigned t = 0; t < config->table.table_count; ++t) {
+      const ConfigTableSpec* spec = &config->table.tables[t];
+      if (spec->id >= ALEN(cluster->placement)) continue;
+      ClusterPlacement* placement = &cluster->placement[spec->id];
+      placement->count = spec->placement_count;
+      memcpy(placement->nodes, spec->placement, sizeof(placement->nodes));
+    }
+    int wrote = snprintf(cluster->hello, sizeof(cluster->hello), "%s%s",
+                         CLUSTER_HELLO_PREFIX, config->cluster.self_name);
+    cluster->hello_len = wrote < 0 ? 0 : (unsigned)wrote;
+    if (cluster->hello_len >= sizeof(cluster->hello)) cluster->hello_len = sizeof(cluster->hello) - 1;
+    LOG_INFO("Running as node %s of a cluster of %u", config->cluster.self_name, cluster->node_count);
+  } while (0);
+  return cluster;
+}
+
+void cluster_destroy(Cluster* cluster) {
+  if (!cluster) return;
+  for (unsigned n = 0; n < cluster->node_count; ++n) {
+    ClusterNode* node = &cluster->nodes[n];
+    node_close(node);
+    for (ClusterJob* job = node->waiting; job; ) {
+      ClusterJob* next = job->next;
+      cluster_job_free(job);
+      job = next;
+    }
+    free(node->out);
+  }
+  free(cluster);
+}
+
+unsigned cluster_route(Cluster* cluster, Table* table, unsigned action, unsigned index_id,
+                       const void* key, unsigned len, unsigned* status) {
+  if (!table) return 0;
+  if (action != MELIAN_ACTION_FETCH && action != MELIAN_ACTION_NEAREST &&
+      action != MELIAN_ACTION_SEARCH && action != MELIAN_ACTION_INGEST &&
+      action != MELIAN_ACTION_GROUP && action != MELIAN_ACTION_EXPORT) return 0;
+  const ClusterPlacement* placement = &cluster->placement[table->table_id];
+  if (!placement->count || (!table->remote && placement->count == 1)) return 0;
+  if (placement->count == 1) return 1u << placement->nodes[0];
+
+  // Split tables are looked up by their first key on the node holding its part
+  if (action == MELIAN_ACTION_GROUP && index_id == 0) {
+    if (len <= MELIAN_GROUP_PREFIX_LEN) return 0;
+    key = (const uint8_t*)key + MELIAN_GROUP_PREFIX_LEN;
+    len -= MELIAN_GROUP_PREFIX_LEN;
+  }
+  if ((action == MELIAN_ACTION_FETCH || action == MELIAN_ACTION_GROUP) && index_id == 0) {
+    if (table->indexes[0].normalize && !table_normalize_key(table, 0, &key, &len)) return 0;
+    unsigned owner = placement->nodes[table_key_part(key, len, placement->count)];
+    return owner == cluster->self ? 0 : 1u << owner;
+  }
+  // One part cannot rank or export rows for the whole table; a FETCH by
+  // another index is tried here first, if this node holds a part
+  if (action != MELIAN_ACTION_FETCH && action != MELIAN_ACTION_INGEST) {
+    *status = MELIAN_STATUS_SPLIT;
+    return 0;
+  }
+  if (!table->remote) return 0;
+  if (action != MELIAN_ACTION_FETCH) return 1u << placement->nodes[0];
+  unsigned nodes = 0;
+  for (unsigned p = 0; p < placement->count; ++p) nodes |= 1u << placement->nodes[p];
+  return nodes;
+}
+
+unsigned cluster_others(Cluster* cluster, Table* table, unsigned index_id) {
+  if (!table || index_id == 0) return 0;
+  const ClusterPlacement* placement = &cluster->placement[table->table_id];
+  if (placement->count < 2) return 0;
+  unsigned nodes = 0;
+  for (unsigned p = 0; p < placement->count; ++p) nodes |= 1u << placement->nodes[p];
+  return nodes & ~(1u << cluster->self);
+}
+
+ClusterJob* cluster_forward(Cluster* cluster, unsigned nodes, const uint8_t* request, unsigned len,
+                            void* owner) {
+  ClusterJob* job = job_build(request, len, owner);
+  if (!job) return 0;
+  job->untried = nodes;
+  if (!cluster_send(cluster, job)) {
+    cluster_job_free(job);
+    return 0;
+  }
+  return job;
+}
+
+unsigned cluster_send(Cluster* cluster, ClusterJob* job) {
+  job->status = 0;
+  free(job->reply);
+  job->reply = 0;
+  job->reply_len = 0;
+  job->reply_have = 0;
+  while (job->untried) {
+    unsigned n = (unsigned)__builtin_ctz(job->untried);
+    job->untried &= job->untried - 1;
+    if (n >= cluster->node_count || n == cluster->self) continue;
+    ClusterNode* node = &cluster->nodes[n];
+    if (!node_connect(cluster, node)) continue;
+    if (!node_queue(node, job)) continue;
+    job->node = n;
+    ++node->forwarded;
+    return 1;
+  }
+  return 0;
+}
+
+void cluster_job_free(ClusterJob* job) {
+  if (!job) return;
+  free(job->request);
+  free(job->reply);
+  free(job);
+}
+
+// Open the connection to node unless it is open, and introduce this node on it.
+static unsigned node_connect(Cluster* cluster, ClusterNode* node) {
+  if (node->fd >= 0) return 1;
+  if (now_sec() < node->retry_at) return 0;
+
+  struct sockaddr_storage addr;
+  socklen_t addr_len = 0;
+  memset(&addr, 0, sizeof(addr));
+  const char* colon = strrchr(node->address, ':');
+  if (strchr(node->address, '/') || !colon) {
+    struct sockaddr_un* sun = (struct sockaddr_un*)&addr;
+    sun->sun_family = AF_UNIX;
+    snprintf(sun->sun_path, sizeof(sun->sun_path), "%s", node->address);
+    addr_len = sizeof(*sun);
+  } else {
+    struct sockaddr_in* sin = (struct sockaddr_in*)&addr;
+    char host[INET_ADDRSTRLEN];
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - node->address), node->address);
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(atoi(colon + 1));
+    if (inet_pton(AF_INET, host, &sin->sin_addr) != 1) {
+      LOG_WARN("Invalid address %s for cluster node %s", node->address, node->name);
+      node->retry_at = now_sec() + CLUSTER_RETRY_SECONDS;
+      return 0;
+    }
+    addr_len = sizeof(*sin);
+  }
+
+  int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    LOG_WARN("Could not create socket for cluster node %s: %s", node->name, strerror(errno));
+    node->retry_at = now_sec() + CLUSTER_RETRY_SECONDS;
+    return 0;
+  }
+  if (connect(fd, (struct sockaddr*)&addr, addr_len) < 0 && errno != EINPROGRESS) {
+    LOG_WARN("Could not connect to cluster node %s at %s: %s", node->name, node->address, strerror(errno));
+    close(fd);
+    node->retry_at = now_sec() + CLUSTER_RETRY_SECONDS;
+    ++node->failures;
+    return 0;
+  }
+  node->fd = fd;
+  node->connecting = 1;
+  node->rev = event_new(cluster->base, fd, EV_READ | EV_PERSIST, on_node_read, cluster);
+  node->wev = event_new(cluster->base, fd, EV_WRITE | EV_PERSIST, on_node_write, cluster);
+  event_add(node->rev, NULL);
+  event_add(node->wev, NULL);
+  ++node->connects;
+  LOG_INFO("Connecting to cluster node %s at %s", node->name, node->address);
+
+  uint8_t hello[sizeof(MelianRequestHeader) + sizeof(cluster->hello)];
+  MelianRequestHeader* header = (MelianRequestHeader*)hello;
+  header->data.version = MELIAN_HEADER_VERSION;
+  header->data.action = MELIAN_ACTION_HELLO;
+  header->data.table_id = 0;
+  header->data.index_id = 0;
+  header->data.length = htonl(cluster->hello_len);
+  memcpy(hello + sizeof(*header), cluster->hello, cluster->hello_len);
+  ClusterJob* job = job_build(hello, sizeof(*header) + cluster->hello_len, 0);
+  if (job) job->node = (unsigned)(node - cluster->nodes);
+  if (!job || !node_queue(node, job)) {
+    cluster_job_free(job);
+    node_close(node);
+    return 0;
+  }
+  return 1;
+}
+
+// Queue job's request for node and keep the job until its reply comes back.
+// Requests go out from the write event, so those queued during one pass of
+// the event loop share one write; and no job fails before its caller has it.
+static unsigned node_queue(ClusterNode* node, ClusterJob* job) {
+  size_t need = node->out_len + job->request_len;
+  if (need > node->out_cap) {
+    size_t cap = node->out_cap ? 2 * node->out_cap : CLUSTER_OUT_INITIAL_CAPACITY;
+    while (cap < need) cap *= 2;
+    uint8_t* out = realloc(node->out, cap);
+    if (!out) {
+      LOG_WARN("Could not grow requests for cluster node %s to %zu bytes", node->name, cap);
+      return 0;
+    }
+    node->out = out;
+    node->out_cap = cap;
+  }
+  memcpy(node->out + node->out_len, job->request, job->request_len);
+  node->out_len += job->request_len;
+
+  job->next = 0;
+  if (node->waiting_tail) node->waiting_tail->next = job;
+  else node->waiting = job;
+  node->waiting_tail = job;
+  ++node->pending;
+  event_add(node->wev, NULL);
+  return 1;
+}
+
+// Write what node can take now; the write event finishes the rest.
+static void node_flush(Cluster* cluster, ClusterNode* node) {
+  if (node->connecting) return;
+  while (node->out_pos < node->out_len) {
+    ssize_t n = write(node->fd, node->out + node->out_pos, node->out_len - node->out_pos);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        event_add(node->wev, NULL);
+        return;
+      }
+      node_fail(cluster, node, strerror(errno));
+      return;
+    }
+    node->out_pos += n;
+  }
+  node->out_len = node->out_pos = 0;
+  event_del(node->wev);
+}
+
+// Drop the connection to node and pass its jobs on to the next node that
+// may answer them, or fail them.
+static void node_fail(Cluster* cluster, ClusterNode* node, const char* why) {
+  LOG_WARN("Lost cluster node %s at %s: %s", node->name, node->address, why);
+  node_close(node);
+  node->out_len = node->out_pos = 0;
+  node->head_have = 0;
+  node->retry_at = now_sec() + CLUSTER_RETRY_SECONDS;
+  ++node->failures;
+
+  ClusterJob* job = node->waiting;
+  node->waiting = node->waiting_tail = 0;
+  node->pending = 0;
+  while (job) {
+    ClusterJob* next = job->next;
+    if (!job->owner) {
+      cluster_job_free(job);
+    } else if (!cluster_send(cluster, job)) {
+      job->status = MELIAN_STATUS_UNAVAILABLE;
+      cluster->on_done(job, cluster->ctx);
+    }
+    job = next;
+  }
+}
+
+static void node_close(ClusterNode* node) {
+  if (node->rev) event_free(node->rev);
+  if (node->wev) event_free(node->wev);
+  node->rev = node->wev = 0;
+  if (node->fd >= 0) close(node->fd);
+  node->fd = -1;
+  node->connecting = 0;
+}
+
+static void on_node_write(evutil_socket_t fd, short what, void* arg) {
+  UNUSED(what);
+  Cluster* cluster = arg;
+  ClusterNode* node = 0;
+  for (unsigned n = 0; n < cluster->node_count && !node; ++n) {
+    if (cluster->nodes[n].fd == fd) node = &cluster->nodes[n];
+  }
+  if (!node) return;
+  if (node->connecting) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+    if (err) {
+      node_fail(cluster, node, strerror(err));
+      return;
+    }
+    node->connecting = 0;
+    LOG_INFO("Connected to cluster node %s at %s", node->name, node->address);
+  }
+  node_flush(cluster, node);
+}
+
+// Read replies from a node and hand each to the oldest job waiting there.
+static void on_node_read(evutil_socket_t fd, short what, void* arg) {
+  UNUSED(what);
+  static uint8_t buf[CLUSTER_READ_SIZE];  // server thread only
+  Cluster* cluster = arg;
+  ClusterNode* node = 0;
+  for (unsigned n = 0; n < cluster->node_count && !node; ++n) {
+    if (cluster->nodes[n].fd == fd) node = &cluster->nodes[n];
+  }
+  if (!node) return;
+
+  ssize_t got = read(fd, buf, sizeof(buf));
+  if (got <= 0) {
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    node_fail(cluster, node, got ? strerror(errno) : "connection closed");
+    return;
+  }
+  size_t pos = 0;
+  while (pos < (size_t)got) {
+    ClusterJob* job = node->waiting;
+    if (!job) {
+      node_fail(cluster, node, "reply without a request");
+      return;
+    }
+    if (node->head_have < sizeof(node->head)) {
+      while (node->head_have < sizeof(node->head) && pos < (size_t)got) {
+        node->head[node->head_have++] = buf[pos++];
+      }
+      if (node->head_have < sizeof(node->head)) break;
+      uint32_t len = 0;
+      memcpy(&len, node->head, sizeof(len));
+      len = ntohl(len);
+      if (len & MELIAN_RESPONSE_STATUS) {
+        job->status = len & ~MELIAN_RESPONSE_STATUS;
+      } else if (len) {
+        job->reply = malloc(len);
+        if (!job->reply) {
+          node_fail(cluster, node, "no memory for reply");
+          return;
+        }
+        job->reply_len = len;
+      }
+    }
+    unsigned take = job->reply_len - job->reply_have;
+    if (take > got - pos) take = (unsigned)(got - pos);
+    if (take) memcpy(job->reply + job->reply_have, buf + pos, take);
+    job->reply_have += take;
+    pos += take;
+    if (job->reply_have < job->reply_len) break;
+
+    node->waiting = job->next;
+    if (!node->waiting) node->waiting_tail = 0;
+    --node->pending;
+    node->head_have = 0;
+    if (job->owner) {
+      cluster->on_done(job, cluster->ctx);
+      // Answering may have sent more requests here, and failed
+      if (node->fd != fd) return;
+    } else {
+      cluster_job_free(job);
+    }
+  }
+}
+
+static ClusterJob* job_build(const uint8_t* request, unsigned len, void* owner) {
+  ClusterJob* job = calloc(1, sizeof(ClusterJob));
+  if (job) job->request = malloc(len);
+  if (!job || !job->request) {
+    LOG_WARN("Could not allocate cluster job");
+    free(job);
+    return 0;
+  }
+  memcpy(job->request, request, len);
+  job->request_len = len;
+  job->owner = owner;
+  return job;
+}
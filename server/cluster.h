@@ -0,0 +1,99 @@
+#pragma once
+
+// A Cluster forwards requests for rows this node does not hold to a node
+// that does. Every node shares the same placement map, so any of them
+// accepts any request, and clients need not know where tables live.
+// Each other node gets one connection, opened on first use and shared by all
+// client connections: requests are written to it back to back, and since a
+// node answers them in order, each reply goes to the oldest job waiting.
+// The server thread pauses the client connection until done is called with
+// the reply, as it does for SEARCH. A node that cannot be reached fails the
+// jobs waiting on it, and is not tried again for a second.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+// Name prefix of the HELLO that opens a connection between nodes; requests on
+// such a connection are always served where they arrive.
+#define CLUSTER_HELLO_PREFIX "melian-node:"
+
+struct Table;
+
+typedef struct ClusterJob {
+  struct ClusterJob* next;
+  void* owner;                 // whoever waits for the reply; 0 for the HELLO opening a connection
+  unsigned untried;            // nodes still to ask, a bit each; the next one is the lowest
+  unsigned node;               // node asked last
+  uint8_t* request;            // header and payload, as sent
+  unsigned request_len;
+  unsigned status;             // status reply, MELIAN_STATUS_UNAVAILABLE if no node answered; 0 if none
+  uint8_t* reply;              // reply payload, without its length
+  unsigned reply_len;
+  unsigned reply_have;         // bytes of the reply read so far
+} ClusterJob;
+
+typedef void (*ClusterDone)(ClusterJob* job, void* ctx);
+
+typedef struct ClusterNode {
+  char name[64];
+  char address[256];
+  int fd;                      // -1 when not connected
+  unsigned connecting;         // connect() has not completed yet
+  struct event* rev;
+  struct event* wev;
+  uint8_t* out;                // requests not written yet
+  size_t out_len;
+  size_t out_pos;
+  size_t out_cap;
+  uint8_t head[4];             // length of the reply being read
+  unsigned head_have;
+  ClusterJob* waiting;         // sent or queued, oldest first
+  ClusterJob* waiting_tail;
+  unsigned pending;            // jobs waiting
+  double retry_at;             // when a node that failed may be tried again
+  unsigned long forwarded;
+  unsigned long failures;
+  unsigned connects;
+} ClusterNode;
+
+// Nodes holding a table, as configured; none if every node does.
+typedef struct ClusterPlacement {
+  unsigned count;
+  unsigned char nodes[MELIAN_MAX_NODES];
+} ClusterPlacement;
+
+typedef struct Cluster {
+  struct event_base* base;
+  ClusterDone on_done;
+  void* ctx;
+  unsigned self;
+  unsigned node_count;
+  ClusterNode nodes[MELIAN_MAX_NODES];
+  ClusterPlacement placement[256];  // by table id
+  char hello[96];              // HELLO payload opening each connection
+  unsigned hello_len;
+} Cluster;
+
+Cluster* cluster_build(struct Config* config, struct event_base* base, ClusterDone on_done, void* ctx);
+void cluster_destroy(Cluster* cluster);
+
+// Which nodes may answer a request for table, a bit each; 0 to answer it here,
+// or with status if it is set.
+unsigned cluster_route(Cluster* cluster, struct Table* table, unsigned action, unsigned index_id,
+                       const void* key, unsigned len, unsigned* status);
+
+// Which other nodes may hold the rows a FETCH found nothing for here; 0 if
+// the answer is final.
+unsigned cluster_others(Cluster* cluster, struct Table* table, unsigned index_id);
+
+// Send a copy of request to the first of nodes that can take it; return the
+// job on_done will be called with, or 0 if no node can be reached.
+ClusterJob* cluster_forward(Cluster* cluster, unsigned nodes, const uint8_t* request, unsigned len,
+                            void* owner);
+
+// Send job on to the next of its untried nodes; 0 if none can take it.
+unsigned cluster_send(Cluster* cluster, ClusterJob* job);
+
+// Free a job, its request and its reply.
+void cluster_job_free(ClusterJob* job);
@@ -9,6 +9,7 @@
 #include "util.h"
 #include "log.h"
 #include "protocol.h"
+#include "jsonpath.h"
 #include "config.h"
 
 static const char* get_config_string(const char* name, const char* def);
@@ -18,8 +19,20 @@ static unsigned get_config_bool(const char* name, const char* def);
 static char* trim(char* s);
 static unsigned parse_table_specs(Config* config, const char* raw);
 static ConfigIndexType parse_index_type(const char* value);
+static unsigned parse_index_where(char* text, ConfigIndexSpec* ispec);
+static unsigned parse_index_order(char* text, ConfigIndexSpec* ispec);
 static ConfigDbDriver parse_db_driver(const char* value);
-static void apply_select_overrides(Config* config);
+static void parse_cluster_nodes(Config* config, const char* raw);
+static void parse_table_placement(Config* config, const char* raw);
+// Which per-table string a table=VALUE variable sets.
+typedef enum TableOverride {
+  TABLE_OVERRIDE_SELECT,
+  TABLE_OVERRIDE_DERIVED,
+  TABLE_OVERRIDE_COMPUTED,
+  TABLE_OVERRIDE_PUSH,
+} TableOverride;
+
+static void apply_table_overrides(Config* config, const char* name, TableOverride kind);
 static ConfigTableSpec* find_table_spec(Config* config, const char* name);
 static unsigned load_config_file(Config* config);
 static char* read_entire_file(const char* path, size_t* len);
@@ -33,6 +46,8 @@ static void set_override_owned(char** field, char* value);
 static int sb_append(char** buf, size_t* len, size_t* cap, const char* fmt, ...);
 static char* build_tables_override(json_t* tables);
 static char* build_selects_override(json_t* selects);
+static char* build_computed_override(json_t* computed);
+static char* build_placement_override(json_t* placement);
 
 static char* config_file_path = NULL;
 static ConfigFileSource config_file_source = CONFIG_FILE_SOURCE_DEFAULT;
@@ -44,13 +59,31 @@ struct ConfigFileOverrides {
   char* db_user;
   char* db_password;
   char* sqlite_filename;
+  char* postgresql_copy;
   char* socket_host;
   char* socket_port;
   char* socket_path;
+  char* socket_tls_cert;
+  char* socket_tls_key;
   char* table_period;
+  char* table_adhoc_idle;
+  char* table_tier_idle;
+  char* table_tier_dir;
+  char* table_reload_budget;
+  char* table_warm_keys;
+  char* table_prefault;
   char* table_selects;
+  char* table_derived;
+  char* table_computed;
+  char* table_push;
+  char* table_placement;
   char* table_tables;
   char* server_tokens;
+  char* server_numa_node;
+  char* server_loader_process;
+  char* server_shed_lag;
+  char* cluster_self;
+  char* cluster_nodes;
 };
 static struct ConfigFileOverrides config_file_overrides = {0};
 
@@ -103,13 +136,22 @@ Config* config_build(void) {
     config->db.user = get_config_string("MELIAN_DB_USER", MELIAN_DEFAULT_DB_USER);
     config->db.password = get_config_string("MELIAN_DB_PASSWORD", MELIAN_DEFAULT_DB_PASSWORD);
     config->db.sqlite_filename = get_config_string("MELIAN_SQLITE_FILENAME", MELIAN_DEFAULT_SQLITE_FILENAME);
+    config->db.postgresql_copy = get_config_bool("MELIAN_POSTGRESQL_COPY", MELIAN_DEFAULT_POSTGRESQL_COPY);
 
     config->socket.host = get_config_string("MELIAN_SOCKET_HOST", MELIAN_DEFAULT_SOCKET_HOST);
     config->socket.port = get_config_number("MELIAN_SOCKET_PORT", MELIAN_DEFAULT_SOCKET_PORT);
     config->socket.path = get_config_string_allow_empty("MELIAN_SOCKET_PATH", MELIAN_DEFAULT_SOCKET_PATH);
+    config->socket.tls_cert = get_config_string("MELIAN_SOCKET_TLS_CERT", MELIAN_DEFAULT_SOCKET_TLS_CERT);
+    config->socket.tls_key = get_config_string("MELIAN_SOCKET_TLS_KEY", MELIAN_DEFAULT_SOCKET_TLS_KEY);
 
     config->table.period = get_config_number("MELIAN_TABLE_PERIOD", MELIAN_DEFAULT_TABLE_PERIOD);
     config->table.strip_null = get_config_bool("MELIAN_TABLE_STRIP_NULL", MELIAN_DEFAULT_TABLE_STRIP_NULL);
+    config->table.adhoc_idle = get_config_number("MELIAN_TABLE_ADHOC_IDLE", MELIAN_DEFAULT_TABLE_ADHOC_IDLE);
+    config->table.tier_idle = get_config_number("MELIAN_TABLE_TIER_IDLE", MELIAN_DEFAULT_TABLE_TIER_IDLE);
+    config->table.tier_dir = get_config_string("MELIAN_TABLE_TIER_DIR", MELIAN_DEFAULT_TABLE_TIER_DIR);
+    config->table.reload_budget = get_config_number("MELIAN_TABLE_RELOAD_BUDGET", MELIAN_DEFAULT_TABLE_RELOAD_BUDGET);
+    config->table.warm_keys = get_config_number("MELIAN_TABLE_WARM_KEYS", MELIAN_DEFAULT_TABLE_WARM_KEYS);
+    config->table.prefault = get_config_bool("MELIAN_TABLE_PREFAULT", MELIAN_DEFAULT_TABLE_PREFAULT);
     const char* table_raw = get_config_string("MELIAN_TABLE_TABLES", MELIAN_DEFAULT_TABLE_TABLES);
     config->table.schema = strdup(table_raw);
     if (!config->table.schema) {
@@ -117,9 +159,19 @@ Config* config_build(void) {
       break;
     }
     parse_table_specs(config, config->table.schema);
-    apply_select_overrides(config);
+    apply_table_overrides(config, "MELIAN_TABLE_SELECTS", TABLE_OVERRIDE_SELECT);
+    apply_table_overrides(config, "MELIAN_TABLE_DERIVED", TABLE_OVERRIDE_DERIVED);
+    apply_table_overrides(config, "MELIAN_TABLE_COMPUTED", TABLE_OVERRIDE_COMPUTED);
+    apply_table_overrides(config, "MELIAN_TABLE_PUSH", TABLE_OVERRIDE_PUSH);
 
     config->server.tokens = get_config_bool("MELIAN_SERVER_TOKENS", MELIAN_DEFAULT_SERVER_TOKENS);
+    config->server.numa_node = get_config_number("MELIAN_SERVER_NUMA_NODE", MELIAN_DEFAULT_SERVER_NUMA_NODE);
+    config->server.loader_process = get_config_bool("MELIAN_SERVER_LOADER_PROCESS", MELIAN_DEFAULT_SERVER_LOADER_PROCESS);
+    config->server.shed_lag = get_config_number("MELIAN_SERVER_SHED_LAG", MELIAN_DEFAULT_SERVER_SHED_LAG);
+
+    config->cluster.self_name = get_config_string_allow_empty("MELIAN_CLUSTER_SELF", MELIAN_DEFAULT_CLUSTER_SELF);
+    parse_cluster_nodes(config, get_config_string("MELIAN_CLUSTER_NODES", MELIAN_DEFAULT_CLUSTER_NODES));
+    parse_table_placement(config, get_config_string("MELIAN_TABLE_PLACEMENT", NULL));
   } while (0);
 
   return config;
@@ -136,18 +188,42 @@ void config_show_usage(void) {
 	printf("  MELIAN_DB_USER         : database user name (default: %s)\n", MELIAN_DEFAULT_DB_USER);
 	printf("  MELIAN_DB_PASSWORD     : database user password (default: %s)\n", MELIAN_DEFAULT_DB_PASSWORD);
 	printf("  MELIAN_SQLITE_FILENAME : SQLite database filename (default: %s)\n", MELIAN_DEFAULT_SQLITE_FILENAME);
+	printf("  MELIAN_POSTGRESQL_COPY : load PostgreSQL tables with binary COPY (default: %s)\n", MELIAN_DEFAULT_POSTGRESQL_COPY);
 	printf("  MELIAN_SOCKET_HOST     : host for TCP listener (default: %s)\n", MELIAN_DEFAULT_SOCKET_HOST);
 	printf("  MELIAN_SOCKET_PORT     : port for TCP listener -- 0 to disable (default: %s)\n", MELIAN_DEFAULT_SOCKET_PORT);
 	printf("  MELIAN_SOCKET_PATH     : UNIX socket path -- empty to disable (default: %s)\n", MELIAN_DEFAULT_SOCKET_PATH);
+	printf("  MELIAN_SOCKET_TLS_CERT : PEM certificate chain to serve TLS on the TCP listener, encrypted by the kernel -- empty for plain TCP (default: %s)\n", MELIAN_DEFAULT_SOCKET_TLS_CERT);
+	printf("  MELIAN_SOCKET_TLS_KEY  : PEM private key for MELIAN_SOCKET_TLS_CERT -- empty if the certificate file holds it (default: %s)\n", MELIAN_DEFAULT_SOCKET_TLS_KEY);
 	printf("  Both UNIX and TCP listeners can be active simultaneously.\n");
 	printf("  MELIAN_SERVER_TOKENS   : whether to advertise server version in status (default: %s)\n", MELIAN_DEFAULT_SERVER_TOKENS);
+	printf("  MELIAN_SERVER_NUMA_NODE: NUMA node to serve queries and hold tables on -- -1 to leave it to the kernel (default: %s)\n", MELIAN_DEFAULT_SERVER_NUMA_NODE);
+	printf("  MELIAN_SERVER_LOADER_PROCESS: whether to load tables in a child process, away from the server heap (default: %s)\n", MELIAN_DEFAULT_SERVER_LOADER_PROCESS);
+	printf("  MELIAN_SERVER_SHED_LAG : milliseconds the event loop may lag before low priority requests are shed -- 0 to never shed (default: %s)\n", MELIAN_DEFAULT_SERVER_SHED_LAG);
+	printf("  MELIAN_CLUSTER_SELF    : name of this node in MELIAN_CLUSTER_NODES -- empty to run alone (default: %s)\n", MELIAN_DEFAULT_CLUSTER_SELF);
+	printf("  MELIAN_CLUSTER_NODES   : semicolon-separated list of name=host:port or name=/socket/path for every cluster node\n");
 	printf("  MELIAN_TABLE_PERIOD    : how often (seconds) to refresh the data by default (default: %s)\n", MELIAN_DEFAULT_TABLE_PERIOD);
+	printf("  MELIAN_TABLE_ADHOC_IDLE: seconds an unused ad-hoc column index is kept -- 0 to disable (default: %s)\n", MELIAN_DEFAULT_TABLE_ADHOC_IDLE);
+	printf("  MELIAN_TABLE_TIER_IDLE : seconds without queries before a table is paged out to a snapshot file -- 0 to disable (default: %s)\n", MELIAN_DEFAULT_TABLE_TIER_IDLE);
+	printf("  MELIAN_TABLE_TIER_DIR  : directory for paged out table snapshots (default: %s)\n", MELIAN_DEFAULT_TABLE_TIER_DIR);
+	printf("  MELIAN_TABLE_RELOAD_BUDGET: megabytes all tables may use, reloads included; reloads that do not fit wait -- 0 for no limit (default: %s)\n", MELIAN_DEFAULT_TABLE_RELOAD_BUDGET);
+	printf("  MELIAN_TABLE_WARM_KEYS : recently fetched keys per table to look up in each new slot before it goes live -- 0 to disable (default: %s)\n", MELIAN_DEFAULT_TABLE_WARM_KEYS);
+	printf("  MELIAN_TABLE_PREFAULT  : whether to read every page of each new slot before it goes live (default: %s)\n", MELIAN_DEFAULT_TABLE_PREFAULT);
 	printf("  MELIAN_TABLE_SELECTS   : semicolon-separated list of table=SELECT ... overrides\n");
+	printf("  MELIAN_TABLE_DERIVED   : semicolon-separated list of table=DEFINITION for tables computed from others:\n");
+	printf("      join LEFT.column RIGHT.column | group SOURCE.column count sum(col) min(col) max(col)\n");
+	printf("  MELIAN_TABLE_COMPUTED  : semicolon-separated list of table=name=EXPR, name=EXPR... computed at load time:\n");
+	printf("      lower(x) upper(x) trim(x) concat(x, ...) substring(x, start[, len]) cast(x, int|float|string) hash(x)\n");
+	printf("  MELIAN_TABLE_PUSH      : semicolon-separated list of table=SECRET for tables a producer streams in with INGEST\n");
+	printf("  MELIAN_TABLE_PLACEMENT : semicolon-separated list of table=node[,node...] naming the cluster nodes that hold a table;\n");
+	printf("      with several nodes, rows are split between them by the hash of their first index key\n");
 	printf("  MELIAN_TABLE_STRIP_NULL: whether to strip null values in returned payloads (default: %s)\n", MELIAN_DEFAULT_TABLE_STRIP_NULL);
 	printf("  MELIAN_TABLE_TABLES    : schema spec (default: %s); format per entry:\n", MELIAN_DEFAULT_TABLE_TABLES);
 	printf("      name[#id][|period][|column#idx[:type];column#idx[:type]...]\n");
 	printf("    Example: users#1|60|id:int;email:string,hosts#2|30|id:int;hostname:string\n");
-	printf("    Supported index types: int, string (default: int)\n");
+	printf("    A period of MIN-MAX adapts to how often the rows change: hosts#2|30-3600|id:int\n");
+	printf("    Supported index types: int, string, geo (column lat/lon), trigram, group (default: int)\n");
+	printf("    A group index may sort the rows of each key by a column, descending with -: product_id#3:group@-created_at\n");
+	printf("    An index column may name a value inside a JSON column: attrs$.sku#2:string\n");
 }
 
 void config_destroy(Config* config) {
@@ -261,11 +337,15 @@ static unsigned parse_table_specs(Config* config, const char* raw) {
           LOG_FATAL("Table spec name '%s' exceeds %zu bytes", value, sizeof(spec->name) - 1);
         }
       } else if (section == 1) {
+        // MIN-MAX lets the period adapt to how often the content changes
+        char* dash = strchr(value, '-');
         unsigned maybe = atoi(value);
-        if (!maybe) {
-          LOG_WARN("Ignoring non-numeric period [%s] for table %s", value, spec->name);
+        unsigned maybe_max = dash ? (unsigned)atoi(dash + 1) : 0;
+        if (!maybe || (dash && maybe_max < maybe)) {
+          LOG_WARN("Ignoring invalid period [%s] for table %s", value, spec->name);
         } else {
           spec->period = maybe;
+          spec->period_max = maybe_max > maybe ? maybe_max : 0;
         }
       } else if (section == 2) {
         char* idx_ctx = 0;
@@ -277,6 +357,9 @@ static unsigned parse_table_specs(Config* config, const char* raw) {
           char* idx_part = trim(idx);
           if (!idx_part[0]) continue;
           ConfigIndexSpec* ispec = &spec->indexes[spec->index_count];
+          memset(ispec, 0, sizeof(*ispec));
+          char* where = strchr(idx_part, '?');
+          if (where) *where++ = '\0';
           char* type_sep = strchr(idx_part, ':');
           const char* type_val = 0;
           if (type_sep) {
@@ -310,11 +393,54 @@ static unsigned parse_table_specs(Config* config, const char* raw) {
             used_index_ids[column_id] = 0;
             continue;
           }
+          char* dollar = strchr(ispec->column, '$');
+          if (dollar == ispec->column) {
+            LOG_WARN("Empty column name in index specification for table %s", spec->name);
+            used_index_ids[column_id] = 0;
+            continue;
+          }
+          if (dollar && !jsonpath_valid(dollar + 1, strlen(dollar + 1))) {
+            LOG_WARN("Invalid JSON path [%s] in index specification for table %s", dollar, spec->name);
+            used_index_ids[column_id] = 0;
+            continue;
+          }
+          char* order = type_val ? strchr(type_sep + 1, '@') : 0;
+          if (order) *order++ = '\0';
           if (type_val) {
             ispec->type = parse_index_type(type_val);
           } else {
             ispec->type = CONFIG_INDEX_TYPE_INT;
           }
+          if (ispec->type == CONFIG_INDEX_TYPE_GEO) {
+            char* slash = strchr(ispec->column, '/');
+            if (!slash || slash == ispec->column || !slash[1] || dollar) {
+              LOG_WARN("Geo index %s in table %s must name two columns, as lat/lon",
+                       ispec->column, spec->name);
+              used_index_ids[column_id] = 0;
+              continue;
+            }
+          }
+          if (ispec->type == CONFIG_INDEX_TYPE_TRIGRAM && dollar) {
+            LOG_WARN("Trigram index %s in table %s must name a column, not a JSON path",
+                     ispec->column, spec->name);
+            used_index_ids[column_id] = 0;
+            continue;
+          }
+          if (order && ispec->type != CONFIG_INDEX_TYPE_GROUP) {
+            LOG_WARN("Only group indexes have an order; ignoring it for index %s in table %s",
+                     ispec->column, spec->name);
+          } else if (order && !parse_index_order(order, ispec)) {
+            LOG_WARN("Invalid order for index %s in table %s; expected column or -column",
+                     ispec->column, spec->name);
+            used_index_ids[column_id] = 0;
+            continue;
+          }
+          if (where && !parse_index_where(where, ispec)) {
+            LOG_WARN("Invalid filter for index %s in table %s; expected column=value or column!=value",
+                     ispec->column, spec->name);
+            used_index_ids[column_id] = 0;
+            continue;
+          }
           ++spec->index_count;
         }
       }
@@ -367,9 +493,42 @@ static ConfigIndexType parse_index_type(const char* value) {
     if (*p >= 'A' && *p <= 'Z') *p = *p - 'A' + 'a';
   }
   if (strcmp(lower, "string") == 0) return CONFIG_INDEX_TYPE_STRING;
+  if (strcmp(lower, "geo") == 0) return CONFIG_INDEX_TYPE_GEO;
+  if (strcmp(lower, "trigram") == 0) return CONFIG_INDEX_TYPE_TRIGRAM;
+  if (strcmp(lower, "group") == 0) return CONFIG_INDEX_TYPE_GROUP;
   return CONFIG_INDEX_TYPE_INT;
 }
 
+// Parse an index filter: `column=value` or `column!=value`.
+static unsigned parse_index_where(char* text, ConfigIndexSpec* ispec) {
+  char* eq = strchr(text, '=');
+  if (!eq) return 0;
+  unsigned negate = eq > text && eq[-1] == '!';
+  if (negate) eq[-1] = '\0';
+  *eq = '\0';
+  char* column = trim(text);
+  char* value = trim(eq + 1);
+  if (!column[0]) return 0;
+  int wrote = snprintf(ispec->where_column, sizeof(ispec->where_column), "%s", column);
+  if (wrote < 0 || (size_t)wrote >= sizeof(ispec->where_column)) return 0;
+  wrote = snprintf(ispec->where_value, sizeof(ispec->where_value), "%s", value);
+  if (wrote < 0 || (size_t)wrote >= sizeof(ispec->where_value)) return 0;
+  ispec->where_negate = negate;
+  return 1;
+}
+
+// Parse the order of a group index: `column`, or `-column` for descending.
+static unsigned parse_index_order(char* text, ConfigIndexSpec* ispec) {
+  char* column = trim(text);
+  if (column[0] == '-') {
+    ispec->order_descending = 1;
+    column = trim(column + 1);
+  }
+  if (!column[0]) return 0;
+  int wrote = snprintf(ispec->order_column, sizeof(ispec->order_column), "%s", column);
+  return wrote >= 0 && (size_t)wrote < sizeof(ispec->order_column);
+}
+
 static ConfigDbDriver parse_db_driver(const char* value) {
   char tmp[64];
   if (value && value[0]) {
@@ -408,12 +567,17 @@ static ConfigTableSpec* find_table_spec(Config* config, const char* name) {
   return NULL;
 }
 
-static void apply_select_overrides(Config* config) {
-  const char* raw = get_config_string("MELIAN_TABLE_SELECTS", NULL);
+// Apply table=VALUE entries from variable name to the parsed table specs:
+// SELECT statements, derived table definitions, computed columns or push secrets.
+static void apply_table_overrides(Config* config, const char* name, TableOverride kind) {
+  const char* what = kind == TABLE_OVERRIDE_DERIVED ? "Derived table" :
+                     kind == TABLE_OVERRIDE_COMPUTED ? "Computed columns" :
+                     kind == TABLE_OVERRIDE_PUSH ? "Push secret" : "Select override";
+  const char* raw = get_config_string(name, NULL);
   if (!raw || !raw[0]) return;
   char* copy = strdup(raw);
   if (!copy) {
-    LOG_WARN("Could not duplicate MELIAN_TABLE_SELECTS");
+    LOG_WARN("Could not duplicate %s", name);
     return;
   }
   char* ctx = 0;
@@ -422,25 +586,127 @@ static void apply_select_overrides(Config* config) {
     if (!trimmed[0]) continue;
     char* eq = strchr(trimmed, '=');
     if (!eq) {
-      LOG_WARN("Invalid select override [%s], missing '='", trimmed);
+      LOG_WARN("Invalid %s entry [%s], missing '='", name, trimmed);
       continue;
     }
     *eq = '\0';
-    char* name = trim(trimmed);
-    char* stmt = trim(eq + 1);
-    if (!name[0] || !stmt[0]) {
-      LOG_WARN("Invalid select override entry [%s]", entry);
+    char* table = trim(trimmed);
+    char* value = trim(eq + 1);
+    if (!table[0] || !value[0]) {
+      LOG_WARN("Invalid %s entry [%s]", name, entry);
       continue;
     }
-    ConfigTableSpec* spec = find_table_spec(config, name);
+    ConfigTableSpec* spec = find_table_spec(config, table);
     if (!spec) {
-      LOG_WARN("Select override references unknown table %s", name);
+      LOG_WARN("%s references unknown table %s", what, table);
       continue;
     }
-    int wrote = snprintf(spec->select_stmt, sizeof(spec->select_stmt), "%s", stmt);
-    if (wrote < 0 || (size_t)wrote >= sizeof(spec->select_stmt)) {
+    char* field = kind == TABLE_OVERRIDE_DERIVED ? spec->derived :
+                  kind == TABLE_OVERRIDE_COMPUTED ? spec->computed :
+                  kind == TABLE_OVERRIDE_PUSH ? spec->push : spec->select_stmt;
+    int wrote = snprintf(field, MELIAN_MAX_SELECT_LEN, "%s", value);
+    if (wrote < 0 || (size_t)wrote >= MELIAN_MAX_SELECT_LEN) {
       errno = ENOMEM;
-      LOG_FATAL("Select override for table %s exceeds %zu bytes", spec->name, sizeof(spec->select_stmt) - 1);
+      LOG_FATAL("%s for table %s exceeds %zu bytes", what, spec->name, (size_t)MELIAN_MAX_SELECT_LEN - 1);
+    }
+  }
+  free(copy);
+}
+
+// Parse the cluster nodes: `name=address;...`, and find this node among them.
+static void parse_cluster_nodes(Config* config, const char* raw) {
+  ConfigCluster* cluster = &config->cluster;
+  cluster->self = -1;
+  if (!cluster->self_name || !cluster->self_name[0]) return;
+  char* copy = strdup(raw);
+  if (!copy) {
+    LOG_WARN("Could not duplicate MELIAN_CLUSTER_NODES");
+    return;
+  }
+  char* ctx = 0;
+  for (char* entry = strtok_r(copy, ";", &ctx); entry; entry = strtok_r(NULL, ";", &ctx)) {
+    char* trimmed = trim(entry);
+    if (!trimmed[0]) continue;
+    char* eq = strchr(trimmed, '=');
+    if (!eq) {
+      LOG_WARN("Invalid MELIAN_CLUSTER_NODES entry [%s], missing '='", trimmed);
+      continue;
+    }
+    *eq = '\0';
+    char* name = trim(trimmed);
+    char* address = trim(eq + 1);
+    if (!name[0] || !address[0]) {
+      LOG_WARN("Invalid MELIAN_CLUSTER_NODES entry [%s]", entry);
+      continue;
+    }
+    if (cluster->node_count >= MELIAN_MAX_NODES) {
+      LOG_WARN("Maximum number of cluster nodes (%u) exceeded, skipping node %s", MELIAN_MAX_NODES, name);
+      continue;
+    }
+    ConfigClusterNode* node = &cluster->nodes[cluster->node_count];
+    int wrote = snprintf(node->name, sizeof(node->name), "%s", name);
+    if (wrote < 0 || (size_t)wrote >= sizeof(node->name)) {
+      errno = ENOMEM;
+      LOG_FATAL("Cluster node name '%s' exceeds %zu bytes", name, sizeof(node->name) - 1);
+    }
+    wrote = snprintf(node->address, sizeof(node->address), "%s", address);
+    if (wrote < 0 || (size_t)wrote >= sizeof(node->address)) {
+      errno = ENOMEM;
+      LOG_FATAL("Address '%s' of cluster node %s exceeds %zu bytes", address, name, sizeof(node->address) - 1);
+    }
+    if (strcmp(node->name, cluster->self_name) == 0) cluster->self = (int)cluster->node_count;
+    ++cluster->node_count;
+  }
+  free(copy);
+  if (cluster->self < 0) {
+    LOG_FATAL("Cluster node %s is not in MELIAN_CLUSTER_NODES", cluster->self_name);
+  }
+}
+
+// Parse table placements: `table=node[,node...];...`.
+static void parse_table_placement(Config* config, const char* raw) {
+  ConfigCluster* cluster = &config->cluster;
+  if (!raw || !raw[0] || cluster->self < 0) return;
+  char* copy = strdup(raw);
+  if (!copy) {
+    LOG_WARN("Could not duplicate MELIAN_TABLE_PLACEMENT");
+    return;
+  }
+  char* ctx = 0;
+  for (char* entry = strtok_r(copy, ";", &ctx); entry; entry = strtok_r(NULL, ";", &ctx)) {
+    char* trimmed = trim(entry);
+    if (!trimmed[0]) continue;
+    char* eq = strchr(trimmed, '=');
+    if (!eq) {
+      LOG_WARN("Invalid MELIAN_TABLE_PLACEMENT entry [%s], missing '='", trimmed);
+      continue;
+    }
+    *eq = '\0';
+    ConfigTableSpec* spec = find_table_spec(config, trim(trimmed));
+    if (!spec) {
+      LOG_WARN("Placement references unknown table %s", trim(trimmed));
+      continue;
+    }
+    spec->placement_count = 0;
+    char* node_ctx = 0;
+    for (char* name = strtok_r(eq + 1, ",", &node_ctx); name; name = strtok_r(NULL, ",", &node_ctx)) {
+      name = trim(name);
+      if (!name[0]) continue;
+      unsigned n = 0;
+      while (n < cluster->node_count && strcmp(cluster->nodes[n].name, name) != 0) ++n;
+      if (n == cluster->node_count) {
+        LOG_WARN("Placement of table %s references unknown node %s", spec->name, name);
+        continue;
+      }
+      unsigned seen = 0;
+      for (unsigned p = 0; p < spec->placement_count; ++p) seen |= spec->placement[p] == n;
+      if (!seen) spec->placement[spec->placement_count++] = (unsigned char)n;
+    }
+    // A producer streams a whole batch to one node, which cannot split it
+    if (spec->push[0] && spec->placement_count > 1) {
+      LOG_WARN("Push table %s cannot be split between nodes; placing it on node %s only",
+               spec->name, cluster->nodes[spec->placement[0]].name);
+      spec->placement_count = 1;
     }
   }
   free(copy);
@@ -573,6 +839,16 @@ static unsigned parse_config_file_defaults(const char* json) {
         set_override_string(&config_file_overrides.sqlite_filename, json_string_value(filename));
       }
     }
+    json_t* postgresql = json_object_get(database, "postgresql");
+    if (json_is_object(postgresql)) {
+      json_t* copy = json_object_get(postgresql, "copy");
+      if (json_is_boolean(copy)) {
+        set_override_string(&config_file_overrides.postgresql_copy,
+                            json_is_true(copy) ? "true" : "false");
+      } else if (json_is_string(copy)) {
+        set_override_string(&config_file_overrides.postgresql_copy, json_string_value(copy));
+      }
+    }
   }
 
   json_t* socket = json_object_get(root, "socket");
@@ -597,6 +873,14 @@ static unsigned parse_config_file_defaults(const char* json) {
     } else if (json_is_string(sock_port)) {
       set_override_string(&config_file_overrides.socket_port, json_string_value(sock_port));
     }
+    json_t* tls_cert = json_object_get(socket, "tls_cert");
+    if (json_is_string(tls_cert)) {
+      set_override_string(&config_file_overrides.socket_tls_cert, json_string_value(tls_cert));
+    }
+    json_t* tls_key = json_object_get(socket, "tls_key");
+    if (json_is_string(tls_key)) {
+      set_override_string(&config_file_overrides.socket_tls_key, json_string_value(tls_key));
+    }
   }
 
   json_t* table = json_object_get(root, "table");
@@ -609,6 +893,49 @@ static unsigned parse_config_file_defaults(const char* json) {
     } else if (json_is_string(period)) {
       set_override_string(&config_file_overrides.table_period, json_string_value(period));
     }
+    json_t* adhoc_idle = json_object_get(table, "adhoc_idle");
+    if (json_is_integer(adhoc_idle)) {
+      char tmp[32];
+      snprintf(tmp, sizeof(tmp), "%lld", (long long)json_integer_value(adhoc_idle));
+      set_override_string(&config_file_overrides.table_adhoc_idle, tmp);
+    } else if (json_is_string(adhoc_idle)) {
+      set_override_string(&config_file_overrides.table_adhoc_idle, json_string_value(adhoc_idle));
+    }
+    json_t* tier_idle = json_object_get(table, "tier_idle");
+    if (json_is_integer(tier_idle)) {
+      char tmp[32];
+      snprintf(tmp, sizeof(tmp), "%lld", (long long)json_integer_value(tier_idle));
+      set_override_string(&config_file_overrides.table_tier_idle, tmp);
+    } else if (json_is_string(tier_idle)) {
+      set_override_string(&config_file_overrides.table_tier_idle, json_string_value(tier_idle));
+    }
+    json_t* reload_budget = json_object_get(table, "reload_budget");
+    if (json_is_integer(reload_budget)) {
+      char tmp[32];
+      snprintf(tmp, sizeof(tmp), "%lld", (long long)json_integer_value(reload_budget));
+      set_override_string(&config_file_overrides.table_reload_budget, tmp);
+    } else if (json_is_string(reload_budget)) {
+      set_override_string(&config_file_overrides.table_reload_budget, json_string_value(reload_budget));
+    }
+    json_t* warm_keys = json_object_get(table, "warm_keys");
+    if (json_is_integer(warm_keys)) {
+      char tmp[32];
+      snprintf(tmp, sizeof(tmp), "%lld", (long long)json_integer_value(warm_keys));
+      set_override_string(&config_file_overrides.table_warm_keys, tmp);
+    } else if (json_is_string(warm_keys)) {
+      set_override_string(&config_file_overrides.table_warm_keys, json_string_value(warm_keys));
+    }
+    json_t* prefault = json_object_get(table, "prefault");
+    if (json_is_boolean(prefault)) {
+      set_override_string(&config_file_overrides.table_prefault,
+                          json_is_true(prefault) ? "true" : "false");
+    } else if (json_is_string(prefault)) {
+      set_override_string(&config_file_overrides.table_prefault, json_string_value(prefault));
+    }
+    json_t* tier_dir = json_object_get(table, "tier_dir");
+    if (json_is_string(tier_dir)) {
+      set_override_string(&config_file_overrides.table_tier_dir, json_string_value(tier_dir));
+    }
     json_t* selects = json_object_get(table, "selects");
     if (json_is_object(selects) && json_object_size(selects) > 0) {
       char* select_spec = build_selects_override(selects);
@@ -616,6 +943,34 @@ static unsigned parse_config_file_defaults(const char* json) {
         set_override_owned(&config_file_overrides.table_selects, select_spec);
       }
     }
+    json_t* derived = json_object_get(table, "derived");
+    if (json_is_object(derived) && json_object_size(derived) > 0) {
+      char* derived_spec = build_selects_override(derived);
+      if (derived_spec) {
+        set_override_owned(&config_file_overrides.table_derived, derived_spec);
+      }
+    }
+    json_t* computed = json_object_get(table, "computed");
+    if (json_is_object(computed) && json_object_size(computed) > 0) {
+      char* computed_spec = build_computed_override(computed);
+      if (computed_spec) {
+        set_override_owned(&config_file_overrides.table_computed, computed_spec);
+      }
+    }
+    json_t* push = json_object_get(table, "push");
+    if (json_is_object(push) && json_object_size(push) > 0) {
+      char* push_spec = build_selects_override(push);
+      if (push_spec) {
+        set_override_owned(&config_file_overrides.table_push, push_spec);
+      }
+    }
+    json_t* placement = json_object_get(table, "placement");
+    if (json_is_object(placement) && json_object_size(placement) > 0) {
+      char* placement_spec = build_placement_override(placement);
+      if (placement_spec) {
+        set_override_owned(&config_file_overrides.table_placement, placement_spec);
+      }
+    }
   }
 
   json_t* tables = json_object_get(root, "tables");
@@ -638,6 +993,40 @@ static unsigned parse_config_file_defaults(const char* json) {
     } else if (json_is_string(tokens)) {
       set_override_string(&config_file_overrides.server_tokens, json_string_value(tokens));
     }
+    json_t* numa_node = json_object_get(server, "numa_node");
+    if (json_is_integer(numa_node)) {
+      char tmp[32];
+      snprintf(tmp, sizeof(tmp), "%lld", (long long)json_integer_value(numa_node));
+      set_override_string(&config_file_overrides.server_numa_node, tmp);
+    }
+    json_t* loader_process = json_object_get(server, "loader_process");
+    if (json_is_boolean(loader_process)) {
+      set_override_string(&config_file_overrides.server_loader_process,
+                          json_is_true(loader_process) ? "true" : "false");
+    } else if (json_is_string(loader_process)) {
+      set_override_string(&config_file_overrides.server_loader_process, json_string_value(loader_process));
+    }
+    json_t* shed_lag = json_object_get(server, "shed_lag");
+    if (json_is_integer(shed_lag)) {
+      char tmp[32];
+      snprintf(tmp, sizeof(tmp), "%lld", (long long)json_integer_value(shed_lag));
+      set_override_string(&config_file_overrides.server_shed_lag, tmp);
+    }
+  }
+
+  json_t* cluster = json_object_get(root, "cluster");
+  if (json_is_object(cluster)) {
+    json_t* self = json_object_get(cluster, "self");
+    if (json_is_string(self)) {
+      set_override_string(&config_file_overrides.cluster_self, json_string_value(self));
+    }
+    json_t* nodes = json_object_get(cluster, "nodes");
+    if (json_is_object(nodes) && json_object_size(nodes) > 0) {
+      char* nodes_spec = build_selects_override(nodes);
+      if (nodes_spec) {
+        set_override_owned(&config_file_overrides.cluster_nodes, nodes_spec);
+      }
+    }
   }
 
   json_decref(root);
@@ -652,13 +1041,31 @@ static void clear_config_file_overrides(void) {
   set_override_owned(&config_file_overrides.db_user, NULL);
   set_override_owned(&config_file_overrides.db_password, NULL);
   set_override_owned(&config_file_overrides.sqlite_filename, NULL);
+  set_override_owned(&config_file_overrides.postgresql_copy, NULL);
   set_override_owned(&config_file_overrides.socket_host, NULL);
   set_override_owned(&config_file_overrides.socket_port, NULL);
   set_override_owned(&config_file_overrides.socket_path, NULL);
+  set_override_owned(&config_file_overrides.socket_tls_cert, NULL);
+  set_override_owned(&config_file_overrides.socket_tls_key, NULL);
   set_override_owned(&config_file_overrides.table_period, NULL);
+  set_override_owned(&config_file_overrides.table_adhoc_idle, NULL);
+  set_override_owned(&config_file_overrides.table_tier_idle, NULL);
+  set_override_owned(&config_file_overrides.table_tier_dir, NULL);
+  set_override_owned(&config_file_overrides.table_reload_budget, NULL);
+  set_override_owned(&config_file_overrides.table_warm_keys, NULL);
+  set_override_owned(&config_file_overrides.table_prefault, NULL);
   set_override_owned(&config_file_overrides.table_selects, NULL);
+  set_override_owned(&config_file_overrides.table_derived, NULL);
+  set_override_owned(&config_file_overrides.table_computed, NULL);
+  set_override_owned(&config_file_overrides.table_push, NULL);
+  set_override_owned(&config_file_overrides.table_placement, NULL);
   set_override_owned(&config_file_overrides.table_tables, NULL);
   set_override_owned(&config_file_overrides.server_tokens, NULL);
+  set_override_owned(&config_file_overrides.server_numa_node, NULL);
+  set_override_owned(&config_file_overrides.server_loader_process, NULL);
+  set_override_owned(&config_file_overrides.server_shed_lag, NULL);
+  set_override_owned(&config_file_overrides.cluster_self, NULL);
+  set_override_owned(&config_file_overrides.cluster_nodes, NULL);
 }
 
 static const char* config_file_default_for(const char* name) {
@@ -670,13 +1077,31 @@ static const char* config_file_default_for(const char* name) {
   if (strcmp(name, "MELIAN_DB_USER") == 0) return config_file_overrides.db_user;
   if (strcmp(name, "MELIAN_DB_PASSWORD") == 0) return config_file_overrides.db_password;
   if (strcmp(name, "MELIAN_SQLITE_FILENAME") == 0) return config_file_overrides.sqlite_filename;
+  if (strcmp(name, "MELIAN_POSTGRESQL_COPY") == 0) return config_file_overrides.postgresql_copy;
   if (strcmp(name, "MELIAN_SOCKET_HOST") == 0) return config_file_overrides.socket_host;
   if (strcmp(name, "MELIAN_SOCKET_PORT") == 0) return config_file_overrides.socket_port;
   if (strcmp(name, "MELIAN_SOCKET_PATH") == 0) return config_file_overrides.socket_path;
+  if (strcmp(name, "MELIAN_SOCKET_TLS_CERT") == 0) return config_file_overrides.socket_tls_cert;
+  if (strcmp(name, "MELIAN_SOCKET_TLS_KEY") == 0) return config_file_overrides.socket_tls_key;
   if (strcmp(name, "MELIAN_TABLE_PERIOD") == 0) return config_file_overrides.table_period;
+  if (strcmp(name, "MELIAN_TABLE_ADHOC_IDLE") == 0) return config_file_overrides.table_adhoc_idle;
+  if (strcmp(name, "MELIAN_TABLE_TIER_IDLE") == 0) return config_file_overrides.table_tier_idle;
+  if (strcmp(name, "MELIAN_TABLE_TIER_DIR") == 0) return config_file_overrides.table_tier_dir;
+  if (strcmp(name, "MELIAN_TABLE_RELOAD_BUDGET") == 0) return config_file_overrides.table_reload_budget;
+  if (strcmp(name, "MELIAN_TABLE_WARM_KEYS") == 0) return config_file_overrides.table_warm_keys;
+  if (strcmp(name, "MELIAN_TABLE_PREFAULT") == 0) return config_file_overrides.table_prefault;
   if (strcmp(name, "MELIAN_TABLE_SELECTS") == 0) return config_file_overrides.table_selects;
+  if (strcmp(name, "MELIAN_TABLE_DERIVED") == 0) return config_file_overrides.table_derived;
+  if (strcmp(name, "MELIAN_TABLE_COMPUTED") == 0) return config_file_overrides.table_computed;
+  if (strcmp(name, "MELIAN_TABLE_PUSH") == 0) return config_file_overrides.table_push;
+  if (strcmp(name, "MELIAN_TABLE_PLACEMENT") == 0) return config_file_overrides.table_placement;
   if (strcmp(name, "MELIAN_TABLE_TABLES") == 0) return config_file_overrides.table_tables;
   if (strcmp(name, "MELIAN_SERVER_TOKENS") == 0) return config_file_overrides.server_tokens;
+  if (strcmp(name, "MELIAN_SERVER_NUMA_NODE") == 0) return config_file_overrides.server_numa_node;
+  if (strcmp(name, "MELIAN_SERVER_LOADER_PROCESS") == 0) return config_file_overrides.server_loader_process;
+  if (strcmp(name, "MELIAN_SERVER_SHED_LAG") == 0) return config_file_overrides.server_shed_lag;
+  if (strcmp(name, "MELIAN_CLUSTER_SELF") == 0) return config_file_overrides.cluster_self;
+  if (strcmp(name, "MELIAN_CLUSTER_NODES") == 0) return config_file_overrides.cluster_nodes;
   return NULL;
 }
 
@@ -743,10 +1168,13 @@ static char* build_tables_override(json_t* tables) {
     }
     if (!sb_append(&buf, &len, &cap, "%s#%u", name, id)) goto fail;
 
-    json_int_t period_raw = 0;
-    if (json_unpack(table, "{s?I}", "period", &period_raw) == 0) {
-      unsigned period = (unsigned)period_raw;
+    json_t* period_value = json_object_get(table, "period");
+    if (json_is_integer(period_value)) {
+      unsigned period = (unsigned)json_integer_value(period_value);
       if (period && !sb_append(&buf, &len, &cap, "|%u", period)) goto fail;
+    } else if (json_is_string(period_value)) {
+      // "MIN-MAX" for an adaptive period
+      if (!sb_append(&buf, &len, &cap, "|%s", json_string_value(period_value))) goto fail;
     }
 
     if (!sb_append(&buf, &len, &cap, "|")) goto fail;
@@ -782,6 +1210,14 @@ static char* build_tables_override(json_t* tables) {
         type = type_buf;
       }
       if (!sb_append(&buf, &len, &cap, ":%s", type)) goto fail;
+      const char* order = NULL;
+      if (json_unpack(idx, "{s?s}", "order", &order) == 0 && order && order[0]) {
+        if (!sb_append(&buf, &len, &cap, "@%s", order)) goto fail;
+      }
+      const char* where = NULL;
+      if (json_unpack(idx, "{s?s}", "where", &where) == 0 && where && where[0]) {
+        if (!sb_append(&buf, &len, &cap, "?%s", where)) goto fail;
+      }
       wrote_index = 1;
     }
     if (!wrote_index) {
@@ -822,3 +1258,80 @@ fail:
   if (buf) free(buf);
   return NULL;
 }
+
+// Each table maps to a node name, or to an array of them.
+static char* build_placement_override(json_t* placement) {
+  char* buf = NULL;
+  size_t len = 0;
+  size_t cap = 0;
+  unsigned wrote_entry = 0;
+  const char* table = NULL;
+  json_t* nodes = NULL;
+  json_object_foreach(placement, table, nodes) {
+    if (!table || !table[0]) continue;
+    if (json_is_string(nodes)) {
+      if (wrote_entry && !sb_append(&buf, &len, &cap, ";")) goto fail;
+      if (!sb_append(&buf, &len, &cap, "%s=%s", table, json_string_value(nodes))) goto fail;
+      wrote_entry = 1;
+      continue;
+    }
+    if (!json_is_array(nodes)) continue;
+    unsigned wrote_node = 0;
+    size_t index = 0;
+    json_t* node = NULL;
+    json_array_foreach(nodes, index, node) {
+      if (!json_is_string(node)) continue;
+      if (wrote_node) {
+        if (!sb_append(&buf, &len, &cap, ",")) goto fail;
+      } else {
+        if (wrote_entry && !sb_append(&buf, &len, &cap, ";")) goto fail;
+        if (!sb_append(&buf, &len, &cap, "%s=", table)) goto fail;
+      }
+      if (!sb_append(&buf, &len, &cap, "%s", json_string_value(node))) goto fail;
+      wrote_node = 1;
+      wrote_entry = 1;
+    }
+  }
+  if (!buf) return NULL;
+  buf[len] = '\0';
+  return buf;
+
+fail:
+  if (buf) free(buf);
+  return NULL;
+}
+
+// Each table maps to an object of column names and expressions.
+static char* build_computed_override(json_t* computed) {
+  char* buf = NULL;
+  size_t len = 0;
+  size_t cap = 0;
+  unsigned wrote_entry = 0;
+  const char* table = NULL;
+  json_t* columns = NULL;
+  json_object_foreach(computed, table, columns) {
+    if (!table || !table[0] || !json_is_object(columns)) continue;
+    unsigned wrote_column = 0;
+    const char* column = NULL;
+    json_t* expr = NULL;
+    json_object_foreach(columns, column, expr) {
+      if (!column || !column[0] || !json_is_string(expr)) continue;
+      if (wrote_column) {
+        if (!sb_append(&buf, &len, &cap, ", ")) goto fail;
+      } else {
+        if (wrote_entry && !sb_append(&buf, &len, &cap, ";")) goto fail;
+        if (!sb_append(&buf, &len, &cap, "%s=", table)) goto fail;
+      }
+      if (!sb_append(&buf, &len, &cap, "%s=%s", column, json_string_value(expr))) goto fail;
+      wrote_column = 1;
+      wrote_entry = 1;
+    }
+  }
+  if (!buf) return NULL;
+  buf[len] = '\0';
+  return buf;
+
+fail:
+  if (buf) free(buf);
+  return NULL;
+}
@@ -21,42 +21,67 @@ typedef struct ConfigDb {
   const char* user;
   const char* password;
   const char* sqlite_filename;
+  unsigned postgresql_copy;   // load PostgreSQL tables with COPY ... (FORMAT binary)
 } ConfigDb;
 
 typedef struct ConfigSocket {
   const char* host;
   unsigned port;
   const char* path;
+  const char* tls_cert;    // PEM certificate chain for TLS on the TCP listener; empty for plain TCP
+  const char* tls_key;     // PEM private key; empty if tls_cert holds it
 } ConfigSocket;
 
 #define MELIAN_MAX_TABLES 64
 #define MELIAN_MAX_INDEXES 16
 #define MELIAN_MAX_NAME_LEN 256
 #define MELIAN_MAX_SELECT_LEN 4096
+#define MELIAN_MAX_NODES 16
 
 typedef enum ConfigIndexType {
   CONFIG_INDEX_TYPE_INT,
   CONFIG_INDEX_TYPE_STRING,
+  CONFIG_INDEX_TYPE_GEO,     // nearest rows to a point; the column is "lat/lon"
+  CONFIG_INDEX_TYPE_TRIGRAM, // rows whose text resembles or contains a query
+  CONFIG_INDEX_TYPE_GROUP,   // every row holding a key, sorted by another column
 } ConfigIndexType;
 
 typedef struct ConfigIndexSpec {
   unsigned id;
   char column[MELIAN_MAX_NAME_LEN];
   ConfigIndexType type;
+  char where_column[MELIAN_MAX_NAME_LEN];  // only rows whose column matches are indexed; empty for all
+  char where_value[MELIAN_MAX_NAME_LEN];
+  unsigned where_negate;                   // column!=value rather than column=value
+  char order_column[MELIAN_MAX_NAME_LEN];  // group index: column its rows are sorted by; empty for load order
+  unsigned order_descending;
 } ConfigIndexSpec;
 
 typedef struct ConfigTableSpec {
   unsigned id;
   char name[MELIAN_MAX_NAME_LEN];
   unsigned period;
+  unsigned period_max;                   // adaptive refresh between period and this; 0 for a fixed period
   unsigned index_count;
   char select_stmt[MELIAN_MAX_SELECT_LEN];
+  char derived[MELIAN_MAX_SELECT_LEN];   // definition of a derived table; empty if loaded from the database
+  char computed[MELIAN_MAX_SELECT_LEN];  // name=expression list of computed columns; empty if none
+  char push[MELIAN_MAX_SELECT_LEN];      // secret a producer gives to INGEST rows; empty if loaded otherwise
+  unsigned placement_count;              // cluster nodes holding the table; 0 for every node
+  unsigned char placement[MELIAN_MAX_NODES];  // their positions in ConfigCluster.nodes; rows are
+                                              // split between them by the hash of their first key
   ConfigIndexSpec indexes[MELIAN_MAX_INDEXES];
 } ConfigTableSpec;
 
 typedef struct ConfigTable {
   unsigned period;
   unsigned strip_null;
+  unsigned adhoc_idle;
+  unsigned tier_idle;
+  const char* tier_dir;
+  unsigned reload_budget;  // megabytes all tables may hold while reloading; 0 for no limit
+  unsigned warm_keys;      // recently fetched keys per table, looked up in each new slot; 0 to not warm
+  unsigned prefault;       // read every page of each new slot before it goes live
   char* schema;
   unsigned table_count;
   ConfigTableSpec tables[MELIAN_MAX_TABLES];
@@ -65,8 +90,23 @@ typedef struct ConfigTable {
 typedef struct ConfigServer {
   unsigned show_msgs;
   unsigned tokens;
+  int numa_node;           // run and allocate on this NUMA node; -1 to leave it to the kernel
+  unsigned loader_process; // query the database from a child process
+  unsigned shed_lag;       // event loop lag, in ms, past which low priority requests are shed; 0 never sheds
 } ConfigServer;
 
+typedef struct ConfigClusterNode {
+  char name[64];
+  char address[256];       // host:port, or the path of a UNIX socket
+} ConfigClusterNode;
+
+typedef struct ConfigCluster {
+  const char* self_name;   // empty outside a cluster
+  int self;                // position of this node in nodes; -1 outside a cluster
+  unsigned node_count;
+  ConfigClusterNode nodes[MELIAN_MAX_NODES];
+} ConfigCluster;
+
 typedef struct ConfigFileData {
   char* path;
   char* contents;
@@ -79,6 +119,7 @@ typedef struct Config {
   ConfigSocket socket;
   ConfigTable table;
   ConfigServer server;
+  ConfigCluster cluster;
 } Config;
 
 const char* config_db_driver_name(ConfigDbDriver driver);
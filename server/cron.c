@@ -85,6 +85,11 @@ unsigned cron_stop(Cron* cron) {
   return 1;
 }
 
+void cron_wakeup(Cron* cron) {
+  if (!cron->running) return;
+  poke_thread(cron, THREAD_MESSAGE_WAKEUP);
+}
+
 static void poke_thread(Cron* cron, uint8_t message) {
   ssize_t wrote = 0;
   do {
@@ -119,7 +124,11 @@ static void* loader_main(void *arg) {
       break;
     }
     LOG_DEBUG("THREAD: woke up");
+    // Tiering first, so a promoted table reloads on this same pass
+    data_update_tiers(cron->server->data);
     data_load_all_tables_from_db(cron->server->data, cron->server->db);
+    data_build_adhoc_indexes(cron->server->data);
+    data_build_arrows(cron->server->data);
   }
   LOG_INFO("THREAD: stopping, cron: %p", (void*)cron);
   return 0;
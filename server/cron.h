@@ -2,6 +2,7 @@
 
 // A Cron has an ongoing clock tick which periodically wakes up a thread.
 // This thread performs the work of reloading data from MySQL.
+// The thread can also be woken up early, e.g. to build a newly requested index.
 
 typedef struct Cron {
   struct event_base *base;
@@ -16,3 +17,4 @@ Cron* cron_build(struct Server* server);
 void cron_destroy(Cron* cron);
 unsigned cron_run(Cron* cron);
 unsigned cron_stop(Cron* cron);
+void cron_wakeup(Cron* cron);
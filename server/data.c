@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <jansson.h>
 #include "util.h"
 #include "log.h"
@@ -11,16 +12,79 @@
 #include "hash.h"
 #include "config.h"
 #include "db.h"
+#include "row.h"
+#include "jsonpath.h"
+#include "derived.h"
+#include "expr.h"
+#include "geo.h"
+#include "trigram.h"
+#include "group.h"
+#include "arrow.h"
+#include "xxhash.h"
+#include "push.h"
+#include "loader.h"
 #include "data.h"
 
 enum {
   DATA_REFRESH_PERIOD = 20,
   ARENA_INITIAL_CAPACITY = 1024,
+  ROWS_INITIAL_CAPACITY = 1024,
+  MAX_KEY_TEXT_LEN = 32,
+  MAX_JSON_KEY_LEN = 1024,
 };
 
+// The key of a row under the first index of its table, and room to build it.
+typedef struct RowKey {
+  char value[MAX_JSON_KEY_LEN];
+  char text[MAX_KEY_TEXT_LEN];
+  unsigned key_int;
+  const uint8_t* key;
+  unsigned len;
+} RowKey;
+
 static void data_refresh_schema(Data* data);
 static json_t* schema_table_json(Table* table);
 static const char* index_type_name(ConfigIndexType type);
+static HashKeyKind index_hash_kind(ConfigIndexType type);
+static unsigned index_uses_hash(const TableIndex* index);
+static unsigned index_field(const TableIndex* index, const uint8_t* row, unsigned row_len,
+                            RowField* field, char* text, unsigned size);
+static unsigned index_where_matches(const TableIndex* index, const uint8_t* row, unsigned row_len);
+static unsigned table_index_row(Table* table, unsigned idx, Hash* hash, unsigned frame,
+                                const uint8_t* row, unsigned row_len,
+                                unsigned* min_id, unsigned* max_id);
+static unsigned table_build_computed(Table* table, const char* list);
+static const uint8_t* table_computed_row(Table* table, const uint8_t* row, unsigned row_len, unsigned* len);
+static struct TableSlot* table_slot_begin(Table* table, unsigned size);
+static unsigned table_load_image(Table* table, unsigned now, size_t room);
+static unsigned table_export_store(struct Arena* arena, const void* data, size_t len, unsigned* offset);
+static unsigned table_slot_commit(Table* table, struct TableSlot* slot, unsigned rows,
+                                  unsigned min_id, unsigned max_id, unsigned now);
+static void table_slot_release(Table* table, struct TableSlot* slot);
+static uint64_t table_slot_content_hash(struct TableSlot* slot);
+static void table_adapt_period(Table* table, struct TableSlot* slot);
+static void table_slot_warm(Table* table, struct TableSlot* slot);
+static void table_slot_collect_columns(struct TableSlot* slot);
+static unsigned table_slot_has_column(const struct TableSlot* slot, const char* name, unsigned len);
+static unsigned table_slot_build_filtered(Table* table, struct TableSlot* slot,
+                                          unsigned* min_id, unsigned* max_id);
+static void table_slot_build_geo(Table* table, struct TableSlot* slot);
+static void table_slot_build_trigram(Table* table, struct TableSlot* slot);
+static void table_slot_build_group(Table* table, struct TableSlot* slot);
+static unsigned field_degrees(const RowField* field, double* degrees);
+static size_t table_slot_bytes(Table* table, struct TableSlot* slot, unsigned resident);
+static unsigned table_reload_fits(Table* table, unsigned rows, size_t room);
+static size_t data_reload_room(Data* data);
+static int table_cmp_memory(const void* a, const void* b);
+static unsigned table_demote(Table* table, unsigned now);
+static void table_promote(Table* table, unsigned now);
+static unsigned table_slot_build_adhoc(Table* table, struct TableSlot* slot);
+static Hash* table_slot_index_column(Table* table, struct TableSlot* slot, TableAdhocIndex* adhoc);
+static unsigned parse_key_text(const void* key, unsigned len, unsigned* value);
+static unsigned table_slot_row_at(void* ctx, unsigned r, const uint8_t** row);
+static void table_slot_drop_arrow(struct TableSlot* slot);
+static unsigned table_row_key(Table* table, const uint8_t* row, unsigned row_len, RowKey* key);
+static unsigned table_push_delta_keys(Table* table, PushBatch* batch, PushKeySet* set);
 
 Table* table_build(const ConfigTableSpec* spec, unsigned arena_cap) {
   Table* table = 0;
@@ -39,6 +103,8 @@ Table* table_build(const ConfigTableSpec* spec, unsigned arena_cap) {
       LOG_FATAL("Table name '%s' exceeds %zu bytes", spec->name, sizeof(table->name) - 1);
     }
     table->period = spec->period ? spec->period : DATA_REFRESH_PERIOD;
+    table->period_min = table->period;
+    table->period_max = spec->period_max > table->period ? spec->period_max : 0;
     len = snprintf(table->select_stmt, sizeof(table->select_stmt), "%s", spec->select_stmt);
     if (len < 0 || (size_t)len >= sizeof(table->select_stmt)) {
       errno = ENOMEM;
@@ -56,6 +122,25 @@ Table* table_build(const ConfigTableSpec* spec, unsigned arena_cap) {
                   spec->indexes[idx].column, spec->name,
                   sizeof(table->indexes[idx].column) - 1);
       }
+      TableIndex* index = &table->indexes[idx];
+      const char* dollar = strchr(index->column, '$');
+      index->column_len = dollar ? (unsigned)(dollar - index->column) : (unsigned)len;
+      index->path = dollar ? dollar + 1 : 0;
+      index->path_len = dollar ? (unsigned)len - index->column_len - 1 : 0;
+      if (index->type == CONFIG_INDEX_TYPE_GEO) {
+        const char* slash = strchr(index->column, '/');
+        index->column_len = (unsigned)(slash - index->column);
+        index->lon = slash + 1;
+        index->lon_len = (unsigned)len - index->column_len - 1;
+      }
+      // Both fit, being copied from spec fields of the same size
+      index->where_column_len = snprintf(index->where_column, sizeof(index->where_column),
+                                         "%s", spec->indexes[idx].where_column);
+      index->where_value_len = snprintf(index->where_value, sizeof(index->where_value),
+                                        "%s", spec->indexes[idx].where_value);
+      index->where_negate = spec->indexes[idx].where_negate;
+      index->order_len = snprintf(index->order, sizeof(index->order), "%s", spec->indexes[idx].order_column);
+      index->order_descending = spec->indexes[idx].order_descending;
     }
 
     for (unsigned b = 0; b < 2; ++b) {
@@ -74,6 +159,17 @@ Table* table_build(const ConfigTableSpec* spec, unsigned arena_cap) {
     if (bad) {
       break;
     }
+    if (spec->computed[0] && !table_build_computed(table, spec->computed)) {
+      ++bad;
+      break;
+    }
+    if (spec->push[0]) {
+      table->push = push_build(spec->push);
+      if (!table->push) {
+        ++bad;
+        break;
+      }
+    }
 
     LOG_DEBUG("Built table id %u name %s period %u indexes %u",
               table->table_id, table->name, table->period, table->index_count);
@@ -91,14 +187,18 @@ void table_destroy(Table* table) {
             table->table_id, table->name, table->period);
   for (unsigned b = 0; b < 2; ++b) {
     struct TableSlot* slot = &table->slots[b];
-    if (slot->indexes) {
-      for (unsigned i = 0; i < table->index_count; ++i) {
-        if (slot->indexes[i]) hash_destroy(slot->indexes[i]);
-      }
-      free(slot->indexes);
-    }
-    if (slot->arena) arena_destroy(slot->arena);
+    table_slot_release(table, slot);
+    if (slot->indexes) free(slot->indexes);
+  }
+  if (table->derived) derived_destroy(table->derived);
+  if (table->push) push_destroy(table->push);
+  for (unsigned c = 0; c < table->computed_count; ++c) {
+    expr_destroy(table->computed[c].expr);
   }
+  row_builder_free(&table->computed_row);
+  if (table->load_scratch) free(table->load_scratch);
+  if (table->key_scratch) free(table->key_scratch);
+  if (table->warm) free(table->warm);
   free(table);
 }
 
@@ -107,7 +207,9 @@ const char* table_name(Table* table) {
   return table->name;
 }
 
-unsigned table_load_from_db(Table* table, struct DB* db, unsigned now, unsigned load) {
+unsigned table_load_from_db(Table* table, struct DB* db, unsigned now, unsigned load, size_t room) {
+  if (table->derived || table->push || table->remote) return 0;
+  if (atomic_load(&table->tier) == TABLE_TIER_COLD) return 0;
   unsigned elapsed = now - table->stats.last_loaded;
   LOG_DEBUG("NOW %u LAST %u ELAPSED %u", now, table->stats.last_loaded, elapsed);
   if (elapsed < table->period) {
@@ -116,36 +218,324 @@ unsigned table_load_from_db(Table* table, struct DB* db, unsigned now, unsigned
   }
 
   if (!load) return 1;
+  if (table->loader) return table_load_image(table, now, room);
+
+  unsigned size = db_get_table_size(db, table);
+  if (!table_reload_fits(table, size, room)) return 0;
+  struct TableSlot* slot = table_slot_begin(table, size);
+  if (!slot) return 0;
+
+  unsigned min_id = (unsigned) -1;
+  unsigned max_id = 0;
+  unsigned rows = db_query_into_hash(db, table, slot, &min_id, &max_id);
+  if (rows == (unsigned)-1) {
+    LOG_WARN("Skipping reload for table %s due to invalid schema data", table->name);
+    return 0;
+  }
+  if (table->parts) rows = slot->row_count;  // the other parts were skipped
+  LOG_INFO("Loaded %u rows for table %s at slot %u", rows, table->name, 1 - table->current_slot);
+
+  if (!table_slot_commit(table, slot, rows, min_id, max_id, now)) return 0;
+  return rows;
+}
+
+int table_export_from_db(Table* table, struct DB* db, TableImage* image) {
+  memset(image, 0, sizeof(*image));
+  image->table_id = table->table_id;
+  image->rows = (unsigned)-1;
+  if (table->derived || table->push) return -1;
+
+  // Each load starts the standby slot over in a fresh shared arena, which
+  // grows by remapping its pages rather than copying them
+  struct TableSlot* slot = &table->slots[1 - table->current_slot];
+  table_slot_release(table, slot);
+  slot->arena = arena_build_shared(ARENA_INITIAL_CAPACITY);
+  if (!slot->arena) {
+    LOG_WARN("Could not allocate shared arena for table %s", table->name);
+    return -1;
+  }
+
+  int fd = -1;
+  unsigned bad = 0;
+  do {
+    unsigned size = db_get_table_size(db, table);
+    if (!table_slot_begin(table, size)) {
+      ++bad;
+      break;
+    }
+    unsigned min_id = (unsigned) -1;
+    unsigned max_id = 0;
+    unsigned rows = db_query_into_hash(db, table, slot, &min_id, &max_id);
+    if (rows == (unsigned)-1) {
+      ++bad;
+      break;
+    }
+    if (table->parts) rows = slot->row_count;
+    // Filtered indexes may copy keys into the arena, which the server cannot
+    // do once the image is mapped there
+    if (!table_slot_build_filtered(table, slot, &min_id, &max_id)) {
+      ++bad;
+      break;
+    }
+
+    struct Arena* arena = slot->arena;
+    image->arena_used = arena->used;
+    if (!table_export_store(arena, slot->rows, (size_t)rows * sizeof(unsigned), &image->row_list)) {
+      ++bad;
+      break;
+    }
+    for (unsigned idx = 0; idx < table->index_count; ++idx) {
+      Hash* hash = slot->indexes[idx];
+      if (!hash) continue;
+      if (!table_export_store(arena, hash->tab, (size_t)hash->cap * sizeof(Bucket),
+                              &image->indexes[idx].buckets)) {
+        ++bad;
+        break;
+      }
+      image->indexes[idx].cap = hash->cap;
+      image->indexes[idx].used = hash->used;
+      image->indexes[idx].kind = hash->kind;
+    }
+    if (bad) break;
+
+    fd = dup(arena->fd);
+    if (fd < 0) {
+      LOG_WARN("Could not duplicate shared memory file for table %s: %s", table->name, strerror(errno));
+      ++bad;
+      break;
+    }
+    image->rows = rows;
+    image->min_id = min_id;
+    image->max_id = max_id;
+    image->size = arena->used;
+    LOG_INFO("Loaded %u rows for table %s into a %u byte image", rows, table->name, image->size);
+  } while (0);
+  if (bad) LOG_WARN("Could not load table %s", table->name);
+  table_slot_release(table, slot);
+  return fd;
+}
+
+unsigned table_load_derived(Table* table, unsigned now, size_t room) {
+  Derived* derived = table->derived;
+  if (!derived || table->remote || !derived_stale(derived)) return 0;
+  if (atomic_load(&table->tier) == TABLE_TIER_COLD) return 0;
+
+  unsigned size = derived_row_estimate(derived);
+  if (!table_reload_fits(table, size, room)) return 0;
+  struct TableSlot* slot = table_slot_begin(table, size);
+  if (!slot) return 0;
+
+  unsigned min_id = (unsigned) -1;
+  unsigned max_id = 0;
+  unsigned rows = derived_fill(derived, table, slot, &min_id, &max_id);
+  if (rows == (unsigned)-1) {
+    LOG_WARN("Skipping rebuild for derived table %s", table->name);
+    return 0;
+  }
+  LOG_INFO("Derived %u rows for table %s at slot %u", rows, table->name, 1 - table->current_slot);
 
+  if (!table_slot_commit(table, slot, rows, min_id, max_id, now)) return 0;
+  return rows;
+}
+
+unsigned table_load_pushed(Table* table, unsigned now, size_t room) {
+  Push* push = table->push;
+  if (!push) return 0;
+  PushBatch* batch = push_take(push);
+  if (!batch) return 0;
+
+  struct TableSlot* live = &table->slots[table->current_slot];
+  unsigned delta = batch->mode == PUSH_DELTA;
+  unsigned size = batch->rows.count + (delta ? live->row_count : 0);
+  struct TableSlot* slot = 0;
+  if (!table_reload_fits(table, size, room) || !(slot = table_slot_begin(table, size))) {
+    // Keep the batch for the next pass; the producer cannot commit another meanwhile
+    push_return(push, batch);
+    return 0;
+  }
+
+  unsigned min_id = (unsigned) -1;
+  unsigned max_id = 0;
+  unsigned rows = 0;
+  unsigned kept = 0;
+  unsigned bad = 0;
+  PushKeySet keys = {0};
+  do {
+    if (delta) {
+      // Keep the live rows whose key the delta neither deletes nor replaces
+      if (!table_push_delta_keys(table, batch, &keys)) {
+        ++bad;
+        break;
+      }
+      for (unsigned r = 0; r < live->row_count; ++r) {
+        const uint8_t* row = 0;
+        unsigned row_len = table_slot_row(live, r, &row);
+        RowKey key;
+        if (table_row_key(table, row, row_len, &key) && push_keys_has(&keys, key.key, key.len)) continue;
+        if (!table_slot_add_row(table, slot, row, row_len, &min_id, &max_id)) {
+          ++bad;
+          break;
+        }
+        ++kept;
+      }
+      if (bad) break;
+    }
+    size_t pos = 0;
+    const uint8_t* row = 0;
+    unsigned row_len = 0;
+    while (push_buffer_next(&batch->rows, &pos, &row, &row_len)) {
+      if (!table_slot_add_row(table, slot, row, row_len, &min_id, &max_id)) {
+        ++bad;
+        break;
+      }
+    }
+  } while (0);
+  push_keys_free(&keys);
+  if (bad) {
+    LOG_WARN("Dropping pushed %s for table %s", delta ? "delta" : "snapshot", table->name);
+    push_batch_destroy(batch);
+    return 0;
+  }
+
+  rows = kept + batch->rows.count;
+  LOG_INFO("Applied pushed %s of %u rows and %u deleted keys for table %s, %u rows at slot %u",
+           delta ? "delta" : "snapshot", batch->rows.count, batch->keys.count,
+           table->name, rows, 1 - table->current_slot);
+  ++push->stats.batches;
+  push->stats.rows = batch->rows.count;
+  push->stats.keys = batch->keys.count;
+  push_batch_destroy(batch);
+
+  if (!table_slot_commit(table, slot, rows, min_id, max_id, now)) return 0;
+  return rows;
+}
+
+// Map the next slot the loader process built for table and make it the current one.
+static unsigned table_load_image(Table* table, unsigned now, size_t room) {
+  struct TableSlot* slot = &table->slots[1 - table->current_slot];
+  if (atomic_load(&slot->pins)) {
+    LOG_DEBUG("Standby slot for table %s still pinned, postponing load", table->name);
+    return 0;
+  }
+
+  TableImage image;
+  int fd = loader_load(table->loader, table->table_id, &image);
+  if (fd < 0) {
+    LOG_WARN("Skipping reload for table %s, the loader process could not load it", table->name);
+    return 0;
+  }
+  struct Arena* arena = arena_map_fd(fd, image.size, image.arena_used);
+  close(fd);
+  if (!arena) return 0;
+  if (!table_reload_fits(table, image.rows, room)) {
+    arena_destroy(arena);
+    return 0;
+  }
+
+  table_slot_release(table, slot);
+  slot->arena = arena;
+  slot->imaged = 1;
+  slot->rows = (unsigned*)(arena->buffer + image.row_list);
+  slot->row_count = image.rows;
+  slot->row_cap = image.rows;
+  unsigned bad = 0;
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    if (!image.indexes[idx].cap) continue;
+    slot->indexes[idx] = hash_adopt((Bucket*)(arena->buffer + image.indexes[idx].buckets),
+                                    image.indexes[idx].cap, image.indexes[idx].used,
+                                    arena, (HashKeyKind)image.indexes[idx].kind);
+    if (!slot->indexes[idx]) ++bad;
+  }
+  if (bad) {
+    table_slot_release(table, slot);
+    return 0;
+  }
+  LOG_INFO("Mapped %u rows for table %s at slot %u", image.rows, table->name, 1 - table->current_slot);
+
+  if (!table_slot_commit(table, slot, image.rows, image.min_id, image.max_id, now)) return 0;
+  return image.rows;
+}
+
+// Append len bytes to arena, 8-byte aligned, and return where they went in offset.
+static unsigned table_export_store(struct Arena* arena, const void* data, size_t len, unsigned* offset) {
+  static const uint8_t zeros[8] = {0};
+  unsigned pad = (8 - arena->used % 8) % 8;
+  if (pad && arena_store(arena, zeros, pad) == (unsigned)-1) return 0;
+  *offset = arena->used;
+  if (len && arena_store(arena, data, (unsigned)len) == (unsigned)-1) return 0;
+  return 1;
+}
+
+// Prepare the standby slot for a load of about size rows.
+static struct TableSlot* table_slot_begin(Table* table, unsigned size) {
   unsigned pos = 1 - table->current_slot;
   struct TableSlot* slot = &table->slots[pos];
+  if (atomic_load(&slot->pins)) {
+    // A slow client is still reading a reply out of it; retry on the next pass
+    LOG_DEBUG("Standby slot for table %s still pinned, postponing load", table->name);
+    return NULL;
+  }
+  if (slot->imaged) table_slot_release(table, slot);
+  if (!slot->arena || slot->arena->mapped) {
+    // Released or paged out; loading needs a growable arena again.
+    // Size it after the live slot so it does not grow (and copy) while loading.
+    if (slot->arena) arena_destroy(slot->arena);
+    struct Arena* live = table->slots[table->current_slot].arena;
+    slot->arena = arena_build(next_power_of_two(live ? live->used : 0, ARENA_INITIAL_CAPACITY));
+    if (!slot->arena) {
+      LOG_WARN("Could not allocate arena for table %s", table->name);
+      return NULL;
+    }
+  }
   arena_reset(slot->arena);
+  slot->row_count = 0;
+  table_slot_drop_arrow(slot);
 
-  unsigned size = db_get_table_size(db, table);
   unsigned hash_cap = 2 * next_power_of_two(size, 1);
   LOG_DEBUG("Building hash tables for %s, size %u, capacity %u", table->name, size, hash_cap);
 
   for (unsigned idx = 0; idx < table->index_count; ++idx) {
     if (slot->indexes[idx]) hash_destroy(slot->indexes[idx]);
-    slot->indexes[idx] = hash_build(hash_cap, slot->arena);
+    slot->indexes[idx] = 0;
+    if (slot->geo[idx]) geo_destroy(slot->geo[idx]);
+    slot->geo[idx] = 0;
+    if (slot->trigram[idx]) trigram_destroy(slot->trigram[idx]);
+    slot->trigram[idx] = 0;
+    if (slot->group[idx]) group_destroy(slot->group[idx]);
+    slot->group[idx] = 0;
+    // Filtered, geo, trigram and group indexes are built at commit, sized for the rows they hold
+    if (table->indexes[idx].where_column_len || !index_uses_hash(&table->indexes[idx])) continue;
+    slot->indexes[idx] = hash_build(hash_cap, slot->arena, index_hash_kind(table->indexes[idx].type));
   }
+  return slot;
+}
 
-  unsigned min_id = (unsigned) -1;
-  unsigned max_id = 0;
-  unsigned rows = db_query_into_hash(db, table, slot, &min_id, &max_id);
-  if (rows == (unsigned)-1) {
-    LOG_WARN("Skipping reload for table %s due to invalid schema data", table->name);
+// Finish a load into the standby slot and make it the current one.
+// Return 0, leaving the current slot in place, if the slot cannot be indexed.
+static unsigned table_slot_commit(Table* table, struct TableSlot* slot, unsigned rows,
+                                  unsigned min_id, unsigned max_id, unsigned now) {
+  unsigned pos = 1 - table->current_slot;
+  if (!table_slot_build_filtered(table, slot, &min_id, &max_id)) {
+    LOG_WARN("Skipping reload for table %s, its filtered indexes could not be built", table->name);
     return 0;
   }
-  LOG_INFO("Loaded %u rows for table %s at slot %u", rows, table->name, pos);
+  table_slot_build_geo(table, slot);
+  table_slot_build_trigram(table, slot);
+  table_slot_build_group(table, slot);
 
   // Finalize pointers BEFORE updating current_slot (ensures readers see valid data)
   for (unsigned idx = 0; idx < table->index_count; ++idx) {
-    hash_finalize_pointers(slot->indexes[idx]);
+    if (slot->indexes[idx]) hash_finalize_pointers(slot->indexes[idx]);
   }
+  table_slot_collect_columns(slot);
+  table_slot_build_adhoc(table, slot);
+  table_slot_warm(table, slot);
 
+  // Derived and pushed tables are not reloaded on a period
+  if (table->period_max && !table->derived && !table->push) table_adapt_period(table, slot);
   table->stats.last_loaded = now;
   table->stats.rows = rows;
+  ++table->stats.loads;
   if (table->index_count && table->indexes[0].type == CONFIG_INDEX_TYPE_INT) {
     table->stats.min_id = min_id == (unsigned)-1 ? 0 : min_id;
     table->stats.max_id = max_id;
@@ -154,7 +544,180 @@ unsigned table_load_from_db(Table* table, struct DB* db, unsigned now, unsigned
     table->stats.max_id = 0;
   }
   table->current_slot = pos;
-  return rows;
+  // Under a reload budget the old slot is not kept around for the next load
+  if (table->budgeted) table->release_standby = 1;
+
+  // Ad-hoc indexes requested while loading are now available
+  for (unsigned i = 0; i < MELIAN_MAX_ADHOC_INDEXES; ++i) {
+    TableAdhocIndex* adhoc = &table->adhoc[i];
+    if (atomic_load(&adhoc->state) != TABLE_ADHOC_PENDING || !slot->adhoc[i]) continue;
+    atomic_store(&adhoc->state, TABLE_ADHOC_READY);
+  }
+  return 1;
+}
+
+// Sum of the hashes of every row, so that the same rows in another order
+// hash the same.
+static uint64_t table_slot_content_hash(struct TableSlot* slot) {
+  uint64_t sum = slot->row_count;
+  for (unsigned r = 0; r < slot->row_count; ++r) {
+    const uint8_t* row = 0;
+    unsigned row_len = table_slot_row(slot, r, &row);
+    sum += XXH3_64bits(row, row_len, 0);
+  }
+  return sum;
+}
+
+// Stretch the period after a load that brought nothing new, and shrink it
+// after one that did.
+static void table_adapt_period(Table* table, struct TableSlot* slot) {
+  struct TableRefreshStats* refresh = &table->refresh_stats;
+  uint64_t hash = table_slot_content_hash(slot);
+  unsigned first = !table->stats.loads;
+  unsigned changed = first || hash != refresh->content_hash;
+  refresh->content_hash = hash;
+  if (first) return;
+
+  refresh->history = (refresh->history << 1) | changed;
+  if (refresh->history_len < sizeof(refresh->history) * 8) ++refresh->history_len;
+  unsigned period = table->period;
+  if (changed) {
+    ++refresh->changed;
+    period /= 2;
+    if (period < table->period_min) period = table->period_min;
+  } else {
+    ++refresh->unchanged;
+    period = period > table->period_max / 2 ? table->period_max : period * 2;
+  }
+  if (period != table->period) {
+    LOG_INFO("Table %s %s, reloading every %u seconds instead of %u",
+             table->name, changed ? "changed" : "unchanged", period, table->period);
+    table->period = period;
+  }
+}
+
+// Look up in slot the keys fetches found lately, so that the first queries
+// after the swap do not wait on page faults and cache misses for them.
+static void table_slot_warm(Table* table, struct TableSlot* slot) {
+  if (!table->warm && !table->prefault) return;
+  double t0 = now_sec();
+  if (table->prefault) arena_prefault(slot->arena);
+  unsigned keys = 0;
+  unsigned found = 0;
+  for (unsigned k = 0; table->warm && k < table->warm_keys; ++k) {
+    uint64_t hash = atomic_load_explicit(&table->warm[k].hash, memory_order_relaxed);
+    unsigned index_id = atomic_load_explicit(&table->warm[k].index, memory_order_relaxed);
+    if (!hash || index_id >= table->index_count || !slot->indexes[index_id]) continue;
+    ++keys;
+    if (hash_warm(slot->indexes[index_id], hash)) ++found;
+  }
+  double t1 = now_sec();
+  table->warm_stats.keys = keys;
+  table->warm_stats.found = found;
+  table->warm_stats.elapsed_us = (t1 - t0) * 1000000;
+  LOG_DEBUG("Warmed %u of %u recent keys%s for table %s in %u us", found, keys,
+            table->prefault ? " and prefaulted the slot" : "", table->name, table->warm_stats.elapsed_us);
+}
+
+unsigned table_slot_add_row(Table* table, struct TableSlot* slot, const uint8_t* row, unsigned row_len,
+                            unsigned* min_id, unsigned* max_id) {
+  if (table->computed_count) {
+    row = table_computed_row(table, row, row_len, &row_len);
+    if (!row) {
+      LOG_WARN("Could not add computed columns to row for table %s", table_name(table));
+      return 0;
+    }
+  }
+  if (table->parts) {
+    // Rows of the parts other cluster nodes hold are left to them; rows
+    // without a key stay with the first part
+    RowKey key;
+    unsigned part = table_row_key(table, row, row_len, &key) ? table_key_part(key.key, key.len, table->parts) : 0;
+    if (part != table->part) return 1;
+  }
+  unsigned frame = arena_store_framed(slot->arena, row, row_len);
+  if (frame == (unsigned)-1) {
+    LOG_WARN("Could not store framed row for SELECT query for table %s", table_name(table));
+    return 0;
+  }
+
+  if (slot->row_count >= slot->row_cap) {
+    unsigned cap = slot->row_cap ? 2 * slot->row_cap : ROWS_INITIAL_CAPACITY;
+    unsigned* rows = realloc(slot->rows, cap * sizeof(unsigned));
+    if (!rows) {
+      LOG_WARN("Could not grow row list to %u entries for table %s", cap, table_name(table));
+      return 0;
+    }
+    slot->rows = rows;
+    slot->row_cap = cap;
+  }
+  slot->rows[slot->row_count++] = frame;
+
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    Hash* hash = slot->indexes[idx];
+    if (!hash) continue;
+    if (!table_index_row(table, idx, hash, frame, row, row_len, min_id, max_id)) return 0;
+  }
+  return 1;
+}
+
+// Insert the row stored at frame into hash, the index idx of table.
+// Rows without a usable key are skipped; return 0 only if the insert fails.
+static unsigned table_index_row(Table* table, unsigned idx, Hash* hash, unsigned frame,
+                                const uint8_t* row, unsigned row_len,
+                                unsigned* min_id, unsigned* max_id) {
+  const TableIndex* index = &table->indexes[idx];
+  RowField field;
+  char value[MAX_JSON_KEY_LEN];
+  if (!index_field(index, row, row_len, &field, value, sizeof(value))) return 1;
+  if (index->type == CONFIG_INDEX_TYPE_INT) {
+    unsigned key_int = 0;
+    if (!row_field_uint(&field, &key_int)) return 1;
+    if (!hash_insert(hash, &key_int, sizeof(unsigned), frame, row_len + sizeof(unsigned))) {
+      LOG_WARN("Could not insert row for table %s key %u index %u",
+               table_name(table), key_int, idx);
+      return 0;
+    }
+    if (idx == 0) {
+      if (*min_id > key_int) *min_id = key_int;
+      if (*max_id < key_int) *max_id = key_int;
+    }
+  } else {
+    char text[MAX_KEY_TEXT_LEN];
+    const uint8_t* key = 0;
+    unsigned key_len = 0;
+    if (!row_field_bytes(&field, text, sizeof(text), &key, &key_len)) return 1;
+    unsigned inserted = 0;
+    if (key >= row && key + key_len <= row + row_len) {
+      // Raw text in the row: point the index at the copy in the frame
+      unsigned key_index = frame + sizeof(unsigned) + (unsigned)(key - row);
+      inserted = hash_insert_ref(hash, key, key_len, key_index, frame, row_len + sizeof(unsigned));
+    } else {
+      inserted = hash_insert(hash, key, key_len, frame, row_len + sizeof(unsigned));
+    }
+    if (!inserted) {
+      LOG_WARN("Could not insert row for table %s key %.*s index %u",
+               table_name(table), key_len, key, idx);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Whether a row passes the filter of index; rows where the column is
+// missing or NULL only pass a != filter.
+static unsigned index_where_matches(const TableIndex* index, const uint8_t* row, unsigned row_len) {
+  RowField field;
+  unsigned equal = 0;
+  if (row_find_field(row, row_len, index->where_column, index->where_column_len, &field) &&
+      field.type != MELIAN_VALUE_NULL) {
+    char text[MAX_KEY_TEXT_LEN];
+    const uint8_t* bytes = 0;
+    unsigned len = 0;
+    if (!row_field_bytes(&field, text, sizeof(text), &bytes, &len)) len = 0;
+    equal = len == index->where_value_len && memcmp(bytes, index->where_value, len) == 0;
+  }
+  return index->where_negate ? !equal : equal;
 }
 
 const Bucket* table_fetch(Table* table, unsigned index_id, const void *key, unsigned len) {
@@ -166,12 +729,254 @@ const Bucket* table_fetch(Table* table, unsigned index_id, const void *key, unsi
   struct TableSlot* slot = &table->slots[current_slot];
   Hash* hash = slot->indexes[index_id];
   if (!hash) {
-    LOG_FATAL("Unexpected null hash for table %s index %u current %u",
-              table->name, index_id, current_slot);
+    // Not loaded yet, or a geo, trigram or group index
+    LOG_DEBUG("No hash for table %s index %u current %u", table->name, index_id, current_slot);
+    return NULL;
   }
+  if (table->indexes[index_id].normalize && !table_normalize_key(table, index_id, &key, &len)) return NULL;
   return hash_get(hash, key, len);
 }
 
+const Bucket* table_fetch_adhoc(Table* table, const char* column, unsigned column_len,
+                                const void *key, unsigned len, unsigned now,
+                                unsigned* lookup) {
+  *lookup = TABLE_ADHOC_LOOKUP_DONE;
+  if (!table->adhoc_idle) return NULL;
+  if (!column_len || column_len >= MELIAN_MAX_NAME_LEN) return NULL;
+
+  TableAdhocIndex* unused = 0;
+  for (unsigned i = 0; i < MELIAN_MAX_ADHOC_INDEXES; ++i) {
+    TableAdhocIndex* adhoc = &table->adhoc[i];
+    unsigned state = atomic_load(&adhoc->state);
+    if (state == TABLE_ADHOC_FREE) {
+      if (!unused) unused = adhoc;
+      continue;
+    }
+    if (adhoc->column_len != column_len || memcmp(adhoc->column, column, column_len) != 0) continue;
+    atomic_store(&adhoc->last_used, now);
+    if (state != TABLE_ADHOC_READY) {
+      *lookup = TABLE_ADHOC_LOOKUP_BUILDING;
+      return NULL;
+    }
+    struct TableSlot* slot = &table->slots[table->current_slot];
+    Hash* hash = slot->adhoc[i];
+    if (!hash) return NULL;
+    if (adhoc->int_keys) {
+      unsigned key_int = 0;
+      if (!parse_key_text(key, len, &key_int)) return NULL;
+      return hash_get(hash, &key_int, sizeof(unsigned));
+    }
+    return hash_get(hash, key, len);
+  }
+
+  // Only columns the rows have may take one of the few entries
+  if (!table->stats.last_loaded) {
+    *lookup = TABLE_ADHOC_LOOKUP_BUILDING;
+    return NULL;
+  }
+  if (!table_slot_has_column(&table->slots[table->current_slot], column, column_len)) return NULL;
+  if (!unused) {
+    LOG_WARN("No room for an ad-hoc index on %s.%.*s, all %u entries in use",
+             table->name, column_len, column, MELIAN_MAX_ADHOC_INDEXES);
+    *lookup = TABLE_ADHOC_LOOKUP_FULL;
+    return NULL;
+  }
+  memcpy(unused->column, column, column_len);
+  unused->column[column_len] = '\0';
+  unused->column_len = column_len;
+  unused->int_keys = 0;
+  unused->builds = 0;
+  atomic_store(&unused->last_used, now);
+  atomic_store(&unused->state, TABLE_ADHOC_PENDING);
+  LOG_INFO("Requested ad-hoc index on %s.%s", table->name, unused->column);
+  *lookup = TABLE_ADHOC_LOOKUP_REQUESTED;
+  return NULL;
+}
+
+unsigned table_build_adhoc_indexes(Table* table, unsigned now) {
+  unsigned built = 0;
+  if (!table->adhoc_idle) return 0;
+  unsigned pos = table->current_slot;
+  struct TableSlot* slot = &table->slots[pos];
+  struct TableSlot* standby = &table->slots[1 - pos];
+  for (unsigned i = 0; i < MELIAN_MAX_ADHOC_INDEXES; ++i) {
+    TableAdhocIndex* adhoc = &table->adhoc[i];
+    unsigned state = atomic_load(&adhoc->state);
+    if (state == TABLE_ADHOC_READY) {
+      unsigned idle = now - atomic_load(&adhoc->last_used);
+      if (idle <= table->adhoc_idle) continue;
+      // Readers may still hold the live hash; it is released when the entry is reused
+      atomic_store(&adhoc->state, TABLE_ADHOC_FREE);
+      if (standby->adhoc[i]) {
+        hash_destroy(standby->adhoc[i]);
+        standby->adhoc[i] = 0;
+      }
+      LOG_INFO("Dropped ad-hoc index on %s.%s after %u idle seconds", table->name, adhoc->column, idle);
+      continue;
+    }
+    if (state != TABLE_ADHOC_PENDING) continue;
+    if (!table->stats.last_loaded) continue;
+
+    // Whatever these hold was built for a previous user of the entry
+    for (unsigned b = 0; b < 2; ++b) {
+      if (!table->slots[b].adhoc[i]) continue;
+      hash_destroy(table->slots[b].adhoc[i]);
+      table->slots[b].adhoc[i] = 0;
+    }
+    double t0 = now_sec();
+    slot->adhoc[i] = table_slot_index_column(table, slot, adhoc);
+    if (!slot->adhoc[i]) {
+      // Free the entry, so the next request for the column tries again
+      atomic_store(&adhoc->state, TABLE_ADHOC_FREE);
+      continue;
+    }
+    atomic_store(&adhoc->state, TABLE_ADHOC_READY);
+    double t1 = now_sec();
+    unsigned long elapsed = (t1 - t0) * 1000000;
+    LOG_INFO("Built ad-hoc %s index on %s.%s with %u keys in %lu us",
+             adhoc->int_keys ? "int" : "string", table->name, adhoc->column,
+             slot->adhoc[i]->used, elapsed);
+    ++built;
+  }
+  return built;
+}
+
+const Arrow* table_arrow(Table* table, unsigned* lookup) {
+  *lookup = TABLE_ADHOC_LOOKUP_DONE;
+  struct TableSlot* slot = &table->slots[table->current_slot];
+  const Arrow* arrow = atomic_load(&slot->arrow);
+  if (arrow || atomic_load(&slot->arrow_failed)) return arrow;
+  *lookup = atomic_exchange(&table->export_wanted, 1) ? TABLE_ADHOC_LOOKUP_BUILDING : TABLE_ADHOC_LOOKUP_REQUESTED;
+  return NULL;
+}
+
+unsigned table_build_arrow(Table* table) {
+  if (!atomic_load(&table->export_wanted) || !table->stats.last_loaded) return 0;
+  struct TableSlot* slot = &table->slots[table->current_slot];
+  atomic_store(&table->export_wanted, 0);
+  if (atomic_load(&slot->arrow) || atomic_load(&slot->arrow_failed)) return 0;
+  double t0 = now_sec();
+  Arrow* arrow = arrow_build(slot->row_count, table_slot_row_at, slot);
+  if (!arrow) {
+    LOG_WARN("Could not build Arrow export of table %s", table->name);
+    atomic_store(&slot->arrow_failed, 1);
+    return 0;
+  }
+  atomic_store(&slot->arrow, arrow);
+  double t1 = now_sec();
+  unsigned long elapsed = (t1 - t0) * 1000000;
+  LOG_INFO("Built Arrow export of table %s with %u rows, %u columns, %u batches, %zu bytes in %lu us",
+           table->name, arrow->rows, arrow->columns, arrow->batches, arrow->frame_len, elapsed);
+  return 1;
+}
+
+unsigned table_normalize_key(Table* table, unsigned index_id, const void** key, unsigned* len) {
+  ExprValue value;
+  const Expr* expr = table->indexes[index_id].normalize;
+  if (!expr_eval_key(expr, *key, *len, table->key_scratch, &value)) return 0;
+  if (!expr_value_text(&value, table->key_scratch)) return 0;
+  *key = value.text;
+  *len = value.len;
+  return 1;
+}
+
+unsigned table_key_part(const void* key, unsigned len, unsigned parts) {
+  return (unsigned)(XXH3_64bits(key, len, 0) % parts);
+}
+
+const struct TableSlot* table_nearest(Table* table, unsigned index_id, double lat, double lon,
+                                      unsigned k, double radius_km, GeoHit* hits,
+                                      unsigned* count) {
+  *count = 0;
+  if (index_id >= table->index_count || table->indexes[index_id].type != CONFIG_INDEX_TYPE_GEO) return NULL;
+  struct TableSlot* slot = &table->slots[table->current_slot];
+  if (!slot->geo[index_id]) return NULL;
+  *count = geo_nearest(slot->geo[index_id], lat, lon, k, radius_km, hits);
+  return slot;
+}
+
+// The live slot, pinned so that it outlives a search on another thread;
+// 0 if index_id is not a loaded trigram index. Called by the server thread.
+struct TableSlot* table_pin_trigram(Table* table, unsigned index_id) {
+  if (index_id >= table->index_count || table->indexes[index_id].type != CONFIG_INDEX_TYPE_TRIGRAM) return NULL;
+  struct TableSlot* slot = &table->slots[table->current_slot];
+  if (!slot->trigram[index_id]) return NULL;
+  atomic_fetch_add(&slot->pins, 1);
+  return slot;
+}
+
+unsigned table_group(Table* table, unsigned index_id, const void* key, unsigned len,
+                     unsigned offset, unsigned limit, const uint8_t** data, size_t* bytes,
+                     unsigned* count, unsigned* total) {
+  *count = 0;
+  *total = 0;
+  if (index_id >= table->index_count || table->indexes[index_id].type != CONFIG_INDEX_TYPE_GROUP) return 0;
+  struct TableSlot* slot = &table->slots[table->current_slot];
+  if (!slot->group[index_id]) return 0;
+  if (table->indexes[index_id].normalize && !table_normalize_key(table, index_id, &key, &len)) return 0;
+  return group_slice(slot->group[index_id], key, len, offset, limit, data, bytes, count, total);
+}
+
+const Bucket* table_fetch_cold(Table* table, Hash* hash, const void *key, unsigned len,
+                               unsigned* first) {
+  *first = atomic_fetch_add(&table->cold_hits, 1) == 0;
+  if (!*first) return hash_get(hash, key, len);
+
+  double t0 = now_sec();
+  const Bucket* bucket = hash_get(hash, key, len);
+  if (bucket) {
+    // Fault the whole frame in, as sending it would
+    volatile uint8_t sink = 0;
+    for (unsigned off = 0; off < bucket->frame_len; off += 4096) sink ^= bucket->frame_ptr[off];
+    sink ^= bucket->frame_ptr[bucket->frame_len - 1];
+  }
+  double t1 = now_sec();
+  table->tier_stats.first_access_us = (t1 - t0) * 1000000;
+  return bucket;
+}
+
+struct TableSlot* table_slot_of(Table* table, const uint8_t* ptr) {
+  for (unsigned b = 0; b < 2; ++b) {
+    struct Arena* arena = table->slots[b].arena;
+    if (arena && ptr >= arena->buffer && ptr < arena->buffer + arena->capacity) return &table->slots[b];
+    // Group replies are written out of the index's own copy of the rows
+    for (unsigned idx = 0; idx < table->index_count; ++idx) {
+      if (group_holds(table->slots[b].group[idx], ptr)) return &table->slots[b];
+    }
+    if (arrow_holds(atomic_load(&table->slots[b].arrow), ptr)) return &table->slots[b];
+  }
+  return NULL;
+}
+
+size_t table_memory_bytes(Table* table) {
+  return table_slot_bytes(table, &table->slots[0], 1) + table_slot_bytes(table, &table->slots[1], 1);
+}
+
+unsigned table_update_tier(Table* table, unsigned now) {
+  unsigned accesses = atomic_load(&table->accesses);
+  if (accesses != table->seen_accesses || !table->last_active) {
+    table->seen_accesses = accesses;
+    table->last_active = now;
+  }
+  struct TableSlot* standby = &table->slots[1 - table->current_slot];
+  if (table->release_standby && !atomic_load(&standby->pins)) {
+    // Readers have had a full loader period to move off the old slot
+    table_slot_release(table, standby);
+    table->release_standby = 0;
+  }
+
+  if (atomic_load(&table->tier) == TABLE_TIER_COLD) {
+    if (!atomic_load(&table->cold_hits)) return 0;
+    table_promote(table, now);
+    return 1;
+  }
+  // Pushed rows exist nowhere else to be reloaded from
+  if (table->push) return 0;
+  if (!table->tier_idle || !table->stats.last_loaded || !table->stats.rows) return 0;
+  if (now - table->last_active <= table->tier_idle) return 0;
+  return table_demote(table, now);
+}
+
 Data* data_build(Config* config) {
   Data* data = 0;
   unsigned bad = 0;
@@ -193,9 +998,41 @@ Data* data_build(Config* config) {
         ++bad;
         break;
       }
+      table->adhoc_idle = config->table.adhoc_idle;
+      table->tier_idle = config->table.tier_idle;
+      table->tier_dir = config->table.tier_dir;
+      table->budgeted = config->table.reload_budget > 0;
+      table->prefault = config->table.prefault;
+      int self = config->cluster.self;
+      if (self >= 0 && spec->placement_count) {
+        table->remote = 1;
+        for (unsigned p = 0; p < spec->placement_count; ++p) {
+          if (spec->placement[p] != self) continue;
+          table->remote = 0;
+          table->part = p;
+        }
+        table->parts = spec->placement_count > 1 ? spec->placement_count : 0;
+      }
       data->tables[data->table_count++] = table;
-      LOG_INFO("Configured table id=%u name=%s period=%u indexes=%u",
-               table->table_id, table->name, table->period, table->index_count);
+      if (config->table.warm_keys && !table->remote) {
+        unsigned keys = config->table.warm_keys;
+        if (keys > TABLE_WARM_MAX_KEYS) keys = TABLE_WARM_MAX_KEYS;
+        // Rounded down, so that a mask picks the entry
+        table->warm_keys = next_power_of_two(keys / 2 + 1, 1);
+        table->warm = calloc(table->warm_keys, sizeof(TableWarmKey));
+        if (!table->warm) {
+          LOG_WARN("Could not allocate %u warm keys for table %s", table->warm_keys, table->name);
+          ++bad;
+          break;
+        }
+      }
+      if (table->period_max) {
+        LOG_INFO("Configured table id=%u name=%s period=%u-%u indexes=%u",
+                 table->table_id, table->name, table->period_min, table->period_max, table->index_count);
+      } else {
+        LOG_INFO("Configured table id=%u name=%s period=%u indexes=%u",
+                 table->table_id, table->name, table->period, table->index_count);
+      }
       if (spec->id < ALEN(data->lookup)) {
         data->lookup[spec->id] = table;
       } else {
@@ -205,6 +1042,24 @@ Data* data_build(Config* config) {
     if (bad) {
       break;
     }
+
+    // Derived tables are resolved once every table exists
+    for (unsigned t = 0; t < config->table.table_count; ++t) {
+      const ConfigTableSpec* spec = &config->table.tables[t];
+      if (!spec->derived[0]) continue;
+      Table* table = data->tables[t];
+      table->derived = derived_build(spec->derived, data, table);
+      if (!table->derived) {
+        LOG_WARN("Invalid derived table definition [%s] for table %s", spec->derived, spec->name);
+        ++bad;
+        break;
+      }
+      LOG_INFO("Table %s is derived: %s", table->name, spec->derived);
+    }
+    if (bad) {
+      break;
+    }
+    data->reload_budget = (size_t)config->table.reload_budget << 20;
     data_refresh_schema(data);
   } while (0);
   if (bad) {
@@ -222,6 +1077,15 @@ void data_destroy(Data* data) {
   free(data);
 }
 
+void data_use_loader(Data* data, struct Loader* loader) {
+  data->loader = loader;
+  for (unsigned t = 0; t < data->table_count; ++t) {
+    Table* table = data->tables[t];
+    if (!table || table->derived || table->push) continue;
+    table->loader = loader;
+  }
+}
+
 unsigned data_load_all_tables_from_db(Data* data, struct DB* db) {
   unsigned rows = 0;
   unsigned now = time(0);
@@ -230,27 +1094,81 @@ unsigned data_load_all_tables_from_db(Data* data, struct DB* db) {
     for (unsigned t = 0; t < data->table_count; ++t) {
       Table* table = data->tables[t];
       if (!table) continue;
-      tables += table_load_from_db(table, db, now, 0);
+      tables += table_load_from_db(table, db, now, 0, (size_t)-1);
     }
     if (!tables) {
       LOG_DEBUG("No tables to refresh");
       break;
     }
 
+    // Under a reload budget, smaller tables go first so that one large
+    // table that does not fit yet does not hold back all the others
+    Table* order[MELIAN_MAX_TABLES];
+    unsigned count = 0;
+    for (unsigned t = 0; t < data->table_count; ++t) {
+      if (data->tables[t]) order[count++] = data->tables[t];
+    }
+    if (data->reload_budget) qsort(order, count, sizeof(Table*), table_cmp_memory);
+
     LOG_DEBUG("Refreshing %u tables", tables);
     rows = 0;
-    db_connect(db);
-    for (unsigned t = 0; t < data->table_count; ++t) {
-      Table* table = data->tables[t];
-      if (!table) continue;
-      rows += table_load_from_db(table, db, now, 1);
+    // The loader process has its own connection
+    if (!data->loader) db_connect(db);
+    for (unsigned t = 0; t < count; ++t) {
+      rows += table_load_from_db(order[t], db, now, 1, data_reload_room(data));
     }
-    db_disconnect(db);
+    if (!data->loader) db_disconnect(db);
   } while (0);
 
+  // Pushed batches do not depend on the database being reachable
+  for (unsigned t = 0; t < data->table_count; ++t) {
+    Table* table = data->tables[t];
+    if (!table || !table->push) continue;
+    rows += table_load_pushed(table, now, data_reload_room(data));
+  }
+
+  // Derived tables follow their sources, in configuration order
+  for (unsigned t = 0; t < data->table_count; ++t) {
+    Table* table = data->tables[t];
+    if (!table || !table->derived) continue;
+    rows += table_load_derived(table, now, data_reload_room(data));
+  }
+
   return rows;
 }
 
+unsigned data_build_adhoc_indexes(Data* data) {
+  unsigned built = 0;
+  unsigned now = time(0);
+  for (unsigned t = 0; t < data->table_count; ++t) {
+    Table* table = data->tables[t];
+    if (!table) continue;
+    built += table_build_adhoc_indexes(table, now);
+  }
+  return built;
+}
+
+unsigned data_build_arrows(Data* data) {
+  unsigned built = 0;
+  for (unsigned t = 0; t < data->table_count; ++t) {
+    Table* table = data->tables[t];
+    if (!table) continue;
+    built += table_build_arrow(table);
+  }
+  return built;
+}
+
+unsigned data_update_tiers(Data* data) {
+  unsigned changed = 0;
+  unsigned now = time(0);
+  for (unsigned t = 0; t < data->table_count; ++t) {
+    Table* table = data->tables[t];
+    if (!table) continue;
+    changed += table_update_tier(table, now);
+  }
+  return changed;
+}
+
 const Bucket* data_fetch(Data* data, unsigned table_id, unsigned index_id, const void *key, unsigned len) {
   if (table_id >= ALEN(data->lookup)) return NULL;
   Table* table = data->lookup[table_id];
@@ -276,6 +1194,23 @@ static json_t* schema_table_json(Table* table) {
                                 "id", index->id,
                                 "column", index->column,
                                 "type", index_type_name(index->type));
+    if (idx_obj && index->where_column_len) {
+      char where[2 * MELIAN_MAX_NAME_LEN + 2];
+      snprintf(where, sizeof(where), "%s%s=%s", index->where_column,
+               index->where_negate ? "!" : "", index->where_value);
+      if (json_object_set_new(idx_obj, "where", json_string(where)) < 0) {
+        json_decref(idx_obj);
+        idx_obj = NULL;
+      }
+    }
+    if (idx_obj && index->order_len) {
+      char order[MELIAN_MAX_NAME_LEN + 1];
+      snprintf(order, sizeof(order), "%s%s", index->order_descending ? "-" : "", index->order);
+      if (json_object_set_new(idx_obj, "order", json_string(order)) < 0) {
+        json_decref(idx_obj);
+        idx_obj = NULL;
+      }
+    }
     if (!idx_obj || json_array_append_new(indexes, idx_obj) < 0) {
       if (idx_obj) json_decref(idx_obj);
       json_decref(indexes);
@@ -289,6 +1224,21 @@ static json_t* schema_table_json(Table* table) {
                                 "indexes", indexes);
   if (!table_obj) {
     json_decref(indexes);
+    return NULL;
+  }
+  if (table->computed_count) {
+    json_t* computed = json_object();
+    for (unsigned c = 0; computed && c < table->computed_count; ++c) {
+      if (json_object_set_new(computed, table->computed[c].name,
+                              json_string(table->computed[c].expr->source)) < 0) {
+        json_decref(computed);
+        computed = NULL;
+      }
+    }
+    if (!computed || json_object_set_new(table_obj, "computed", computed) < 0) {
+      json_decref(table_obj);
+      return NULL;
+    }
   }
   return table_obj;
 }
@@ -357,8 +1307,747 @@ static const char* index_type_name(ConfigIndexType type) {
   switch (type) {
     case CONFIG_INDEX_TYPE_STRING:
       return "string";
+    case CONFIG_INDEX_TYPE_GEO:
+      return "geo";
+    case CONFIG_INDEX_TYPE_TRIGRAM:
+      return "trigram";
+    case CONFIG_INDEX_TYPE_GROUP:
+      return "group";
     case CONFIG_INDEX_TYPE_INT:
     default:
       return "int";
   }
 }
+
+static HashKeyKind index_hash_kind(ConfigIndexType type) {
+  switch (type) {
+    case CONFIG_INDEX_TYPE_STRING:
+      return HASH_KEY_BYTES;
+    case CONFIG_INDEX_TYPE_INT:
+    default:
+      return HASH_KEY_INT;
+  }
+}
+
+// Geo, trigram and group indexes answer their own actions, not FETCH.
+static unsigned index_uses_hash(const TableIndex* index) {
+  return index->type != CONFIG_INDEX_TYPE_GEO && index->type != CONFIG_INDEX_TYPE_TRIGRAM &&
+         index->type != CONFIG_INDEX_TYPE_GROUP;
+}
+
+// Find the value a configured index keys on: a column, or a JSON path inside one.
+// Values taken from JSON are presented as fields of the matching type;
+// escaped strings are decoded into text (of size bytes).
+// Return 0 if there is no usable (non-NULL) value.
+static unsigned index_field(const TableIndex* index, const uint8_t* row, unsigned row_len,
+                            RowField* field, char* text, unsigned size) {
+  static const uint8_t json_false = 0;
+  static const uint8_t json_true = 1;
+
+  if (!row_find_field(row, row_len, index->column, index->column_len, field)) return 0;
+  if (field->type == MELIAN_VALUE_NULL) return 0;
+  if (!index->path) return 1;
+  if (field->type != MELIAN_VALUE_BYTES) return 0;
+
+  JsonPathValue value;
+  if (!jsonpath_extract((const char*)field->value, field->value_len,
+                        index->path, index->path_len, &value)) return 0;
+  switch (value.type) {
+    case JSONPATH_STRING:
+      field->type = MELIAN_VALUE_BYTES;
+      if (value.escaped) {
+        unsigned len = 0;
+        if (!jsonpath_unescape(&value, text, size, &len)) return 0;
+        field->value = (const uint8_t*)text;
+        field->value_len = len;
+      } else {
+        field->value = (const uint8_t*)value.ptr;
+        field->value_len = value.len;
+      }
+      break;
+    case JSONPATH_NUMBER:
+      field->type = MELIAN_VALUE_DECIMAL;
+      field->value = (const uint8_t*)value.ptr;
+      field->value_len = value.len;
+      break;
+    case JSONPATH_TRUE:
+    case JSONPATH_FALSE:
+      field->type = MELIAN_VALUE_BOOL;
+      field->value = value.type == JSONPATH_TRUE ? &json_true : &json_false;
+      field->value_len = 1;
+      break;
+    default:
+      // null, objects and arrays are not indexed
+      return 0;
+  }
+  return 1;
+}
+
+// Return the length of row r in slot, and point row at its payload.
+unsigned table_slot_row(struct TableSlot* slot, unsigned r, const uint8_t** row) {
+  const uint8_t* frame = arena_get_ptr(slot->arena, slot->rows[r]);
+  *row = frame + sizeof(unsigned);
+  return ((unsigned)frame[0] << 24) | ((unsigned)frame[1] << 16) |
+         ((unsigned)frame[2] << 8) | (unsigned)frame[3];
+}
+
+static unsigned table_slot_row_at(void* ctx, unsigned r, const uint8_t** row) {
+  return table_slot_row(ctx, r, row);
+}
+
+// Readers are off the slot by the time it is released or reloaded.
+static void table_slot_drop_arrow(struct TableSlot* slot) {
+  arrow_destroy(atomic_exchange(&slot->arrow, NULL));
+  atomic_store(&slot->arrow_failed, 0);
+}
+
+// Parse the name=expression list of computed columns, and find the indexes on them
+// whose incoming keys need the same treatment.
+static unsigned table_build_computed(Table* table, const char* list) {
+  const char* pos = list;
+  char name[MELIAN_MAX_NAME_LEN];
+  char source[EXPR_MAX_POOL];
+  while (expr_next_definition(&pos, name, sizeof(name), source, sizeof(source))) {
+    if (table->computed_count >= MELIAN_MAX_COMPUTED) {
+      LOG_WARN("Table %s has more than %u computed columns", table->name, MELIAN_MAX_COMPUTED);
+      return 0;
+    }
+    Expr* expr = expr_build(source, strlen(source));
+    if (!expr) return 0;
+    TableComputed* computed = &table->computed[table->computed_count++];
+    memcpy(computed->name, name, strlen(name) + 1);
+    computed->expr = expr;
+  }
+  if (!pos) {
+    LOG_WARN("Invalid computed columns [%s] for table %s", list, table->name);
+    return 0;
+  }
+
+  table->load_scratch = malloc(sizeof(ExprScratch));
+  table->key_scratch = malloc(sizeof(ExprScratch));
+  if (!table->load_scratch || !table->key_scratch) {
+    LOG_WARN("Could not allocate expression buffers for table %s", table->name);
+    return 0;
+  }
+
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    TableIndex* index = &table->indexes[idx];
+    if (index->path || index->type != CONFIG_INDEX_TYPE_STRING) continue;
+    for (unsigned c = 0; c < table->computed_count; ++c) {
+      TableComputed* computed = &table->computed[c];
+      if (strlen(computed->name) != index->column_len ||
+          memcmp(computed->name, index->column, index->column_len) != 0) continue;
+      // Keys can only stand in for the source column if there is just one
+      unsigned column_len = 0;
+      if (expr_column(computed->expr, &column_len)) index->normalize = computed->expr;
+      break;
+    }
+    if (index->normalize) {
+      LOG_INFO("Keys for index %s.%s are normalized with %s",
+               table->name, index->column, index->normalize->source);
+    }
+  }
+  return 1;
+}
+
+// Copy row with the computed columns appended; loaded fields sharing a name
+// with one are replaced. Expressions always see the row as loaded.
+static const uint8_t* table_computed_row(Table* table, const uint8_t* row, unsigned row_len, unsigned* len) {
+  RowBuilder* builder = &table->computed_row;
+  if (!row_builder_reset(builder)) return NULL;
+
+  unsigned pos = 0;
+  RowField field;
+  while (row_next_field(row, row_len, &pos, &field)) {
+    unsigned replaced = 0;
+    for (unsigned c = 0; c < table->computed_count && !replaced; ++c) {
+      const char* name = table->computed[c].name;
+      replaced = strlen(name) == field.name_len && memcmp(name, field.name, field.name_len) == 0;
+    }
+    if (replaced) continue;
+    if (!row_builder_add(builder, field.name, field.name_len, field.type, field.value, field.value_len)) return NULL;
+  }
+
+  for (unsigned c = 0; c < table->computed_count; ++c) {
+    TableComputed* computed = &table->computed[c];
+    ExprValue value;
+    // A result too large for the scratch buffer is stored as NULL
+    if (!expr_eval(computed->expr, row, row_len, table->load_scratch, &value)) value.type = EXPR_NULL;
+    unsigned ok = 0;
+    switch (value.type) {
+      case EXPR_INT:
+        ok = row_builder_add_int(builder, computed->name, value.integer);
+        break;
+      case EXPR_FLOAT:
+        ok = row_builder_add_float(builder, computed->name, value.number);
+        break;
+      case EXPR_TEXT:
+        ok = row_builder_add(builder, (const uint8_t*)computed->name, strlen(computed->name),
+                             MELIAN_VALUE_BYTES, value.text, value.len);
+        break;
+      default:
+        ok = row_builder_add(builder, (const uint8_t*)computed->name, strlen(computed->name),
+                             MELIAN_VALUE_NULL, NULL, 0);
+        break;
+    }
+    if (!ok) return NULL;
+  }
+  return row_builder_finish(builder, len);
+}
+
+// Bytes held by slot: arena, row list and index buckets.
+// Unless resident is 0, a snapshot mapping does not count, as the kernel can drop it;
+// an image mapping is shared memory, which it cannot, and holds rows and buckets too.
+static size_t table_slot_bytes(Table* table, struct TableSlot* slot, unsigned resident) {
+  size_t bytes = 0;
+  if (slot->arena && !(resident && slot->arena->mapped && !slot->imaged)) bytes += slot->arena->capacity;
+  if (!slot->imaged) {
+    bytes += (size_t)slot->row_cap * sizeof(unsigned);
+    for (unsigned idx = 0; idx < table->index_count; ++idx) {
+      if (slot->indexes && slot->indexes[idx]) bytes += (size_t)slot->indexes[idx]->cap * sizeof(Bucket);
+    }
+  }
+  for (unsigned i = 0; i < MELIAN_MAX_ADHOC_INDEXES; ++i) {
+    if (slot->adhoc[i]) bytes += (size_t)slot->adhoc[i]->cap * sizeof(Bucket);
+  }
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    if (slot->geo[idx]) bytes += (size_t)slot->geo[idx]->count * sizeof(GeoPoint);
+    bytes += trigram_bytes(slot->trigram[idx]);
+    bytes += group_bytes(slot->group[idx]);
+  }
+  Arrow* arrow = atomic_load(&slot->arrow);
+  if (arrow) bytes += arrow->frame_len;
+  return bytes;
+}
+
+// Whether a reload of about rows rows fits in room more bytes. The new slot
+// is estimated from the live one, scaled by row count; what the standby slot
+// already holds is reused. The first load of a table always goes ahead.
+static unsigned table_reload_fits(Table* table, unsigned rows, size_t room) {
+  if (room == (size_t)-1 || !table->stats.loads) return 1;
+
+  struct TableSlot* live = &table->slots[table->current_slot];
+  struct TableSlot* standby = &table->slots[1 - table->current_slot];
+  size_t need = table_slot_bytes(table, live, 0);
+  if (table->stats.rows) need = need / table->stats.rows * rows;
+  size_t have = table_slot_bytes(table, standby, 1);
+  need = need > have ? need - have : 0;
+  if (need <= room) {
+    if (table->deferring) LOG_INFO("Reload of table %s fits the reload budget again", table->name);
+    table->deferring = 0;
+    return 1;
+  }
+
+  ++table->stats.deferrals;
+  if (!table->deferring) {
+    LOG_WARN("Deferring reload of table %s: needs about %zu bytes, %zu left in the reload budget",
+             table->name, need, room);
+  }
+  table->deferring = 1;
+  return 0;
+}
+
+// Bytes a reload may still allocate; (size_t)-1 if there is no budget.
+static size_t data_reload_room(Data* data) {
+  if (!data->reload_budget) return (size_t)-1;
+  size_t used = 0;
+  for (unsigned t = 0; t < data->table_count; ++t) {
+    if (data->tables[t]) used += table_memory_bytes(data->tables[t]);
+  }
+  return used < data->reload_budget ? data->reload_budget - used : 0;
+}
+
+static int table_cmp_memory(const void* a, const void* b) {
+  size_t ma = table_memory_bytes(*(Table* const*)a);
+  size_t mb = table_memory_bytes(*(Table* const*)b);
+  return ma < mb ? -1 : ma > mb;
+}
+
+// Build the filtered indexes of slot once all its rows are in, counting the
+// matching rows first so that each index is sized for them alone.
+// Return 0 if any of them cannot be built in full, as a failed load.
+static unsigned table_slot_build_filtered(Table* table, struct TableSlot* slot,
+                                          unsigned* min_id, unsigned* max_id) {
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    const TableIndex* index = &table->indexes[idx];
+    if (!index->where_column_len || !index_uses_hash(index)) continue;
+    if (slot->indexes[idx]) continue;  // built by the loader process
+
+    unsigned count = 0;
+    for (unsigned r = 0; r < slot->row_count; ++r) {
+      const uint8_t* row = 0;
+      unsigned row_len = table_slot_row(slot, r, &row);
+      count += index_where_matches(index, row, row_len);
+    }
+    Hash* hash = hash_build(2 * next_power_of_two(count, 1), slot->arena, index_hash_kind(index->type));
+    if (!hash) {
+      LOG_WARN("Could not allocate filtered index %s for table %s", index->column, table->name);
+      return 0;
+    }
+    for (unsigned r = 0; r < slot->row_count; ++r) {
+      const uint8_t* row = 0;
+      unsigned row_len = table_slot_row(slot, r, &row);
+      if (!index_where_matches(index, row, row_len)) continue;
+      if (!table_index_row(table, idx, hash, slot->rows[r], row, row_len, min_id, max_id)) {
+        hash_destroy(hash);
+        return 0;
+      }
+    }
+    slot->indexes[idx] = hash;
+    LOG_DEBUG("Indexed %u of %u rows of table %s on %s", count, slot->row_count, table->name, index->column);
+  }
+  return 1;
+}
+
+// Build the geo indexes of slot once all its rows are in.
+// Rows without a valid latitude and longitude are left out.
+static void table_slot_build_geo(Table* table, struct TableSlot* slot) {
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    const TableIndex* index = &table->indexes[idx];
+    if (index->type != CONFIG_INDEX_TYPE_GEO) continue;
+
+    GeoPoint* points = malloc((slot->row_count ? slot->row_count : 1) * sizeof(GeoPoint));
+    if (!points) {
+      LOG_WARN("Could not allocate geo index %s for table %s", index->column, table->name);
+      continue;
+    }
+    unsigned count = 0;
+    for (unsigned r = 0; r < slot->row_count; ++r) {
+      const uint8_t* row = 0;
+      unsigned row_len = table_slot_row(slot, r, &row);
+      if (index->where_column_len && !index_where_matches(index, row, row_len)) continue;
+      RowField lat_field;
+      RowField lon_field;
+      double lat = 0;
+      double lon = 0;
+      if (!row_find_field(row, row_len, index->column, index->column_len, &lat_field)) continue;
+      if (!row_find_field(row, row_len, index->lon, index->lon_len, &lon_field)) continue;
+      if (!field_degrees(&lat_field, &lat) || !field_degrees(&lon_field, &lon)) continue;
+      if (!geo_point(lat, lon, &points[count])) continue;
+      points[count].frame = slot->rows[r];
+      points[count].frame_len = row_len + sizeof(unsigned);
+      ++count;
+    }
+    slot->geo[idx] = geo_build(points, count);
+    LOG_DEBUG("Placed %u of %u rows of table %s on %s", count, slot->row_count, table->name, index->column);
+  }
+}
+
+// Build the trigram indexes of slot once all its rows are in.
+// Only text values are indexed; rows without one are left out.
+static void table_slot_build_trigram(Table* table, struct TableSlot* slot) {
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    const TableIndex* index = &table->indexes[idx];
+    if (index->type != CONFIG_INDEX_TYPE_TRIGRAM) continue;
+
+    TrigramDoc* docs = malloc((slot->row_count ? slot->row_count : 1) * sizeof(TrigramDoc));
+    if (!docs) {
+      LOG_WARN("Could not allocate trigram index %s for table %s", index->column, table->name);
+      continue;
+    }
+    double t0 = now_sec();
+    unsigned count = 0;
+    for (unsigned r = 0; r < slot->row_count; ++r) {
+      const uint8_t* row = 0;
+      unsigned row_len = table_slot_row(slot, r, &row);
+      if (index->where_column_len && !index_where_matches(index, row, row_len)) continue;
+      RowField field;
+      if (!row_find_field(row, row_len, index->column, index->column_len, &field)) continue;
+      if (field.type != MELIAN_VALUE_BYTES) continue;
+      docs[count].frame = slot->rows[r];
+      docs[count].frame_len = row_len + sizeof(unsigned);
+      docs[count].text = (unsigned)(field.value - slot->arena->buffer);
+      docs[count].text_len = field.value_len;
+      ++count;
+    }
+    slot->trigram[idx] = trigram_build(docs, count, slot->arena->buffer);
+    if (!slot->trigram[idx]) continue;
+    LOG_INFO("Indexed trigrams of %u of %u rows of table %s on %s: %u lists, %zu bytes in %.0f us",
+              count, slot->row_count, table->name, index->column, slot->trigram[idx]->list_count,
+              trigram_bytes(slot->trigram[idx]), (now_sec() - t0) * 1000000);
+  }
+}
+
+// Build the group indexes of slot once all its rows are in. Keys are taken
+// as text, numbers in decimal; rows without one are left out, and rows
+// without an order value go after the others of their key.
+static void table_slot_build_group(Table* table, struct TableSlot* slot) {
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    const TableIndex* index = &table->indexes[idx];
+    if (index->type != CONFIG_INDEX_TYPE_GROUP) continue;
+
+    GroupEntry* entries = malloc((slot->row_count ? slot->row_count : 1) * sizeof(GroupEntry));
+    if (!entries) {
+      LOG_WARN("Could not allocate group index %s for table %s", index->column, table->name);
+      continue;
+    }
+    // Keys that are not bytes of the row (numbers, escaped JSON strings) are
+    // collected here; entries keep their offset in hash until it stops growing
+    uint8_t* copies = 0;
+    size_t copies_len = 0;
+    size_t copies_cap = 0;
+    unsigned bad = 0;
+    double t0 = now_sec();
+    unsigned count = 0;
+    for (unsigned r = 0; r < slot->row_count; ++r) {
+      const uint8_t* row = 0;
+      unsigned row_len = table_slot_row(slot, r, &row);
+      if (index->where_column_len && !index_where_matches(index, row, row_len)) continue;
+      RowField field;
+      char value[MAX_JSON_KEY_LEN];
+      char text[MAX_KEY_TEXT_LEN];
+      const uint8_t* key = 0;
+      unsigned key_len = 0;
+      if (!index_field(index, row, row_len, &field, value, sizeof(value))) continue;
+      if (!row_field_bytes(&field, text, sizeof(text), &key, &key_len)) continue;
+
+      GroupEntry* entry = &entries[count];
+      memset(entry, 0, sizeof(*entry));
+      entry->key_len = key_len;
+      if (key >= row && key + key_len <= row + row_len) {
+        entry->key = key;
+      } else {
+        if (copies_len + key_len > copies_cap) {
+          size_t cap = copies_cap ? 2 * copies_cap : 4096;
+          while (cap < copies_len + key_len) cap *= 2;
+          uint8_t* grown = realloc(copies, cap);
+          if (!grown) {
+            ++bad;
+            break;
+          }
+          copies = grown;
+          copies_cap = cap;
+        }
+        memcpy(copies + copies_len, key, key_len);
+        entry->hash = copies_len;
+        copies_len += key_len;
+      }
+      entry->row = row;
+      entry->row_len = row_len;
+      entry->seq = r;
+      entry->kind = GROUP_ORDER_NONE;
+      RowField order;
+      if (index->order_len && row_find_field(row, row_len, index->order, index->order_len, &order) &&
+          order.type != MELIAN_VALUE_NULL) {
+        int64_t integer = 0;
+        unsigned is_int = 0;
+        if (row_field_number(&order, &entry->number, &integer, &is_int)) {
+          entry->kind = GROUP_ORDER_NUMBER;
+        } else if (order.type == MELIAN_VALUE_BYTES) {
+          entry->kind = GROUP_ORDER_TEXT;
+          entry->text = order.value;
+          entry->text_len = order.value_len;
+        }
+      } else if (!index->order_len) {
+        entry->kind = GROUP_ORDER_NUMBER;  // all equal, so rows keep their load order
+      }
+      ++count;
+    }
+    for (unsigned e = 0; !bad && e < count; ++e) {
+      if (!entries[e].key) entries[e].key = copies + entries[e].hash;
+    }
+    if (!bad) slot->group[idx] = group_build(entries, count, index->order_descending);
+    free(entries);
+    free(copies);
+    if (!slot->group[idx]) {
+      LOG_WARN("Could not build group index %s for table %s", index->column, table->name);
+      continue;
+    }
+    LOG_INFO("Grouped %u of %u rows of table %s on %s: %u keys, %zu bytes in %.0f us",
+             count, slot->row_count, table->name, index->column, slot->group[idx]->key_count,
+             group_bytes(slot->group[idx]), (now_sec() - t0) * 1000000);
+  }
+}
+
+static unsigned field_degrees(const RowField* field, double* degrees) {
+  int64_t integer = 0;
+  unsigned is_int = 0;
+  return row_field_number(field, degrees, &integer, &is_int);
+}
+
+// Free everything a slot holds; the next load starts it over.
+static void table_slot_release(Table* table, struct TableSlot* slot) {
+  if (slot->indexes) {
+    for (unsigned idx = 0; idx < table->index_count; ++idx) {
+      if (!slot->indexes[idx]) continue;
+      hash_destroy(slot->indexes[idx]);
+      slot->indexes[idx] = 0;
+    }
+  }
+  for (unsigned i = 0; i < MELIAN_MAX_ADHOC_INDEXES; ++i) {
+    if (!slot->adhoc[i]) continue;
+    hash_destroy(slot->adhoc[i]);
+    slot->adhoc[i] = 0;
+  }
+  for (unsigned idx = 0; idx < MELIAN_MAX_INDEXES; ++idx) {
+    if (slot->geo[idx]) geo_destroy(slot->geo[idx]);
+    slot->geo[idx] = 0;
+    if (slot->trigram[idx]) trigram_destroy(slot->trigram[idx]);
+    slot->trigram[idx] = 0;
+    if (slot->group[idx]) group_destroy(slot->group[idx]);
+    slot->group[idx] = 0;
+  }
+  table_slot_drop_arrow(slot);
+  // An image's row list and buckets go away with its mapping
+  if (slot->rows && !slot->imaged) free(slot->rows);
+  slot->rows = 0;
+  slot->row_count = 0;
+  slot->row_cap = 0;
+  if (slot->arena) arena_destroy(slot->arena);
+  slot->arena = 0;
+  slot->imaged = 0;
+}
+
+// Page out the live slot: copy its arena to a mapped snapshot file, point
+// copies of its hashes there, and make that the live slot. The heap slot it
+// replaces is released on the next pass, once readers have moved off it.
+static unsigned table_demote(Table* table, unsigned now) {
+  unsigned pos = table->current_slot;
+  struct TableSlot* live = &table->slots[pos];
+  struct TableSlot* cold = &table->slots[1 - pos];
+  unsigned idle = now - table->last_active;
+  if (live->arena->mapped && !live->imaged) {
+    // Promoted, but the reload has not replaced the snapshot yet
+    atomic_store(&table->cold_hits, 0);
+    atomic_store(&table->tier, TABLE_TIER_COLD);
+    return 1;
+  }
+
+  if (atomic_load(&cold->pins)) return 0;
+
+  double t0 = now_sec();
+  table_slot_release(table, cold);
+  cold->arena = arena_map(live->arena, table->tier_dir, table->name);
+  if (!cold->arena) {
+    LOG_WARN("Could not page out table %s to %s", table->name, table->tier_dir);
+    return 0;
+  }
+  unsigned bad = 0;
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    if (!live->indexes[idx]) continue;
+    cold->indexes[idx] = hash_clone(live->indexes[idx], cold->arena);
+    if (!cold->indexes[idx]) ++bad;
+  }
+  for (unsigned i = 0; i < MELIAN_MAX_ADHOC_INDEXES; ++i) {
+    if (!live->adhoc[i]) continue;
+    cold->adhoc[i] = hash_clone(live->adhoc[i], cold->arena);
+    if (!cold->adhoc[i]) ++bad;
+  }
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    // Geo and trigram indexes hold arena offsets, valid for the mapping as they are;
+    // group indexes hold their own copy of the rows
+    if (live->geo[idx]) {
+      cold->geo[idx] = geo_clone(live->geo[idx]);
+      if (!cold->geo[idx]) ++bad;
+    }
+    if (live->trigram[idx]) {
+      cold->trigram[idx] = trigram_clone(live->trigram[idx]);
+      if (!cold->trigram[idx]) ++bad;
+    }
+    if (live->group[idx]) {
+      cold->group[idx] = group_clone(live->group[idx]);
+      if (!cold->group[idx]) ++bad;
+    }
+  }
+  memcpy(cold->columns, live->columns, sizeof(live->columns));
+  cold->column_count = live->column_count;
+  if (bad) {
+    LOG_WARN("Could not copy indexes to page out table %s", table->name);
+    table_slot_release(table, cold);
+    return 0;
+  }
+  if (live->imaged) {
+    // The row list lives in the image, which goes away with the live slot
+    cold->rows = malloc((live->row_count ? live->row_count : 1) * sizeof(unsigned));
+    if (!cold->rows) {
+      LOG_WARN("Could not copy row list to page out table %s", table->name);
+      table_slot_release(table, cold);
+      return 0;
+    }
+    memcpy(cold->rows, live->rows, live->row_count * sizeof(unsigned));
+    cold->row_count = live->row_count;
+    cold->row_cap = live->row_count;
+  } else {
+    // Only the loader thread walks the row list, so it can simply move over
+    cold->rows = live->rows;
+    cold->row_count = live->row_count;
+    cold->row_cap = live->row_cap;
+    live->rows = 0;
+    live->row_count = 0;
+    live->row_cap = 0;
+  }
+
+  atomic_store(&table->cold_hits, 0);
+  table->current_slot = 1 - pos;
+  atomic_store(&table->tier, TABLE_TIER_COLD);
+  table->release_standby = 1;
+  ++table->tier_stats.demotions;
+  double t1 = now_sec();
+  unsigned long elapsed = (t1 - t0) * 1000000;
+  LOG_INFO("Paged out table %s (%u bytes) after %u idle seconds in %lu us",
+           table->name, cold->arena->used, idle, elapsed);
+  return 1;
+}
+
+// Queries reached a paged out table: reload it into RAM right away.
+static void table_promote(Table* table, unsigned now) {
+  atomic_store(&table->tier, TABLE_TIER_HOT);
+  table->last_active = now;
+  ++table->tier_stats.promotions;
+  if (table->derived) {
+    derived_invalidate(table->derived);
+  } else {
+    table->stats.last_loaded = 0;
+  }
+  LOG_INFO("Promoting table %s after %u queries while paged out",
+           table->name, atomic_load(&table->cold_hits));
+}
+
+// Note the names of the fields the rows of slot carry, most often the same
+// for every row, so that ad-hoc requests for other names are turned away.
+static void table_slot_collect_columns(struct TableSlot* slot) {
+  slot->column_count = 0;
+  const uint8_t* base = slot->arena->buffer;
+  for (unsigned r = 0; r < slot->row_count; ++r) {
+    const uint8_t* row = 0;
+    unsigned row_len = table_slot_row(slot, r, &row);
+    unsigned pos = 0;
+    RowField field;
+    while (row_next_field(row, row_len, &pos, &field)) {
+      if (table_slot_has_column(slot, (const char*)field.name, field.name_len)) continue;
+      if (slot->column_count == TABLE_MAX_COLUMNS) {
+        ++slot->column_count;
+        return;
+      }
+      struct TableColumn* column = &slot->columns[slot->column_count++];
+      column->name = (unsigned)(field.name - base);
+      column->len = field.name_len;
+    }
+  }
+}
+
+static unsigned table_slot_has_column(const struct TableSlot* slot, const char* name, unsigned len) {
+  if (slot->column_count > TABLE_MAX_COLUMNS) return 1;
+  for (unsigned c = 0; c < slot->column_count; ++c) {
+    const struct TableColumn* column = &slot->columns[c];
+    if (column->len == len && memcmp(slot->arena->buffer + column->name, name, len) == 0) return 1;
+  }
+  return 0;
+}
+
+// Build every requested ad-hoc index for a freshly loaded, not yet visible, slot.
+static unsigned table_slot_build_adhoc(Table* table, struct TableSlot* slot) {
+  unsigned built = 0;
+  for (unsigned i = 0; i < MELIAN_MAX_ADHOC_INDEXES; ++i) {
+    if (slot->adhoc[i]) {
+      hash_destroy(slot->adhoc[i]);
+      slot->adhoc[i] = 0;
+    }
+    TableAdhocIndex* adhoc = &table->adhoc[i];
+    unsigned state = atomic_load(&adhoc->state);
+    if (state != TABLE_ADHOC_READY && state != TABLE_ADHOC_PENDING) continue;
+    slot->adhoc[i] = table_slot_index_column(table, slot, adhoc);
+    if (slot->adhoc[i]) ++built;
+  }
+  return built;
+}
+
+// Index all rows of slot by the ad-hoc column. Nothing is added to the arena,
+// so this is safe on the live slot: string keys point into the row frames.
+static Hash* table_slot_index_column(Table* table, struct TableSlot* slot, TableAdhocIndex* adhoc) {
+  if (!adhoc->builds) {
+    // First build decides the key kind from the first row holding the column
+    for (unsigned r = 0; r < slot->row_count; ++r) {
+      const uint8_t* row = 0;
+      unsigned row_len = table_slot_row(slot, r, &row);
+      RowField field;
+      if (!row_find_field(row, row_len, adhoc->column, adhoc->column_len, &field)) continue;
+      if (field.type == MELIAN_VALUE_NULL) continue;
+      adhoc->int_keys = field.type == MELIAN_VALUE_INT64 || field.type == MELIAN_VALUE_BOOL;
+      break;
+    }
+  }
+  ++adhoc->builds;
+
+  unsigned cap = 2 * next_power_of_two(slot->row_count, 1);
+  Hash* hash = hash_build(cap, slot->arena, adhoc->int_keys ? HASH_KEY_INT : HASH_KEY_BYTES);
+  if (!hash) {
+    LOG_WARN("Could not allocate ad-hoc index on %s.%s", table->name, adhoc->column);
+    return NULL;
+  }
+  for (unsigned r = 0; r < slot->row_count; ++r) {
+    const uint8_t* row = 0;
+    unsigned row_len = table_slot_row(slot, r, &row);
+    unsigned frame = slot->rows[r];
+    RowField field;
+    if (!row_find_field(row, row_len, adhoc->column, adhoc->column_len, &field)) continue;
+    if (adhoc->int_keys) {
+      unsigned key_int = 0;
+      if (field.type == MELIAN_VALUE_NULL || !row_field_uint(&field, &key_int)) continue;
+      hash_insert(hash, &key_int, sizeof(unsigned), frame, row_len + sizeof(unsigned));
+    } else {
+      if (field.type != MELIAN_VALUE_BYTES && field.type != MELIAN_VALUE_DECIMAL) continue;
+      if (!field.value_len) continue;
+      hash_insert_ref(hash, field.value, field.value_len,
+                      frame + sizeof(unsigned) + field.offset,
+                      frame, row_len + sizeof(unsigned));
+    }
+  }
+  hash_finalize_pointers(hash);
+  return hash;
+}
+
+// Ad-hoc keys for integer columns arrive as decimal text.
+static unsigned parse_key_text(const void* key, unsigned len, unsigned* value) {
+  const char* text = key;
+  if (!len || len > 10) return 0;
+  unsigned long long v = 0;
+  for (unsigned i = 0; i < len; ++i) {
+    if (text[i] < '0' || text[i] > '9') return 0;
+    v = v * 10 + (unsigned)(text[i] - '0');
+  }
+  if (v > 0xFFFFFFFFULL) return 0;
+  *value = (unsigned)v;
+  return 1;
+}
+
+// Find the key row holds under the first index of table: the integer of an
+// int index or the bytes of a string one. Return 0 if it has none.
+static unsigned table_row_key(Table* table, const uint8_t* row, unsigned row_len, RowKey* key) {
+  const TableIndex* index = &table->indexes[0];
+  RowField field;
+  if (!index_field(index, row, row_len, &field, key->value, sizeof(key->value))) return 0;
+  if (index->type == CONFIG_INDEX_TYPE_INT) {
+    if (!row_field_uint(&field, &key->key_int)) return 0;
+    key->key = (const uint8_t*)&key->key_int;
+    key->len = sizeof(unsigned);
+    return 1;
+  }
+  return row_field_bytes(&field, key->text, sizeof(key->text), &key->key, &key->len);
+}
+
+// Collect the keys a delta deletes, and those of the rows it upserts.
+static unsigned table_push_delta_keys(Table* table, PushBatch* batch, PushKeySet* set) {
+  size_t pos = 0;
+  const uint8_t* data = 0;
+  unsigned len = 0;
+  while (push_buffer_next(&batch->keys, &pos, &data, &len)) {
+    if (table->indexes[0].type == CONFIG_INDEX_TYPE_INT) {
+      unsigned key_int = 0;
+      if (!parse_key_text(data, len, &key_int)) continue;
+      if (!push_keys_add(set, (const uint8_t*)&key_int, sizeof(unsigned))) return 0;
+    } else if (!push_keys_add(set, data, len)) {
+      return 0;
+    }
+  }
+  pos = 0;
+  while (push_buffer_next(&batch->rows, &pos, &data, &len)) {
+    // The key may be a computed column
+    if (table->computed_count && !(data = table_computed_row(table, data, len, &len))) return 0;
+    RowKey key;
+    if (!table_row_key(table, data, len, &key)) continue;
+    if (!push_keys_add(set, key.key, key.len)) return 0;
+  }
+  push_keys_seal(set);
+  return 1;
+}
@@ -2,18 +2,50 @@
 
 // Data stores the indexed data for all configured tables.
 // Each table has a period, indicating how often to refresh the data.
+// An adaptive period doubles after a reload that brought the same rows and
+// halves after one that did not, within the configured bounds.
 // Each table has an arena for the actual data, and up to two hashes as indexes.
 // Each table stores two slots of data, to allow lock-free data refreshes.
+// Columns without a configured index can get an ad-hoc index, built on first use
+// by the loader thread and dropped again after sitting idle.
+// Tables nobody queries for a while are paged out: the live slot is moved to a
+// snapshot file mapped read-only, the standby slot is released, and periodic
+// reloads stop until the table is queried again.
+// Computed columns are evaluated once per row at load time and stored with it;
+// keys for an index on one are put through the same expression before lookup.
+// With a loader process, tables are queried there and each new slot arrives as
+// one block of shared memory, which the loader thread maps and swaps in.
+// In a cluster, a table placed on other nodes is never loaded here, and one
+// split between several nodes keeps only the rows whose first key hashes to
+// this node's part.
+// The first EXPORT of a slot has the loader thread encode it as an Arrow
+// stream, which is kept with the slot until the slot is loaded again.
+// Before a new slot goes live, the loader thread looks up in it the keys the
+// server thread last found, a sample of the hot ones, so that their buckets
+// and frames are in memory and cache when the first queries for them arrive.
 
 #include <stdatomic.h>
 #include "protocol.h"
+#include "row.h"
 
+struct Arrow;
 struct Bucket;
 struct Config;
 struct DB;
+struct Derived;
+struct Expr;
+struct ExprScratch;
+struct Geo;
+struct GeoHit;
+struct Group;
+struct Hash;
+struct Loader;
+struct Trigram;
 
 struct TableStats {
   unsigned last_loaded;
+  unsigned loads;          // number of completed loads
+  unsigned deferrals;      // reloads put off because they did not fit the reload budget
   unsigned rows;
   unsigned min_id;
   unsigned max_id;
@@ -21,24 +53,189 @@ struct TableStats {
 
 #include "config.h"
 
+enum {
+  MELIAN_MAX_ADHOC_INDEXES = 4,
+  MELIAN_MAX_COMPUTED = 8,
+};
+
+enum {
+  TABLE_MAX_COLUMNS = 64,  // column names a slot keeps for checking ad-hoc requests
+};
+
+// A column some row of a slot carries: its name, as an arena offset, so that
+// it still holds once the arena is paged out.
+struct TableColumn {
+  unsigned name;
+  unsigned len;
+};
+
 struct TableSlot {
   struct Arena* arena;
-  struct Hash** indexes;
+  struct Hash** indexes;   // 0 for geo and trigram indexes
+  struct Geo* geo[MELIAN_MAX_INDEXES];  // k-d trees of geo indexes, by position
+  struct Trigram* trigram[MELIAN_MAX_INDEXES];  // posting lists of trigram indexes, by position
+  struct Group* group[MELIAN_MAX_INDEXES];  // sorted rows of group indexes, by position
+  struct Hash* adhoc[MELIAN_MAX_ADHOC_INDEXES];
+  _Atomic(struct Arrow*) arrow;  // Arrow export, built on the first EXPORT; 0 until then
+  atomic_uint arrow_failed;  // the export could not be built, so EXPORT finds nothing
+  unsigned* rows;          // arena index of every row frame, in load order
+  unsigned row_count;
+  unsigned row_cap;
+  unsigned imaged;         // arena, row list and index buckets all live in one TableImage mapping
+  struct TableColumn columns[TABLE_MAX_COLUMNS];
+  unsigned column_count;   // more than TABLE_MAX_COLUMNS if the rows had more, then any name is taken
+  atomic_uint pins;        // replies and searches still reading the arena, counted by the server thread
+};
+
+// A slot loaded by the loader process, laid out in one shared memory file:
+// the arena bytes from offset 0, then the row list and the bucket array of
+// each hashed index, whose buckets still hold arena offsets.
+typedef struct TableImage {
+  unsigned table_id;
+  unsigned rows;           // (unsigned)-1 if the load failed
+  unsigned min_id;
+  unsigned max_id;
+  unsigned arena_used;
+  unsigned size;           // bytes in the image
+  unsigned row_list;       // offset of the row list
+  struct {
+    unsigned buckets;      // offset of the bucket array
+    unsigned cap;          // 0 if the index has no hash
+    unsigned used;
+    unsigned kind;         // HashKeyKind
+  } indexes[MELIAN_MAX_INDEXES];
+} TableImage;
+
+typedef enum TableAdhocState {
+  TABLE_ADHOC_FREE,        // entry not in use
+  TABLE_ADHOC_PENDING,     // requested by a reader, waiting for the loader thread
+  TABLE_ADHOC_READY,       // built for the current slot
+} TableAdhocState;
+
+// An index on a column that was not configured, built when first requested.
+// Readers only claim FREE entries; the loader thread moves them to READY and
+// back to FREE once the entry has been idle for longer than the table allows.
+typedef struct TableAdhocIndex {
+  char column[MELIAN_MAX_NAME_LEN];
+  unsigned column_len;
+  unsigned int_keys;       // column holds integers; keys are sent as decimal text
+  atomic_uint state;
+  atomic_uint last_used;
+  unsigned builds;
+} TableAdhocIndex;
+
+typedef enum TableAdhocLookup {
+  TABLE_ADHOC_LOOKUP_DONE,       // lookup result is final (hit or miss)
+  TABLE_ADHOC_LOOKUP_BUILDING,   // index is still being built
+  TABLE_ADHOC_LOOKUP_REQUESTED,  // index was just requested; the loader must be woken up
+  TABLE_ADHOC_LOOKUP_FULL,       // every entry is taken by another column
+} TableAdhocLookup;
+
+typedef enum TableTier {
+  TABLE_TIER_HOT,          // both slots in RAM, reloaded every period
+  TABLE_TIER_COLD,         // live slot mapped from a snapshot file, no reloads
+} TableTier;
+
+enum {
+  TABLE_WARM_SAMPLE = 16,  // one in this many fetches leaves its key for warming
+  TABLE_WARM_MAX_KEYS = 65536,
+};
+
+// A key a fetch found, remembered by the hash its bucket holds. The server
+// thread overwrites entries while the loader thread reads them; a torn entry
+// only warms the wrong bucket.
+typedef struct TableWarmKey {
+  _Atomic uint64_t hash;   // 0 if unused
+  atomic_uint index;
+} TableWarmKey;
+
+struct TableWarmStats {
+  unsigned keys;           // sampled keys looked up in the last slot before it went live
+  unsigned found;          // of which were still in it
+  unsigned elapsed_us;     // time spent warming it, prefaulting included
+};
+
+// How an adaptive period has followed the content: each load is compared
+// with the one before it through an order-independent hash of its rows.
+struct TableRefreshStats {
+  uint64_t content_hash;   // of the live slot's rows
+  unsigned changed;        // loads whose rows differed from the previous load
+  unsigned unchanged;      // loads that brought the same rows again
+  unsigned history;        // one bit per recent load, newest lowest, set if it changed
+  unsigned history_len;
+};
+
+struct TableTierStats {
+  unsigned demotions;
+  unsigned promotions;
+  unsigned first_access_us;  // latency of the first query after the last demotion
 };
 
 typedef struct TableIndex {
   unsigned id;
-  char column[MELIAN_MAX_NAME_LEN];
+  char column[MELIAN_MAX_NAME_LEN];   // as configured, e.g. "attrs$.sku"
+  unsigned column_len;     // length of the column name proper, e.g. "attrs"
+  const char* path;        // JSON path inside the column, e.g. ".sku"; 0 if none
+  unsigned path_len;
+  const char* lon;         // longitude column of a geo index, e.g. "lon" in "lat/lon"
+  unsigned lon_len;        // (column_len is then the length of the latitude column)
   ConfigIndexType type;
+  struct Expr* normalize;  // applied to incoming keys; 0 if none
+  char where_column[MELIAN_MAX_NAME_LEN];  // only rows matching the filter are indexed; empty if none
+  unsigned where_column_len;
+  char where_value[MELIAN_MAX_NAME_LEN];
+  unsigned where_value_len;
+  unsigned where_negate;   // filter is column!=value
+  char order[MELIAN_MAX_NAME_LEN];  // column a group index sorts the rows of a key by; empty for load order
+  unsigned order_len;
+  unsigned order_descending;
 } TableIndex;
 
+typedef struct TableComputed {
+  char name[MELIAN_MAX_NAME_LEN];
+  struct Expr* expr;
+} TableComputed;
+
 typedef struct Table {
   unsigned table_id;
   char name[MELIAN_MAX_NAME_LEN];
   char select_stmt[MELIAN_MAX_SELECT_LEN];
-  unsigned period;
+  unsigned period;          // seconds between reloads; adapts between the two below if period_max is set
+  unsigned period_min;
+  unsigned period_max;      // 0 for a fixed period
   unsigned index_count;
   TableIndex indexes[MELIAN_MAX_INDEXES];
+  unsigned adhoc_idle;     // seconds an ad-hoc index survives unused; 0 disables them
+  TableAdhocIndex adhoc[MELIAN_MAX_ADHOC_INDEXES];
+  atomic_uint export_wanted; // an EXPORT waits for the loader thread to build the live slot's export
+  struct Derived* derived; // computed from other tables rather than loaded; 0 if not
+  struct Push* push;       // streamed in by a producer rather than loaded; 0 if not
+  struct Loader* loader;   // loads come from the loader process; 0 to query the database here
+  unsigned remote;         // held by other cluster nodes only, so never loaded here
+  unsigned part;           // which of parts this node holds,
+  unsigned parts;          // when the rows are split between cluster nodes; 0 if not split
+  unsigned computed_count;
+  TableComputed computed[MELIAN_MAX_COMPUTED];
+  RowBuilder computed_row; // loader thread only
+  struct ExprScratch* load_scratch;  // loader thread only
+  struct ExprScratch* key_scratch;   // server thread only
+  unsigned tier_idle;      // seconds without queries before paging out; 0 disables it
+  const char* tier_dir;    // directory for snapshot files
+  atomic_uint accesses;    // queries so far, counted by the server thread
+  atomic_uint tier;        // TableTier
+  atomic_uint cold_hits;   // queries since the last demotion
+  unsigned seen_accesses;  // accesses at the last loader pass
+  unsigned last_active;    // when accesses last changed
+  unsigned release_standby; // free the standby slot on the next pass
+  unsigned budgeted;       // reloads count against the reload budget
+  unsigned deferring;      // the last reload attempt was deferred
+  TableWarmKey* warm;      // recently fetched keys; 0 if warming is off
+  unsigned warm_keys;      // entries in warm, a power of two
+  unsigned warm_next;      // server thread only
+  unsigned prefault;       // read every page of a new slot before it goes live
+  struct TableTierStats tier_stats;
+  struct TableRefreshStats refresh_stats;
+  struct TableWarmStats warm_stats;
   struct TableStats stats;
   atomic_uint current_slot;
   struct TableSlot slots[2];
@@ -53,18 +250,68 @@ typedef struct Data {
   unsigned table_count;
   Table* tables[MELIAN_MAX_TABLES];
   Table* lookup[256];
+  size_t reload_budget;    // bytes all tables may hold, reloads included; 0 for no limit
+  struct Loader* loader;   // 0 unless tables are loaded by the loader process
   DataSchema schema;
 } Data;
 
 Table* table_build(const ConfigTableSpec* spec, unsigned arena_cap);
 void table_destroy(Table* table);
 const char* table_name(Table* table);
-unsigned table_load_from_db(Table* table, struct DB* db, unsigned now, unsigned load);
+unsigned table_load_from_db(Table* table, struct DB* db, unsigned now, unsigned load, size_t room);
+unsigned table_load_derived(Table* table, unsigned now, size_t room);
+// Loader process: load table into a new shared memory file laid out as image.
+// Return the file descriptor, or -1 if the load failed.
+int table_export_from_db(Table* table, struct DB* db, TableImage* image);
+// Apply the batch a producer committed with INGEST, if there is one.
+unsigned table_load_pushed(Table* table, unsigned now, size_t room);
+size_t table_memory_bytes(Table* table);
+unsigned table_slot_add_row(Table* table, struct TableSlot* slot, const uint8_t* row, unsigned row_len,
+                            unsigned* min_id, unsigned* max_id);
+unsigned table_slot_row(struct TableSlot* slot, unsigned r, const uint8_t** row);
+struct TableSlot* table_slot_of(Table* table, const uint8_t* ptr);
 const struct Bucket* table_fetch(Table* table, unsigned index_id, const void *key, unsigned len);
+const struct Bucket* table_fetch_adhoc(Table* table, const char* column, unsigned column_len,
+                                       const void *key, unsigned len, unsigned now,
+                                       unsigned* lookup);
+unsigned table_build_adhoc_indexes(Table* table, unsigned now);
+// The Arrow export of the live slot, or 0 with lookup (a TableAdhocLookup)
+// telling whether it is being built, was just requested, or failed for good.
+const struct Arrow* table_arrow(Table* table, unsigned* lookup);
+unsigned table_build_arrow(Table* table);
+unsigned table_normalize_key(Table* table, unsigned index_id, const void** key, unsigned* len);
+// Which of parts a key of the first index, as a FETCH gives it, belongs to.
+unsigned table_key_part(const void* key, unsigned len, unsigned parts);
+const struct TableSlot* table_nearest(Table* table, unsigned index_id, double lat, double lon,
+                                      unsigned k, double radius_km, struct GeoHit* hits,
+                                      unsigned* count);
+struct TableSlot* table_pin_trigram(Table* table, unsigned index_id);
+// Rows of key in group index index_id, in order: skip offset, take up to limit
+// (all if 0). Point data at the slice, as GROUP sends it; return 0 if the key
+// has no rows or index_id is not a loaded group index.
+unsigned table_group(Table* table, unsigned index_id, const void* key, unsigned len,
+                     unsigned offset, unsigned limit, const uint8_t** data, size_t* bytes,
+                     unsigned* count, unsigned* total);
+const struct Bucket* table_fetch_cold(Table* table, struct Hash* hash, const void *key, unsigned len,
+                                      unsigned* first);
+unsigned table_update_tier(Table* table, unsigned now);
+
+// Remember a key a fetch on index_id found, by its bucket hash. Server thread only.
+static inline void table_note_hot(Table* table, unsigned index_id, uint64_t hash) {
+  if (!table->warm) return;
+  TableWarmKey* entry = &table->warm[table->warm_next++ & (table->warm_keys - 1)];
+  atomic_store_explicit(&entry->hash, hash, memory_order_relaxed);
+  atomic_store_explicit(&entry->index, index_id, memory_order_relaxed);
+}
 
 Data* data_build(struct Config* config);
 void data_destroy(Data* data);
+// Have the loader process load every table that comes from the database.
+void data_use_loader(Data* data, struct Loader* loader);
 unsigned data_load_all_tables_from_db(Data* data, struct DB* db);
+unsigned data_build_adhoc_indexes(Data* data);
+unsigned data_build_arrows(Data* data);
+unsigned data_update_tiers(Data* data);
 const struct Bucket* data_fetch(Data* data, unsigned table_id, unsigned index_id, const void *key, unsigned len);
 void data_show_usage(void);
 const char* data_schema_json(Data* data, unsigned* len);
@@ -19,6 +19,7 @@
 #include "config.h"
 #include "db.h"
 #include "data.h"
+#include "row.h"
 
 // TODO: make these limits dynamic? Arena?
 enum {
@@ -78,6 +79,8 @@ static void db_postgresql_disconnect(DB* db);
 static unsigned db_postgresql_get_table_size(DB* db, Table* table);
 static unsigned db_postgresql_query_into_hash(DB* db, Table* table, struct TableSlot* slot,
                             unsigned* min_id, unsigned* max_id);
+static unsigned db_postgresql_copy_into_hash(DB* db, Table* table, struct TableSlot* slot,
+                            unsigned* min_id, unsigned* max_id);
 #endif
 
 #if !defined(HAVE_MYSQL) || !defined(HAVE_SQLITE3) || !defined(HAVE_POSTGRESQL)
@@ -419,8 +422,6 @@ static unsigned db_mysql_query_into_hash(DB* db, Table* table, struct TableSlot*
 
     char names[MAX_FIELDS][MAX_FIELD_NAME_LEN];
     enum enum_field_types types[MAX_FIELDS];
-    int index_pos[MELIAN_MAX_INDEXES];
-    for (unsigned idx = 0; idx < MELIAN_MAX_INDEXES; ++idx) index_pos[idx] = -1;
     unsigned bad = 0;
     unsigned skip_table = 0;
     for (unsigned col = 0; col < num_fields; ++col) {
@@ -441,11 +442,6 @@ static unsigned db_mysql_query_into_hash(DB* db, Table* table, struct TableSlot*
         skip_table = 1;
         break;
       }
-      for (unsigned idx = 0; idx < table->index_count; ++idx) {
-        if (strcmp(field->name, table->indexes[idx].column) == 0) {
-          index_pos[idx] = col;
-        }
-      }
     }
     if (skip_table) {
       rows = (unsigned)-1;
@@ -562,45 +558,9 @@ static unsigned db_mysql_query_into_hash(DB* db, Table* table, struct TableSlot*
         }
       }
 
-      unsigned frame = arena_store_framed(slot->arena, row_buf, (unsigned)row_size);
+      unsigned stored = table_slot_add_row(table, slot, row_buf, (unsigned)row_size, min_id, max_id);
       free(row_buf);
-      if (frame == (unsigned)-1) {
-        LOG_WARN("Could not store framed row for SELECT query for table %s", table_name(table));
-        break;
-      }
-
-      int insert_error = 0;
-      for (unsigned idx = 0; idx < table->index_count; ++idx) {
-        int col_pos = index_pos[idx];
-        if (col_pos < 0) continue;
-        if (!slot->indexes[idx]) continue;
-        const char* value = row[col_pos];
-        if (!value) continue;
-        if (table->indexes[idx].type == CONFIG_INDEX_TYPE_INT) {
-          unsigned key_int = (unsigned) atoi(value);
-          if (!hash_insert(slot->indexes[idx], &key_int, sizeof(unsigned),
-                           frame, (unsigned)row_size + sizeof(unsigned))) {
-            LOG_WARN("Could not insert row for table %s key %u index %u",
-                     table_name(table), key_int, idx);
-            insert_error = 1;
-            break;
-          }
-          if (idx == 0) {
-            if (*min_id > key_int) *min_id = key_int;
-            if (*max_id < key_int) *max_id = key_int;
-          }
-        } else {
-          unsigned hlen = lengths ? (unsigned)lengths[col_pos] : (unsigned)strlen(value);
-          if (!hlen) continue;
-          if (!hash_insert(slot->indexes[idx], value, hlen, frame, (unsigned)row_size + sizeof(unsigned))) {
-            LOG_WARN("Could not insert row for table %s key %.*s index %u",
-                     table_name(table), hlen, value, idx);
-            insert_error = 1;
-            break;
-          }
-        }
-      }
-      if (insert_error) break;
+      if (!stored) break;
       ++rows;
     }
     double t1 = now_sec();
@@ -725,8 +685,6 @@ static unsigned db_sqlite_query_into_hash(DB* db, Table* table, struct TableSlot
     }
 
     char names[MAX_FIELDS][MAX_FIELD_NAME_LEN];
-    int index_pos[MELIAN_MAX_INDEXES];
-    for (unsigned idx = 0; idx < MELIAN_MAX_INDEXES; ++idx) index_pos[idx] = -1;
     unsigned skip_table = 0;
     for (int col = 0; col < num_fields; ++col) {
       const char* name = sqlite3_column_name(stmt, col);
@@ -736,11 +694,6 @@ static unsigned db_sqlite_query_into_hash(DB* db, Table* table, struct TableSlot
         skip_table = 1;
         break;
       }
-      for (unsigned idx = 0; idx < table->index_count; ++idx) {
-        if (strcmp(names[col], table->indexes[idx].column) == 0) {
-          index_pos[idx] = col;
-        }
-      }
     }
     if (skip_table) {
       rows = (unsigned)-1;
@@ -851,45 +804,9 @@ static unsigned db_sqlite_query_into_hash(DB* db, Table* table, struct TableSlot
         }
       }
 
-      unsigned frame = arena_store_framed(slot->arena, row_buf, (unsigned)row_size);
+      unsigned stored = table_slot_add_row(table, slot, row_buf, (unsigned)row_size, min_id, max_id);
       free(row_buf);
-      if (frame == (unsigned)-1) {
-        LOG_WARN("Could not store framed row for SELECT query for table %s", table_name(table));
-        break;
-      }
-
-      int insert_error = 0;
-      for (unsigned idx = 0; idx < table->index_count; ++idx) {
-        int col_pos = index_pos[idx];
-        if (col_pos < 0) continue;
-        if (!slot->indexes[idx]) continue;
-        if (table->indexes[idx].type == CONFIG_INDEX_TYPE_INT) {
-          unsigned key_int = (unsigned) sqlite3_column_int64(stmt, col_pos);
-          if (!hash_insert(slot->indexes[idx], &key_int, sizeof(unsigned),
-                           frame, (unsigned)row_size + sizeof(unsigned))) {
-            LOG_WARN("Could not insert row for table %s key %u index %u",
-                     table_name(table), key_int, idx);
-            insert_error = 1;
-            break;
-          }
-          if (idx == 0) {
-            if (*min_id > key_int) *min_id = key_int;
-            if (*max_id < key_int) *max_id = key_int;
-          }
-        } else {
-          const unsigned char* value = sqlite3_column_text(stmt, col_pos);
-          unsigned hlen = (unsigned) sqlite3_column_bytes(stmt, col_pos);
-          if (!value || !hlen) continue;
-          if (!hash_insert(slot->indexes[idx], value, hlen,
-                           frame, (unsigned)row_size + sizeof(unsigned))) {
-            LOG_WARN("Could not insert row for table %s key %.*s index %u",
-                     table_name(table), hlen, value, idx);
-            insert_error = 1;
-            break;
-          }
-        }
-      }
-      if (insert_error) break;
+      if (!stored) break;
       ++rows;
     }
     if (rc != SQLITE_DONE) {
@@ -908,6 +825,25 @@ static unsigned db_sqlite_query_into_hash(DB* db, Table* table, struct TableSlot
 
 #ifdef HAVE_POSTGRESQL
 
+// Type OIDs from pg_type.h, and COPY binary framing.
+enum {
+  PG_OID_BOOL = 16,
+  PG_OID_NAME = 19,
+  PG_OID_INT8 = 20,
+  PG_OID_INT2 = 21,
+  PG_OID_INT4 = 23,
+  PG_OID_TEXT = 25,
+  PG_OID_FLOAT4 = 700,
+  PG_OID_FLOAT8 = 701,
+  PG_OID_BPCHAR = 1042,
+  PG_OID_VARCHAR = 1043,
+  PG_OID_NUMERIC = 1700,
+  PG_COPY_SIGNATURE_LEN = 11,
+};
+
+// Returned by the COPY loader when the COPY could not be started.
+#define PG_COPY_NOT_STARTED ((unsigned)-2)
+
 static void postgres_refresh_versions(DB* db) {
   db->client_version[0] = '\0';
   int lv = PQlibVersion();
@@ -1029,6 +965,11 @@ static unsigned db_postgresql_query_into_hash(DB* db, Table* table, struct Table
     LOG_WARN("Cannot query table data for %s, PostgreSQL connection not established", table_name(table));
     return 0;
   }
+  if (db->config->db.postgresql_copy) {
+    unsigned copied = db_postgresql_copy_into_hash(db, table, slot, min_id, max_id);
+    if (copied != PG_COPY_NOT_STARTED) return copied;
+    LOG_WARN("Falling back to a regular query for table %s", table_name(table));
+  }
   const char* query = table_select_sql(table);
   PGresult* res = PQexec(db->postgres, query);
   if (!res) {
@@ -1048,8 +989,6 @@ static unsigned db_postgresql_query_into_hash(DB* db, Table* table, struct Table
     return 0;
   }
   char names[MAX_FIELDS][MAX_FIELD_NAME_LEN];
-  int index_pos[MELIAN_MAX_INDEXES];
-  for (unsigned idx = 0; idx < MELIAN_MAX_INDEXES; ++idx) index_pos[idx] = -1;
   unsigned skip_table = 0;
   for (int col = 0; col < num_fields; ++col) {
     const char* fname = PQfname(res, col);
@@ -1059,11 +998,6 @@ static unsigned db_postgresql_query_into_hash(DB* db, Table* table, struct Table
       skip_table = 1;
       break;
     }
-    for (unsigned idx = 0; idx < table->index_count; ++idx) {
-      if (strcmp(names[col], table->indexes[idx].column) == 0) {
-        index_pos[idx] = col;
-      }
-    }
   }
   if (skip_table) {
     PQclear(res);
@@ -1186,51 +1120,299 @@ static unsigned db_postgresql_query_into_hash(DB* db, Table* table, struct Table
       }
     }
 
-    unsigned frame = arena_store_framed(slot->arena, row_buf, (unsigned)row_size);
+    unsigned stored = table_slot_add_row(table, slot, row_buf, (unsigned)row_size, min_id, max_id);
     free(row_buf);
-    if (frame == (unsigned)-1) {
-      LOG_WARN("Could not store framed row for SELECT query for table %s", table_name(table));
+    if (!stored) break;
+    ++rows;
+  }
+  double t1 = now_sec();
+  unsigned long elapsed = (t1 - t0) * 1000000;
+  LOG_INFO("Fetched %u rows from table %s in %lu us", rows, table_name(table), elapsed);
+  PQclear(res);
+  return rows;
+}
+
+static uint16_t read_be16(const uint8_t *buf) {
+  return (uint16_t)(((uint16_t)buf[0] << 8) | buf[1]);
+}
+
+static uint32_t read_be32(const uint8_t *buf) {
+  return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+         ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+}
+
+static uint64_t read_be64(const uint8_t *buf) {
+  return ((uint64_t)read_be32(buf) << 32) | read_be32(buf + 4);
+}
+
+// Whether COPY can send this type in binary the way the text path reads it;
+// every other column is cast to text on the server.
+static unsigned postgres_copy_native(unsigned oid) {
+  switch (oid) {
+    case PG_OID_BOOL:
+    case PG_OID_INT2:
+    case PG_OID_INT4:
+    case PG_OID_INT8:
+    case PG_OID_FLOAT4:
+    case PG_OID_FLOAT8:
+    case PG_OID_TEXT:
+    case PG_OID_VARCHAR:
+    case PG_OID_BPCHAR:
+    case PG_OID_NAME:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// Append one COPY binary field to the row, with the same value types as the text path.
+static unsigned postgres_copy_field(RowBuilder* builder, const char* name, unsigned name_len,
+                                    unsigned oid, const uint8_t* value, unsigned len) {
+  switch (oid) {
+    case PG_OID_BOOL: {
+      if (len != 1) return 0;
+      uint8_t b = value[0] ? 1 : 0;
+      return row_builder_add(builder, (const uint8_t*)name, name_len, MELIAN_VALUE_BOOL, &b, 1);
+    }
+    case PG_OID_INT2:
+      if (len != 2) return 0;
+      return row_builder_add_int(builder, name, (int16_t)read_be16(value));
+    case PG_OID_INT4:
+      if (len != 4) return 0;
+      return row_builder_add_int(builder, name, (int32_t)read_be32(value));
+    case PG_OID_INT8:
+      if (len != 8) return 0;
+      return row_builder_add_int(builder, name, (int64_t)read_be64(value));
+    case PG_OID_FLOAT4: {
+      if (len != 4) return 0;
+      uint32_t bits = read_be32(value);
+      float f = 0;
+      memcpy(&f, &bits, sizeof(f));
+      return row_builder_add_float(builder, name, f);
+    }
+    case PG_OID_FLOAT8: {
+      if (len != 8) return 0;
+      uint64_t bits = read_be64(value);
+      double d = 0;
+      memcpy(&d, &bits, sizeof(d));
+      return row_builder_add_float(builder, name, d);
+    }
+    case PG_OID_NUMERIC:
+      return row_builder_add(builder, (const uint8_t*)name, name_len, MELIAN_VALUE_DECIMAL, value, len);
+    default:
+      return row_builder_add(builder, (const uint8_t*)name, name_len, MELIAN_VALUE_BYTES, value, len);
+  }
+}
+
+// Build COPY (SELECT cols FROM (query) AS melian_sub) TO STDOUT (FORMAT binary),
+// casting columns without a native binary decoder to text. Caller frees.
+static char* postgres_copy_sql(DB* db, const char* query, int num_fields,
+                               char names[][MAX_FIELD_NAME_LEN], const unsigned* oids) {
+  size_t cap = strlen(query) + 128;
+  for (int col = 0; col < num_fields; ++col) {
+    cap += 2 * (2 * strlen(names[col]) + 2) + 16;
+  }
+  char* sql = malloc(cap);
+  if (!sql) return NULL;
+  size_t len = (size_t)snprintf(sql, cap, "COPY (SELECT ");
+  for (int col = 0; col < num_fields; ++col) {
+    char* ident = PQescapeIdentifier(db->postgres, names[col], strlen(names[col]));
+    if (!ident) {
+      free(sql);
+      return NULL;
+    }
+    if (postgres_copy_native(oids[col])) {
+      len += (size_t)snprintf(sql + len, cap - len, "%s%s", col ? ", " : "", ident);
+    } else {
+      len += (size_t)snprintf(sql + len, cap - len, "%s%s::text AS %s", col ? ", " : "", ident, ident);
+    }
+    PQfreemem(ident);
+  }
+  int wrote = snprintf(sql + len, cap - len, " FROM (%s) AS melian_sub) TO STDOUT (FORMAT binary)", query);
+  if (wrote < 0 || (size_t)wrote >= cap - len) {
+    free(sql);
+    return NULL;
+  }
+  return sql;
+}
+
+// Return 1 if every index of table reads a column of the result set, or one
+// of the table's computed columns.
+static unsigned postgres_copy_has_indexes(Table* table, int num_fields,
+                                          char names[][MAX_FIELD_NAME_LEN], const unsigned* name_lens) {
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    const TableIndex* index = &table->indexes[idx];
+    unsigned found = 0;
+    for (int col = 0; !found && col < num_fields; ++col) {
+      found = name_lens[col] == index->column_len &&
+              memcmp(names[col], index->column, index->column_len) == 0;
+    }
+    for (unsigned c = 0; !found && c < table->computed_count; ++c) {
+      found = strlen(table->computed[c].name) == index->column_len &&
+              memcmp(table->computed[c].name, index->column, index->column_len) == 0;
+    }
+    if (!found) {
+      LOG_WARN("Index column %s not in COPY result for table %s, skipping table",
+               index->column, table_name(table));
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Load a table through COPY ... (FORMAT binary), decoding the stream one
+// message at a time straight into the row encoder, so the result set is never
+// held in libpq memory. Return PG_COPY_NOT_STARTED if the COPY could not be
+// set up, so the caller can fall back to a regular query, and -1 if the table
+// must be skipped, including when the stream failed part way.
+static unsigned db_postgresql_copy_into_hash(DB* db, Table* table, struct TableSlot* slot,
+                                             unsigned* min_id, unsigned* max_id) {
+  const char* query = table_select_sql(table);
+  PGresult* res = PQprepare(db->postgres, "", query, 0, NULL);
+  if (!res || PQresultStatus(res) != PGRES_COMMAND_OK) {
+    LOG_WARN("Cannot prepare query [%s] for table %s: %s", query, table_name(table), PQerrorMessage(db->postgres));
+    if (res) PQclear(res);
+    return PG_COPY_NOT_STARTED;
+  }
+  PQclear(res);
+  res = PQdescribePrepared(db->postgres, "");
+  if (!res || PQresultStatus(res) != PGRES_COMMAND_OK) {
+    LOG_WARN("Cannot describe query [%s] for table %s: %s", query, table_name(table), PQerrorMessage(db->postgres));
+    if (res) PQclear(res);
+    return PG_COPY_NOT_STARTED;
+  }
+  int num_fields = PQnfields(res);
+  if (num_fields > MAX_FIELDS) {
+    LOG_WARN("Expected at most %u number of fields for SELECT query for table %s, got %d",
+             MAX_FIELDS, table_name(table), num_fields);
+    PQclear(res);
+    return (unsigned)-1;
+  }
+  char names[MAX_FIELDS][MAX_FIELD_NAME_LEN];
+  unsigned name_lens[MAX_FIELDS];
+  unsigned oids[MAX_FIELDS];
+  for (int col = 0; col < num_fields; ++col) {
+    const char* fname = PQfname(res, col);
+    int wrote = snprintf(names[col], MAX_FIELD_NAME_LEN, "%s", fname ? fname : "");
+    if (wrote < 0 || (size_t)wrote >= MAX_FIELD_NAME_LEN) {
+      LOG_WARN("PostgreSQL column name too long for table %s, skipping table", table->name);
+      PQclear(res);
+      return (unsigned)-1;
+    }
+    name_lens[col] = (unsigned)wrote;
+    oids[col] = (unsigned)PQftype(res, col);
+  }
+  PQclear(res);
+  if (!postgres_copy_has_indexes(table, num_fields, names, name_lens)) return (unsigned)-1;
+
+  char* sql = postgres_copy_sql(db, query, num_fields, names, oids);
+  if (!sql) {
+    LOG_WARN("Cannot build COPY statement for table %s", table_name(table));
+    return PG_COPY_NOT_STARTED;
+  }
+  res = PQexec(db->postgres, sql);
+  if (!res || PQresultStatus(res) != PGRES_COPY_OUT) {
+    LOG_WARN("Cannot run [%s] for table %s: %s", sql, table_name(table), PQerrorMessage(db->postgres));
+    if (res) PQclear(res);
+    free(sql);
+    return PG_COPY_NOT_STARTED;
+  }
+  PQclear(res);
+  free(sql);
+
+  static const uint8_t signature[PG_COPY_SIGNATURE_LEN] = "PGCOPY\n\377\r\n";
+  RowBuilder builder = {0};
+  unsigned rows = 0;
+  unsigned bad = 0;
+  unsigned header = 0;
+  *min_id = (unsigned)-1;
+  *max_id = 0;
+  double t0 = now_sec();
+  while (1) {
+    char* data = NULL;
+    int len = PQgetCopyData(db->postgres, &data, 0);
+    if (len == -1) break;
+    if (len < 0) {
+      LOG_WARN("COPY failed for table %s: %s", table_name(table), PQerrorMessage(db->postgres));
+      ++bad;
       break;
     }
-    int insert_error = 0;
-    for (unsigned idx = 0; idx < table->index_count; ++idx) {
-      int col_pos = index_pos[idx];
-      if (col_pos < 0) continue;
-      if (!slot->indexes[idx]) continue;
-      if (table->indexes[idx].type == CONFIG_INDEX_TYPE_INT) {
-        const char* value = PQgetvalue(res, row, col_pos);
-        unsigned key_int = (unsigned) strtoul(value ? value : "0", 0, 10);
-        if (!hash_insert(slot->indexes[idx], &key_int, sizeof(unsigned),
-                         frame, (unsigned)row_size + sizeof(unsigned))) {
-          LOG_WARN("Could not insert row for table %s key %u index %u",
-                   table_name(table), key_int, idx);
-          insert_error = 1;
+    // Each message holds whole tuples; the first one also carries the header.
+    // After an error keep draining, so the connection leaves COPY mode.
+    const uint8_t* buf = (const uint8_t*)data;
+    unsigned size = (unsigned)len;
+    unsigned pos = 0;
+    if (!bad && !header) {
+      // signature, u32 flags, u32 header extension length, extension
+      if (size < PG_COPY_SIGNATURE_LEN + 8 || memcmp(buf, signature, PG_COPY_SIGNATURE_LEN) != 0) {
+        LOG_WARN("Invalid COPY binary header for table %s", table_name(table));
+        ++bad;
+      } else {
+        pos = PG_COPY_SIGNATURE_LEN + 4;
+        pos += 4 + read_be32(buf + pos);
+        header = 1;
+      }
+    }
+    while (!bad && pos + 2 <= size) {
+      int16_t tuple_fields = (int16_t)read_be16(buf + pos);
+      pos += 2;
+      if (tuple_fields == -1) break;  // trailer
+      if (tuple_fields != num_fields || !row_builder_reset(&builder)) {
+        LOG_WARN("Unexpected COPY tuple with %d fields for table %s", tuple_fields, table_name(table));
+        ++bad;
+        break;
+      }
+      for (int col = 0; !bad && col < num_fields; ++col) {
+        if (pos + 4 > size) {
+          ++bad;
           break;
         }
-        if (idx == 0) {
-          if (*min_id > key_int) *min_id = key_int;
-          if (*max_id < key_int) *max_id = key_int;
+        int32_t flen = (int32_t)read_be32(buf + pos);
+        pos += 4;
+        if (flen < 0) {
+          if (db->config->table.strip_null) continue;
+          if (!row_builder_add(&builder, (const uint8_t*)names[col], name_lens[col],
+                               MELIAN_VALUE_NULL, NULL, 0)) ++bad;
+          continue;
         }
-      } else {
-        const char* value = PQgetvalue(res, row, col_pos);
-        int hlen = PQgetlength(res, row, col_pos);
-        if (!value || !hlen) continue;
-        if (!hash_insert(slot->indexes[idx], value, (unsigned) hlen,
-                         frame, (unsigned)row_size + sizeof(unsigned))) {
-          LOG_WARN("Could not insert row for table %s key %.*s index %u",
-                   table_name(table), hlen, value, idx);
-          insert_error = 1;
+        if (pos + (unsigned)flen > size ||
+            !postgres_copy_field(&builder, names[col], name_lens[col], oids[col],
+                                 buf + pos, (unsigned)flen)) {
+          ++bad;
           break;
         }
+        pos += (unsigned)flen;
+      }
+      if (bad) {
+        LOG_WARN("Invalid COPY tuple for table %s", table_name(table));
+        break;
       }
+      if (!builder.count) continue;
+      unsigned row_len = 0;
+      const uint8_t* row = row_builder_finish(&builder, &row_len);
+      if (!table_slot_add_row(table, slot, row, row_len, min_id, max_id)) {
+        ++bad;
+        break;
+      }
+      ++rows;
     }
-    if (insert_error) break;
-    ++rows;
+    PQfreemem(data);
+  }
+  while ((res = PQgetResult(db->postgres))) {
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+      LOG_WARN("COPY failed for table %s: %s", table_name(table), PQerrorMessage(db->postgres));
+    }
+    PQclear(res);
   }
+  row_builder_free(&builder);
   double t1 = now_sec();
   unsigned long elapsed = (t1 - t0) * 1000000;
-  LOG_INFO("Fetched %u rows from table %s in %lu us", rows, table_name(table), elapsed);
-  PQclear(res);
+  if (bad) {
+    // A partial table must not replace the one being served
+    LOG_WARN("Discarding %u rows COPYed from table %s", rows, table_name(table));
+    return (unsigned)-1;
+  }
+  LOG_INFO("Fetched %u rows from table %s with binary COPY in %lu us", rows, table_name(table), elapsed);
   return rows;
 }
 
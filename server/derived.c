@@ -0,0 +1,547 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "util.h"
+#include "log.h"
+#include "hash.h"
+#include "row.h"
+#include "data.h"
+#include "derived.h"
+
+enum {
+  MAX_KEY_TEXT_LEN = 32,
+  MAX_TOKENS = 4 + DERIVED_MAX_COLUMNS,
+};
+
+// One source row while grouping, keyed by the raw bytes of its group column.
+typedef struct GroupEntry {
+  const uint8_t* key;
+  unsigned key_len;
+  uint8_t key_type;
+  unsigned row;
+} GroupEntry;
+
+// Running value of one aggregate over a group.
+typedef struct Accumulator {
+  unsigned seen;
+  unsigned is_int;
+  int64_t integer;
+  double number;
+} Accumulator;
+
+static Table* find_table(Data* data, const char* name, unsigned name_len);
+static unsigned split_column(Data* data, const char* token, Table** table, char* column, unsigned size);
+static unsigned parse_aggregate(const char* token, DerivedAggregate* aggregate);
+static unsigned parse_view(Derived* derived, Data* data, const char** tokens, unsigned count);
+static unsigned parse_where(Derived* derived, const char* token);
+static unsigned view_keeps_row(const Derived* derived, const uint8_t* row, unsigned row_len);
+static unsigned view_keeps_field(const Derived* derived, const RowField* field);
+static unsigned fill_join(Derived* derived, Table* table, struct TableSlot* slot,
+                          unsigned* min_id, unsigned* max_id);
+static unsigned fill_group(Derived* derived, Table* table, struct TableSlot* slot,
+                           unsigned* min_id, unsigned* max_id);
+static unsigned add_group_row(Derived* derived, Table* table, struct TableSlot* slot,
+                              struct TableSlot* source, RowBuilder* builder,
+                              const GroupEntry* first, unsigned count,
+                              unsigned* min_id, unsigned* max_id);
+static unsigned fill_view(Derived* derived, Table* table, struct TableSlot* slot,
+                          unsigned* min_id, unsigned* max_id);
+static int compare_group_entries(const void* a, const void* b);
+
+Derived* derived_build(const char* definition, Data* data, Table* table) {
+  Derived* derived = 0;
+  char* copy = 0;
+  unsigned bad = 0;
+  do {
+    derived = calloc(1, sizeof(Derived));
+    if (!derived) {
+      LOG_WARN("Could not allocate Derived object");
+      break;
+    }
+    int wrote = snprintf(derived->definition, sizeof(derived->definition), "%s", definition);
+    if (wrote < 0 || (size_t)wrote >= sizeof(derived->definition)) {
+      ++bad;
+      break;
+    }
+    copy = strdup(definition);
+    if (!copy) {
+      LOG_WARN("Could not duplicate derived table definition");
+      ++bad;
+      break;
+    }
+
+    const char* tokens[MAX_TOKENS];
+    unsigned token_count = 0;
+    char* ctx = 0;
+    for (char* tok = strtok_r(copy, " \t", &ctx); tok; tok = strtok_r(NULL, " \t", &ctx)) {
+      if (token_count >= MAX_TOKENS) {
+        LOG_WARN("Too many terms in derived table definition [%s]", definition);
+        ++bad;
+        break;
+      }
+      tokens[token_count++] = tok;
+    }
+    if (bad) break;
+    if (token_count < 2) {
+      LOG_WARN("Derived table definition [%s] names no source", definition);
+      ++bad;
+      break;
+    }
+
+    if (strcasecmp(tokens[0], "view") == 0) {
+      // A view names its source table alone
+      derived->kind = DERIVED_VIEW;
+      if (!parse_view(derived, data, tokens, token_count)) {
+        LOG_WARN("Invalid view definition [%s]", definition);
+        ++bad;
+        break;
+      }
+    } else if (!split_column(data, tokens[1], &derived->source, derived->column, sizeof(derived->column))) {
+      ++bad;
+      break;
+    } else if (strcasecmp(tokens[0], "join") == 0) {
+      derived->kind = DERIVED_JOIN;
+      char column[MELIAN_MAX_NAME_LEN];
+      if (token_count != 3) {
+        LOG_WARN("A join needs exactly two columns: [%s]", definition);
+        ++bad;
+        break;
+      }
+      if (!split_column(data, tokens[2], &derived->other, column, sizeof(column))) {
+        ++bad;
+        break;
+      }
+      unsigned found = 0;
+      for (unsigned idx = 0; idx < derived->other->index_count; ++idx) {
+        if (derived->other->indexes[idx].type == CONFIG_INDEX_TYPE_GEO ||
+            derived->other->indexes[idx].type == CONFIG_INDEX_TYPE_TRIGRAM ||
+            derived->other->indexes[idx].type == CONFIG_INDEX_TYPE_GROUP) continue;
+        if (strcmp(derived->other->indexes[idx].column, column) != 0) continue;
+        derived->other_index = idx;
+        found = 1;
+        break;
+      }
+      if (!found) {
+        LOG_WARN("Table %s has no index on column %s to join on", derived->other->name, column);
+        ++bad;
+        break;
+      }
+    } else if (strcasecmp(tokens[0], "group") == 0) {
+      derived->kind = DERIVED_GROUP;
+      for (unsigned t = 2; t < token_count; ++t) {
+        if (!parse_aggregate(tokens[t], &derived->aggregates[derived->aggregate_count])) {
+          LOG_WARN("Invalid aggregate [%s] in derived table definition [%s]", tokens[t], definition);
+          ++bad;
+          break;
+        }
+        ++derived->aggregate_count;
+      }
+      if (bad) break;
+    } else {
+      LOG_WARN("Unknown derived table kind [%s], expected join, group or view", tokens[0]);
+      ++bad;
+      break;
+    }
+
+    if (derived->source == table || derived->other == table) {
+      LOG_WARN("Derived table %s cannot be built from itself", table->name);
+      ++bad;
+      break;
+    }
+  } while (0);
+  if (copy) free(copy);
+  if (bad) {
+    derived_destroy(derived);
+    derived = 0;
+  }
+  return derived;
+}
+
+void derived_destroy(Derived* derived) {
+  if (!derived) return;
+  free(derived);
+}
+
+void derived_invalidate(Derived* derived) {
+  derived->source_loads = (unsigned)-1;
+}
+
+unsigned derived_stale(const Derived* derived) {
+  // Wait until every source has been loaded at least once
+  if (!derived->source->stats.loads) return 0;
+  if (derived->other && !derived->other->stats.loads) return 0;
+  if (derived->source->stats.loads != derived->source_loads) return 1;
+  if (derived->other && derived->other->stats.loads != derived->other_loads) return 1;
+  return 0;
+}
+
+unsigned derived_row_estimate(const Derived* derived) {
+  return derived->source->stats.rows;
+}
+
+unsigned derived_fill(Derived* derived, Table* table, struct TableSlot* slot,
+                      unsigned* min_id, unsigned* max_id) {
+  derived->source_loads = derived->source->stats.loads;
+  if (derived->other) derived->other_loads = derived->other->stats.loads;
+  switch (derived->kind) {
+    case DERIVED_JOIN:
+      return fill_join(derived, table, slot, min_id, max_id);
+    case DERIVED_VIEW:
+      return fill_view(derived, table, slot, min_id, max_id);
+    case DERIVED_GROUP:
+    default:
+      return fill_group(derived, table, slot, min_id, max_id);
+  }
+}
+
+static Table* find_table(Data* data, const char* name, unsigned name_len) {
+  for (unsigned t = 0; t < data->table_count; ++t) {
+    Table* table = data->tables[t];
+    if (strlen(table->name) == name_len && strncasecmp(table->name, name, name_len) == 0) return table;
+  }
+  return 0;
+}
+
+// Split TABLE.COLUMN and resolve the table.
+static unsigned split_column(Data* data, const char* token, Table** table, char* column, unsigned size) {
+  const char* dot = strchr(token, '.');
+  if (!dot || dot == token || !dot[1]) {
+    LOG_WARN("Expected TABLE.COLUMN in derived table definition, got [%s]", token);
+    return 0;
+  }
+  *table = find_table(data, token, (unsigned)(dot - token));
+  if (!*table) {
+    LOG_WARN("Derived table definition references unknown table [%.*s]", (int)(dot - token), token);
+    return 0;
+  }
+  int wrote = snprintf(column, size, "%s", dot + 1);
+  if (wrote < 0 || (unsigned)wrote >= size) return 0;
+  return 1;
+}
+
+// Parse count, sum(col), min(col) or max(col).
+static unsigned parse_aggregate(const char* token, DerivedAggregate* aggregate) {
+  static const struct {
+    const char* name;
+    DerivedAggregateKind kind;
+  } kinds[] = {
+    { "sum", DERIVED_SUM },
+    { "min", DERIVED_MIN },
+    { "max", DERIVED_MAX },
+  };
+
+  if (strcasecmp(token, "count") == 0) {
+    aggregate->kind = DERIVED_COUNT;
+    aggregate->column[0] = '\0';
+    snprintf(aggregate->name, sizeof(aggregate->name), "count");
+    return 1;
+  }
+  const char* open = strchr(token, '(');
+  unsigned len = strlen(token);
+  if (!open || len < 2 || token[len - 1] != ')' || open + 1 >= token + len - 1) return 0;
+  for (unsigned k = 0; k < ALEN(kinds); ++k) {
+    if (strlen(kinds[k].name) != (size_t)(open - token) ||
+        strncasecmp(token, kinds[k].name, open - token) != 0) continue;
+    unsigned column_len = (unsigned)(token + len - 1 - (open + 1));
+    if (column_len >= sizeof(aggregate->column)) return 0;
+    aggregate->kind = kinds[k].kind;
+    memcpy(aggregate->column, open + 1, column_len);
+    aggregate->column[column_len] = '\0';
+    int wrote = snprintf(aggregate->name, sizeof(aggregate->name), "%s_%.*s",
+                         kinds[k].name, (int)column_len, open + 1);
+    return wrote > 0 && (size_t)wrote < sizeof(aggregate->name);
+  }
+  return 0;
+}
+
+// Parse view SOURCE [COLUMN...] [where CONDITION].
+static unsigned parse_view(Derived* derived, Data* data, const char** tokens, unsigned count) {
+  derived->source = find_table(data, tokens[1], strlen(tokens[1]));
+  if (!derived->source) {
+    LOG_WARN("Derived table definition references unknown table [%s]", tokens[1]);
+    return 0;
+  }
+  for (unsigned t = 2; t < count; ++t) {
+    if (strcasecmp(tokens[t], "where") == 0) {
+      // The filter comes last
+      return t + 2 == count && parse_where(derived, tokens[t + 1]);
+    }
+    if (derived->column_count >= DERIVED_MAX_COLUMNS) {
+      LOG_WARN("A view keeps at most %u columns", DERIVED_MAX_COLUMNS);
+      return 0;
+    }
+    int wrote = snprintf(derived->columns[derived->column_count], MELIAN_MAX_NAME_LEN, "%s", tokens[t]);
+    if (wrote < 0 || wrote >= MELIAN_MAX_NAME_LEN) return 0;
+    ++derived->column_count;
+  }
+  return 1;
+}
+
+// Parse COLUMN=VALUE or COLUMN!=VALUE.
+static unsigned parse_where(Derived* derived, const char* token) {
+  const char* eq = strchr(token, '=');
+  if (!eq) return 0;
+  const char* end = eq;
+  if (end > token && end[-1] == '!') {
+    derived->where_negate = 1;
+    --end;
+  }
+  if (end == token) return 0;
+  int wrote = snprintf(derived->where_column, sizeof(derived->where_column), "%.*s",
+                       (int)(end - token), token);
+  if (wrote < 0 || (size_t)wrote >= sizeof(derived->where_column)) return 0;
+  wrote = snprintf(derived->where_value, sizeof(derived->where_value), "%s", eq + 1);
+  return wrote >= 0 && (size_t)wrote < sizeof(derived->where_value);
+}
+
+// Same test as an index filter: the field's value as text, a missing or
+// NULL field being equal to nothing.
+static unsigned view_keeps_row(const Derived* derived, const uint8_t* row, unsigned row_len) {
+  RowField field;
+  unsigned equal = 0;
+  if (row_find_field(row, row_len, derived->where_column, strlen(derived->where_column), &field) &&
+      field.type != MELIAN_VALUE_NULL) {
+    char text[MAX_KEY_TEXT_LEN];
+    const uint8_t* bytes = 0;
+    unsigned len = 0;
+    if (!row_field_bytes(&field, text, sizeof(text), &bytes, &len)) len = 0;
+    equal = len == strlen(derived->where_value) && memcmp(bytes, derived->where_value, len) == 0;
+  }
+  return derived->where_negate ? !equal : equal;
+}
+
+static unsigned view_keeps_field(const Derived* derived, const RowField* field) {
+  for (unsigned c = 0; c < derived->column_count; ++c) {
+    const char* column = derived->columns[c];
+    if (strlen(column) == field->name_len && memcmp(column, field->name, field->name_len) == 0) return 1;
+  }
+  return 0;
+}
+
+static unsigned fill_join(Derived* derived, Table* table, struct TableSlot* slot,
+                          unsigned* min_id, unsigned* max_id) {
+  Table* left = derived->source;
+  Table* right = derived->other;
+  struct TableSlot* left_slot = &left->slots[left->current_slot];
+  struct TableSlot* right_slot = &right->slots[right->current_slot];
+  Hash* hash = right_slot->indexes[derived->other_index];
+  ConfigIndexType key_type = right->indexes[derived->other_index].type;
+  unsigned column_len = strlen(derived->column);
+  RowBuilder builder = {0};
+  unsigned rows = 0;
+  unsigned bad = 0;
+
+  for (unsigned r = 0; r < left_slot->row_count; ++r) {
+    const uint8_t* row = 0;
+    unsigned row_len = table_slot_row(left_slot, r, &row);
+    RowField field;
+    if (!row_find_field(row, row_len, derived->column, column_len, &field)) continue;
+    if (field.type == MELIAN_VALUE_NULL) continue;
+
+    const Bucket* bucket = 0;
+    if (key_type == CONFIG_INDEX_TYPE_INT) {
+      unsigned key_int = 0;
+      if (!row_field_uint(&field, &key_int)) continue;
+      bucket = hash_find(hash, &key_int, sizeof(unsigned));
+    } else {
+      char text[MAX_KEY_TEXT_LEN];
+      const uint8_t* key = 0;
+      unsigned key_len = 0;
+      if (!row_field_bytes(&field, text, sizeof(text), &key, &key_len)) continue;
+      bucket = hash_find(hash, key, key_len);
+    }
+    if (!bucket) continue;
+    const uint8_t* other = bucket->frame_ptr + sizeof(unsigned);
+    unsigned other_len = bucket->frame_len - sizeof(unsigned);
+
+    if (!row_builder_reset(&builder)) {
+      ++bad;
+      break;
+    }
+    unsigned pos = 0;
+    while (row_next_field(row, row_len, &pos, &field)) {
+      if (!row_builder_add(&builder, field.name, field.name_len, field.type,
+                           field.value, field.value_len)) ++bad;
+    }
+    pos = 0;
+    while (row_next_field(other, other_len, &pos, &field)) {
+      RowField dup;
+      if (row_find_field(row, row_len, (const char*)field.name, field.name_len, &dup)) continue;
+      if (!row_builder_add(&builder, field.name, field.name_len, field.type,
+                           field.value, field.value_len)) ++bad;
+    }
+    if (bad) {
+      LOG_WARN("Could not build joined row for table %s", table->name);
+      break;
+    }
+    unsigned len = 0;
+    const uint8_t* joined = row_builder_finish(&builder, &len);
+    if (!table_slot_add_row(table, slot, joined, len, min_id, max_id)) {
+      ++bad;
+      break;
+    }
+    ++rows;
+  }
+  row_builder_free(&builder);
+  return bad ? (unsigned)-1 : rows;
+}
+
+// Rows that keep all their fields are stored as they are; the others are
+// rebuilt with just the fields the view keeps, in the source's order.
+static unsigned fill_view(Derived* derived, Table* table, struct TableSlot* slot,
+                          unsigned* min_id, unsigned* max_id) {
+  Table* source = derived->source;
+  struct TableSlot* source_slot = &source->slots[source->current_slot];
+  RowBuilder builder = {0};
+  unsigned rows = 0;
+  unsigned bad = 0;
+
+  for (unsigned r = 0; r < source_slot->row_count; ++r) {
+    const uint8_t* row = 0;
+    unsigned row_len = table_slot_row(source_slot, r, &row);
+    if (derived->where_column[0] && !view_keeps_row(derived, row, row_len)) continue;
+    if (derived->column_count) {
+      if (!row_builder_reset(&builder)) {
+        ++bad;
+        break;
+      }
+      unsigned pos = 0;
+      RowField field;
+      while (row_next_field(row, row_len, &pos, &field)) {
+        if (!view_keeps_field(derived, &field)) continue;
+        if (!row_builder_add(&builder, field.name, field.name_len, field.type,
+                             field.value, field.value_len)) ++bad;
+      }
+      if (bad) {
+        LOG_WARN("Could not build projected row for table %s", table->name);
+        break;
+      }
+      row = row_builder_finish(&builder, &row_len);
+    }
+    if (!table_slot_add_row(table, slot, row, row_len, min_id, max_id)) {
+      ++bad;
+      break;
+    }
+    ++rows;
+  }
+  row_builder_free(&builder);
+  return bad ? (unsigned)-1 : rows;
+}
+
+static unsigned fill_group(Derived* derived, Table* table, struct TableSlot* slot,
+                           unsigned* min_id, unsigned* max_id) {
+  Table* source = derived->source;
+  struct TableSlot* source_slot = &source->slots[source->current_slot];
+  unsigned column_len = strlen(derived->column);
+  GroupEntry* entries = 0;
+  RowBuilder builder = {0};
+  unsigned rows = 0;
+  unsigned bad = 0;
+  do {
+    if (!source_slot->row_count) break;
+    entries = malloc(source_slot->row_count * sizeof(GroupEntry));
+    if (!entries) {
+      LOG_WARN("Could not allocate %u group entries for table %s", source_slot->row_count, table->name);
+      ++bad;
+      break;
+    }
+
+    unsigned count = 0;
+    for (unsigned r = 0; r < source_slot->row_count; ++r) {
+      const uint8_t* row = 0;
+      unsigned row_len = table_slot_row(source_slot, r, &row);
+      RowField field;
+      if (!row_find_field(row, row_len, derived->column, column_len, &field)) continue;
+      if (field.type == MELIAN_VALUE_NULL) continue;
+      entries[count].key = field.value;
+      entries[count].key_len = field.value_len;
+      entries[count].key_type = field.type;
+      entries[count].row = r;
+      ++count;
+    }
+    qsort(entries, count, sizeof(GroupEntry), compare_group_entries);
+
+    for (unsigned start = 0; start < count; ) {
+      unsigned end = start + 1;
+      while (end < count && compare_group_entries(&entries[start], &entries[end]) == 0) ++end;
+      if (!add_group_row(derived, table, slot, source_slot, &builder,
+                         &entries[start], end - start, min_id, max_id)) {
+        ++bad;
+        break;
+      }
+      ++rows;
+      start = end;
+    }
+  } while (0);
+  if (entries) free(entries);
+  row_builder_free(&builder);
+  return bad ? (unsigned)-1 : rows;
+}
+
+static unsigned add_group_row(Derived* derived, Table* table, struct TableSlot* slot,
+                              struct TableSlot* source, RowBuilder* builder,
+                              const GroupEntry* first, unsigned count,
+                              unsigned* min_id, unsigned* max_id) {
+  if (!row_builder_reset(builder)) return 0;
+  unsigned bad = 0;
+  if (!row_builder_add(builder, (const uint8_t*)derived->column, strlen(derived->column),
+                       first->key_type, first->key, first->key_len)) ++bad;
+
+  for (unsigned a = 0; !bad && a < derived->aggregate_count; ++a) {
+    const DerivedAggregate* aggregate = &derived->aggregates[a];
+    if (aggregate->kind == DERIVED_COUNT) {
+      if (!row_builder_add_int(builder, aggregate->name, count)) ++bad;
+      continue;
+    }
+    Accumulator acc = { 0, 1, 0, 0 };
+    unsigned column_len = strlen(aggregate->column);
+    for (unsigned e = 0; e < count; ++e) {
+      const uint8_t* row = 0;
+      unsigned row_len = table_slot_row(source, first[e].row, &row);
+      RowField field;
+      double number = 0;
+      int64_t integer = 0;
+      unsigned is_int = 0;
+      if (!row_find_field(row, row_len, aggregate->column, column_len, &field)) continue;
+      if (!row_field_number(&field, &number, &integer, &is_int)) continue;
+      if (!is_int) acc.is_int = 0;
+      if (!acc.seen) {
+        acc.integer = integer;
+        acc.number = number;
+      } else if (aggregate->kind == DERIVED_SUM) {
+        acc.integer += integer;
+        acc.number += number;
+      } else if (aggregate->kind == DERIVED_MIN ? number < acc.number : number > acc.number) {
+        acc.integer = integer;
+        acc.number = number;
+      }
+      ++acc.seen;
+    }
+    unsigned ok = 0;
+    if (!acc.seen) {
+      ok = row_builder_add(builder, (const uint8_t*)aggregate->name, strlen(aggregate->name),
+                           MELIAN_VALUE_NULL, 0, 0);
+    } else if (acc.is_int) {
+      ok = row_builder_add_int(builder, aggregate->name, acc.integer);
+    } else {
+      ok = row_builder_add_float(builder, aggregate->name, acc.number);
+    }
+    if (!ok) ++bad;
+  }
+  if (bad) {
+    LOG_WARN("Could not build grouped row for table %s", table->name);
+    return 0;
+  }
+  unsigned len = 0;
+  const uint8_t* row = row_builder_finish(builder, &len);
+  return table_slot_add_row(table, slot, row, len, min_id, max_id);
+}
+
+static int compare_group_entries(const void* a, const void* b) {
+  const GroupEntry* ea = a;
+  const GroupEntry* eb = b;
+  if (ea->key_type != eb->key_type) return ea->key_type < eb->key_type ? -1 : 1;
+  if (ea->key_len != eb->key_len) return ea->key_len < eb->key_len ? -1 : 1;
+  return memcmp(ea->key, eb->key, ea->key_len);
+}
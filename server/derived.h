@@ -0,0 +1,84 @@
+#pragma once
+
+// A Derived table is computed in-process from tables Melian already holds,
+// instead of being loaded from the database. It is rebuilt whenever one of
+// its sources reloads, then indexed and swapped like any other table.
+// Definitions are one of:
+//   join LEFT.COLUMN RIGHT.COLUMN
+//     One row per LEFT row whose COLUMN value is found in RIGHT's index on
+//     COLUMN, with the fields of both rows (RIGHT fields already present in
+//     LEFT are left out).
+//   group SOURCE.COLUMN AGGREGATE...
+//     One row per distinct COLUMN value in SOURCE, holding that value and
+//     the aggregates: count, sum(col), min(col), max(col), named count,
+//     sum_col, min_col, max_col. Non-numeric values are ignored.
+//   view SOURCE [COLUMN...] [where COLUMN=VALUE | where COLUMN!=VALUE]
+//     The rows of SOURCE, keeping only the listed fields (all if none) and
+//     only the rows that pass the filter, which compares values as text like
+//     an index filter does. SOURCE is queried once, and the view gets its own
+//     indexes over its own copy of the rows.
+
+#include "config.h"
+
+struct Data;
+struct Table;
+struct TableSlot;
+
+enum {
+  DERIVED_MAX_AGGREGATES = 16,
+  DERIVED_MAX_COLUMNS = 32,
+};
+
+typedef enum DerivedKind {
+  DERIVED_JOIN,
+  DERIVED_GROUP,
+  DERIVED_VIEW,
+} DerivedKind;
+
+typedef enum DerivedAggregateKind {
+  DERIVED_COUNT,
+  DERIVED_SUM,
+  DERIVED_MIN,
+  DERIVED_MAX,
+} DerivedAggregateKind;
+
+typedef struct DerivedAggregate {
+  DerivedAggregateKind kind;
+  char column[MELIAN_MAX_NAME_LEN];   // aggregated column; empty for count
+  char name[MELIAN_MAX_NAME_LEN];     // name of the output field
+} DerivedAggregate;
+
+typedef struct Derived {
+  char definition[MELIAN_MAX_SELECT_LEN];
+  DerivedKind kind;
+  struct Table* source;    // LEFT of a join, SOURCE of a group or view
+  char column[MELIAN_MAX_NAME_LEN];
+  struct Table* other;     // RIGHT of a join
+  unsigned other_index;    // position of RIGHT's index on the join column
+  unsigned aggregate_count;
+  DerivedAggregate aggregates[DERIVED_MAX_AGGREGATES];
+  unsigned column_count;   // fields a view keeps; 0 for all of them
+  char columns[DERIVED_MAX_COLUMNS][MELIAN_MAX_NAME_LEN];
+  char where_column[MELIAN_MAX_NAME_LEN];  // rows a view keeps; empty for all
+  char where_value[MELIAN_MAX_NAME_LEN];
+  unsigned where_negate;   // filter is column!=value
+  unsigned source_loads;   // source loads seen by the last build
+  unsigned other_loads;
+} Derived;
+
+// Parse definition for table, resolving its sources among the tables in data.
+Derived* derived_build(const char* definition, struct Data* data, struct Table* table);
+void derived_destroy(Derived* derived);
+
+// Return 1 if a source has reloaded since the last build.
+unsigned derived_stale(const Derived* derived);
+
+// Force a rebuild on the next pass, even if no source has reloaded.
+void derived_invalidate(Derived* derived);
+
+// Upper bound on the number of rows the next build will produce.
+unsigned derived_row_estimate(const Derived* derived);
+
+// Compute the rows of table into slot; return the row count, or -1 on failure.
+unsigned derived_fill(Derived* derived, struct Table* table, struct TableSlot* slot,
+                      unsigned* min_id, unsigned* max_id);
@@ -0,0 +1,579 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "log.h"
+#include "row.h"
+#include "xxhash.h"
+#include "protocol.h"
+#include "expr.h"
+
+typedef struct Parser {
+  Expr* expr;
+  const char* pos;
+  const char* end;
+  const char* error;
+} Parser;
+
+typedef struct EvalContext {
+  const uint8_t* row;
+  unsigned row_len;
+  const uint8_t* key;          // stands for the only column, if set
+  unsigned key_len;
+  ExprScratch* scratch;
+} EvalContext;
+
+static const struct {
+  const char* name;
+  ExprOp op;
+  unsigned min_args;
+  unsigned max_args;
+} functions[] = {
+  { "lower",     EXPR_OP_LOWER,     1, 1 },
+  { "upper",     EXPR_OP_UPPER,     1, 1 },
+  { "trim",      EXPR_OP_TRIM,      1, 1 },
+  { "concat",    EXPR_OP_CONCAT,    1, EXPR_MAX_ARGS },
+  { "substring", EXPR_OP_SUBSTRING, 2, 3 },
+  { "cast",      EXPR_OP_CAST,      2, 2 },
+  { "hash",      EXPR_OP_HASH,      1, 1 },
+};
+
+static int parse_term(Parser* p);
+static int parse_call(Parser* p, const char* name, unsigned name_len);
+static int new_node(Parser* p, ExprOp op);
+static unsigned pool_add(Parser* p, const char* text, unsigned len, unsigned unquote, unsigned* added);
+static void skip_blanks(Parser* p);
+static unsigned is_name_char(char c, unsigned first);
+static unsigned is_blank(char c);
+static void find_column(Expr* expr);
+static unsigned eval_node(const Expr* expr, unsigned n, EvalContext* ctx, ExprValue* value);
+static unsigned eval_column(const Expr* expr, const ExprNode* node, EvalContext* ctx, ExprValue* value);
+static unsigned eval_cast(ExprValue* value, ExprType type, ExprScratch* scratch);
+static uint8_t* scratch_reserve(ExprScratch* scratch, unsigned len);
+
+Expr* expr_build(const char* source, unsigned len) {
+  Expr* expr = 0;
+  unsigned bad = 0;
+  do {
+    if (len >= EXPR_MAX_POOL) {
+      LOG_WARN("Expression [%.*s] exceeds %u bytes", len, source, EXPR_MAX_POOL - 1);
+      break;
+    }
+    expr = calloc(1, sizeof(Expr));
+    if (!expr) {
+      LOG_WARN("Could not allocate Expr object");
+      break;
+    }
+    memcpy(expr->source, source, len);
+    expr->source[len] = '\0';
+
+    Parser p = { expr, expr->source, expr->source + len, 0 };
+    int root = parse_term(&p);
+    skip_blanks(&p);
+    if (root >= 0 && p.pos < p.end) p.error = "unexpected text after expression";
+    if (p.error) {
+      LOG_WARN("Invalid expression [%s] at offset %u: %s",
+               expr->source, (unsigned)(p.pos - expr->source), p.error);
+      ++bad;
+      break;
+    }
+    expr->root = (unsigned)root;
+    find_column(expr);
+  } while (0);
+  if (bad) {
+    expr_destroy(expr);
+    expr = 0;
+  }
+  return expr;
+}
+
+void expr_destroy(Expr* expr) {
+  if (!expr) return;
+  free(expr);
+}
+
+unsigned expr_next_definition(const char** list, char* name, unsigned name_size,
+                              char* source, unsigned source_size) {
+  const char* p = *list;
+  while (*p && (is_blank(*p) || *p == ',')) ++p;
+  if (!*p) {
+    *list = p;
+    return 0;
+  }
+
+  const char* eq = strchr(p, '=');
+  if (!eq) {
+    *list = 0;
+    return 0;
+  }
+  const char* name_end = eq;
+  while (name_end > p && is_blank(name_end[-1])) --name_end;
+  unsigned name_len = (unsigned)(name_end - p);
+  if (!name_len || name_len >= name_size) {
+    *list = 0;
+    return 0;
+  }
+  for (unsigned j = 0; j < name_len; ++j) {
+    if (!is_name_char(p[j], j == 0)) {
+      *list = 0;
+      return 0;
+    }
+  }
+  memcpy(name, p, name_len);
+  name[name_len] = '\0';
+
+  // The expression runs up to the next comma outside parentheses and quotes
+  const char* start = eq + 1;
+  while (is_blank(*start)) ++start;
+  const char* q = start;
+  unsigned depth = 0;
+  unsigned quoted = 0;
+  for (; *q; ++q) {
+    if (quoted) {
+      if (*q == '\'') quoted = 0;
+    } else if (*q == '\'') {
+      quoted = 1;
+    } else if (*q == '(') {
+      ++depth;
+    } else if (*q == ')') {
+      if (depth) --depth;
+    } else if (*q == ',' && !depth) {
+      break;
+    }
+  }
+  const char* end = q;
+  while (end > start && is_blank(end[-1])) --end;
+  unsigned source_len = (unsigned)(end - start);
+  if (!source_len || source_len >= source_size) {
+    *list = 0;
+    return 0;
+  }
+  memcpy(source, start, source_len);
+  source[source_len] = '\0';
+  *list = q;
+  return 1;
+}
+
+const char* expr_column(const Expr* expr, unsigned* len) {
+  if (expr->column < 0) return 0;
+  const ExprNode* node = &expr->nodes[expr->column];
+  *len = node->len;
+  return expr->pool + node->pos;
+}
+
+unsigned expr_eval(const Expr* expr, const uint8_t* row, unsigned row_len,
+                   ExprScratch* scratch, ExprValue* value) {
+  EvalContext ctx = { row, row_len, 0, 0, scratch };
+  scratch->used = 0;
+  return eval_node(expr, expr->root, &ctx, value);
+}
+
+unsigned expr_eval_key(const Expr* expr, const uint8_t* key, unsigned len,
+                       ExprScratch* scratch, ExprValue* value) {
+  EvalContext ctx = { 0, 0, key, len, scratch };
+  scratch->used = 0;
+  return eval_node(expr, expr->root, &ctx, value);
+}
+
+unsigned expr_value_text(ExprValue* value, ExprScratch* scratch) {
+  char buf[32];
+  int wrote = 0;
+  switch (value->type) {
+    case EXPR_TEXT:
+      return 1;
+    case EXPR_INT:
+      wrote = snprintf(buf, sizeof(buf), "%lld", (long long)value->integer);
+      break;
+    case EXPR_FLOAT:
+      wrote = snprintf(buf, sizeof(buf), "%.17g", value->number);
+      break;
+    default:
+      return 0;
+  }
+  if (wrote <= 0 || (size_t)wrote >= sizeof(buf)) return 0;
+  uint8_t* text = scratch_reserve(scratch, (unsigned)wrote);
+  if (!text) return 0;
+  memcpy(text, buf, (unsigned)wrote);
+  value->type = EXPR_TEXT;
+  value->text = text;
+  value->len = (unsigned)wrote;
+  return 1;
+}
+
+static int parse_term(Parser* p) {
+  skip_blanks(p);
+  if (p->pos >= p->end) {
+    p->error = "expression expected";
+    return -1;
+  }
+
+  char c = *p->pos;
+  if (c == '\'') {
+    const char* start = ++p->pos;
+    unsigned doubled = 0;
+    while (1) {
+      if (p->pos >= p->end) {
+        p->error = "unterminated text";
+        return -1;
+      }
+      if (*p->pos == '\'') {
+        if (p->pos + 1 < p->end && p->pos[1] == '\'') {
+          p->pos += 2;
+          doubled = 1;
+          continue;
+        }
+        break;
+      }
+      ++p->pos;
+    }
+    unsigned len = (unsigned)(p->pos - start);
+    ++p->pos;
+    int n = new_node(p, EXPR_OP_TEXT);
+    if (n < 0) return -1;
+    ExprNode* node = &p->expr->nodes[n];
+    node->pos = pool_add(p, start, len, doubled, &node->len);
+    return p->error ? -1 : n;
+  }
+
+  if (c == '-' || (c >= '0' && c <= '9')) {
+    char* end = 0;
+    long long v = strtoll(p->pos, &end, 10);
+    if (end == p->pos) {
+      p->error = "number expected";
+      return -1;
+    }
+    p->pos = end;
+    int n = new_node(p, EXPR_OP_INT);
+    if (n < 0) return -1;
+    p->expr->nodes[n].integer = v;
+    return n;
+  }
+
+  if (!is_name_char(c, 1)) {
+    p->error = "column, text, number or function expected";
+    return -1;
+  }
+  const char* name = p->pos;
+  while (p->pos < p->end && is_name_char(*p->pos, 0)) ++p->pos;
+  unsigned name_len = (unsigned)(p->pos - name);
+  skip_blanks(p);
+  if (p->pos < p->end && *p->pos == '(') return parse_call(p, name, name_len);
+
+  int n = new_node(p, EXPR_OP_COLUMN);
+  if (n < 0) return -1;
+  ExprNode* node = &p->expr->nodes[n];
+  node->pos = pool_add(p, name, name_len, 0, &node->len);
+  return p->error ? -1 : n;
+}
+
+// Cursor is on the opening parenthesis of a call to name.
+static int parse_call(Parser* p, const char* name, unsigned name_len) {
+  unsigned f = 0;
+  for (; f < sizeof(functions) / sizeof(functions[0]); ++f) {
+    if (strlen(functions[f].name) == name_len &&
+        strncasecmp(functions[f].name, name, name_len) == 0) break;
+  }
+  if (f >= sizeof(functions) / sizeof(functions[0])) {
+    p->pos = name;
+    p->error = "unknown function";
+    return -1;
+  }
+  ++p->pos;
+
+  int n = new_node(p, functions[f].op);
+  if (n < 0) return -1;
+  unsigned args = 0;
+  while (1) {
+    skip_blanks(p);
+    if (args && p->pos < p->end && *p->pos == ')') break;
+    if (args >= functions[f].max_args) {
+      p->error = "too many arguments";
+      return -1;
+    }
+    if (functions[f].op == EXPR_OP_CAST && args == 1) {
+      // The second argument of cast is a type name
+      const char* type = p->pos;
+      while (p->pos < p->end && is_name_char(*p->pos, 0)) ++p->pos;
+      unsigned type_len = (unsigned)(p->pos - type);
+      ExprNode* node = &p->expr->nodes[n];
+      if (type_len == 3 && strncasecmp(type, "int", 3) == 0) {
+        node->integer = EXPR_INT;
+      } else if (type_len == 5 && strncasecmp(type, "float", 5) == 0) {
+        node->integer = EXPR_FLOAT;
+      } else if (type_len == 6 && strncasecmp(type, "string", 6) == 0) {
+        node->integer = EXPR_TEXT;
+      } else {
+        p->pos = type;
+        p->error = "cast type must be int, float or string";
+        return -1;
+      }
+      ++args;
+    } else {
+      int arg = parse_term(p);
+      if (arg < 0) return -1;
+      p->expr->nodes[n].args[p->expr->nodes[n].arg_count++] = (unsigned)arg;
+      ++args;
+    }
+    skip_blanks(p);
+    if (p->pos < p->end && *p->pos == ',') {
+      ++p->pos;
+      continue;
+    }
+    if (p->pos < p->end && *p->pos == ')') break;
+    p->error = "',' or ')' expected";
+    return -1;
+  }
+  ++p->pos;
+  if (args < functions[f].min_args) {
+    p->error = "too few arguments";
+    return -1;
+  }
+  return n;
+}
+
+static int new_node(Parser* p, ExprOp op) {
+  Expr* expr = p->expr;
+  if (expr->node_count >= EXPR_MAX_NODES) {
+    p->error = "expression too long";
+    return -1;
+  }
+  unsigned n = expr->node_count++;
+  memset(&expr->nodes[n], 0, sizeof(ExprNode));
+  expr->nodes[n].op = op;
+  return (int)n;
+}
+
+// Copy text into the pool, turning '' into ' if unquote is set.
+// Return its position, and its length in added.
+static unsigned pool_add(Parser* p, const char* text, unsigned len, unsigned unquote, unsigned* added) {
+  Expr* expr = p->expr;
+  unsigned pos = expr->pool_len;
+  *added = 0;
+  if (pos + len + 1 > EXPR_MAX_POOL) {
+    p->error = "expression too long";
+    return pos;
+  }
+  for (unsigned j = 0; j < len; ++j) {
+    expr->pool[pos + (*added)++] = text[j];
+    if (unquote && text[j] == '\'') ++j;
+  }
+  expr->pool[pos + *added] = '\0';
+  expr->pool_len = pos + *added + 1;
+  return pos;
+}
+
+static void skip_blanks(Parser* p) {
+  while (p->pos < p->end && is_blank(*p->pos)) ++p->pos;
+}
+
+static unsigned is_name_char(char c, unsigned first) {
+  if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') return 1;
+  return !first && c >= '0' && c <= '9';
+}
+
+static unsigned is_blank(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Remember the column node if every column node names the same column.
+static void find_column(Expr* expr) {
+  expr->column = -1;
+  for (unsigned n = 0; n < expr->node_count; ++n) {
+    const ExprNode* node = &expr->nodes[n];
+    if (node->op != EXPR_OP_COLUMN) continue;
+    if (expr->column < 0) {
+      expr->column = (int)n;
+      continue;
+    }
+    const ExprNode* seen = &expr->nodes[expr->column];
+    if (seen->len != node->len ||
+        memcmp(expr->pool + seen->pos, expr->pool + node->pos, node->len) != 0) {
+      expr->column = -1;
+      return;
+    }
+  }
+}
+
+static unsigned eval_node(const Expr* expr, unsigned n, EvalContext* ctx, ExprValue* value) {
+  const ExprNode* node = &expr->nodes[n];
+  memset(value, 0, sizeof(*value));
+  switch (node->op) {
+    case EXPR_OP_COLUMN:
+      return eval_column(expr, node, ctx, value);
+
+    case EXPR_OP_TEXT:
+      value->type = EXPR_TEXT;
+      value->text = (const uint8_t*)expr->pool + node->pos;
+      value->len = node->len;
+      return 1;
+
+    case EXPR_OP_INT:
+      value->type = EXPR_INT;
+      value->integer = node->integer;
+      return 1;
+
+    case EXPR_OP_LOWER:
+    case EXPR_OP_UPPER: {
+      if (!eval_node(expr, node->args[0], ctx, value)) return 0;
+      if (value->type == EXPR_NULL) return 1;
+      if (!expr_value_text(value, ctx->scratch)) return 0;
+      uint8_t* text = scratch_reserve(ctx->scratch, value->len);
+      if (!text) return 0;
+      for (unsigned j = 0; j < value->len; ++j) {
+        uint8_t c = value->text[j];
+        if (node->op == EXPR_OP_LOWER && c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        if (node->op == EXPR_OP_UPPER && c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        text[j] = c;
+      }
+      value->text = text;
+      return 1;
+    }
+
+    case EXPR_OP_TRIM:
+      if (!eval_node(expr, node->args[0], ctx, value)) return 0;
+      if (value->type == EXPR_NULL) return 1;
+      if (!expr_value_text(value, ctx->scratch)) return 0;
+      while (value->len && is_blank((char)value->text[0])) {
+        ++value->text;
+        --value->len;
+      }
+      while (value->len && is_blank((char)value->text[value->len - 1])) --value->len;
+      return 1;
+
+    case EXPR_OP_CONCAT: {
+      ExprValue args[EXPR_MAX_ARGS];
+      unsigned total = 0;
+      for (unsigned a = 0; a < node->arg_count; ++a) {
+        if (!eval_node(expr, node->args[a], ctx, &args[a])) return 0;
+        if (args[a].type == EXPR_NULL) return 1;
+        if (!expr_value_text(&args[a], ctx->scratch)) return 0;
+        total += args[a].len;
+      }
+      uint8_t* text = scratch_reserve(ctx->scratch, total);
+      if (!text) return 0;
+      unsigned len = 0;
+      for (unsigned a = 0; a < node->arg_count; ++a) {
+        memcpy(text + len, args[a].text, args[a].len);
+        len += args[a].len;
+      }
+      value->type = EXPR_TEXT;
+      value->text = text;
+      value->len = len;
+      return 1;
+    }
+
+    case EXPR_OP_SUBSTRING: {
+      ExprValue start;
+      ExprValue count;
+      if (!eval_node(expr, node->args[0], ctx, value)) return 0;
+      if (!eval_node(expr, node->args[1], ctx, &start)) return 0;
+      if (node->arg_count > 2) {
+        if (!eval_node(expr, node->args[2], ctx, &count)) return 0;
+      } else {
+        count.type = EXPR_INT;
+        count.integer = value->len;
+      }
+      if (value->type == EXPR_NULL) return 1;
+      if (!expr_value_text(value, ctx->scratch)) return 0;
+      if (!eval_cast(&start, EXPR_INT, ctx->scratch) || !eval_cast(&count, EXPR_INT, ctx->scratch) ||
+          start.type != EXPR_INT || count.type != EXPR_INT) {
+        value->type = EXPR_NULL;
+        return 1;
+      }
+      int64_t from = start.integer < 1 ? 0 : start.integer - 1;
+      if (from > value->len) from = value->len;
+      int64_t len = count.integer < 0 ? 0 : count.integer;
+      if (len > value->len - from) len = value->len - from;
+      value->text += from;
+      value->len = (unsigned)len;
+      return 1;
+    }
+
+    case EXPR_OP_CAST:
+      if (!eval_node(expr, node->args[0], ctx, value)) return 0;
+      return eval_cast(value, (ExprType)node->integer, ctx->scratch);
+
+    case EXPR_OP_HASH:
+      if (!eval_node(expr, node->args[0], ctx, value)) return 0;
+      if (value->type == EXPR_NULL) return 1;
+      if (!expr_value_text(value, ctx->scratch)) return 0;
+      value->integer = (int64_t)XXH3_64bits(value->text, value->len, 0);
+      value->type = EXPR_INT;
+      return 1;
+  }
+  return 0;
+}
+
+static unsigned eval_column(const Expr* expr, const ExprNode* node, EvalContext* ctx, ExprValue* value) {
+  value->type = EXPR_NULL;
+  if (ctx->key) {
+    value->type = EXPR_TEXT;
+    value->text = ctx->key;
+    value->len = ctx->key_len;
+    return 1;
+  }
+
+  RowField field;
+  if (!row_find_field(ctx->row, ctx->row_len, expr->pool + node->pos, node->len, &field)) return 1;
+  switch (field.type) {
+    case MELIAN_VALUE_INT64:
+    case MELIAN_VALUE_BOOL:
+    case MELIAN_VALUE_FLOAT64: {
+      unsigned is_int = 0;
+      if (!row_field_number(&field, &value->number, &value->integer, &is_int)) return 1;
+      value->type = is_int ? EXPR_INT : EXPR_FLOAT;
+      return 1;
+    }
+    case MELIAN_VALUE_BYTES:
+    case MELIAN_VALUE_DECIMAL:
+      value->type = EXPR_TEXT;
+      value->text = field.value;
+      value->len = field.value_len;
+      return 1;
+    default:
+      return 1;
+  }
+}
+
+// Convert value to type in place; values that do not convert become NULL.
+static unsigned eval_cast(ExprValue* value, ExprType type, ExprScratch* scratch) {
+  if (value->type == EXPR_NULL || value->type == type) return 1;
+  if (type == EXPR_TEXT) return expr_value_text(value, scratch);
+
+  if (value->type == EXPR_TEXT) {
+    char buf[64];
+    if (!value->len || value->len >= sizeof(buf)) {
+      value->type = EXPR_NULL;
+      return 1;
+    }
+    memcpy(buf, value->text, value->len);
+    buf[value->len] = '\0';
+    char* end = 0;
+    long long integer = strtoll(buf, &end, 10);
+    if (end != buf && !*end) {
+      value->type = EXPR_INT;
+      value->integer = integer;
+      value->number = (double)integer;
+    } else {
+      double number = strtod(buf, &end);
+      if (end == buf || *end) {
+        value->type = EXPR_NULL;
+        return 1;
+      }
+      value->type = EXPR_FLOAT;
+      value->number = number;
+      value->integer = (int64_t)number;
+    }
+  }
+  if (type == EXPR_INT && value->type == EXPR_FLOAT) value->integer = (int64_t)value->number;
+  if (type == EXPR_FLOAT && value->type == EXPR_INT) value->number = (double)value->integer;
+  value->type = type;
+  return 1;
+}
+
+static uint8_t* scratch_reserve(ExprScratch* scratch, unsigned len) {
+  if (len > EXPR_SCRATCH_LEN - scratch->used) return 0;
+  uint8_t* ptr = scratch->buf + scratch->used;
+  scratch->used += len;
+  return ptr;
+}
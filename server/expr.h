@@ -0,0 +1,100 @@
+#pragma once
+
+// An Expr computes a value from the fields of a row, as in `lower(hostname)`
+// or `concat(dc, '-', rack)`. It is parsed once, then evaluated once per row
+// at load time to produce a computed column.
+// Terms are column names, 'quoted' text ('' for a quote), integers, and calls:
+//   lower(x), upper(x)           ASCII case folding
+//   trim(x)                      strip blanks at both ends
+//   concat(x, y, ...)            text of every argument joined; NULL if any is NULL
+//   substring(x, start[, len])   bytes of x from start, counting from 1
+//   cast(x, int|float|string)    NULL if x does not convert
+//   hash(x)                      64-bit XXH3 of the text of x, as an integer
+// Numbers used as text are written in decimal.
+
+#include <stdint.h>
+
+enum {
+  EXPR_MAX_NODES = 32,
+  EXPR_MAX_ARGS = 8,
+  EXPR_MAX_POOL = 512,         // column names and literals
+  EXPR_SCRATCH_LEN = 16384,    // text produced by one evaluation
+};
+
+typedef enum ExprType {
+  EXPR_NULL,
+  EXPR_INT,
+  EXPR_FLOAT,
+  EXPR_TEXT,
+} ExprType;
+
+typedef struct ExprValue {
+  ExprType type;
+  int64_t integer;
+  double number;
+  const uint8_t* text;         // points into the row or the scratch buffer
+  unsigned len;
+} ExprValue;
+
+// Room for the text one evaluation produces; reused across evaluations.
+typedef struct ExprScratch {
+  uint8_t buf[EXPR_SCRATCH_LEN];
+  unsigned used;
+} ExprScratch;
+
+typedef enum ExprOp {
+  EXPR_OP_COLUMN,
+  EXPR_OP_TEXT,
+  EXPR_OP_INT,
+  EXPR_OP_LOWER,
+  EXPR_OP_UPPER,
+  EXPR_OP_TRIM,
+  EXPR_OP_CONCAT,
+  EXPR_OP_SUBSTRING,
+  EXPR_OP_CAST,
+  EXPR_OP_HASH,
+} ExprOp;
+
+typedef struct ExprNode {
+  ExprOp op;
+  unsigned args[EXPR_MAX_ARGS];
+  unsigned arg_count;
+  unsigned pos;                // column name or text, in the pool
+  unsigned len;
+  int64_t integer;             // integer literal, or ExprType for cast
+} ExprNode;
+
+typedef struct Expr {
+  char source[EXPR_MAX_POOL];
+  unsigned root;
+  unsigned node_count;
+  ExprNode nodes[EXPR_MAX_NODES];
+  char pool[EXPR_MAX_POOL];
+  unsigned pool_len;
+  int column;                  // node of the only column referenced, or -1
+} Expr;
+
+// Parse source; return 0 (after logging why) if it is not a valid expression.
+Expr* expr_build(const char* source, unsigned len);
+void expr_destroy(Expr* expr);
+
+// Split the next `name = expression` out of a comma separated list.
+// Return 1 and fill name and source, advancing *list;
+// return 0 at the end of the list, or on a malformed entry with *list set to 0.
+unsigned expr_next_definition(const char** list, char* name, unsigned name_size,
+                              char* source, unsigned source_size);
+
+// The column the expression reads, if it reads exactly one; 0 otherwise.
+const char* expr_column(const Expr* expr, unsigned* len);
+
+// Evaluate expr on an encoded row; missing and NULL fields are NULL.
+// Return 0 if the result does not fit in scratch.
+unsigned expr_eval(const Expr* expr, const uint8_t* row, unsigned row_len,
+                   ExprScratch* scratch, ExprValue* value);
+
+// Evaluate expr with its only column taken to be key, as text.
+unsigned expr_eval_key(const Expr* expr, const uint8_t* key, unsigned len,
+                       ExprScratch* scratch, ExprValue* value);
+
+// Return value as text, formatting numbers into scratch; 0 for NULL or no room.
+unsigned expr_value_text(ExprValue* value, ExprScratch* scratch);
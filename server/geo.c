@@ -0,0 +1,212 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "geo.h"
+
+#define GEO_EARTH_RADIUS_KM 6371.0088
+
+// State of one nearest-neighbor search: hits is a max-heap on distance.
+struct GeoSearch {
+  const GeoPoint* points;
+  double target[3];
+  unsigned k;
+  double limit;                // squared chord length of the radius
+  unsigned found;
+  GeoHit* hits;                // .km holds the squared chord length until the end
+};
+
+static void geo_arrange(GeoPoint* points, unsigned lo, unsigned hi, unsigned depth);
+static void geo_select(GeoPoint* points, unsigned lo, unsigned hi, unsigned nth, unsigned axis);
+static void geo_search(struct GeoSearch* search, unsigned lo, unsigned hi, unsigned depth);
+static void geo_offer(struct GeoSearch* search, const GeoPoint* point, double d2);
+static void geo_sift_down(GeoHit* hits, unsigned count, unsigned pos);
+static int geo_cmp_hit(const void* a, const void* b);
+static void geo_to_xyz(double lat, double lon, double* xyz);
+
+unsigned geo_point(double lat, double lon, GeoPoint* point) {
+  if (!isfinite(lat) || !isfinite(lon)) return 0;
+  if (lat < -90 || lat > 90 || lon < -180 || lon > 360) return 0;
+  double xyz[3];
+  geo_to_xyz(lat, lon, xyz);
+  for (unsigned a = 0; a < 3; ++a) point->xyz[a] = (float)xyz[a];
+  return 1;
+}
+
+Geo* geo_build(GeoPoint* points, unsigned count) {
+  Geo* geo = calloc(1, sizeof(Geo));
+  if (!geo) {
+    LOG_WARN("Could not allocate Geo object");
+    free(points);
+    return NULL;
+  }
+  geo->count = count;
+  geo->points = points;
+  geo_arrange(points, 0, count, 0);
+  return geo;
+}
+
+Geo* geo_clone(const Geo* geo) {
+  Geo* copy = calloc(1, sizeof(Geo));
+  if (!copy) return NULL;
+  copy->count = geo->count;
+  if (geo->count) {
+    copy->points = malloc(geo->count * sizeof(GeoPoint));
+    if (!copy->points) {
+      free(copy);
+      return NULL;
+    }
+    memcpy(copy->points, geo->points, geo->count * sizeof(GeoPoint));
+  }
+  return copy;
+}
+
+void geo_destroy(Geo* geo) {
+  if (!geo) return;
+  free(geo->points);
+  free(geo);
+}
+
+unsigned geo_nearest(const Geo* geo, double lat, double lon, unsigned k, double radius_km,
+                     GeoHit* hits) {
+  if (!geo || !geo->count || !isfinite(lat) || !isfinite(lon)) return 0;
+  if (!k || k > GEO_MAX_NEAREST) k = GEO_MAX_NEAREST;
+
+  struct GeoSearch search = {
+    .points = geo->points,
+    .k = k,
+    .limit = INFINITY,
+    .hits = hits,
+  };
+  geo_to_xyz(lat, lon, search.target);
+  if (radius_km > 0 && radius_km < M_PI * GEO_EARTH_RADIUS_KM) {
+    double chord = 2 * sin(radius_km / (2 * GEO_EARTH_RADIUS_KM));
+    search.limit = chord * chord;
+  }
+  geo_search(&search, 0, geo->count, 0);
+
+  for (unsigned h = 0; h < search.found; ++h) {
+    double chord = sqrt(hits[h].km);
+    if (chord > 2) chord = 2;
+    hits[h].km = 2 * GEO_EARTH_RADIUS_KM * asin(chord / 2);
+  }
+  qsort(hits, search.found, sizeof(GeoHit), geo_cmp_hit);
+  return search.found;
+}
+
+// Put the median of [lo, hi) in the middle, split on the axis for depth, and recurse.
+static void geo_arrange(GeoPoint* points, unsigned lo, unsigned hi, unsigned depth) {
+  while (hi - lo > 1) {
+    unsigned mid = lo + (hi - lo) / 2;
+    geo_select(points, lo, hi, mid, depth % 3);
+    geo_arrange(points, lo, mid, depth + 1);
+    lo = mid + 1;
+    ++depth;
+  }
+}
+
+// Quickselect: leave the nth smallest point on axis at nth.
+static void geo_select(GeoPoint* points, unsigned lo, unsigned hi, unsigned nth, unsigned axis) {
+  while (hi - lo > 1) {
+    float pivot = points[lo + (hi - lo) / 2].xyz[axis];
+    unsigned i = lo;
+    unsigned j = hi - 1;
+    while (i <= j) {
+      while (points[i].xyz[axis] < pivot) ++i;
+      while (points[j].xyz[axis] > pivot) --j;
+      if (i <= j) {
+        GeoPoint tmp = points[i];
+        points[i] = points[j];
+        points[j] = tmp;
+        ++i;
+        if (!j--) break;
+      }
+    }
+    if (nth <= j) {
+      hi = j + 1;
+    } else if (nth >= i) {
+      lo = i;
+    } else {
+      return;
+    }
+  }
+}
+
+static void geo_search(struct GeoSearch* search, unsigned lo, unsigned hi, unsigned depth) {
+  while (lo < hi) {
+    unsigned mid = lo + (hi - lo) / 2;
+    const GeoPoint* point = &search->points[mid];
+    double d2 = 0;
+    for (unsigned a = 0; a < 3; ++a) {
+      double d = point->xyz[a] - search->target[a];
+      d2 += d * d;
+    }
+    geo_offer(search, point, d2);
+
+    unsigned axis = depth % 3;
+    double diff = search->target[axis] - point->xyz[axis];
+    unsigned near_lo = diff < 0 ? lo : mid + 1;
+    unsigned near_hi = diff < 0 ? mid : hi;
+    unsigned far_lo = diff < 0 ? mid + 1 : lo;
+    unsigned far_hi = diff < 0 ? hi : mid;
+    geo_search(search, near_lo, near_hi, depth + 1);
+
+    // The far side can only help if the splitting plane is closer than the worst hit
+    double worst = search->found < search->k ? search->limit : search->hits[0].km;
+    if (diff * diff > worst) return;
+    lo = far_lo;
+    hi = far_hi;
+    ++depth;
+  }
+}
+
+static void geo_offer(struct GeoSearch* search, const GeoPoint* point, double d2) {
+  if (d2 > search->limit) return;
+  GeoHit* hits = search->hits;
+  if (search->found < search->k) {
+    // Sift up the new hit
+    unsigned pos = search->found++;
+    while (pos) {
+      unsigned parent = (pos - 1) / 2;
+      if (hits[parent].km >= d2) break;
+      hits[pos] = hits[parent];
+      pos = parent;
+    }
+    hits[pos].point = point;
+    hits[pos].km = d2;
+    return;
+  }
+  if (d2 >= hits[0].km) return;
+  hits[0].point = point;
+  hits[0].km = d2;
+  geo_sift_down(hits, search->found, 0);
+}
+
+static void geo_sift_down(GeoHit* hits, unsigned count, unsigned pos) {
+  while (1) {
+    unsigned largest = pos;
+    unsigned l = 2 * pos + 1;
+    unsigned r = l + 1;
+    if (l < count && hits[l].km > hits[largest].km) largest = l;
+    if (r < count && hits[r].km > hits[largest].km) largest = r;
+    if (largest == pos) return;
+    GeoHit tmp = hits[pos];
+    hits[pos] = hits[largest];
+    hits[largest] = tmp;
+    pos = largest;
+  }
+}
+
+static int geo_cmp_hit(const void* a, const void* b) {
+  double l = ((const GeoHit*)a)->km;
+  double r = ((const GeoHit*)b)->km;
+  return l < r ? -1 : l > r;
+}
+
+static void geo_to_xyz(double lat, double lon, double* xyz) {
+  double phi = lat * M_PI / 180;
+  double lambda = lon * M_PI / 180;
+  xyz[0] = cos(phi) * cos(lambda);
+  xyz[1] = cos(phi) * sin(lambda);
+  xyz[2] = sin(phi);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// A Geo index answers "which rows are nearest to this latitude / longitude".
+// Points are stored as unit vectors on the sphere, so straight-line distance
+// orders them the same as great-circle distance and nothing special happens
+// at the poles or the antimeridian. The points form an implicit k-d tree in
+// one flat array: each range has its median (on the axis for its depth) in
+// the middle, smaller values before it and larger ones after.
+// Rows are referenced by arena offset, so a Geo stays valid for a mapped copy
+// of its arena.
+
+enum {
+  GEO_MAX_NEAREST = 1024,      // most rows one query returns
+};
+
+typedef struct GeoPoint {
+  float xyz[3];
+  unsigned frame;              // arena offset of the row frame
+  unsigned frame_len;
+} GeoPoint;
+
+typedef struct Geo {
+  unsigned count;
+  GeoPoint* points;
+} Geo;
+
+typedef struct GeoHit {
+  const GeoPoint* point;
+  double km;
+} GeoHit;
+
+// Set point to the location lat / lon, in degrees; return 0 if out of range.
+unsigned geo_point(double lat, double lon, GeoPoint* point);
+
+// Arrange count points as a k-d tree; the Geo takes ownership of them.
+Geo* geo_build(GeoPoint* points, unsigned count);
+Geo* geo_clone(const Geo* geo);
+void geo_destroy(Geo* geo);
+
+// Find up to k points nearest to lat / lon, within radius_km if it is not 0.
+// Fill hits, nearest first, and return how many there are.
+unsigned geo_nearest(const Geo* geo, double lat, double lon, unsigned k, double radius_km,
+                     GeoHit* hits);
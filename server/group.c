@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "util.h"
+#include "xxhash.h"
+#include "group.h"
+
+static void write_le32(uint8_t *buf, uint32_t v);
+static int group_cmp_entry(const void* a, const void* b);
+static int group_cmp_order(const GroupEntry* a, const GroupEntry* b);
+static const GroupKey* group_find(const Group* group, const void* key, unsigned key_len, uint64_t hash);
+
+Group* group_build(GroupEntry* entries, unsigned count, unsigned descending) {
+  Group* group = 0;
+  unsigned bad = 0;
+  do {
+    group = calloc(1, sizeof(Group));
+    if (!group) {
+      LOG_WARN("Could not allocate Group object");
+      break;
+    }
+    for (unsigned e = 0; e < count; ++e) {
+      entries[e].hash = XXH3_64bits(entries[e].key, entries[e].key_len, 0);
+      entries[e].sign = descending ? -1 : 1;
+    }
+    // Rows of one key end up together, in order
+    if (count) qsort(entries, count, sizeof(GroupEntry), group_cmp_entry);
+
+    size_t key_bytes = 0;
+    size_t row_bytes = 0;
+    for (unsigned e = 0; e < count; ++e) {
+      row_bytes += sizeof(uint32_t) + entries[e].row_len;
+      if (e && entries[e].hash == entries[e - 1].hash && entries[e].key_len == entries[e - 1].key_len &&
+          memcmp(entries[e].key, entries[e - 1].key, entries[e].key_len) == 0) continue;
+      ++group->key_count;
+      key_bytes += entries[e].key_len;
+    }
+    group->cap = 2 * next_power_of_two(group->key_count, 1);
+    group->keys = calloc(group->cap, sizeof(GroupKey));
+    group->key_bytes = malloc(key_bytes ? key_bytes : 1);
+    group->starts = malloc((count + 1) * sizeof(size_t));
+    group->rows = malloc(row_bytes ? row_bytes : 1);
+    if (!group->keys || !group->key_bytes || !group->starts || !group->rows) {
+      LOG_WARN("Could not allocate %zu bytes for a group index of %u rows", row_bytes, count);
+      ++bad;
+      break;
+    }
+
+    GroupKey* current = 0;
+    for (unsigned e = 0; e < count; ++e) {
+      const GroupEntry* entry = &entries[e];
+      if (!current || current->hash != entry->hash || current->key_len != entry->key_len ||
+          memcmp(group->key_bytes + current->key, entry->key, entry->key_len) != 0) {
+        unsigned pos = (unsigned)entry->hash & (group->cap - 1);
+        while (group->keys[pos].count) pos = (pos + 1) & (group->cap - 1);
+        current = &group->keys[pos];
+        current->hash = entry->hash;
+        current->key = group->key_bytes_len;
+        current->key_len = entry->key_len;
+        current->first = e;
+        memcpy(group->key_bytes + group->key_bytes_len, entry->key, entry->key_len);
+        group->key_bytes_len += entry->key_len;
+      }
+      ++current->count;
+      group->starts[e] = group->rows_len;
+      uint8_t* p = group->rows + group->rows_len;
+      write_le32(p, entry->row_len);
+      memcpy(p + sizeof(uint32_t), entry->row, entry->row_len);
+      group->rows_len += sizeof(uint32_t) + entry->row_len;
+    }
+    group->starts[count] = group->rows_len;
+    group->row_count = count;
+  } while (0);
+  if (bad) {
+    group_destroy(group);
+    group = 0;
+  }
+  return group;
+}
+
+Group* group_clone(const Group* group) {
+  Group* copy = calloc(1, sizeof(Group));
+  if (!copy) return NULL;
+  *copy = *group;
+  copy->keys = malloc(group->cap * sizeof(GroupKey));
+  copy->key_bytes = malloc(group->key_bytes_len ? group->key_bytes_len : 1);
+  copy->starts = malloc((group->row_count + 1) * sizeof(size_t));
+  copy->rows = malloc(group->rows_len ? group->rows_len : 1);
+  if (!copy->keys || !copy->key_bytes || !copy->starts || !copy->rows) {
+    group_destroy(copy);
+    return NULL;
+  }
+  memcpy(copy->keys, group->keys, group->cap * sizeof(GroupKey));
+  memcpy(copy->key_bytes, group->key_bytes, group->key_bytes_len);
+  memcpy(copy->starts, group->starts, (group->row_count + 1) * sizeof(size_t));
+  memcpy(copy->rows, group->rows, group->rows_len);
+  return copy;
+}
+
+void group_destroy(Group* group) {
+  if (!group) return;
+  free(group->keys);
+  free(group->key_bytes);
+  free(group->starts);
+  free(group->rows);
+  free(group);
+}
+
+size_t group_bytes(const Group* group) {
+  if (!group) return 0;
+  return (size_t)group->cap * sizeof(GroupKey) + group->key_bytes_len +
+         (size_t)(group->row_count + 1) * sizeof(size_t) + group->rows_len;
+}
+
+unsigned group_slice(const Group* group, const void* key, unsigned key_len,
+                     unsigned offset, unsigned limit,
+                     const uint8_t** data, size_t* len, unsigned* count, unsigned* total) {
+  *data = 0;
+  *len = 0;
+  *count = 0;
+  *total = 0;
+  if (!group || !group->key_count) return 0;
+  const GroupKey* entry = group_find(group, key, key_len, XXH3_64bits(key, key_len, 0));
+  if (!entry) return 0;
+  *total = entry->count;
+  if (offset >= entry->count) return 1;
+  unsigned take = entry->count - offset;
+  if (limit && limit < take) take = limit;
+  unsigned first = entry->first + offset;
+  *data = group->rows + group->starts[first];
+  *len = group->starts[first + take] - group->starts[first];
+  *count = take;
+  return 1;
+}
+
+unsigned group_holds(const Group* group, const uint8_t* ptr) {
+  return group && ptr >= group->rows && ptr < group->rows + group->rows_len;
+}
+
+static const GroupKey* group_find(const Group* group, const void* key, unsigned key_len, uint64_t hash) {
+  unsigned pos = (unsigned)hash & (group->cap - 1);
+  while (group->keys[pos].count) {
+    const GroupKey* entry = &group->keys[pos];
+    if (entry->hash == hash && entry->key_len == key_len &&
+        memcmp(group->key_bytes + entry->key, key, key_len) == 0) return entry;
+    pos = (pos + 1) & (group->cap - 1);
+  }
+  return NULL;
+}
+
+// By key hash, then key bytes, then order value, then load order.
+static int group_cmp_entry(const void* a, const void* b) {
+  const GroupEntry* ea = a;
+  const GroupEntry* eb = b;
+  if (ea->hash != eb->hash) return ea->hash < eb->hash ? -1 : 1;
+  if (ea->key_len != eb->key_len) return ea->key_len < eb->key_len ? -1 : 1;
+  int cmp = memcmp(ea->key, eb->key, ea->key_len);
+  if (cmp) return cmp;
+  cmp = group_cmp_order(ea, eb);
+  if (cmp) return cmp;
+  return ea->seq < eb->seq ? -1 : ea->seq > eb->seq;
+}
+
+// Numbers before text, and rows without a value last whatever the direction.
+static int group_cmp_order(const GroupEntry* a, const GroupEntry* b) {
+  if (a->kind != b->kind) {
+    if (a->kind == GROUP_ORDER_NONE || b->kind == GROUP_ORDER_NONE) {
+      return a->kind == GROUP_ORDER_NONE ? 1 : -1;
+    }
+    return a->sign * (a->kind < b->kind ? -1 : 1);
+  }
+  int cmp = 0;
+  switch (a->kind) {
+    case GROUP_ORDER_NUMBER:
+      cmp = a->number < b->number ? -1 : a->number > b->number;
+      break;
+    case GROUP_ORDER_TEXT: {
+      unsigned len = a->text_len < b->text_len ? a->text_len : b->text_len;
+      cmp = memcmp(a->text, b->text, len);
+      if (!cmp) cmp = a->text_len < b->text_len ? -1 : a->text_len > b->text_len;
+      break;
+    }
+    case GROUP_ORDER_NONE:
+      break;
+  }
+  return a->sign * cmp;
+}
+
+static void write_le32(uint8_t *buf, uint32_t v) {
+  for (int i = 0; i < 4; ++i) {
+    buf[i] = (uint8_t)((v >> (8 * i)) & 0xFF);
+  }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+// A Group index answers "the rows holding this key, in order": each key may
+// have many rows, kept sorted by another column of the row, so that the first
+// N rows for a key, or any page of them, are one slice.
+// The rows are copied out of the arena when the index is built, grouped by
+// key and sorted, into one buffer, each as its u32 length (little-endian) and
+// the row, the layout of a GROUP reply; a slice is then one contiguous range
+// of that buffer, written out as it is. Keys are found through an open
+// addressing table of their 64-bit XXH3 hashes.
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum GroupOrderKind {
+  GROUP_ORDER_NUMBER,
+  GROUP_ORDER_TEXT,
+  GROUP_ORDER_NONE,            // no order value; such rows come last either way
+} GroupOrderKind;
+
+// One row to index: its key, the value it is ordered by, and the row itself.
+// The pointers only need to stay valid until group_build returns.
+typedef struct GroupEntry {
+  uint64_t hash;               // XXH3 of key, set by group_build
+  const uint8_t* key;
+  unsigned key_len;
+  const uint8_t* row;
+  unsigned row_len;
+  GroupOrderKind kind;
+  double number;
+  const uint8_t* text;
+  unsigned text_len;
+  unsigned seq;                // load order, which breaks ties
+  int sign;                    // -1 to order descending, set by group_build
+} GroupEntry;
+
+typedef struct GroupKey {
+  uint64_t hash;
+  size_t key;                  // offset of the key in key_bytes
+  unsigned key_len;
+  unsigned first;              // first of the key's rows, in row order
+  unsigned count;              // 0 for an empty entry
+} GroupKey;
+
+typedef struct Group {
+  unsigned key_count;
+  unsigned cap;                // power-of-two size of keys
+  GroupKey* keys;
+  uint8_t* key_bytes;
+  size_t key_bytes_len;
+  unsigned row_count;
+  size_t* starts;              // offset of each row in rows, and the end of the last one
+  uint8_t* rows;
+  size_t rows_len;
+} Group;
+
+// Index count entries, ordered by their order value, descending if asked.
+// The entries array is sorted in place; the Group keeps copies of keys and rows.
+Group* group_build(GroupEntry* entries, unsigned count, unsigned descending);
+Group* group_clone(const Group* group);
+void group_destroy(Group* group);
+size_t group_bytes(const Group* group);
+
+// Find the rows of key, skip offset of them and take up to limit (all of them
+// if 0). Point data at the slice, of len bytes, and set count to the rows in it
+// and total to all the rows of the key. Return 0 if the key has no rows.
+unsigned group_slice(const Group* group, const void* key, unsigned key_len,
+                     unsigned offset, unsigned limit,
+                     const uint8_t** data, size_t* len, unsigned* count, unsigned* total);
+
+// Whether ptr points into the rows of group.
+unsigned group_holds(const Group* group, const uint8_t* ptr);
@@ -6,35 +6,135 @@
 #include "xxhash.h"
 #include "hash.h"
 
-// Fast 4-byte key comparison (most keys are integer IDs)
-static inline int key_equals(const uint8_t* a, const void* b, uint32_t len) {
-  if (len == 4) {
-    uint32_t x, y;
-    memcpy(&x, a, 4);
-    memcpy(&y, b, 4);
-    return x == y;
-  }
-  return memcmp(a, b, len) == 0;
+// Integer keys: a multiply by an odd constant followed by an xor-shift.
+// Both steps are bijective, so two 32-bit keys share a hash only if they are
+// equal; comparing the stored hash is therefore a full key comparison.
+static inline uint64_t hash_int_key(const void *key, uint32_t key_len) {
+  UNUSED(key_len);
+  uint32_t k;
+  memcpy(&k, key, sizeof(k));
+  uint64_t h = (uint64_t)k * 0x9E3779B97F4A7C15ULL;
+  return h ^ (h >> 32);
+}
+
+static inline int int_key_equals(const Bucket *bucket, const void *key, uint32_t key_len) {
+  UNUSED(bucket);
+  UNUSED(key);
+  UNUSED(key_len);
+  return 1;
+}
+
+// Integer keys are never copied into the arena; the bucket hash identifies them,
+// so -1 here means "no copy", not a failure.
+static inline unsigned int_key_store(Arena *arena, const void *key, uint32_t key_len,
+                                     unsigned key_index) {
+  UNUSED(arena);
+  UNUSED(key);
+  UNUSED(key_len);
+  UNUSED(key_index);
+  return (unsigned)-1;
+}
+
+// Byte keys: 64-bit XXH3, then a full compare against the stored copy.
+static inline uint64_t hash_bytes_key(const void *key, uint32_t key_len) {
+  return XXH3_64bits(key, key_len, 0);
+}
+
+static inline int bytes_key_equals(const Bucket *bucket, const void *key, uint32_t key_len) {
+  return memcmp(bucket->key_ptr, key, key_len) == 0;
 }
 
-#define USE_XXH3_32 1
-#define USE_XXH3_64 0
+// Keys already living in the arena (e.g. inside a row) are referenced, not copied.
+static inline unsigned bytes_key_store(Arena *arena, const void *key, uint32_t key_len,
+                                       unsigned key_index) {
+  if (key_index != HASH_KEY_COPY) return key_index;
+  return arena_store(arena, key, key_len);
+}
 
-#if USE_XXH3_32
-#define HASH_FUNC(d, l) XXH32(d, l, 0)
-#endif
+// Instantiate insert / lookup for one key kind.
+// KEY_OK rejects keys of the wrong shape before hashing; KEY_STORED tells
+// whether KEY_STORE managed to keep the key (kindex is what it returned).
+#define HASH_DEFINE_VARIANT(NAME, KEY_OK, KEY_HASH, KEY_EQUALS, KEY_STORE, KEY_STORED)     \
+static unsigned hash_insert_##NAME(Hash *hash, const void *key, uint32_t key_len,         \
+                                   unsigned key_index,                                    \
+                                   unsigned frame, uint32_t frame_len) {                  \
+  if (!(KEY_OK)) return 0;                                                                 \
+  uint64_t h = KEY_HASH(key, key_len);                                                     \
+  uint8_t tag = (uint8_t)(h >> 56);                                                        \
+  uint64_t mask = hash->cap - 1;                                                           \
+  uint64_t idx = h & mask;                                                                 \
+  while (1) {                                                                              \
+    if (hash->tab[idx].key_len == 0) {                                                     \
+      unsigned kindex = KEY_STORE(hash->arena, key, key_len, key_index);                   \
+      if (!(KEY_STORED)) return 0;                                                         \
+      /* Store indices as pointers temporarily (finalized after load) */                   \
+      hash->tab[idx].hash = h;                                                             \
+      hash->tab[idx].tag = tag;                                                            \
+      hash->tab[idx].key_len = key_len;                                                    \
+      hash->tab[idx].key_ptr = (uint8_t*)(uintptr_t)kindex;                                \
+      hash->tab[idx].frame_len = frame_len;                                                \
+      hash->tab[idx].frame_ptr = (uint8_t*)(uintptr_t)frame;                               \
+      hash->used++;                                                                        \
+      return 1;                                                                            \
+    }                                                                                      \
+    idx = (idx + 1) & mask;                                                                \
+  }                                                                                        \
+}                                                                                          \
+                                                                                           \
+static inline __attribute__((always_inline))                                              \
+const Bucket* hash_lookup_##NAME(Hash *hash, const void *key, uint32_t key_len,           \
+                                 unsigned counted) {                                       \
+  if (counted) ++hash->stats.queries;                                                      \
+  if (unlikely(!(KEY_OK))) return 0;                                                       \
+  uint64_t h = KEY_HASH(key, key_len);                                                     \
+  uint8_t tag = (uint8_t)(h >> 56);                                                        \
+  LOG_DEBUG("Looking up %u bytes, hash %llu", key_len, (unsigned long long)h);             \
+  uint64_t mask = hash->cap - 1;                                                           \
+  uint64_t idx = h & mask;                                                                 \
+                                                                                           \
+  /* Prefetch the bucket we're about to access */                                          \
+  __builtin_prefetch(&hash->tab[idx], 0, 3);                                               \
+                                                                                           \
+  unsigned probes = 0;                                                                     \
+  const Bucket *bucket = 0;                                                                \
+  while (1) {                                                                              \
+    ++probes;                                                                              \
+    bucket = &hash->tab[idx];                                                              \
+    if (unlikely(bucket->key_len == 0)) {                                                  \
+      bucket = 0;                                                                          \
+      break;                                                                               \
+    }                                                                                      \
+    if (likely(bucket->tag == tag && bucket->hash == h && bucket->key_len == key_len)) {   \
+      if (likely(KEY_EQUALS(bucket, key, key_len))) break;                                 \
+    }                                                                                      \
+    idx = (idx + 1) & mask;                                                                \
+  }                                                                                        \
+  if (!counted) return bucket;                                                             \
+  if (likely(probes < MAX_PROBE_COUNT)) {                                                  \
+    ++hash->stats.probes[probes];                                                          \
+  } else {                                                                                 \
+    LOG_WARN("Discarding probe count %u -- higher than maximum: %u", probes, MAX_PROBE_COUNT); \
+  }                                                                                        \
+  return bucket;                                                                           \
+}                                                                                          \
+                                                                                           \
+static HOT_FUNC const Bucket* hash_get_##NAME(Hash *hash, const void *key, uint32_t key_len) { \
+  return hash_lookup_##NAME(hash, key, key_len, 1);                                        \
+}                                                                                          \
+                                                                                           \
+static const Bucket* hash_find_##NAME(Hash *hash, const void *key, uint32_t key_len) {    \
+  return hash_lookup_##NAME(hash, key, key_len, 0);                                        \
+}
 
-#if USE_XXH3_64
-#define HASH_FUNC(d, l) XXH3_64bits(d, l, 0)
-#endif
+HASH_DEFINE_VARIANT(int, key_len == sizeof(uint32_t),
+                    hash_int_key, int_key_equals, int_key_store, 1)
+HASH_DEFINE_VARIANT(bytes, key_len > 0,
+                    hash_bytes_key, bytes_key_equals, bytes_key_store, kindex != (unsigned)-1)
 
-#if !USE_XXH3_32 && !USE_XXH3_64
-static inline uint64_t fast_hash(const void *data, unsigned len);
-#define HASH_FUNC(d, l) fast_hash(d, l)
-#endif
+static void hash_set_kind(Hash* hash, HashKeyKind kind);
 
 // Initialize hash table with arena for storage
-Hash* hash_build(unsigned cap_pow2, struct Arena* arena) {
+Hash* hash_build(unsigned cap_pow2, struct Arena* arena, HashKeyKind kind) {
   Hash* hash = 0;
   unsigned bad = 0;
   do {
@@ -57,6 +157,7 @@ Hash* hash_build(unsigned cap_pow2, struct Arena* arena) {
     }
     hash->cap = cap_pow2;
     hash->arena = arena;
+    hash_set_kind(hash, kind);
   } while (0);
   if (bad) {
     hash_destroy(hash);
@@ -65,37 +166,93 @@ Hash* hash_build(unsigned cap_pow2, struct Arena* arena) {
   return hash;
 }
 
+Hash* hash_adopt(Bucket* tab, unsigned cap_pow2, unsigned used, struct Arena* arena, HashKeyKind kind) {
+  if (!arena) {
+    LOG_WARN("Cannot create a Hash object without a valid Arena");
+    return 0;
+  }
+  Hash* hash = calloc(1, sizeof(Hash));
+  if (!hash) {
+    LOG_WARN("Could not allocate a Hash object");
+    return 0;
+  }
+  hash->cap = cap_pow2;
+  hash->used = used;
+  hash->tab = tab;
+  hash->borrowed = 1;
+  hash->arena = arena;
+  hash_set_kind(hash, kind);
+  return hash;
+}
+
+Hash* hash_clone(const Hash* src, struct Arena* arena) {
+  Hash* hash = hash_build(src->cap, arena, src->kind);
+  if (!hash) return 0;
+  memcpy(hash->tab, src->tab, src->cap * sizeof(Bucket));
+  hash->used = src->used;
+  hash->stats = src->stats;
+  const uint8_t* from = src->arena->buffer;
+  uint8_t* to = arena->buffer;
+  for (unsigned i = 0; i < hash->cap; ++i) {
+    Bucket* b = &hash->tab[i];
+    if (b->key_len == 0) continue;
+    if (b->key_ptr) b->key_ptr = to + (b->key_ptr - from);
+    if (b->frame_ptr) b->frame_ptr = to + (b->frame_ptr - from);
+  }
+  return hash;
+}
+
 void hash_destroy(Hash* hash) {
   if (!hash) return;
-  if (hash->tab) free(hash->tab);
+  if (hash->tab && !hash->borrowed) free(hash->tab);
   free(hash);
 }
 
-// Insert preframed value
-// During load, stores indices cast to pointers. Call hash_finalize_pointers() after load.
-unsigned hash_insert(Hash *hash, const void *key, uint32_t key_len, unsigned frame, uint32_t frame_len) {
-  uint64_t h = HASH_FUNC(key, key_len);
-  uint8_t tag = (uint8_t)(h >> 56);
+const char* hash_kind_name(HashKeyKind kind) {
+  switch (kind) {
+    case HASH_KEY_INT:
+      return "int";
+    case HASH_KEY_BYTES:
+    default:
+      return "bytes";
+  }
+}
+
+static void hash_set_kind(Hash* hash, HashKeyKind kind) {
+  hash->kind = kind;
+  switch (kind) {
+    case HASH_KEY_INT:
+      hash->insert = hash_insert_int;
+      hash->get = hash_get_int;
+      hash->find = hash_find_int;
+      break;
+    case HASH_KEY_BYTES:
+    default:
+      hash->kind = HASH_KEY_BYTES;
+      hash->insert = hash_insert_bytes;
+      hash->get = hash_get_bytes;
+      hash->find = hash_find_bytes;
+      break;
+  }
+}
+
+const Bucket* hash_warm(Hash *hash, uint64_t h) {
   uint64_t mask = hash->cap - 1;
   uint64_t idx = h & mask;
-  while (1) {
-    if (hash->tab[idx].key_len == 0) {
-      // Store key in arena
-      unsigned kindex = arena_store(hash->arena, key, key_len);
-      if (kindex == (unsigned)-1) return 0;
-
-      // Store indices as pointers temporarily (finalized after load)
-      hash->tab[idx].hash = h;
-      hash->tab[idx].tag = tag;
-      hash->tab[idx].key_len = key_len;
-      hash->tab[idx].key_ptr = (uint8_t*)(uintptr_t)kindex;
-      hash->tab[idx].frame_len = frame_len;
-      hash->tab[idx].frame_ptr = (uint8_t*)(uintptr_t)frame;
-      hash->used++;
-      return 1;
+  for (unsigned probes = 0; probes < hash->cap; ++probes) {
+    const Bucket* bucket = &hash->tab[idx];
+    if (bucket->key_len == 0) return 0;
+    if (bucket->hash == h) {
+      // One read per cache line is enough to bring the whole frame in
+      volatile uint8_t sink = 0;
+      if (bucket->key_ptr) sink ^= bucket->key_ptr[0];
+      for (uint32_t off = 0; off < bucket->frame_len; off += 64) sink ^= bucket->frame_ptr[off];
+      UNUSED(sink);
+      return bucket;
     }
     idx = (idx + 1) & mask;
   }
+  return 0;
 }
 
 // Convert stored indices to actual arena pointers
@@ -111,59 +268,3 @@ void hash_finalize_pointers(Hash *hash) {
     b->frame_ptr = arena_get_ptr(arena, frame_idx);
   }
 }
-
-// Lookup by key
-HOT_FUNC const Bucket* hash_get(Hash *hash, const void *key, uint32_t key_len) {
-  ++hash->stats.queries;
-  uint64_t h = HASH_FUNC(key, key_len);
-  uint8_t tag = (uint8_t)(h >> 56);
-  LOG_DEBUG("Looking up %u bytes, [%.*s], hash %llu", key_len, key_len, key, h);
-  uint64_t mask = hash->cap - 1;
-  uint64_t idx = h & mask;
-
-  // Prefetch the bucket we're about to access
-  __builtin_prefetch(&hash->tab[idx], 0, 3);
-
-  unsigned probes = 0;
-  const Bucket *bucket = 0;
-  while (1) {
-    ++probes;
-    LOG_DEBUG(">> PROBE");
-    bucket = &hash->tab[idx];
-    if (unlikely(bucket->key_len == 0)) {
-      bucket = 0;
-      break;
-    }
-    if (likely(bucket->tag == tag && bucket->hash == h && bucket->key_len == key_len)) {
-      if (likely(key_equals(bucket->key_ptr, key, key_len))) break;
-    }
-    idx = (idx + 1) & mask;
-  }
-  if (likely(probes < MAX_PROBE_COUNT)) {
-    ++hash->stats.probes[probes];
-  } else {
-    LOG_WARN("Discarding probe count %u -- higher than maximum: %u", probes, MAX_PROBE_COUNT);
-  }
-  return bucket;
-}
-
-#if !USE_XXH3_32 && !USE_XXH3_64
-// Simple fast hash (xxhash64-like) for variable length binary keys
-static inline uint64_t fast_hash(const void *data, unsigned len) {
-  const uint64_t prime1 = 11400714785074694791ULL;
-  uint64_t h = 0x9E3779B97F4A7C15ULL ^ (len * prime1);
-  const uint8_t *p = data;
-  while (len >= 8) {
-    uint64_t v;
-    memcpy(&v, p, 8);
-    h ^= v;
-    h *= prime1;
-    p += 8; len -= 8;
-  }
-  while (len--) {
-    h ^= *p++;
-    h *= prime1;
-  }
-  return h ^ (h >> 33);
-}
-#endif
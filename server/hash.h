@@ -1,8 +1,10 @@
 #pragma once
 
 // A Hash keeps an index for data stored in an Arena.
-// Keys are variable length byte arrays.
+// Keys are either 4-byte integers or variable length byte arrays.
 // Values are variable length byte arrays.
+// The key kind is fixed when the hash is built, and selects specialized
+// insert / lookup functions, so the hot path never branches on key type.
 
 #include <stdint.h>
 
@@ -25,18 +27,68 @@ typedef struct Bucket {
   uint32_t frame_len;     // = 4 + value_len
 } Bucket;
 
+typedef enum HashKeyKind {
+  HASH_KEY_INT,           // 4-byte integer keys: multiply-shift mixer, compare by hash
+  HASH_KEY_BYTES,         // variable length keys: 64-bit XXH3, compare by bytes
+} HashKeyKind;
+
+// Passed as key_index when the key must be copied into the arena.
+#define HASH_KEY_COPY ((unsigned)-1)
+
+struct Hash;
+typedef unsigned (*HashInsertFunc)(struct Hash *hash, const void *key, uint32_t key_len,
+                                   unsigned key_index,
+                                   unsigned frame, uint32_t frame_len);
+typedef const Bucket* (*HashGetFunc)(struct Hash *hash, const void *key, uint32_t key_len);
+
 typedef struct Hash {
   unsigned cap;           // power-of-two capacity
   unsigned used;          // number of items stored
   Bucket *tab;            // array of buckets
+  unsigned borrowed;      // tab is not ours to free
   struct Arena* arena;    // pointer to common arena
+  HashKeyKind kind;       // key kind, fixed at build time
+  HashInsertFunc insert;  // specialized insert for kind
+  HashGetFunc get;        // specialized lookup for kind
+  HashGetFunc find;       // same lookup, not counted in stats
   struct HashStats stats;
 } Hash;
 
-Hash* hash_build(unsigned cap_pow2, struct Arena* arena);
+Hash* hash_build(unsigned cap_pow2, struct Arena* arena, HashKeyKind kind);
+// Copy a finalized hash for arena, which holds the same bytes as the source's arena.
+Hash* hash_clone(const Hash* hash, struct Arena* arena);
+// Wrap a bucket array laid out elsewhere, still holding arena offsets; the hash
+// does not free it.
+Hash* hash_adopt(Bucket* tab, unsigned cap_pow2, unsigned used, struct Arena* arena, HashKeyKind kind);
 void hash_destroy(Hash* hash);
-unsigned hash_insert(Hash *hash, const void *key, uint32_t key_len, unsigned frame, uint32_t frame_len);
-const Bucket* hash_get(Hash *hash, const void *key, uint32_t key_len);
+const char* hash_kind_name(HashKeyKind kind);
+
+static inline unsigned hash_insert(Hash *hash, const void *key, uint32_t key_len,
+                                   unsigned frame, uint32_t frame_len) {
+  return hash->insert(hash, key, key_len, HASH_KEY_COPY, frame, frame_len);
+}
+
+// Insert a key whose bytes are already stored in the arena at key_index,
+// so the hash references them instead of storing a copy.
+static inline unsigned hash_insert_ref(Hash *hash, const void *key, uint32_t key_len,
+                                       unsigned key_index,
+                                       unsigned frame, uint32_t frame_len) {
+  return hash->insert(hash, key, key_len, key_index, frame, frame_len);
+}
+
+static inline const Bucket* hash_get(Hash *hash, const void *key, uint32_t key_len) {
+  return hash->get(hash, key, key_len);
+}
+
+// Lookup for internal use (e.g. building derived tables), kept out of the query stats.
+static inline const Bucket* hash_find(Hash *hash, const void *key, uint32_t key_len) {
+  return hash->find(hash, key, key_len);
+}
+
+// Walk the probe sequence of a key whose hash is h, as a lookup would, and read
+// the key and frame of its bucket, so that a lookup soon after finds all of it
+// in memory and cache. Return 0 if no bucket holds h.
+const Bucket* hash_warm(Hash *hash, uint64_t h);
 
 // Convert stored indices to actual arena pointers after load is complete.
 // Must be called BEFORE making the hash visible to readers.
@@ -0,0 +1,262 @@
+#include <string.h>
+#include "jsonpath.h"
+
+// A position while scanning a JSON document.
+typedef struct Cursor {
+  const char* pos;
+  const char* end;
+} Cursor;
+
+enum {
+  MAX_NESTING = 256,
+};
+
+static void skip_ws(Cursor* c);
+static unsigned skip_string(Cursor* c);
+static unsigned skip_value(Cursor* c);
+static unsigned find_member(Cursor* c, const char* name, unsigned name_len);
+static unsigned find_element(Cursor* c, unsigned index);
+static unsigned path_step(const char* path, unsigned path_len, unsigned* pos,
+                          const char** name, unsigned* name_len, unsigned* index);
+static unsigned hex_value(char c);
+
+unsigned jsonpath_valid(const char* path, unsigned path_len) {
+  if (!path_len) return 0;
+  unsigned pos = 0;
+  while (pos < path_len) {
+    const char* name = 0;
+    unsigned name_len = 0;
+    unsigned index = 0;
+    if (!path_step(path, path_len, &pos, &name, &name_len, &index)) return 0;
+  }
+  return 1;
+}
+
+unsigned jsonpath_extract(const char* json, unsigned json_len,
+                          const char* path, unsigned path_len,
+                          JsonPathValue* value) {
+  Cursor c = { json, json + json_len };
+  unsigned pos = 0;
+  while (pos < path_len) {
+    const char* name = 0;
+    unsigned name_len = 0;
+    unsigned index = 0;
+    if (!path_step(path, path_len, &pos, &name, &name_len, &index)) return 0;
+    skip_ws(&c);
+    unsigned found = name ? find_member(&c, name, name_len) : find_element(&c, index);
+    if (!found) return 0;
+  }
+
+  skip_ws(&c);
+  if (c.pos >= c.end) return 0;
+  const char* start = c.pos;
+  value->escaped = 0;
+  switch (*start) {
+    case '"':
+      if (!skip_string(&c)) return 0;
+      value->type = JSONPATH_STRING;
+      value->ptr = start + 1;
+      value->len = (unsigned)(c.pos - start - 2);
+      value->escaped = memchr(value->ptr, '\\', value->len) != 0;
+      return 1;
+    case '{':
+      value->type = JSONPATH_OBJECT;
+      break;
+    case '[':
+      value->type = JSONPATH_ARRAY;
+      break;
+    case 't':
+      value->type = JSONPATH_TRUE;
+      break;
+    case 'f':
+      value->type = JSONPATH_FALSE;
+      break;
+    case 'n':
+      value->type = JSONPATH_NULL;
+      break;
+    default:
+      value->type = JSONPATH_NUMBER;
+      break;
+  }
+  if (!skip_value(&c)) return 0;
+  value->ptr = start;
+  value->len = (unsigned)(c.pos - start);
+  return 1;
+}
+
+unsigned jsonpath_unescape(const JsonPathValue* value, char* buf, unsigned size, unsigned* len) {
+  unsigned out = 0;
+  for (unsigned j = 0; j < value->len; ++j) {
+    char ch = value->ptr[j];
+    if (ch == '\\') {
+      if (++j >= value->len) return 0;
+      switch (value->ptr[j]) {
+        case '"':  ch = '"'; break;
+        case '\\': ch = '\\'; break;
+        case '/':  ch = '/'; break;
+        case 'b':  ch = '\b'; break;
+        case 'f':  ch = '\f'; break;
+        case 'n':  ch = '\n'; break;
+        case 'r':  ch = '\r'; break;
+        case 't':  ch = '\t'; break;
+        case 'u': {
+          if (j + 4 >= value->len) return 0;
+          unsigned cp = 0;
+          for (unsigned k = 1; k <= 4; ++k) {
+            unsigned h = hex_value(value->ptr[j + k]);
+            if (h > 15) return 0;
+            cp = (cp << 4) | h;
+          }
+          j += 4;
+          // Surrogate pairs are not combined; each half is encoded on its own.
+          char utf8[3];
+          unsigned n = 0;
+          if (cp < 0x80) {
+            utf8[n++] = (char)cp;
+          } else if (cp < 0x800) {
+            utf8[n++] = (char)(0xC0 | (cp >> 6));
+            utf8[n++] = (char)(0x80 | (cp & 0x3F));
+          } else {
+            utf8[n++] = (char)(0xE0 | (cp >> 12));
+            utf8[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+            utf8[n++] = (char)(0x80 | (cp & 0x3F));
+          }
+          if (out + n > size) return 0;
+          memcpy(buf + out, utf8, n);
+          out += n;
+          continue;
+        }
+        default:
+          return 0;
+      }
+    }
+    if (out >= size) return 0;
+    buf[out++] = ch;
+  }
+  *len = out;
+  return 1;
+}
+
+static void skip_ws(Cursor* c) {
+  while (c->pos < c->end &&
+         (*c->pos == ' ' || *c->pos == '\t' || *c->pos == '\n' || *c->pos == '\r')) {
+    ++c->pos;
+  }
+}
+
+// Cursor is on the opening quote; leave it just past the closing one.
+static unsigned skip_string(Cursor* c) {
+  ++c->pos;
+  while (c->pos < c->end) {
+    char ch = *c->pos++;
+    if (ch == '"') return 1;
+    if (ch == '\\') ++c->pos;
+  }
+  return 0;
+}
+
+// Skip one value of any kind, nested ones included, without parsing it.
+static unsigned skip_value(Cursor* c) {
+  if (c->pos >= c->end) return 0;
+  char ch = *c->pos;
+  if (ch == '"') return skip_string(c);
+  if (ch != '{' && ch != '[') {
+    const char* start = c->pos;
+    while (c->pos < c->end) {
+      ch = *c->pos;
+      if (ch == ',' || ch == '}' || ch == ']' ||
+          ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') break;
+      ++c->pos;
+    }
+    return c->pos > start;
+  }
+
+  unsigned depth = 0;
+  while (c->pos < c->end) {
+    ch = *c->pos;
+    if (ch == '"') {
+      if (!skip_string(c)) return 0;
+      continue;
+    }
+    ++c->pos;
+    if (ch == '{' || ch == '[') {
+      if (++depth > MAX_NESTING) return 0;
+    } else if (ch == '}' || ch == ']') {
+      if (--depth == 0) return 1;
+    }
+  }
+  return 0;
+}
+
+// Cursor is on an object; leave it on the value of member name.
+static unsigned find_member(Cursor* c, const char* name, unsigned name_len) {
+  if (c->pos >= c->end || *c->pos != '{') return 0;
+  ++c->pos;
+  while (1) {
+    skip_ws(c);
+    if (c->pos >= c->end || *c->pos != '"') return 0;
+    const char* key = c->pos + 1;
+    if (!skip_string(c)) return 0;
+    unsigned key_len = (unsigned)(c->pos - key - 1);
+    skip_ws(c);
+    if (c->pos >= c->end || *c->pos != ':') return 0;
+    ++c->pos;
+    skip_ws(c);
+    if (key_len == name_len && memcmp(key, name, name_len) == 0) return 1;
+    if (!skip_value(c)) return 0;
+    skip_ws(c);
+    if (c->pos >= c->end || *c->pos != ',') return 0;
+    ++c->pos;
+  }
+}
+
+// Cursor is on an array; leave it on the element at index.
+static unsigned find_element(Cursor* c, unsigned index) {
+  if (c->pos >= c->end || *c->pos != '[') return 0;
+  ++c->pos;
+  for (unsigned j = 0; ; ++j) {
+    skip_ws(c);
+    if (c->pos >= c->end || *c->pos == ']') return 0;
+    if (j == index) return 1;
+    if (!skip_value(c)) return 0;
+    skip_ws(c);
+    if (c->pos >= c->end || *c->pos != ',') return 0;
+    ++c->pos;
+  }
+}
+
+// Parse the step of path starting at *pos: either `.name` or `[N]`.
+// Fill name / name_len for the former, index (and name = 0) for the latter.
+static unsigned path_step(const char* path, unsigned path_len, unsigned* pos,
+                          const char** name, unsigned* name_len, unsigned* index) {
+  unsigned p = *pos;
+  if (path[p] == '.') {
+    unsigned start = ++p;
+    while (p < path_len && path[p] != '.' && path[p] != '[') ++p;
+    if (p == start) return 0;
+    *name = path + start;
+    *name_len = p - start;
+  } else if (path[p] == '[') {
+    unsigned start = ++p;
+    unsigned value = 0;
+    while (p < path_len && path[p] >= '0' && path[p] <= '9') {
+      value = value * 10 + (unsigned)(path[p] - '0');
+      ++p;
+    }
+    if (p == start || p >= path_len || path[p] != ']') return 0;
+    ++p;
+    *name = 0;
+    *index = value;
+  } else {
+    return 0;
+  }
+  *pos = p;
+  return 1;
+}
+
+static unsigned hex_value(char c) {
+  if (c >= '0' && c <= '9') return (unsigned)(c - '0');
+  if (c >= 'a' && c <= 'f') return (unsigned)(c - 'a' + 10);
+  if (c >= 'A' && c <= 'F') return (unsigned)(c - 'A' + 10);
+  return 16;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// A JSON path picks one value out of a JSON document, as in `$.attrs.sku`
+// or `$.tags[0]`; the leading `$` is not part of the path given here.
+// Steps are `.name` (object member) and `[N]` (array element).
+// Extraction is a single forward scan over the document: values that are
+// not on the path are skipped without being parsed, and nothing is copied.
+// Member names are compared as raw bytes, without unescaping.
+
+typedef enum JsonPathType {
+  JSONPATH_NULL,
+  JSONPATH_FALSE,
+  JSONPATH_TRUE,
+  JSONPATH_NUMBER,
+  JSONPATH_STRING,
+  JSONPATH_OBJECT,
+  JSONPATH_ARRAY,
+} JsonPathType;
+
+typedef struct JsonPathValue {
+  JsonPathType type;
+  const char* ptr;        // value text; for strings, without the quotes
+  unsigned len;
+  unsigned escaped;       // string contains escapes; see jsonpath_unescape()
+} JsonPathValue;
+
+// Return 1 if path (what follows the `$`) is well formed.
+unsigned jsonpath_valid(const char* path, unsigned path_len);
+
+// Find the value at path in json; return 1 and fill value if found.
+unsigned jsonpath_extract(const char* json, unsigned json_len,
+                          const char* path, unsigned path_len,
+                          JsonPathValue* value);
+
+// Decode an escaped string value into buf (of size bytes).
+// Return 1 and fill len on success, 0 if it does not fit or is malformed.
+unsigned jsonpath_unescape(const JsonPathValue* value, char* buf, unsigned size, unsigned* len);
@@ -0,0 +1,293 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "util.h"
+#include "log.h"
+#include "config.h"
+#include "db.h"
+#include "data.h"
+#include "numa.h"
+#include "loader.h"
+
+enum {
+  LOADER_CHILD_FD = 3,         // where the child finds its end of the socket pair
+};
+
+static int loader_request(Loader* loader, unsigned table_id, TableImage* image);
+static void loader_restart(Loader* loader);
+static unsigned send_image(int fd, const TableImage* image, int image_fd);
+static int recv_image(int fd, TableImage* image);
+
+Loader* loader_build(Config* config) {
+  Loader* loader = 0;
+  unsigned bad = 0;
+  do {
+    loader = calloc(1, sizeof(Loader));
+    if (!loader) {
+      LOG_WARN("Could not allocate Loader object");
+      break;
+    }
+    loader->fd = -1;
+    if (config->file.contents && config->file.path) {
+      int wrote = snprintf(loader->config_path, sizeof(loader->config_path), "%s", config->file.path);
+      if (wrote < 0 || (size_t)wrote >= sizeof(loader->config_path)) {
+        LOG_WARN("Config file path %s is too long for the loader process", config->file.path);
+        ++bad;
+        break;
+      }
+    }
+  } while (0);
+  if (bad) {
+    loader_destroy(loader);
+    loader = 0;
+  }
+  return loader;
+}
+
+void loader_destroy(Loader* loader) {
+  if (!loader) return;
+  loader_stop(loader);
+  free(loader);
+}
+
+unsigned loader_start(Loader* loader) {
+  if (loader->fd >= 0) return 1;
+
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) < 0) {
+    LOG_WARN("Could not create socket pair for loader process: %s", strerror(errno));
+    return 0;
+  }
+  // Listeners and client connections are not close-on-exec, so the child
+  // closes everything but its end of the pair before it runs
+  struct rlimit limit;
+  int max_fd = getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY
+             ? (int)limit.rlim_cur : 1024;
+
+  char fd_arg[16];
+  snprintf(fd_arg, sizeof(fd_arg), "%d", LOADER_CHILD_FD);
+  char* argv[6];
+  unsigned argc = 0;
+  argv[argc++] = "melian-loader";
+  argv[argc++] = "--loader";
+  argv[argc++] = fd_arg;
+  if (loader->config_path[0]) {
+    argv[argc++] = "--configfile";
+    argv[argc++] = loader->config_path;
+  }
+  argv[argc] = 0;
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    LOG_WARN("Could not fork loader process: %s", strerror(errno));
+    close(pair[0]);
+    close(pair[1]);
+    return 0;
+  }
+  if (pid == 0) {
+    if (pair[1] != LOADER_CHILD_FD) {
+      if (dup2(pair[1], LOADER_CHILD_FD) < 0) _exit(127);
+    } else {
+      fcntl(LOADER_CHILD_FD, F_SETFD, 0);
+    }
+    for (int fd = LOADER_CHILD_FD + 1; fd < max_fd; ++fd) close(fd);
+    // Run the very binary the server runs, even if it was replaced on disk
+    execv("/proc/self/exe", argv);
+    _exit(127);
+  }
+  close(pair[1]);
+  loader->fd = pair[0];
+  loader->pid = pid;
+  LOG_INFO("Started loader process %d", (int)pid);
+  return 1;
+}
+
+void loader_stop(Loader* loader) {
+  if (loader->fd < 0) return;
+  // The child exits once it sees the socket closed
+  close(loader->fd);
+  loader->fd = -1;
+  int status = 0;
+  waitpid(loader->pid, &status, 0);
+  LOG_INFO("Stopped loader process %d", (int)loader->pid);
+  loader->pid = 0;
+}
+
+int loader_load(Loader* loader, unsigned table_id, TableImage* image) {
+  memset(image, 0, sizeof(*image));
+  image->rows = (unsigned)-1;
+  if (loader->fd < 0 && !loader_start(loader)) return -1;
+
+  int fd = loader_request(loader, table_id, image);
+  if (fd == -2) {
+    // The child died; start another one for the next load
+    loader_restart(loader);
+    return -1;
+  }
+  if (fd < 0) {
+    ++loader->failures;
+    return -1;
+  }
+  ++loader->loads;
+  return fd;
+}
+
+int loader_main(int fd) {
+  // The server stops the loader by closing the socket
+  signal(SIGINT, SIG_IGN);
+
+  Config* config = 0;
+  DB* db = 0;
+  Data* data = 0;
+  do {
+    config = config_build();
+    if (!config) break;
+    db = db_build(config);
+    if (!db) break;
+    data = data_build(config);
+    if (!data) break;
+
+    // Shared memory pages are placed where they are first touched: here
+    int node = config->server.numa_node;
+    if (node >= 0) {
+      char cpus[256];
+      if (!numa_bind(node, cpus, sizeof(cpus))) {
+        LOG_WARN("Could not bind loader process to NUMA node %d", node);
+      }
+    }
+    LOG_INFO("Loader process %d ready", (int)getpid());
+
+    while (1) {
+      uint32_t table_id = 0;
+      ssize_t got = recv(fd, &table_id, sizeof(table_id), 0);
+      if (got < 0 && errno == EINTR) continue;
+      if (got != sizeof(table_id)) break;
+
+      TableImage image;
+      memset(&image, 0, sizeof(image));
+      image.table_id = table_id;
+      image.rows = (unsigned)-1;
+      int image_fd = -1;
+      Table* table = table_id < ALEN(data->lookup) ? data->lookup[table_id] : 0;
+      if (table) {
+        db_connect(db);
+        image_fd = table_export_from_db(table, db, &image);
+        db_disconnect(db);
+      } else {
+        LOG_WARN("Loader process asked for unknown table id %u", table_id);
+      }
+      unsigned sent = send_image(fd, &image, image_fd);
+      if (image_fd >= 0) close(image_fd);
+      if (!sent) break;
+    }
+  } while (0);
+  LOG_INFO("Loader process %d exiting", (int)getpid());
+  if (data) data_destroy(data);
+  if (db) db_destroy(db);
+  if (config) config_destroy(config);
+  close(fd);
+  return 0;
+}
+
+// Return the image's descriptor, -1 if the child could not load it, or -2 if
+// the child is gone.
+static int loader_request(Loader* loader, unsigned table_id, TableImage* image) {
+  uint32_t request = table_id;
+  ssize_t sent = 0;
+  do {
+    sent = send(loader->fd, &request, sizeof(request), MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  if (sent != sizeof(request)) return -2;
+
+  int fd = recv_image(loader->fd, image);
+  if (fd == -2) return -2;
+  if (image->table_id != table_id || image->rows == (unsigned)-1) {
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void loader_restart(Loader* loader) {
+  pid_t pid = loader->pid;
+  close(loader->fd);
+  loader->fd = -1;
+  int status = 0;
+  waitpid(pid, &status, 0);
+  if (WIFSIGNALED(status)) {
+    LOG_WARN("Loader process %d died with signal %d", (int)pid, WTERMSIG(status));
+  } else {
+    LOG_WARN("Loader process %d exited with status %d", (int)pid, WEXITSTATUS(status));
+  }
+  ++loader->restarts;
+  loader_start(loader);
+}
+
+// Send image, and image_fd along with it unless it is -1.
+static unsigned send_image(int fd, const TableImage* image, int image_fd) {
+  struct iovec iov = { .iov_base = (void*)image, .iov_len = sizeof(*image) };
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (image_fd >= 0) {
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &image_fd, sizeof(int));
+  }
+  ssize_t sent = 0;
+  do {
+    sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  if (sent != (ssize_t)sizeof(*image)) {
+    LOG_WARN("Could not send table image: %s", strerror(errno));
+    return 0;
+  }
+  return 1;
+}
+
+// Receive an image; return the descriptor sent with it, -1 if there was none,
+// or -2 if the socket is closed or broken.
+static int recv_image(int fd, TableImage* image) {
+  struct iovec iov = { .iov_base = image, .iov_len = sizeof(*image) };
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  ssize_t got = 0;
+  do {
+    got = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  } while (got < 0 && errno == EINTR);
+  int image_fd = -1;
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); got > 0 && cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+    memcpy(&image_fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+  if (got != (ssize_t)sizeof(*image)) {
+    if (image_fd >= 0) close(image_fd);
+    return -2;
+  }
+  return image_fd;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+// A Loader runs the database side of table loads in a child process, so that
+// database drivers and their allocations never touch the server's heap, and a
+// driver that crashes or leaks takes down only the child.
+// The child is the server binary run again with --loader; it builds its own
+// config, db and data. For each table the loader thread asks for, the child
+// builds a slot in a shared memory file and sends back a TableImage and the
+// file's descriptor; the loader thread maps it and swaps it in.
+// If the child dies, it is started again on the next request.
+
+#include <sys/types.h>
+
+struct Config;
+struct TableImage;
+
+typedef struct Loader {
+  char config_path[4096];      // config file the child must read; empty to let it resolve its own
+  int fd;                      // server end of the socket pair; -1 if the child is not running
+  pid_t pid;
+  unsigned loads;              // images received
+  unsigned failures;           // loads the child could not do
+  unsigned restarts;           // children started again after dying
+} Loader;
+
+Loader* loader_build(struct Config* config);
+void loader_destroy(Loader* loader);
+unsigned loader_start(Loader* loader);
+void loader_stop(Loader* loader);
+
+// Have the child load table_id; return the image's file descriptor, or -1.
+int loader_load(Loader* loader, unsigned table_id, struct TableImage* image);
+
+// Child side: serve load requests on fd until the server closes it.
+int loader_main(int fd);
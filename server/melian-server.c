@@ -6,6 +6,7 @@
 #include "protocol.h"
 #include "config.h"
 #include "data.h"
+#include "loader.h"
 #include "server.h"
 
 static void show_usage(const char* prog) {
@@ -30,11 +31,13 @@ int main(int argc, char **argv) {
   signal(SIGPIPE, SIG_IGN);
   const char* cli_config_path = NULL;
   unsigned show_version = 0;
+  int loader_fd = -1;
   int opt = 0;
   static const struct option long_opts[] = {
     {"configfile", required_argument, NULL, 'c'},
     {"help", no_argument, NULL, 'h'},
     {"version", no_argument, NULL, 'v'},
+    {"loader", required_argument, NULL, 'L'},  // internal: run as the loader process
     {0, 0, 0, 0},
   };
   while ((opt = getopt_long(argc, argv, "c:hv", long_opts, NULL)) != -1) {
@@ -48,6 +51,9 @@ int main(int argc, char **argv) {
       case 'v':
         show_version = 1;
         break;
+      case 'L':
+        loader_fd = atoi(optarg);
+        break;
       default:
         show_usage(argv[0]);
         return 1;
@@ -72,6 +78,7 @@ int main(int argc, char **argv) {
     printf("%s\n", MELIAN_SERVER_VERSION);
     return 0;
   }
+  if (loader_fd >= 0) return loader_main(loader_fd);
 
   Server* server = 0;
   do {
@@ -0,0 +1,106 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "log.h"
+#include "numa.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+static unsigned read_sys_line(const char* path, char* buf, unsigned size);
+static unsigned parse_cpu_list(const char* list, cpu_set_t* set);
+
+unsigned numa_node_count(void) {
+  char online[256];
+  if (!read_sys_line("/sys/devices/system/node/online", online, sizeof(online))) return 1;
+  cpu_set_t nodes;  // same list syntax as CPUs
+  if (!parse_cpu_list(online, &nodes)) return 1;
+  unsigned count = CPU_COUNT(&nodes);
+  return count ? count : 1;
+}
+
+unsigned numa_bind(unsigned node, char* cpus, unsigned size) {
+  unsigned ok = 0;
+  do {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+    if (!read_sys_line(path, cpus, size)) {
+      LOG_WARN("NUMA node %u not found", node);
+      break;
+    }
+    cpu_set_t set;
+    if (!parse_cpu_list(cpus, &set) || !CPU_COUNT(&set)) {
+      LOG_WARN("NUMA node %u has no usable CPUs [%s]", node, cpus);
+      break;
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+      LOG_WARN("Could not run on the CPUs of NUMA node %u: %s", node, strerror(errno));
+      break;
+    }
+
+    // Preferred rather than bound: allocations still succeed if the node fills up
+    unsigned long mask[16] = {0};
+    unsigned bits = 8 * sizeof(unsigned long);
+    if (node >= ALEN(mask) * bits) break;
+    mask[node / bits] |= 1UL << (node % bits);
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, ALEN(mask) * bits) < 0) {
+      LOG_WARN("Could not prefer memory on NUMA node %u: %s", node, strerror(errno));
+      break;
+    }
+    ok = 1;
+  } while (0);
+  return ok;
+}
+
+static unsigned read_sys_line(const char* path, char* buf, unsigned size) {
+  FILE* fp = fopen(path, "r");
+  if (!fp) return 0;
+  unsigned ok = fgets(buf, size, fp) != 0;
+  fclose(fp);
+  if (!ok) return 0;
+  buf[strcspn(buf, "\n")] = '\0';
+  return buf[0] != '\0';
+}
+
+// Parse a kernel list such as "0-3,8,10-11".
+static unsigned parse_cpu_list(const char* list, cpu_set_t* set) {
+  CPU_ZERO(set);
+  const char* p = list;
+  while (*p) {
+    char* end = 0;
+    unsigned long first = strtoul(p, &end, 10);
+    if (end == p) return 0;
+    unsigned long last = first;
+    p = end;
+    if (*p == '-') {
+      ++p;
+      last = strtoul(p, &end, 10);
+      if (end == p || last < first) return 0;
+      p = end;
+    }
+    for (unsigned long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) CPU_SET(cpu, set);
+    if (*p == ',') ++p;
+    else if (*p) return 0;
+  }
+  return 1;
+}
+
+#else
+
+unsigned numa_node_count(void) {
+  return 1;
+}
+
+unsigned numa_bind(unsigned node, char* cpus, unsigned size) {
+  UNUSED(size);
+  cpus[0] = '\0';
+  LOG_WARN("NUMA binding to node %u is only supported on Linux", node);
+  return 0;
+}
+
+#endif
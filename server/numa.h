@@ -0,0 +1,15 @@
+#pragma once
+
+// Keep query serving and table memory on one NUMA node.
+// The server thread runs the event loop and is the only reader, so there is a
+// single copy of every table to place. Binding the main thread before any
+// table is allocated or the loader starts makes the loader inherit the same
+// CPUs and memory policy: arenas and indexes are then first touched, and
+// placed, on the node that serves queries from them.
+
+// Number of NUMA nodes online; 1 where that cannot be told.
+unsigned numa_node_count(void);
+
+// Run the calling thread on the CPUs of node and prefer its memory.
+// Writes the node's CPU list (e.g. "0-15,32-47") to cpus; return 0 on failure.
+unsigned numa_bind(unsigned node, char* cpus, unsigned size);
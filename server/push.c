@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "xxhash.h"
+#include "push.h"
+
+enum {
+  PUSH_BUFFER_INITIAL_CAPACITY = 64 * 1024,
+  PUSH_KEYS_INITIAL_CAPACITY = 1024,
+};
+
+static unsigned push_buffer_reserve(PushBuffer* buffer, size_t need);
+static int push_key_cmp(const void* a, const void* b);
+
+Push* push_build(const char* secret) {
+  Push* push = 0;
+  do {
+    size_t len = strlen(secret);
+    if (!len || len >= sizeof(push->secret)) {
+      LOG_WARN("Push secret must have between 1 and %zu bytes", sizeof(push->secret) - 1);
+      break;
+    }
+    push = calloc(1, sizeof(Push));
+    if (!push) {
+      LOG_WARN("Could not allocate Push object");
+      break;
+    }
+    memcpy(push->secret, secret, len);
+    push->secret_len = (unsigned)len;
+    atomic_init(&push->ready, NULL);
+  } while (0);
+  return push;
+}
+
+void push_destroy(Push* push) {
+  if (!push) return;
+  push_batch_destroy(push->open);
+  push_batch_destroy(atomic_load(&push->ready));
+  free(push);
+}
+
+unsigned push_check_secret(const Push* push, const uint8_t* secret, unsigned len) {
+  // Look at every byte whatever matches, so timing tells nothing about the secret
+  unsigned diff = len ^ push->secret_len;
+  for (unsigned j = 0; j < push->secret_len; ++j) {
+    diff |= push->secret[j] ^ (j < len ? secret[j] : 0);
+  }
+  return diff == 0;
+}
+
+PushBatch* push_batch_build(PushMode mode, const void* owner) {
+  PushBatch* batch = calloc(1, sizeof(PushBatch));
+  if (!batch) {
+    LOG_WARN("Could not allocate PushBatch object");
+    return NULL;
+  }
+  batch->mode = mode;
+  batch->owner = owner;
+  return batch;
+}
+
+void push_batch_destroy(PushBatch* batch) {
+  if (!batch) return;
+  free(batch->rows.data);
+  free(batch->keys.data);
+  free(batch);
+}
+
+unsigned push_buffer_add(PushBuffer* buffer, const uint8_t* data, unsigned len) {
+  if (!push_buffer_reserve(buffer, buffer->len + sizeof(uint32_t) + len)) return 0;
+  uint32_t l = len;
+  memcpy(buffer->data + buffer->len, &l, sizeof(l));
+  memcpy(buffer->data + buffer->len + sizeof(l), data, len);
+  buffer->len += sizeof(l) + len;
+  ++buffer->count;
+  return 1;
+}
+
+unsigned push_buffer_next(const PushBuffer* buffer, size_t* pos, const uint8_t** data, unsigned* len) {
+  if (*pos + sizeof(uint32_t) > buffer->len) return 0;
+  uint32_t l = 0;
+  memcpy(&l, buffer->data + *pos, sizeof(l));
+  *data = buffer->data + *pos + sizeof(l);
+  *len = l;
+  *pos += sizeof(l) + l;
+  return 1;
+}
+
+unsigned push_commit(Push* push) {
+  PushBatch* expected = NULL;
+  if (!atomic_compare_exchange_strong(&push->ready, &expected, push->open)) return 0;
+  push->open = NULL;
+  return 1;
+}
+
+PushBatch* push_take(Push* push) {
+  return atomic_exchange(&push->ready, NULL);
+}
+
+void push_return(Push* push, PushBatch* batch) {
+  // Nothing else commits while a batch is taken, since commits need ready empty
+  // and the loader is the only one emptying it
+  atomic_store(&push->ready, batch);
+}
+
+unsigned push_keys_add(PushKeySet* set, const uint8_t* key, unsigned len) {
+  if (set->count >= set->cap) {
+    unsigned cap = set->cap ? 2 * set->cap : PUSH_KEYS_INITIAL_CAPACITY;
+    PushKey* keys = realloc(set->keys, cap * sizeof(PushKey));
+    if (!keys) {
+      LOG_WARN("Could not grow push key set to %u keys", cap);
+      return 0;
+    }
+    set->keys = keys;
+    set->cap = cap;
+  }
+  if (set->len + len > set->size) {
+    size_t size = set->size ? 2 * set->size : PUSH_BUFFER_INITIAL_CAPACITY;
+    while (size < set->len + len) size *= 2;
+    uint8_t* bytes = realloc(set->bytes, size);
+    if (!bytes) {
+      LOG_WARN("Could not grow push key set to %zu bytes", size);
+      return 0;
+    }
+    set->bytes = bytes;
+    set->size = size;
+  }
+  memcpy(set->bytes + set->len, key, len);
+  PushKey* entry = &set->keys[set->count++];
+  entry->hash = XXH3_64bits(key, len, 0);
+  entry->offset = set->len;
+  entry->len = len;
+  set->len += len;
+  return 1;
+}
+
+void push_keys_seal(PushKeySet* set) {
+  if (set->count) qsort(set->keys, set->count, sizeof(PushKey), push_key_cmp);
+}
+
+unsigned push_keys_has(const PushKeySet* set, const uint8_t* key, unsigned len) {
+  uint64_t hash = XXH3_64bits(key, len, 0);
+  unsigned lo = 0;
+  unsigned hi = set->count;
+  while (lo < hi) {
+    unsigned mid = lo + (hi - lo) / 2;
+    if (set->keys[mid].hash < hash) lo = mid + 1;
+    else hi = mid;
+  }
+  for (unsigned k = lo; k < set->count && set->keys[k].hash == hash; ++k) {
+    const PushKey* entry = &set->keys[k];
+    if (entry->len == len && memcmp(set->bytes + entry->offset, key, len) == 0) return 1;
+  }
+  return 0;
+}
+
+void push_keys_free(PushKeySet* set) {
+  free(set->keys);
+  free(set->bytes);
+  memset(set, 0, sizeof(*set));
+}
+
+static unsigned push_buffer_reserve(PushBuffer* buffer, size_t need) {
+  if (need <= buffer->cap) return 1;
+  size_t cap = buffer->cap ? 2 * buffer->cap : PUSH_BUFFER_INITIAL_CAPACITY;
+  while (cap < need) cap *= 2;
+  uint8_t* data = realloc(buffer->data, cap);
+  if (!data) {
+    LOG_WARN("Could not grow push buffer to %zu bytes", cap);
+    return 0;
+  }
+  buffer->data = data;
+  buffer->cap = cap;
+  return 1;
+}
+
+static int push_key_cmp(const void* a, const void* b) {
+  const PushKey* ka = a;
+  const PushKey* kb = b;
+  if (ka->hash != kb->hash) return ka->hash < kb->hash ? -1 : 1;
+  return 0;
+}
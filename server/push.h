@@ -0,0 +1,91 @@
+#pragma once
+
+// A Push holds the rows a producer streams into a table with INGEST, for
+// tables fed that way rather than from the database. The server thread
+// collects one batch at a time, from the connection that opened it; a
+// committed batch is handed to the loader thread, which builds a fresh slot
+// from it and swaps it in like any reload. A snapshot replaces every row;
+// a delta upserts its rows and deletes its keys, by the table's first index.
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum PushMode {
+  PUSH_SNAPSHOT,
+  PUSH_DELTA,
+} PushMode;
+
+// Rows and keys are stored back to back, each as [u32 len][bytes].
+typedef struct PushBuffer {
+  uint8_t* data;
+  size_t len;
+  size_t cap;
+  unsigned count;
+} PushBuffer;
+
+typedef struct PushBatch {
+  PushMode mode;
+  const void* owner;           // connection streaming the batch
+  PushBuffer rows;
+  PushBuffer keys;             // deleted keys, deltas only
+} PushBatch;
+
+typedef struct PushStats {
+  unsigned batches;            // applied so far
+  unsigned rows;               // rows in the last applied batch
+  unsigned keys;               // keys deleted by the last applied batch
+} PushStats;
+
+typedef struct Push {
+  char secret[256];
+  unsigned secret_len;
+  PushBatch* open;             // being streamed; server thread only
+  _Atomic(PushBatch*) ready;   // committed, waiting for the loader
+  PushStats stats;             // loader thread only
+} Push;
+
+Push* push_build(const char* secret);
+void push_destroy(Push* push);
+
+// Whether secret is the one the table was configured with.
+unsigned push_check_secret(const Push* push, const uint8_t* secret, unsigned len);
+
+PushBatch* push_batch_build(PushMode mode, const void* owner);
+void push_batch_destroy(PushBatch* batch);
+
+// Append len bytes as one entry of buffer.
+unsigned push_buffer_add(PushBuffer* buffer, const uint8_t* data, unsigned len);
+
+// Walk the entries of buffer: pass 0 as pos to start; return 0 at the end.
+unsigned push_buffer_next(const PushBuffer* buffer, size_t* pos, const uint8_t** data, unsigned* len);
+
+// Hand the open batch to the loader; 0 if the previous one is still waiting.
+unsigned push_commit(Push* push);
+
+// Loader side: take the committed batch, if any, and put it back if it
+// could not be applied yet.
+PushBatch* push_take(Push* push);
+void push_return(Push* push, PushBatch* batch);
+
+// A set of keys, looked up while a delta copies the current rows.
+typedef struct PushKey {
+  uint64_t hash;
+  size_t offset;               // into the set's bytes
+  unsigned len;
+} PushKey;
+
+typedef struct PushKeySet {
+  PushKey* keys;
+  unsigned count;
+  unsigned cap;
+  uint8_t* bytes;
+  size_t len;
+  size_t size;
+} PushKeySet;
+
+unsigned push_keys_add(PushKeySet* set, const uint8_t* key, unsigned len);
+// Sort the keys added so far, so push_keys_has can find them.
+void push_keys_seal(PushKeySet* set);
+unsigned push_keys_has(const PushKeySet* set, const uint8_t* key, unsigned len);
+void push_keys_free(PushKeySet* set);
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "protocol.h"
+#include "row.h"
+
+enum {
+  ROW_BUILDER_INITIAL_CAPACITY = 256,
+};
+
+static uint16_t read_le16(const uint8_t *buf) {
+  return (uint16_t)(buf[0] | ((uint16_t)buf[1] << 8));
+}
+
+static uint32_t read_le32(const uint8_t *buf) {
+  return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+         ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static void write_le16(uint8_t *buf, uint16_t v) {
+  buf[0] = (uint8_t)(v & 0xFF);
+  buf[1] = (uint8_t)((v >> 8) & 0xFF);
+}
+
+static void write_le32(uint8_t *buf, uint32_t v) {
+  for (int i = 0; i < 4; ++i) {
+    buf[i] = (uint8_t)((v >> (8 * i)) & 0xFF);
+  }
+}
+
+static void write_le64(uint8_t *buf, uint64_t v) {
+  for (int i = 0; i < 8; ++i) {
+    buf[i] = (uint8_t)((v >> (8 * i)) & 0xFF);
+  }
+}
+
+static uint64_t read_le64(const uint8_t *buf) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; ++i) {
+    v |= ((uint64_t)buf[i]) << (8 * i);
+  }
+  return v;
+}
+
+unsigned row_next_field(const uint8_t* row, unsigned row_len, unsigned* pos, RowField* field) {
+  unsigned p = *pos;
+  if (!p) {
+    if (!row || row_len < 4) return 0;
+    p = 4;
+  }
+  if (p + 2 > row_len) return 0;
+  unsigned flen = read_le16(row + p);
+  p += 2;
+  if (p + flen + 1 + 4 > row_len) return 0;
+  field->name = row + p;
+  field->name_len = flen;
+  p += flen;
+  field->type = row[p++];
+  field->value_len = read_le32(row + p);
+  p += 4;
+  if (p + field->value_len > row_len) return 0;
+  field->value = row + p;
+  field->offset = p;
+  *pos = p + field->value_len;
+  return 1;
+}
+
+unsigned row_find_field(const uint8_t* row, unsigned row_len,
+                        const char* name, unsigned name_len, RowField* field) {
+  unsigned pos = 0;
+  while (row_next_field(row, row_len, &pos, field)) {
+    if (field->name_len == name_len && memcmp(field->name, name, name_len) == 0) return 1;
+  }
+  return 0;
+}
+
+unsigned row_field_uint(const RowField* field, unsigned* key) {
+  switch (field->type) {
+    case MELIAN_VALUE_INT64:
+      if (field->value_len != 8) return 0;
+      *key = (unsigned)read_le64(field->value);
+      return 1;
+    case MELIAN_VALUE_BOOL:
+      *key = field->value_len && field->value[0] ? 1 : 0;
+      return 1;
+    case MELIAN_VALUE_BYTES:
+    case MELIAN_VALUE_DECIMAL: {
+      char buf[32];
+      if (!field->value_len || field->value_len >= sizeof(buf)) return 0;
+      memcpy(buf, field->value, field->value_len);
+      buf[field->value_len] = '\0';
+      *key = (unsigned)strtoul(buf, 0, 10);
+      return 1;
+    }
+    default:
+      return 0;
+  }
+}
+
+unsigned row_field_bytes(const RowField* field, char* buf, unsigned size,
+                         const uint8_t** bytes, unsigned* len) {
+  int wrote = 0;
+  switch (field->type) {
+    case MELIAN_VALUE_BYTES:
+    case MELIAN_VALUE_DECIMAL:
+      if (!field->value_len) return 0;
+      *bytes = field->value;
+      *len = field->value_len;
+      return 1;
+    case MELIAN_VALUE_INT64:
+      if (field->value_len != 8) return 0;
+      wrote = snprintf(buf, size, "%lld", (long long)(int64_t)read_le64(field->value));
+      break;
+    case MELIAN_VALUE_FLOAT64: {
+      if (field->value_len != 8) return 0;
+      uint64_t bits = read_le64(field->value);
+      double value = 0;
+      memcpy(&value, &bits, sizeof(value));
+      wrote = snprintf(buf, size, "%.15g", value);
+      break;
+    }
+    case MELIAN_VALUE_BOOL:
+      wrote = snprintf(buf, size, "%u", field->value_len && field->value[0] ? 1 : 0);
+      break;
+    default:
+      return 0;
+  }
+  if (wrote <= 0 || (unsigned)wrote >= size) return 0;
+  *bytes = (const uint8_t*)buf;
+  *len = (unsigned)wrote;
+  return 1;
+}
+
+unsigned row_field_number(const RowField* field, double* number, int64_t* integer, unsigned* is_int) {
+  switch (field->type) {
+    case MELIAN_VALUE_INT64:
+      if (field->value_len != 8) return 0;
+      *integer = (int64_t)read_le64(field->value);
+      *number = (double)*integer;
+      *is_int = 1;
+      return 1;
+    case MELIAN_VALUE_BOOL:
+      *integer = field->value_len && field->value[0] ? 1 : 0;
+      *number = (double)*integer;
+      *is_int = 1;
+      return 1;
+    case MELIAN_VALUE_FLOAT64: {
+      if (field->value_len != 8) return 0;
+      uint64_t bits = read_le64(field->value);
+      memcpy(number, &bits, sizeof(*number));
+      *integer = (int64_t)*number;
+      *is_int = 0;
+      return 1;
+    }
+    case MELIAN_VALUE_BYTES:
+    case MELIAN_VALUE_DECIMAL: {
+      char buf[64];
+      if (!field->value_len || field->value_len >= sizeof(buf)) return 0;
+      memcpy(buf, field->value, field->value_len);
+      buf[field->value_len] = '\0';
+      char* end = 0;
+      *number = strtod(buf, &end);
+      if (end == buf || *end) return 0;
+      *integer = (int64_t)*number;
+      *is_int = !strpbrk(buf, ".eE") && (double)*integer == *number;
+      return 1;
+    }
+    default:
+      return 0;
+  }
+}
+
+unsigned row_builder_reset(RowBuilder* builder) {
+  if (!builder->buf) {
+    builder->buf = malloc(ROW_BUILDER_INITIAL_CAPACITY);
+    if (!builder->buf) return 0;
+    builder->cap = ROW_BUILDER_INITIAL_CAPACITY;
+  }
+  builder->len = 4;
+  builder->count = 0;
+  return 1;
+}
+
+void row_builder_free(RowBuilder* builder) {
+  if (builder->buf) free(builder->buf);
+  builder->buf = 0;
+  builder->len = builder->cap = builder->count = 0;
+}
+
+unsigned row_builder_add(RowBuilder* builder, const uint8_t* name, unsigned name_len,
+                         uint8_t type, const uint8_t* value, unsigned value_len) {
+  if (name_len > 0xFFFF) return 0;
+  unsigned need = builder->len + 2 + name_len + 1 + 4 + value_len;
+  if (need > builder->cap) {
+    unsigned cap = builder->cap;
+    while (cap < need) cap *= 2;
+    uint8_t* buf = realloc(builder->buf, cap);
+    if (!buf) return 0;
+    builder->buf = buf;
+    builder->cap = cap;
+  }
+  uint8_t* p = builder->buf + builder->len;
+  write_le16(p, (uint16_t)name_len);
+  p += 2;
+  memcpy(p, name, name_len);
+  p += name_len;
+  *p++ = type;
+  write_le32(p, value_len);
+  p += 4;
+  if (value_len) memcpy(p, value, value_len);
+  builder->len = need;
+  ++builder->count;
+  return 1;
+}
+
+unsigned row_builder_add_int(RowBuilder* builder, const char* name, int64_t value) {
+  uint8_t buf[8];
+  write_le64(buf, (uint64_t)value);
+  return row_builder_add(builder, (const uint8_t*)name, strlen(name), MELIAN_VALUE_INT64, buf, sizeof(buf));
+}
+
+unsigned row_builder_add_float(RowBuilder* builder, const char* name, double value) {
+  uint8_t buf[8];
+  uint64_t bits = 0;
+  memcpy(&bits, &value, sizeof(bits));
+  write_le64(buf, bits);
+  return row_builder_add(builder, (const uint8_t*)name, strlen(name), MELIAN_VALUE_FLOAT64, buf, sizeof(buf));
+}
+
+const uint8_t* row_builder_finish(RowBuilder* builder, unsigned* len) {
+  write_le32(builder->buf, builder->count);
+  *len = builder->len;
+  return builder->buf;
+}
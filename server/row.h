@@ -0,0 +1,61 @@
+#pragma once
+
+// A Row is one record in the binary row format served by FETCH:
+//   u32 field_count, then per field: u16 name_len, name, u8 type, u32 value_len, value.
+// All integers are little-endian; see protocol.h for the value types.
+// The row_field / row_find helpers read fields out of an encoded row without
+// copying it; a RowBuilder encodes new rows.
+
+#include <stdint.h>
+
+typedef struct RowField {
+  const uint8_t* name;
+  unsigned name_len;
+  uint8_t type;           // one of MelianValueType
+  const uint8_t* value;
+  unsigned value_len;
+  unsigned offset;        // offset of value from the start of the row
+} RowField;
+
+typedef struct RowBuilder {
+  uint8_t* buf;
+  unsigned len;
+  unsigned cap;
+  unsigned count;         // fields added so far
+} RowBuilder;
+
+// Step through the fields of row; start with *pos = 0.
+// Return 1 and fill field while there are fields left.
+unsigned row_next_field(const uint8_t* row, unsigned row_len, unsigned* pos, RowField* field);
+
+// Find the field called name in row; return 1 and fill field if found.
+unsigned row_find_field(const uint8_t* row, unsigned row_len,
+                        const char* name, unsigned name_len, RowField* field);
+
+// Interpret a field as an unsigned integer key (ints, bools and decimal text).
+// Return 1 and fill key if the field holds a usable value.
+unsigned row_field_uint(const RowField* field, unsigned* key);
+
+// Interpret a field as string key bytes. Text fields are returned in place;
+// numbers are formatted as decimal text into buf (of size bytes).
+// Return 1 and fill bytes / len if the field holds a non-empty value.
+unsigned row_field_bytes(const RowField* field, char* buf, unsigned size,
+                         const uint8_t** bytes, unsigned* len);
+
+// Interpret a field as a number (ints, floats, bools and numeric text).
+// Return 1 and fill number, integer and is_int if the field holds one.
+unsigned row_field_number(const RowField* field, double* number, int64_t* integer, unsigned* is_int);
+
+// Start a new row in builder (zero-initialized before first use), keeping its buffer.
+// Return 0 if out of memory.
+unsigned row_builder_reset(RowBuilder* builder);
+void row_builder_free(RowBuilder* builder);
+
+// Append a field; return 0 if out of memory.
+unsigned row_builder_add(RowBuilder* builder, const uint8_t* name, unsigned name_len,
+                         uint8_t type, const uint8_t* value, unsigned value_len);
+unsigned row_builder_add_int(RowBuilder* builder, const char* name, int64_t value);
+unsigned row_builder_add_float(RowBuilder* builder, const char* name, double value);
+
+// Return the encoded row and its length.
+const uint8_t* row_builder_finish(RowBuilder* builder, unsigned* len);
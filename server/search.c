@@ -0,0 +1,227 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <event2/event.h>
+#include <event2/util.h>
+#include "util.h"
+#include "log.h"
+#include "arena.h"
+#include "data.h"
+#include "trigram.h"
+#include "search.h"
+
+enum {
+  SEARCH_MESSAGE_DONE = 'D',
+};
+
+static void* search_main(void* arg);
+static void search_execute(SearchJob* job);
+static void on_ready(evutil_socket_t fd, short what, void* arg);
+static void write_le32(uint8_t* buf, uint32_t v);
+static void write_le64(uint8_t* buf, uint64_t v);
+
+Search* search_build(struct event_base* base, SearchDone on_done, void* ctx) {
+  Search* search = 0;
+  do {
+    search = calloc(1, sizeof(Search));
+    if (!search) {
+      LOG_WARN("Could not allocate Search object");
+      break;
+    }
+    search->base = base;
+    search->on_done = on_done;
+    search->ctx = ctx;
+    search->pair[0] = search->pair[1] = -1;
+    pthread_mutex_init(&search->lock, 0);
+    pthread_cond_init(&search->wake, 0);
+  } while (0);
+  return search;
+}
+
+void search_destroy(Search* search) {
+  if (!search) return;
+  search_stop(search);
+
+  for (SearchJob* job = search->todo; job; ) {
+    SearchJob* next = job->next;
+    search_job_free(job);
+    job = next;
+  }
+  for (SearchJob* job = search->done; job; ) {
+    SearchJob* next = job->next;
+    search_job_free(job);
+    job = next;
+  }
+  if (search->ready) event_free(search->ready);
+  if (search->pair[0] >= 0) close(search->pair[0]);
+  if (search->pair[1] >= 0) close(search->pair[1]);
+  pthread_cond_destroy(&search->wake);
+  pthread_mutex_destroy(&search->lock);
+  free(search);
+}
+
+unsigned search_run(Search* search) {
+  do {
+    if (search->running) break;
+
+    if (evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, search->pair) < 0) {
+      LOG_WARN("Could not create socket pair for search worker: %s", strerror(errno));
+      return 0;
+    }
+    evutil_make_socket_nonblocking(search->pair[0]);
+    search->ready = event_new(search->base, search->pair[0], EV_READ | EV_PERSIST, on_ready, search);
+    event_add(search->ready, NULL);
+
+    search->quit = 0;
+    pthread_t thread;
+    if (pthread_create(&thread, 0, search_main, search)) {
+      LOG_WARN("Could not start search worker");
+      return 0;
+    }
+    search->thread = (void*) thread;
+    search->running = 1;
+    LOG_INFO("Started search worker");
+  } while (0);
+  return 1;
+}
+
+unsigned search_stop(Search* search) {
+  do {
+    if (!search->running) break;
+    search->running = 0;
+
+    pthread_mutex_lock(&search->lock);
+    search->quit = 1;
+    pthread_cond_signal(&search->wake);
+    pthread_mutex_unlock(&search->lock);
+    pthread_t thread = (pthread_t) search->thread;
+    pthread_join(thread, 0);
+    LOG_DEBUG("Joined search worker");
+    search->thread = 0;
+    if (search->ready) event_del(search->ready);
+  } while (0);
+  return 1;
+}
+
+void search_submit(Search* search, SearchJob* job) {
+  job->next = 0;
+  pthread_mutex_lock(&search->lock);
+  if (search->todo_tail) search->todo_tail->next = job;
+  else search->todo = job;
+  search->todo_tail = job;
+  pthread_cond_signal(&search->wake);
+  pthread_mutex_unlock(&search->lock);
+}
+
+void search_job_free(SearchJob* job) {
+  if (!job) return;
+  free(job->reply);
+  free(job);
+}
+
+static void* search_main(void* arg) {
+  Search* search = arg;
+  LOG_INFO("THREAD: running search worker");
+  while (1) {
+    pthread_mutex_lock(&search->lock);
+    while (!search->todo && !search->quit) pthread_cond_wait(&search->wake, &search->lock);
+    if (search->quit) {
+      pthread_mutex_unlock(&search->lock);
+      break;
+    }
+    SearchJob* job = search->todo;
+    search->todo = job->next;
+    if (!search->todo) search->todo_tail = 0;
+    pthread_mutex_unlock(&search->lock);
+
+    search_execute(job);
+
+    pthread_mutex_lock(&search->lock);
+    job->next = search->done;
+    search->done = job;
+    pthread_mutex_unlock(&search->lock);
+
+    uint8_t message = SEARCH_MESSAGE_DONE;
+    ssize_t wrote = 0;
+    do {
+      wrote = write(search->pair[1], &message, 1);
+    } while (wrote < 0 && errno == EINTR);
+    if (wrote != 1) LOG_ERROR("Failed to hand back search job: %s", strerror(errno));
+  }
+  LOG_INFO("THREAD: stopping search worker");
+  return 0;
+}
+
+// Rank the rows of the job's pinned slot and build the reply.
+static void search_execute(SearchJob* job) {
+  static TrigramHit hits[TRIGRAM_MAX_RESULTS];  // search worker only
+  const struct TableSlot* slot = job->slot;
+  const uint8_t* base = slot->arena->buffer;
+  unsigned count = trigram_search(slot->trigram[job->index_id], base, job->substring,
+                                  job->query, job->query_len, job->limit, job->min_score, hits);
+
+  // A row frame is its 4-byte length and the row, so each hit takes 8 + frame_len
+  size_t need = 4;
+  for (unsigned h = 0; h < count; ++h) need += 8 + hits[h].doc->frame_len;
+  if (need >= MELIAN_RESPONSE_STATUS) {
+    LOG_WARN("SEARCH reply of %zu bytes is too large", need);
+    return;
+  }
+  job->reply = malloc(need);
+  if (!job->reply) {
+    LOG_WARN("Could not allocate %zu bytes for SEARCH reply", need);
+    return;
+  }
+  job->reply_cap = (unsigned)need;
+  uint8_t* p = job->reply;
+  write_le32(p, count);
+  p += 4;
+  for (unsigned h = 0; h < count; ++h) {
+    uint64_t bits;
+    memcpy(&bits, &hits[h].score, sizeof(bits));
+    write_le64(p, bits);
+    p += 8;
+    const TrigramDoc* doc = hits[h].doc;
+    // Frames carry a big-endian length, as FETCH replies; this payload is little-endian
+    write_le32(p, doc->frame_len - 4);
+    memcpy(p + 4, base + doc->frame + 4, doc->frame_len - 4);
+    p += doc->frame_len;
+  }
+  job->reply_len = (unsigned)need;
+  LOG_DEBUG("SEARCH for [%.*s] found %u rows", (int)job->query_len, job->query, count);
+}
+
+// Event loop side: pass every finished job to on_done, oldest first.
+static void on_ready(evutil_socket_t fd, short what, void* arg) {
+  UNUSED(what);
+  Search* search = arg;
+  uint8_t buf[64];
+  while (read(fd, buf, sizeof(buf)) > 0) {}
+
+  pthread_mutex_lock(&search->lock);
+  SearchJob* done = search->done;
+  search->done = 0;
+  pthread_mutex_unlock(&search->lock);
+
+  SearchJob* oldest = 0;
+  while (done) {
+    SearchJob* next = done->next;
+    done->next = oldest;
+    oldest = done;
+    done = next;
+  }
+  while (oldest) {
+    SearchJob* next = oldest->next;
+    search->on_done(oldest, search->ctx);
+    oldest = next;
+  }
+}
+
+static void write_le32(uint8_t* buf, uint32_t v) {
+  for (unsigned b = 0; b < 4; ++b) buf[b] = (uint8_t)(v >> (8 * b));
+}
+
+static void write_le64(uint8_t* buf, uint64_t v) {
+  for (unsigned b = 0; b < 8; ++b) buf[b] = (uint8_t)(v >> (8 * b));
+}
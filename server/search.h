@@ -0,0 +1,59 @@
+#pragma once
+
+// A Search runs SEARCH requests on a worker thread, so that ranking rows by
+// trigram never holds up the event loop and the fetches it serves.
+// The server thread pins the slot a job reads and submits it; the worker
+// builds the reply and hands the job back through a socket pair watched by
+// the event loop, which calls done to write the reply and unpin the slot.
+
+#include <pthread.h>
+#include <stdint.h>
+#include "protocol.h"
+
+struct Table;
+struct TableSlot;
+
+typedef struct SearchJob {
+  struct SearchJob* next;
+  void* owner;                 // whoever waits for the reply
+  struct Table* table;
+  struct TableSlot* slot;      // pinned until the job is done
+  unsigned index_id;
+  unsigned substring;
+  unsigned limit;
+  double min_score;
+  uint8_t query[MELIAN_SEARCH_MAX_QUERY];
+  unsigned query_len;
+  uint8_t* reply;              // [u32 count] then [f64 score][u32 len][row] per hit
+  unsigned reply_len;          // 0 if the reply could not be built
+  unsigned reply_cap;
+} SearchJob;
+
+typedef void (*SearchDone)(SearchJob* job, void* ctx);
+
+typedef struct Search {
+  struct event_base* base;
+  struct event* ready;         // the event loop end of pair
+  int pair[2];
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  SearchJob* todo;             // oldest first
+  SearchJob* todo_tail;
+  SearchJob* done;             // newest first
+  SearchDone on_done;
+  void* ctx;
+  void* thread;
+  unsigned running;
+  unsigned quit;
+} Search;
+
+Search* search_build(struct event_base* base, SearchDone on_done, void* ctx);
+void search_destroy(Search* search);
+unsigned search_run(Search* search);
+unsigned search_stop(Search* search);
+
+// Queue job for the worker; the Search owns it until it is passed to on_done.
+void search_submit(Search* search, SearchJob* job);
+
+// Free a job and its reply.
+void search_job_free(SearchJob* job);
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
@@ -12,6 +13,7 @@
 #include <sys/un.h>
 #include <event2/event.h>
 #include <event2/listener.h>
+#include <jansson.h>
 #include "util.h"
 #include "log.h"
 #include "arena.h"
@@ -19,8 +21,17 @@
 #include "config.h"
 #include "status.h"
 #include "data.h"
+#include "geo.h"
+#include "arrow.h"
 #include "db.h"
 #include "cron.h"
+#include "search.h"
+#include "push.h"
+#include "row.h"
+#include "numa.h"
+#include "loader.h"
+#include "cluster.h"
+#include "tls.h"
 #include "protocol.h"
 #include "server.h"
 
@@ -28,6 +39,22 @@ enum {
   MELIAN_MAX_KEY_LEN = 256,   // max key length in bytes
   MELIAN_RBUF_SIZE = 4096,    // read buffer size
   MELIAN_WBUF_SIZE = 65536,   // write buffer size
+  MELIAN_MAX_CLIENT_NAME_LEN = 64,
+  MELIAN_MAX_PEER_LEN = 64,
+  MELIAN_LAG_PROBE_MIN_US = 1000,
+};
+
+// Counters for one connection; only the server thread touches them.
+struct conn_stats_t {
+  unsigned long requests;
+  unsigned long bytes_in;
+  unsigned long bytes_out;
+  unsigned long misses;          // FETCH requests that found nothing
+  unsigned long partial_writes;  // replies that did not fit in the socket at once
+  unsigned long blocked_us;      // time spent waiting for the socket to drain
+  unsigned long expired;         // requests past their deadline when their turn came
+  unsigned long shed;            // requests dropped while the server lagged
+  unsigned long forwarded;       // requests answered by another cluster node
 };
 
 // State for each client connection using direct I/O
@@ -36,11 +63,13 @@ struct conn_state_t {
   int fd;
   struct event *rev;           // read event
   struct event *wev;           // write event (lazy-created)
+  struct ssl_st* tls;          // TLS connection that OpenSSL still reads for; 0 once the kernel does
 
   // Read buffer
   uint8_t rbuf[MELIAN_RBUF_SIZE];
   unsigned rbuf_len;           // bytes in buffer
   unsigned rbuf_pos;           // current parse position
+  double arrived;              // when the last bytes were read
 
   // Write buffer for small responses
   uint8_t wbuf[MELIAN_WBUF_SIZE];
@@ -51,6 +80,12 @@ struct conn_state_t {
   const uint8_t* pending_ref;
   unsigned pending_ref_len;
   unsigned pending_ref_pos;
+  struct TableSlot* pending_slot;  // pinned while pending_ref points into its arena
+  unsigned paused;             // requests wait in rbuf until the pending reply is out
+  struct SearchJob* search;    // SEARCH on the worker; requests wait until it answers
+  struct ClusterJob* forward;  // request sent to another cluster node; requests wait until it answers
+  unsigned cluster_peer;       // another cluster node, whose requests are never forwarded again
+  struct Table* ingesting;     // table whose INGEST batch this connection streams; 0 if none
 
   // Parse state
   MelianRequestHeader hdr;
@@ -61,22 +96,72 @@ struct conn_state_t {
   uint32_t key_len;
   uint32_t key_have;
   unsigned discarding;
-
-  struct conn_state_t* next;
+  uint32_t budget_us;          // how long the caller waits once the request arrived; 0 for no limit
+  double deadline;             // when the caller stops waiting; 0 for never
+  uint8_t priority;            // 0 is never shed
+
+  // Identity and counters, reported by CLIENT LIST
+  unsigned id;
+  unsigned connected;          // epoch
+  char name[MELIAN_MAX_CLIENT_NAME_LEN];
+  char peer[MELIAN_MAX_PEER_LEN];
+  char hello[32];              // HELLO reply
+  char ingested[48];           // INGEST reply
+  uint8_t group_head[12];      // GROUP reply length, count and total, ahead of the rows
+  uint8_t* reply;              // replies built for this connection, e.g. NEAREST
+  unsigned reply_cap;
+  double blocked_since;        // when the pending write started; 0 if none
+  struct conn_stats_t stats;
+
+  struct conn_state_t* next;   // free list
+  struct conn_state_t* active_prev;
+  struct conn_state_t* active_next;
+  unsigned active;
 };
 
 static HOT_FUNC void on_read(evutil_socket_t fd, short events, void *ctx);
+static void on_handshake(evutil_socket_t fd, short events, void *ctx);
+static void conn_read_pending(struct conn_state_t *state);
+static HOT_FUNC void conn_process(struct conn_state_t *state);
+static void conn_unpin(struct conn_state_t *state);
 static void on_write(evutil_socket_t fd, short events, void *ctx);
 static void on_accept(struct evconnlistener *lev, evutil_socket_t fd,
                       struct sockaddr *addr, int socklen, void *ctx);
 static void on_quit(evutil_socket_t fd, short what, void *ctx);
 static void on_signal(int signal, short events, void *ctx);
+static void on_lag_probe(evutil_socket_t fd, short what, void *ctx);
+static void schedule_lag_probe(Server* server);
+static unsigned conn_triage(struct conn_state_t *state);
 static void conn_close(struct conn_state_t *state);
+static void conn_open(struct conn_state_t *state, struct sockaddr *addr, int socklen);
+static unsigned conn_hello(struct conn_state_t *state, const uint8_t* name, unsigned len);
+static int conn_cmp_load(const void* a, const void* b);
+static unsigned conn_nearest(struct conn_state_t *state, const uint8_t* payload, unsigned len);
+static unsigned conn_search(struct conn_state_t *state, const uint8_t* payload, unsigned len);
+static const uint8_t* conn_group(struct conn_state_t *state, const uint8_t* payload, unsigned len,
+                                 unsigned* rlen, unsigned* rfmt);
+static const uint8_t* conn_export(struct conn_state_t *state, unsigned* rlen, unsigned* status);
+static void on_search_done(SearchJob* job, void* ctx);
+static unsigned conn_forward(struct conn_state_t *state, unsigned nodes, const uint8_t* payload,
+                             unsigned* status);
+static void on_cluster_done(ClusterJob* job, void* ctx);
+static unsigned conn_ingest(struct conn_state_t *state, const uint8_t* payload, unsigned len,
+                            unsigned* status);
+static void conn_ingest_abort(struct conn_state_t *state);
+static unsigned ingest_rows_valid(const uint8_t* data, unsigned len);
+static unsigned ingest_keys_valid(const uint8_t* data, unsigned len);
+static void conn_count_access(Server* server, Table* table);
+static uint32_t read_le32(const uint8_t* buf);
+static uint64_t read_le64(const uint8_t* buf);
+static void write_le32(uint8_t* buf, uint32_t v);
+static void write_le64(uint8_t* buf, uint64_t v);
+static unsigned conn_clients(struct conn_state_t *state);
 
 // Inline fetch combining data_fetch + table_fetch + hash_get for hot path
-static inline const Bucket* data_fetch_inline(Data* data, unsigned table_id,
+static inline const Bucket* data_fetch_inline(Server* server, unsigned table_id,
                                                unsigned index_id,
                                                const void *key, unsigned len) {
+  Data* data = server->data;
   if (unlikely(table_id >= ALEN(data->lookup))) return NULL;
   Table* table = data->lookup[table_id];
   if (unlikely(!table)) return NULL;
@@ -86,8 +171,50 @@ static inline const Bucket* data_fetch_inline(Data* data, unsigned table_id,
   struct TableSlot* slot = &table->slots[current_slot];
   Hash* hash = slot->indexes[index_id];
   if (unlikely(!hash)) return NULL;
+  if (unlikely(table->indexes[index_id].normalize) &&
+      !table_normalize_key(table, index_id, &key, &len)) return NULL;
+
+  // Only this thread writes the counter, so a plain increment is enough
+  unsigned accesses = atomic_load_explicit(&table->accesses, memory_order_relaxed);
+  atomic_store_explicit(&table->accesses, accesses + 1, memory_order_relaxed);
+  if (unlikely(atomic_load_explicit(&table->tier, memory_order_relaxed) == TABLE_TIER_COLD)) {
+    unsigned first = 0;
+    const Bucket* bucket = table_fetch_cold(table, hash, key, len, &first);
+    if (first) cron_wakeup(server->cron);
+    return bucket;
+  }
 
-  return hash_get(hash, key, len);
+  const Bucket* bucket = hash_get(hash, key, len);
+  // Every so many fetches leave their key for warming the next slot
+  if (unlikely(!(accesses & (TABLE_WARM_SAMPLE - 1))) && bucket) table_note_hot(table, index_id, bucket->hash);
+  return bucket;
+}
+
+// FETCH through an ad-hoc index: the payload is [u8 column_len][column][key].
+// Sets status when the index is not ready yet, waking up the loader if needed.
+static const Bucket* fetch_adhoc(Server* server, unsigned table_id,
+                                 const uint8_t* payload, unsigned len, unsigned* status) {
+  Data* data = server->data;
+  if (!len || 1u + payload[0] > len) return NULL;
+  if (table_id >= ALEN(data->lookup)) return NULL;
+  Table* table = data->lookup[table_id];
+  if (!table) return NULL;
+
+  unsigned accesses = atomic_load_explicit(&table->accesses, memory_order_relaxed);
+  atomic_store_explicit(&table->accesses, accesses + 1, memory_order_relaxed);
+
+  unsigned column_len = payload[0];
+  unsigned lookup = TABLE_ADHOC_LOOKUP_DONE;
+  const Bucket* bucket = table_fetch_adhoc(table, (const char*)payload + 1, column_len,
+                                           payload + 1 + column_len, len - 1 - column_len,
+                                           time(0), &lookup);
+  if (lookup == TABLE_ADHOC_LOOKUP_REQUESTED) cron_wakeup(server->cron);
+  if (lookup == TABLE_ADHOC_LOOKUP_FULL) {
+    *status = MELIAN_STATUS_NO_ROOM;
+  } else if (lookup != TABLE_ADHOC_LOOKUP_DONE) {
+    *status = MELIAN_STATUS_NOT_READY;
+  }
+  return bucket;
 }
 
 Server* server_build(void) {
@@ -99,15 +226,26 @@ Server* server_build(void) {
       LOG_WARN("Could not allocate a Server object");
       break;
     }
-    server->base = event_base_new();
-    if (!server->base) {
-      LOG_WARN("Could not allocate a Server event_base object");
+    server->config = config_build();
+    if (!server->config) {
       ++bad;
       break;
     }
 
-    server->config = config_build();
-    if (!server->config) {
+    // Before anything else is allocated and before any thread or the loader
+    // process starts, so that tables, indexes and the event base are placed
+    // on the node and every thread inherits the binding
+    int node = server->config->server.numa_node;
+    if (node >= 0) {
+      char cpus[256];
+      if (numa_bind(node, cpus, sizeof(cpus))) {
+        LOG_INFO("Serving from NUMA node %d of %u, CPUs %s", node, numa_node_count(), cpus);
+      }
+    }
+
+    server->base = event_base_new();
+    if (!server->base) {
+      LOG_WARN("Could not allocate a Server event_base object");
       ++bad;
       break;
     }
@@ -121,17 +259,48 @@ Server* server_build(void) {
       ++bad;
       break;
     }
+    if (server->config->server.loader_process) {
+      // Started before any thread, so the child copies as little as possible
+      server->loader = loader_build(server->config);
+      if (!server->loader || !loader_start(server->loader)) {
+        ++bad;
+        break;
+      }
+      data_use_loader(server->data, server->loader);
+    }
     server->cron = cron_build(server);
     if (!server->cron) {
       ++bad;
       break;
     }
+    server->search = search_build(server->base, on_search_done, server);
+    if (!server->search) {
+      ++bad;
+      break;
+    }
 
     server->status = status_build(server->base, server->db);
     if (!server->status) {
       ++bad;
       break;
     }
+    if (server->config->cluster.self >= 0) {
+      server->cluster = cluster_build(server->config, server->base, on_cluster_done, server);
+      if (!server->cluster) {
+        ++bad;
+        break;
+      }
+      server->status->cluster = server->cluster;
+    }
+    const char* cert = server->config->socket.tls_cert;
+    if (cert && cert[0] && server->config->socket.port) {
+      server->tls = tls_build(cert, server->config->socket.tls_key);
+      if (!server->tls) {
+        ++bad;
+        break;
+      }
+      server->status->tls = server->tls;
+    }
     status_log(server->status);
 
     server->sev = evsignal_new(server->base, SIGINT, on_signal, server);
@@ -164,12 +333,17 @@ void server_destroy(Server* server) {
 
   if (server->listener_unix) evconnlistener_free(server->listener_unix);
   if (server->listener_tcp) evconnlistener_free(server->listener_tcp);
+  if (server->tls) tls_destroy(server->tls);
   if (server->cron) cron_destroy(server->cron);
+  if (server->search) search_destroy(server->search);
+  if (server->cluster) cluster_destroy(server->cluster);
+  if (server->loader) loader_destroy(server->loader);
   if (server->data) data_destroy(server->data);
   if (server->db) db_destroy(server->db);
   if (server->status) status_destroy(server->status);
   if (server->config) config_destroy(server->config);
   if (server->sev) event_free(server->sev);
+  if (server->lag_ev) event_free(server->lag_ev);
   if (server->tev) event_free(server->tev);
   if (server->base) event_base_free(server->base);
   free(server);
@@ -177,7 +351,8 @@ void server_destroy(Server* server) {
 
 unsigned server_initial_load(Server* server) {
   unsigned total_rows = data_load_all_tables_from_db(server->data, server->db);
-  return total_rows > 0;
+  // A cluster node may hold no rows at all and only forward requests
+  return total_rows > 0 || server->cluster;
 }
 
 unsigned server_listen(Server* server) {
@@ -216,7 +391,7 @@ unsigned server_listen(Server* server) {
     unsigned flags = LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE | LEV_OPT_REUSEABLE_PORT;
     server->listener_tcp = evconnlistener_new_bind(server->base, on_accept, server, flags, -1,
                                                    (struct sockaddr*)&sin, sizeof(sin));
-    LOG_INFO("Listening on TCP socket [%s:%u]", host, port);
+    LOG_INFO("Listening on TCP socket [%s:%u]%s", host, port, server->tls ? " with TLS" : "");
     ++listeners;
   }
 
@@ -228,7 +403,16 @@ unsigned server_run(Server* server) {
     if (server->running) break;
     server->running = 1;
 
+    search_run(server->search);
     cron_run(server->cron);
+    if (server->config->server.shed_lag) {
+      server->lag_ev = evtimer_new(server->base, on_lag_probe, server);
+      if (server->lag_ev) {
+        schedule_lag_probe(server);
+        LOG_INFO("Shedding low priority requests when the event loop lags over %u ms",
+                 server->config->server.shed_lag);
+      }
+    }
     LOG_INFO("Running event loop");
     event_base_dispatch(server->base);
   } while (0);
@@ -241,6 +425,8 @@ unsigned server_stop(Server* server) {
     server->running = 0;
 
     cron_stop(server->cron);
+    search_stop(server->search);
+    if (server->lag_ev) event_del(server->lag_ev);
     LOG_INFO("Stopping event loop");
     event_base_loopexit(server->base, 0);
   } while (0);
@@ -252,18 +438,38 @@ static void conn_close(struct conn_state_t *state) {
   LOG_DEBUG("Closing connection fd=%d", state->fd);
   if (state->rev && event_get_base(state->rev)) event_del(state->rev);
   if (state->wev && event_get_base(state->wev)) event_del(state->wev);
+  if (state->tls) {
+    tls_close(state->tls);
+    state->tls = NULL;
+  }
   if (state->fd >= 0) {
     close(state->fd);
     state->fd = -1;
   }
+  Server* server = state->server;
+  if (state->active) {
+    if (state->active_prev) state->active_prev->active_next = state->active_next;
+    else server->conn_active = state->active_next;
+    if (state->active_next) state->active_next->active_prev = state->active_prev;
+    state->active_prev = state->active_next = NULL;
+    state->active = 0;
+    --server->conn_count;
+    LOG_DEBUG("Connection %u [%s] closed after %lu requests",
+              state->id, state->name, state->stats.requests);
+  }
   // Reset state
   state->rbuf_len = 0;
   state->rbuf_pos = 0;
   state->wbuf_len = 0;
   state->wbuf_pos = 0;
+  conn_unpin(state);
   state->pending_ref = NULL;
   state->pending_ref_len = 0;
   state->pending_ref_pos = 0;
+  state->paused = 0;
+  state->search = NULL;        // on_search_done drops the job when it comes back
+  state->forward = NULL;       // and on_cluster_done a forwarded one
+  conn_ingest_abort(state);
   state->hdr_have = 0;
   state->key_have = 0;
   state->key_len = 0;
@@ -272,7 +478,6 @@ static void conn_close(struct conn_state_t *state) {
   state->index_id = 0;
   state->discarding = 0;
   // Return to free list
-  Server* server = state->server;
   state->next = server->conn_free;
   server->conn_free = state;
 }
@@ -294,6 +499,7 @@ static void on_write(evutil_socket_t fd, short events, void *ctx) {
       return;
     }
     state->wbuf_pos += n;
+    state->stats.bytes_out += n;
   }
 
   // Then flush pending reference (zero-copy arena data)
@@ -308,19 +514,44 @@ static void on_write(evutil_socket_t fd, short events, void *ctx) {
       return;
     }
     state->pending_ref_pos += n;
+    state->stats.bytes_out += n;
   }
 
   // All done - disable write event, clear buffers
   event_del(state->wev);
+  if (state->blocked_since) {
+    state->stats.blocked_us += (now_sec() - state->blocked_since) * 1000000;
+    state->blocked_since = 0;
+  }
   state->wbuf_len = 0;
   state->wbuf_pos = 0;
+  conn_unpin(state);
   state->pending_ref = NULL;
   state->pending_ref_len = 0;
   state->pending_ref_pos = 0;
+
+  // Pick up the requests that arrived while the reply was pending
+  if (state->paused) {
+    state->paused = 0;
+    event_add(state->rev, NULL);
+    conn_process(state);
+    conn_read_pending(state);
+  }
 }
 
-// Queue response for writing, using writev for zero-copy when possible
-static inline void queue_response(struct conn_state_t *state,
+// Let the loader reuse the slot the pending reply was written from.
+static void conn_unpin(struct conn_state_t *state) {
+  if (!state->pending_slot) return;
+  atomic_fetch_sub(&state->pending_slot->pins, 1);
+  state->pending_slot = NULL;
+}
+
+// Queue response for writing, using writev for zero-copy when possible.
+// Only called with nothing pending, so the reply can be as large as it gets:
+// what does not fit in the socket is written out of data by on_write, which
+// pins table's slot if data lives in its arena. Replies that are not arena
+// data are copied to wbuf when they fit, since their buffers are shared.
+static inline void queue_response(struct conn_state_t *state, Table* table,
                                    const uint8_t *hdr, unsigned hdr_len,
                                    const uint8_t *data, unsigned data_len) {
   // Try immediate write with writev for zero-copy
@@ -343,6 +574,7 @@ static inline void queue_response(struct conn_state_t *state,
 
   if (n == total) {
     // Complete write - done
+    state->stats.bytes_out += n;
     return;
   }
 
@@ -353,6 +585,9 @@ static inline void queue_response(struct conn_state_t *state,
     }
     n = 0; // treat as zero bytes written
   }
+  state->stats.bytes_out += n;
+  ++state->stats.partial_writes;
+  if (!state->blocked_since) state->blocked_since = now_sec();
 
   // Partial write - buffer the rest
   unsigned written = (unsigned)n;
@@ -371,9 +606,17 @@ static inline void queue_response(struct conn_state_t *state,
 
   // Set up pending reference for remaining data
   if (data && data_len && written < data_len) {
-    state->pending_ref = data + written;
-    state->pending_ref_len = data_len - written;
-    state->pending_ref_pos = 0;
+    unsigned data_remain = data_len - written;
+    if (!table && data_remain <= MELIAN_WBUF_SIZE - state->wbuf_len) {
+      memcpy(state->wbuf + state->wbuf_len, data + written, data_remain);
+      state->wbuf_len += data_remain;
+    } else {
+      state->pending_ref = data + written;
+      state->pending_ref_len = data_remain;
+      state->pending_ref_pos = 0;
+      state->pending_slot = table ? table_slot_of(table, data) : NULL;
+      if (state->pending_slot) atomic_fetch_add(&state->pending_slot->pins, 1);
+    }
   }
 
   // Enable write event
@@ -386,12 +629,12 @@ static inline void queue_response(struct conn_state_t *state,
 static HOT_FUNC void on_read(evutil_socket_t fd, short events, void *ctx) {
   UNUSED(events);
   struct conn_state_t *state = ctx;
-  Server* server = state->server;
 
   // Read into buffer
   ssize_t space = MELIAN_RBUF_SIZE - state->rbuf_len;
   if (space > 0) {
-    ssize_t n = read(fd, state->rbuf + state->rbuf_len, space);
+    ssize_t n = unlikely(state->tls) ? tls_read(state->tls, state->rbuf + state->rbuf_len, space)
+                                     : read(fd, state->rbuf + state->rbuf_len, space);
     if (n <= 0) {
       if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
         conn_close(state);
@@ -400,14 +643,66 @@ static HOT_FUNC void on_read(evutil_socket_t fd, short events, void *ctx) {
       // EAGAIN - no data available yet
       if (state->rbuf_len == 0) return;
     } else {
+      // Deadlines count from here, for every request these bytes complete
+      state->arrived = now_sec();
       state->rbuf_len += n;
+      state->stats.bytes_in += n;
     }
   }
 
-  // Process all complete requests in tight loop
+  conn_process(state);
+  conn_read_pending(state);
+}
+
+// Bytes OpenSSL already decrypted raise no event on the socket, so read them
+// as soon as the connection takes requests again.
+static void conn_read_pending(struct conn_state_t *state) {
+  if (likely(!state->tls) || state->paused || !tls_pending(state->tls)) return;
+  event_active(state->rev, EV_READ, 0);
+}
+
+// Drive a TLS handshake on the events it waits for, then serve the
+// connection like any other.
+static void on_handshake(evutil_socket_t fd, short events, void *ctx) {
+  UNUSED(events);
+  struct conn_state_t *state = ctx;
+  switch (tls_handshake(state->server->tls, &state->tls)) {
+    case TLS_STEP_READ:
+      event_del(state->wev);
+      return;
+    case TLS_STEP_WRITE:
+      event_add(state->wev, NULL);
+      return;
+    case TLS_STEP_FAILED:
+      conn_close(state);
+      return;
+    case TLS_STEP_DONE:
+      break;
+  }
+  struct event_base *base = state->server->base;
+  event_del(state->rev);
+  event_del(state->wev);
+  event_assign(state->rev, base, fd, EV_READ | EV_PERSIST, on_read, state);
+  event_assign(state->wev, base, fd, EV_WRITE | EV_PERSIST, on_write, state);
+  event_add(state->rev, NULL);
+  conn_read_pending(state);
+}
+
+// Parse and answer the complete requests in rbuf, in order. Stops at the
+// first reply that cannot be written in full and stops reading, so a client
+// that does not drain its socket holds one reply at a time; on_write resumes.
+// A SEARCH pauses the connection the same way until on_search_done answers it,
+// and a request forwarded to another cluster node until on_cluster_done does.
+static HOT_FUNC void conn_process(struct conn_state_t *state) {
+  Server* server = state->server;
   static const uint8_t zero_hdr[4] = {0};
 
   while (1) {
+    if (unlikely(state->wbuf_len || state->pending_ref || state->search || state->forward)) {
+      event_del(state->rev);
+      state->paused = 1;
+      break;
+    }
     unsigned avail = state->rbuf_len - state->rbuf_pos;
 
     // Step 1: Parse header
@@ -415,19 +710,32 @@ static HOT_FUNC void on_read(evutil_socket_t fd, short events, void *ctx) {
       if (avail < sizeof(MelianRequestHeader)) break; // need more bytes
 
       const MelianRequestHeader *H = (const MelianRequestHeader *)(state->rbuf + state->rbuf_pos);
+      unsigned hdr_len = sizeof(MelianRequestHeader);
+      state->budget_us = 0;
+      state->priority = 0;
       if (unlikely(H->data.version != MELIAN_HEADER_VERSION)) {
-        LOG_WARN("Invalid protocol version 0x%02x (expected 0x%02x), closing connection",
-                 H->data.version, MELIAN_HEADER_VERSION);
-        conn_close(state);
-        return;
+        if (H->data.version != MELIAN_HEADER_VERSION_DEADLINE) {
+          LOG_WARN("Invalid protocol version 0x%02x (expected 0x%02x), closing connection",
+                   H->data.version, MELIAN_HEADER_VERSION);
+          conn_close(state);
+          return;
+        }
+        hdr_len += sizeof(MelianRequestDeadline);
+        if (avail < hdr_len) break; // need more bytes
+        const MelianRequestDeadline *D = (const MelianRequestDeadline *)(state->rbuf + state->rbuf_pos +
+                                                                         sizeof(MelianRequestHeader));
+        state->budget_us = read_le32(D->bytes);
+        state->priority = D->data.priority;
       }
       state->action = H->data.action;
       state->table_id = H->data.table_id;
       state->index_id = H->data.index_id;
       state->key_len = ntohl(H->data.length);
-      state->rbuf_pos += sizeof(MelianRequestHeader);
-      state->hdr_have = sizeof(MelianRequestHeader);
-      state->discarding = unlikely(state->key_len > MELIAN_MAX_KEY_LEN);
+      state->rbuf_pos += hdr_len;
+      state->hdr_have = hdr_len;
+      state->discarding = unlikely(state->key_len > MELIAN_MAX_KEY_LEN) &&
+                          !(state->action == MELIAN_ACTION_INGEST &&
+                            state->key_len <= MELIAN_INGEST_MAX_PAYLOAD);
       state->key_have = 0;
       avail = state->rbuf_len - state->rbuf_pos;
     }
@@ -446,23 +754,57 @@ static HOT_FUNC void on_read(evutil_socket_t fd, short events, void *ctx) {
     }
 
     const uint8_t *key_ptr = state->discarding ? NULL : (state->rbuf + state->rbuf_pos);
+    ++state->stats.requests;
+    // No read happens while a complete request waits its turn, so the last
+    // one is the read that completed this request
+    state->deadline = unlikely(state->budget_us) ? state->arrived + state->budget_us * 1e-6 : 0;
 
     // Step 3: Lookup & prepare response
     const uint8_t* rptr = NULL;
     unsigned rlen = 0;
     unsigned rfmt = 0;  // 1 = preframed (arena data)
+    Table* rtable = NULL;  // owner of the arena data
+    const uint8_t* rhead = NULL;  // sent ahead of preframed data; 0 if none
+    unsigned rstatus = 0;  // status reply instead of data
+    unsigned rdeferred = 0;  // answered later, by on_search_done or on_cluster_done
     uint8_t len_hdr[4];
 
+    if (unlikely(state->hdr_have > sizeof(MelianRequestHeader)) && !state->discarding) {
+      rstatus = conn_triage(state);
+    }
+    if (unlikely(server->cluster) && !state->cluster_peer && !state->discarding && !rstatus) {
+      Table* table = server->data->lookup[state->table_id];
+      unsigned nodes = cluster_route(server->cluster, table, state->action, state->index_id,
+                                     key_ptr, state->key_len, &rstatus);
+      if (nodes) rdeferred = conn_forward(state, nodes, key_ptr, &rstatus);
+    }
+
     if (unlikely(state->discarding)) {
       // Discarding oversized key - skip to response
+    } else if (unlikely(rstatus || rdeferred)) {
+      // Expired, shed or forwarded - answered with the status alone, or later
     } else if (likely(state->action == MELIAN_ACTION_FETCH)) {
       // Hot path: FETCH action - use inline lookup
-      const Bucket* bucket = data_fetch_inline(server->data, state->table_id,
-                                                state->index_id, key_ptr, state->key_len);
+      const Bucket* bucket = 0;
+      if (likely(state->index_id != MELIAN_INDEX_ADHOC)) {
+        bucket = data_fetch_inline(server, state->table_id,
+                                   state->index_id, key_ptr, state->key_len);
+      } else {
+        bucket = fetch_adhoc(server, state->table_id, key_ptr, state->key_len, &rstatus);
+      }
       if (likely(bucket)) {
         rptr = bucket->frame_ptr;
         rlen = bucket->frame_len;
         rfmt = 1;
+        rtable = server->data->lookup[state->table_id];
+      } else if (!rstatus) {
+        // Other cluster nodes may hold the row, if the table is split between them
+        if (unlikely(server->cluster) && !state->cluster_peer) {
+          Table* table = server->data->lookup[state->table_id];
+          unsigned nodes = cluster_others(server->cluster, table, state->index_id);
+          if (nodes) rdeferred = conn_forward(state, nodes, key_ptr, &rstatus);
+        }
+        if (!rdeferred && !rstatus) ++state->stats.misses;
       }
     } else {
       // Cold path: non-FETCH actions
@@ -484,6 +826,53 @@ static HOT_FUNC void on_read(evutil_socket_t fd, short events, void *ctx) {
           break;
         }
 
+        case MELIAN_ACTION_HELLO: {
+          rlen = conn_hello(state, key_ptr, state->key_len);
+          rptr = (const uint8_t*)state->hello;
+          break;
+        }
+
+        case MELIAN_ACTION_NEAREST: {
+          rlen = conn_nearest(state, key_ptr, state->key_len);
+          rptr = state->reply;
+          break;
+        }
+
+        case MELIAN_ACTION_SEARCH: {
+          rdeferred = conn_search(state, key_ptr, state->key_len);
+          break;
+        }
+
+        case MELIAN_ACTION_GROUP: {
+          rptr = conn_group(state, key_ptr, state->key_len, &rlen, &rfmt);
+          if (rfmt) {
+            rhead = state->group_head;
+            rtable = server->data->lookup[state->table_id];
+          }
+          break;
+        }
+
+        case MELIAN_ACTION_EXPORT: {
+          rptr = conn_export(state, &rlen, &rstatus);
+          if (rptr) {
+            rfmt = 1;
+            rtable = server->data->lookup[state->table_id];
+          }
+          break;
+        }
+
+        case MELIAN_ACTION_INGEST: {
+          rlen = conn_ingest(state, key_ptr, state->key_len, &rstatus);
+          rptr = (const uint8_t*)state->ingested;
+          break;
+        }
+
+        case MELIAN_ACTION_LIST_CLIENTS: {
+          rlen = conn_clients(state);
+          rptr = state->reply;
+          break;
+        }
+
         case MELIAN_ACTION_QUIT: {
           const char* bye = "{\"BYE\":true}";
           rptr = (uint8_t*)bye;
@@ -501,25 +890,33 @@ static HOT_FUNC void on_read(evutil_socket_t fd, short events, void *ctx) {
     }
 
     // Step 4: Send response
-    if (likely(rptr && rlen)) {
+    if (unlikely(rdeferred)) {
+      // Nothing to send yet
+    } else if (unlikely(rstatus)) {
+      uint32_t l = htonl(MELIAN_RESPONSE_STATUS | rstatus);
+      memcpy(len_hdr, &l, 4);
+      queue_response(state, NULL, len_hdr, 4, NULL, 0);
+    } else if (likely(rptr && rlen)) {
       LOG_DEBUG("Writing response with %u bytes", rlen);
       if (unlikely(!rfmt)) {
         // Non-arena reply - need length header
         uint32_t l = htonl(rlen);
         memcpy(len_hdr, &l, 4);
-        queue_response(state, len_hdr, 4, rptr, rlen);
+        queue_response(state, NULL, len_hdr, 4, rptr, rlen);
       } else {
-        // Arena data is preframed
-        queue_response(state, NULL, 0, rptr, rlen);
+        // Arena data is preframed; group rows only need their count ahead of them
+        queue_response(state, rtable, rhead, rhead ? sizeof(state->group_head) : 0, rptr, rlen);
       }
     } else {
       if (unlikely(state->action == MELIAN_ACTION_DESCRIBE_SCHEMA)) {
         LOG_WARN("Describe schema returned empty data");
       }
       LOG_DEBUG("Writing ZERO response");
-      queue_response(state, zero_hdr, 4, NULL, 0);
+      queue_response(state, NULL, zero_hdr, 4, NULL, 0);
     }
 
+    if (unlikely(state->fd < 0)) return; // closed while writing
+
     // Consume key bytes (only for non-discarded keys; discarded already consumed above)
     if (!state->discarding) {
       state->rbuf_pos += state->key_len;
@@ -545,10 +942,6 @@ static HOT_FUNC void on_read(evutil_socket_t fd, short events, void *ctx) {
 // Accept callback: set up direct I/O for new client
 static void on_accept(struct evconnlistener *lev, evutil_socket_t fd,
                       struct sockaddr *addr, int socklen, void *ctx) {
-  UNUSED(lev);
-  UNUSED(addr);
-  UNUSED(socklen);
-
   // Set non-blocking
   int flags = fcntl(fd, F_GETFL, 0);
   fcntl(fd, F_SETFL, flags | O_NONBLOCK);
@@ -575,6 +968,12 @@ static void on_accept(struct evconnlistener *lev, evutil_socket_t fd,
     state->pending_ref = NULL;
     state->pending_ref_len = 0;
     state->pending_ref_pos = 0;
+    state->pending_slot = NULL;
+    state->paused = 0;
+    state->search = NULL;
+    state->forward = NULL;
+    state->ingesting = NULL;
+    state->tls = NULL;
     state->hdr_have = 0;
     state->key_have = 0;
     state->key_len = 0;
@@ -592,19 +991,642 @@ static void on_accept(struct evconnlistener *lev, evutil_socket_t fd,
     LOG_DEBUG("CREATED conn state");
   }
 
+  // A TLS connection starts with its handshake
+  event_callback_fn read_cb = on_read;
+  event_callback_fn write_cb = on_write;
+  if (server->tls && lev == server->listener_tcp) {
+    state->tls = tls_accept(server->tls, fd);
+    if (!state->tls) {
+      close(fd);
+      state->fd = -1;
+      state->next = server->conn_free;
+      server->conn_free = state;
+      return;
+    }
+    read_cb = write_cb = on_handshake;
+  }
+
   // Update events for new fd (in case reused)
   if (state->rev) {
     event_del(state->rev);
-    event_assign(state->rev, base, fd, EV_READ | EV_PERSIST, on_read, state);
+    event_assign(state->rev, base, fd, EV_READ | EV_PERSIST, read_cb, state);
   }
   if (state->wev) {
     event_del(state->wev);
-    event_assign(state->wev, base, fd, EV_WRITE | EV_PERSIST, on_write, state);
+    event_assign(state->wev, base, fd, EV_WRITE | EV_PERSIST, write_cb, state);
   }
 
+  conn_open(state, addr, socklen);
   event_add(state->rev, NULL);
 }
 
+// Give a new connection its identity and fresh counters, and track it.
+static void conn_open(struct conn_state_t *state, struct sockaddr *addr, int socklen) {
+  Server* server = state->server;
+  state->id = ++server->conn_next_id;
+  state->connected = time(0);
+  state->name[0] = '\0';
+  state->blocked_since = 0;
+  state->cluster_peer = 0;
+  memset(&state->stats, 0, sizeof(state->stats));
+
+  state->peer[0] = '\0';
+  if (addr && addr->sa_family == AF_INET && socklen >= (int)sizeof(struct sockaddr_in)) {
+    const struct sockaddr_in* sin = (const struct sockaddr_in*)addr;
+    char ip[INET_ADDRSTRLEN];
+    if (inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip))) {
+      snprintf(state->peer, sizeof(state->peer), "%s:%u", ip, ntohs(sin->sin_port));
+    }
+  } else if (addr && addr->sa_family == AF_UNIX) {
+    snprintf(state->peer, sizeof(state->peer), "unix");
+  }
+
+  state->active_prev = NULL;
+  state->active_next = server->conn_active;
+  if (server->conn_active) server->conn_active->active_prev = state;
+  server->conn_active = state;
+  state->active = 1;
+  ++server->conn_count;
+}
+
+// Name the connection after the HELLO payload and format the reply into state->hello.
+// Anything outside printable ASCII is replaced, so the name is always valid JSON.
+static unsigned conn_hello(struct conn_state_t *state, const uint8_t* name, unsigned len) {
+  if (len >= sizeof(state->name)) len = sizeof(state->name) - 1;
+  for (unsigned j = 0; j < len; ++j) {
+    uint8_t c = name[j];
+    state->name[j] = (c >= 0x20 && c < 0x7f) ? (char)c : '?';
+  }
+  state->name[len] = '\0';
+  state->cluster_peer = strncmp(state->name, CLUSTER_HELLO_PREFIX, strlen(CLUSTER_HELLO_PREFIX)) == 0;
+  LOG_DEBUG("Connection %u is [%s]", state->id, state->name);
+  int wrote = snprintf(state->hello, sizeof(state->hello), "{\"id\":%u}", state->id);
+  return wrote < 0 ? 0 : (unsigned)wrote;
+}
+
+// Answer NEAREST into state->reply: [u32 count] then [f64 km][u32 len][row] per hit.
+// Return the reply length; 0 if the request names no geo index.
+static unsigned conn_nearest(struct conn_state_t *state, const uint8_t* payload, unsigned len) {
+  static GeoHit hits[GEO_MAX_NEAREST];
+  Server* server = state->server;
+  if (len != MELIAN_NEAREST_REQUEST_LEN) return 0;
+  Table* table = server->data->lookup[state->table_id];
+  if (!table) return 0;
+
+  uint64_t bits = read_le64(payload);
+  double lat = 0;
+  memcpy(&lat, &bits, sizeof(lat));
+  bits = read_le64(payload + 8);
+  double lon = 0;
+  memcpy(&lon, &bits, sizeof(lon));
+  unsigned k = payload[16] | payload[17] << 8 | payload[18] << 16 | (unsigned)payload[19] << 24;
+  bits = read_le64(payload + 20);
+  double radius_km = 0;
+  memcpy(&radius_km, &bits, sizeof(radius_km));
+
+  unsigned count = 0;
+  const struct TableSlot* slot = table_nearest(table, state->index_id, lat, lon, k, radius_km, hits, &count);
+  if (!slot) return 0;
+  conn_count_access(server, table);
+
+  // A row frame is its 4-byte length and the row, so each hit takes 8 + frame_len
+  size_t need = 4;
+  for (unsigned h = 0; h < count; ++h) need += 8 + hits[h].point->frame_len;
+  if (need >= MELIAN_RESPONSE_STATUS) {
+    LOG_WARN("NEAREST reply of %zu bytes is too large", need);
+    return 0;
+  }
+  if (need > state->reply_cap) {
+    unsigned cap = next_power_of_two(need, 4096);
+    uint8_t* reply = realloc(state->reply, cap);
+    if (!reply) {
+      LOG_WARN("Could not allocate %zu bytes for NEAREST reply", need);
+      return 0;
+    }
+    state->reply = reply;
+    state->reply_cap = cap;
+  }
+  uint8_t* p = state->reply;
+  write_le32(p, count);
+  p += 4;
+  for (unsigned h = 0; h < count; ++h) {
+    memcpy(&bits, &hits[h].km, sizeof(bits));
+    write_le64(p, bits);
+    p += 8;
+    const GeoPoint* point = hits[h].point;
+    const uint8_t* frame = slot->arena->buffer + point->frame;
+    // Frames carry a big-endian length, as FETCH replies; this payload is little-endian
+    write_le32(p, point->frame_len - 4);
+    memcpy(p + 4, frame + 4, point->frame_len - 4);
+    p += point->frame_len;
+  }
+  return (unsigned)need;
+}
+
+// Answer GROUP: [u32 offset][u32 limit][key]. The rows are a slice of the
+// group index, sent as they are behind state->group_head, with rfmt set;
+// a key whose slice is empty gets just the count and total from there.
+// Return 0 if the key has no rows.
+static const uint8_t* conn_group(struct conn_state_t *state, const uint8_t* payload, unsigned len,
+                                 unsigned* rlen, unsigned* rfmt) {
+  Server* server = state->server;
+  if (len <= MELIAN_GROUP_PREFIX_LEN) return 0;
+  Table* table = server->data->lookup[state->table_id];
+  if (!table) return 0;
+
+  unsigned offset = payload[0] | payload[1] << 8 | payload[2] << 16 | (unsigned)payload[3] << 24;
+  unsigned limit = payload[4] | payload[5] << 8 | payload[6] << 16 | (unsigned)payload[7] << 24;
+  const uint8_t* data = 0;
+  size_t bytes = 0;
+  unsigned count = 0;
+  unsigned total = 0;
+  if (!table_group(table, state->index_id, payload + MELIAN_GROUP_PREFIX_LEN, len - MELIAN_GROUP_PREFIX_LEN,
+                   offset, limit, &data, &bytes, &count, &total)) return 0;
+  conn_count_access(server, table);
+  if (bytes + 8 >= MELIAN_RESPONSE_STATUS) {
+    LOG_WARN("GROUP reply of %zu bytes is too large", bytes + 8);
+    return 0;
+  }
+  uint32_t l = htonl((uint32_t)(bytes + 8));
+  memcpy(state->group_head, &l, 4);
+  write_le32(state->group_head + 4, count);
+  write_le32(state->group_head + 8, total);
+  if (!count) {
+    *rlen = 8;
+    return state->group_head + 4;
+  }
+  *rlen = (unsigned)bytes;
+  *rfmt = 1;
+  return data;
+}
+
+// Answer EXPORT with the Arrow stream of the table's live slot, which comes
+// preframed; until the loader thread has built it, set status to NOT_READY.
+static const uint8_t* conn_export(struct conn_state_t *state, unsigned* rlen, unsigned* status) {
+  Server* server = state->server;
+  Table* table = server->data->lookup[state->table_id];
+  if (!table) return 0;
+  conn_count_access(server, table);
+  unsigned lookup = TABLE_ADHOC_LOOKUP_DONE;
+  const Arrow* arrow = table_arrow(table, &lookup);
+  if (lookup == TABLE_ADHOC_LOOKUP_REQUESTED) cron_wakeup(server->cron);
+  if (lookup != TABLE_ADHOC_LOOKUP_DONE) *status = MELIAN_STATUS_NOT_READY;
+  if (!arrow) return 0;
+  *rlen = (unsigned)arrow->frame_len;
+  return arrow->frame;
+}
+
+// Hand SEARCH to the worker: [u8 mode][u32 limit][f64 min_score][query].
+// Return 1 if on_search_done will answer it; 0 to answer with nothing now.
+static unsigned conn_search(struct conn_state_t *state, const uint8_t* payload, unsigned len) {
+  Server* server = state->server;
+  if (len <= MELIAN_SEARCH_PREFIX_LEN) return 0;
+  Table* table = server->data->lookup[state->table_id];
+  if (!table) return 0;
+  SearchJob* job = calloc(1, sizeof(SearchJob));
+  if (!job) {
+    LOG_WARN("Could not allocate SEARCH job");
+    return 0;
+  }
+  job->slot = table_pin_trigram(table, state->index_id);
+  if (!job->slot) {
+    free(job);
+    return 0;
+  }
+  conn_count_access(server, table);
+
+  job->owner = state;
+  job->table = table;
+  job->index_id = state->index_id;
+  job->substring = payload[0] == MELIAN_SEARCH_SUBSTRING;
+  job->limit = payload[1] | payload[2] << 8 | payload[3] << 16 | (unsigned)payload[4] << 24;
+  uint64_t bits = read_le64(payload + 5);
+  memcpy(&job->min_score, &bits, sizeof(job->min_score));
+  job->query_len = len - MELIAN_SEARCH_PREFIX_LEN;
+  if (job->query_len > sizeof(job->query)) job->query_len = sizeof(job->query);
+  memcpy(job->query, payload + MELIAN_SEARCH_PREFIX_LEN, job->query_len);
+  state->search = job;
+  search_submit(server->search, job);
+  return 1;
+}
+
+// Write the reply of a finished SEARCH and pick up the requests behind it.
+static void on_search_done(SearchJob* job, void* ctx) {
+  UNUSED(ctx);
+  static const uint8_t zero_hdr[4] = {0};
+  struct conn_state_t *state = job->owner;
+  atomic_fetch_sub(&job->slot->pins, 1);
+  if (state->search != job) {
+    // The connection closed while the worker was busy
+    search_job_free(job);
+    return;
+  }
+  state->search = NULL;
+
+  if (job->reply_len) {
+    // The reply buffer becomes the connection's, so on_write can finish it
+    free(state->reply);
+    state->reply = job->reply;
+    state->reply_cap = job->reply_cap;
+    job->reply = NULL;
+    uint8_t len_hdr[4];
+    uint32_t l = htonl(job->reply_len);
+    memcpy(len_hdr, &l, 4);
+    queue_response(state, NULL, len_hdr, 4, state->reply, job->reply_len);
+  } else {
+    queue_response(state, NULL, zero_hdr, 4, NULL, 0);
+  }
+  search_job_free(job);
+  if (state->fd < 0) return; // closed while writing
+
+  if (state->paused && !state->wbuf_len && !state->pending_ref) {
+    state->paused = 0;
+    event_add(state->rev, NULL);
+    conn_process(state);
+  }
+}
+
+// Send the request being parsed to the first of nodes that can take it, with
+// what is left of its deadline. Return 1 if on_cluster_done will answer it;
+// 0 with status set if no node can be reached.
+static unsigned conn_forward(struct conn_state_t *state, unsigned nodes, const uint8_t* payload,
+                             unsigned* status) {
+  uint8_t request[sizeof(MelianRequestHeader) + sizeof(MelianRequestDeadline) + MELIAN_INGEST_MAX_PAYLOAD];
+  MelianRequestHeader* header = (MelianRequestHeader*)request;
+  unsigned len = sizeof(MelianRequestHeader);
+  header->data.version = MELIAN_HEADER_VERSION;
+  header->data.action = state->action;
+  header->data.table_id = state->table_id;
+  header->data.index_id = state->index_id;
+  header->data.length = htonl(state->key_len);
+  if (state->deadline || state->priority) {
+    MelianRequestDeadline* deadline = (MelianRequestDeadline*)(request + len);
+    double left_us = state->deadline ? (state->deadline - now_sec()) * 1e6 : 0;
+    header->data.version = MELIAN_HEADER_VERSION_DEADLINE;
+    write_le32(deadline->bytes, state->deadline ? (left_us < 1 ? 1 : (uint32_t)left_us) : 0);
+    deadline->data.priority = state->priority;
+    memset(deadline->data.reserved, 0, sizeof(deadline->data.reserved));
+    len += sizeof(MelianRequestDeadline);
+  }
+  if (state->key_len > sizeof(request) - len) return 0;
+  memcpy(request + len, payload, state->key_len);
+  len += state->key_len;
+
+  ClusterJob* job = cluster_forward(state->server->cluster, nodes, request, len, state);
+  if (!job) {
+    *status = MELIAN_STATUS_UNAVAILABLE;
+    return 0;
+  }
+  ++state->stats.forwarded;
+  state->forward = job;
+  return 1;
+}
+
+// Relay the reply of a forwarded request and pick up the requests behind it.
+static void on_cluster_done(ClusterJob* job, void* ctx) {
+  Server* server = ctx;
+  static const uint8_t zero_hdr[4] = {0};
+  struct conn_state_t *state = job->owner;
+  if (state->forward != job) {
+    // The connection closed while the other node was busy
+    cluster_job_free(job);
+    return;
+  }
+  // A node without the row leaves it to the next one holding part of the table
+  if (!job->status && !job->reply_len && job->untried && cluster_send(server->cluster, job)) return;
+  state->forward = NULL;
+
+  uint8_t len_hdr[4];
+  if (job->status) {
+    uint32_t l = htonl(MELIAN_RESPONSE_STATUS | job->status);
+    memcpy(len_hdr, &l, 4);
+    queue_response(state, NULL, len_hdr, 4, NULL, 0);
+  } else if (job->reply_len) {
+    // The reply buffer becomes the connection's, so on_write can finish it
+    free(state->reply);
+    state->reply = job->reply;
+    state->reply_cap = job->reply_len;
+    job->reply = NULL;
+    uint32_t l = htonl(job->reply_len);
+    memcpy(len_hdr, &l, 4);
+    queue_response(state, NULL, len_hdr, 4, state->reply, job->reply_len);
+  } else {
+    if (state->action == MELIAN_ACTION_FETCH) ++state->stats.misses;
+    queue_response(state, NULL, zero_hdr, 4, NULL, 0);
+  }
+  cluster_job_free(job);
+  if (state->fd < 0) return; // closed while writing
+
+  if (state->paused && !state->wbuf_len && !state->pending_ref) {
+    state->paused = 0;
+    event_add(state->rev, NULL);
+    conn_process(state);
+  }
+}
+
+// Apply one INGEST request: [u8 op] then op data, see protocol.h.
+// Return the length of the reply in state->ingested; 0 with status set
+// to answer with a status, or without to answer with nothing.
+static unsigned conn_ingest(struct conn_state_t *state, const uint8_t* payload, unsigned len,
+                            unsigned* status) {
+  Server* server = state->server;
+  if (!len) return 0;
+  Table* table = server->data->lookup[state->table_id];
+  if (!table || !table->push) return 0;
+  Push* push = table->push;
+  uint8_t op = payload[0];
+  ++payload;
+  --len;
+  unsigned rows = 0;
+  unsigned keys = 0;
+
+  if (op == MELIAN_INGEST_BEGIN) {
+    if (!len || (state->ingesting && state->ingesting != table)) return 0;
+    if (!push_check_secret(push, payload + 1, len - 1)) {
+      LOG_WARN("Connection %u [%s] gave the wrong secret for INGEST into table %s",
+               state->id, state->name, table->name);
+      *status = MELIAN_STATUS_DENIED;
+      return 0;
+    }
+    unsigned delta = payload[0] == MELIAN_INGEST_DELTA;
+    if (delta && (!table->index_count || (table->indexes[0].type != CONFIG_INDEX_TYPE_INT &&
+                                          table->indexes[0].type != CONFIG_INDEX_TYPE_STRING))) {
+      LOG_WARN("Table %s has no int or string first index to apply a delta by", table->name);
+      return 0;
+    }
+    if (push->open && push->open->owner != state) {
+      *status = MELIAN_STATUS_NOT_READY;
+      return 0;
+    }
+    // Beginning again drops what was streamed so far
+    push_batch_destroy(push->open);
+    push->open = push_batch_build(delta ? PUSH_DELTA : PUSH_SNAPSHOT, state);
+    state->ingesting = push->open ? table : NULL;
+    if (!push->open) return 0;
+    LOG_INFO("Connection %u [%s] streams a %s into table %s",
+             state->id, state->name, delta ? "delta" : "snapshot", table->name);
+  } else {
+    // Everything else needs the batch this connection began
+    PushBatch* batch = push->open;
+    if (!batch || batch->owner != state) return 0;
+    switch (op) {
+      case MELIAN_INGEST_ROWS:
+        if (!ingest_rows_valid(payload, len)) {
+          LOG_WARN("Malformed rows in INGEST for table %s", table->name);
+          return 0;
+        }
+        for (unsigned pos = 0; pos < len; ) {
+          unsigned row_len = payload[pos] | payload[pos + 1] << 8 |
+                             payload[pos + 2] << 16 | (unsigned)payload[pos + 3] << 24;
+          if (!push_buffer_add(&batch->rows, payload + pos + 4, row_len)) return 0;
+          pos += 4 + row_len;
+        }
+        break;
+
+      case MELIAN_INGEST_DELETE:
+        if (batch->mode != PUSH_DELTA) return 0;
+        if (!ingest_keys_valid(payload, len)) {
+          LOG_WARN("Malformed keys in INGEST for table %s", table->name);
+          return 0;
+        }
+        for (unsigned pos = 0; pos < len; ) {
+          unsigned key_len = payload[pos] | payload[pos + 1] << 8 |
+                             payload[pos + 2] << 16 | (unsigned)payload[pos + 3] << 24;
+          if (!push_buffer_add(&batch->keys, payload + pos + 4, key_len)) return 0;
+          pos += 4 + key_len;
+        }
+        break;
+
+      case MELIAN_INGEST_COMMIT:
+        // Once committed, the batch is the loader's to apply and free
+        rows = batch->rows.count;
+        keys = batch->keys.count;
+        if (!push_commit(push)) {
+          // The loader has not applied the previous batch yet
+          *status = MELIAN_STATUS_NOT_READY;
+          return 0;
+        }
+        state->ingesting = NULL;
+        cron_wakeup(server->cron);
+        LOG_INFO("Connection %u [%s] committed %u rows and %u deleted keys for table %s",
+                 state->id, state->name, rows, keys, table->name);
+        break;
+
+      case MELIAN_INGEST_ABORT:
+        conn_ingest_abort(state);
+        break;
+
+      default:
+        return 0;
+    }
+    if (op == MELIAN_INGEST_ROWS || op == MELIAN_INGEST_DELETE) {
+      rows = batch->rows.count;
+      keys = batch->keys.count;
+    }
+  }
+  int wrote = snprintf(state->ingested, sizeof(state->ingested), "{\"rows\":%u,\"keys\":%u}", rows, keys);
+  return wrote < 0 ? 0 : (unsigned)wrote;
+}
+
+// Drop the batch the connection was streaming, if any.
+static void conn_ingest_abort(struct conn_state_t *state) {
+  Table* table = state->ingesting;
+  if (!table) return;
+  state->ingesting = NULL;
+  Push* push = table->push;
+  if (!push->open || push->open->owner != state) return;
+  LOG_INFO("Dropping INGEST batch of %u rows for table %s", push->open->rows.count, table->name);
+  push_batch_destroy(push->open);
+  push->open = NULL;
+}
+
+// Whether data holds whole [u32 len][row] entries, each with well-formed fields.
+static unsigned ingest_rows_valid(const uint8_t* data, unsigned len) {
+  for (unsigned pos = 0; pos < len; ) {
+    if (len - pos < 4) return 0;
+    unsigned row_len = data[pos] | data[pos + 1] << 8 | data[pos + 2] << 16 | (unsigned)data[pos + 3] << 24;
+    if (row_len > len - pos - 4) return 0;
+    const uint8_t* row = data + pos + 4;
+    if (row_len < 4) return 0;
+    unsigned fields = row[0] | row[1] << 8 | row[2] << 16 | (unsigned)row[3] << 24;
+    unsigned field_pos = 0;
+    RowField field;
+    for (unsigned f = 0; f < fields; ++f) {
+      if (!row_next_field(row, row_len, &field_pos, &field)) return 0;
+    }
+    if ((fields ? field_pos : 4) != row_len) return 0;
+    pos += 4 + row_len;
+  }
+  return 1;
+}
+
+// Whether data holds whole [u32 len][key] entries.
+static unsigned ingest_keys_valid(const uint8_t* data, unsigned len) {
+  for (unsigned pos = 0; pos < len; ) {
+    if (len - pos < 4) return 0;
+    unsigned key_len = data[pos] | data[pos + 1] << 8 | data[pos + 2] << 16 | (unsigned)data[pos + 3] << 24;
+    if (key_len > len - pos - 4) return 0;
+    pos += 4 + key_len;
+  }
+  return 1;
+}
+
+// Count a query on table; the first one since it was paged out wakes the loader.
+static void conn_count_access(Server* server, Table* table) {
+  unsigned accesses = atomic_load_explicit(&table->accesses, memory_order_relaxed);
+  atomic_store_explicit(&table->accesses, accesses + 1, memory_order_relaxed);
+  if (unlikely(atomic_load_explicit(&table->tier, memory_order_relaxed) == TABLE_TIER_COLD) &&
+      atomic_fetch_add(&table->cold_hits, 1) == 0) {
+    cron_wakeup(server->cron);
+  }
+}
+
+static uint32_t read_le32(const uint8_t* buf) {
+  return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static uint64_t read_le64(const uint8_t* buf) {
+  uint64_t v = 0;
+  for (unsigned b = 0; b < 8; ++b) v |= (uint64_t)buf[b] << (8 * b);
+  return v;
+}
+
+static void write_le32(uint8_t* buf, uint32_t v) {
+  for (unsigned b = 0; b < 4; ++b) buf[b] = (uint8_t)(v >> (8 * b));
+}
+
+static void write_le64(uint8_t* buf, uint64_t v) {
+  for (unsigned b = 0; b < 8; ++b) buf[b] = (uint8_t)(v >> (8 * b));
+}
+
+static int conn_cmp_load(const void* a, const void* b) {
+  const struct conn_state_t* l = *(const struct conn_state_t* const*)a;
+  const struct conn_state_t* r = *(const struct conn_state_t* const*)b;
+  if (l->stats.requests != r->stats.requests) return l->stats.requests < r->stats.requests ? 1 : -1;
+  if (l->stats.bytes_out != r->stats.bytes_out) return l->stats.bytes_out < r->stats.bytes_out ? 1 : -1;
+  return l->id < r->id ? -1 : (l->id > r->id);
+}
+
+// Format every open connection as JSON, busiest (most requests) first, into
+// state->reply: a long list can outlive this call in the connection's
+// pending write. Return the reply length; 0 if it could not be built.
+static unsigned conn_clients(struct conn_state_t *state) {
+  Server* server = state->server;
+  unsigned len = 0;
+  char* text = NULL;
+  struct conn_state_t** conns = calloc(server->conn_count ? server->conn_count : 1, sizeof(*conns));
+  json_t* list = json_array();
+  do {
+    if (!conns || !list) {
+      LOG_WARN("Could not allocate client list for %u connections", server->conn_count);
+      break;
+    }
+    unsigned count = 0;
+    for (struct conn_state_t* p = server->conn_active; p && count < server->conn_count; p = p->active_next) {
+      conns[count++] = p;
+    }
+    qsort(conns, count, sizeof(*conns), conn_cmp_load);
+
+    double now = now_sec();
+    unsigned epoch = time(0);
+    unsigned bad = 0;
+    for (unsigned c = 0; c < count; ++c) {
+      const struct conn_state_t* p = conns[c];
+      unsigned long blocked_us = p->stats.blocked_us;
+      if (p->blocked_since) blocked_us += (now - p->blocked_since) * 1000000;
+      json_t* obj = json_pack("{s:i,s:s,s:s,s:i,s:I,s:I,s:I,s:I,s:I,s:I,s:I,s:I,s:I}",
+                              "id", (int)p->id,
+                              "name", p->name,
+                              "peer", p->peer,
+                              "age_seconds", (int)(epoch - p->connected),
+                              "requests", (json_int_t)p->stats.requests,
+                              "bytes_in", (json_int_t)p->stats.bytes_in,
+                              "bytes_out", (json_int_t)p->stats.bytes_out,
+                              "misses", (json_int_t)p->stats.misses,
+                              "partial_writes", (json_int_t)p->stats.partial_writes,
+                              "blocked_us", (json_int_t)blocked_us,
+                              "expired", (json_int_t)p->stats.expired,
+                              "shed", (json_int_t)p->stats.shed,
+                              "forwarded", (json_int_t)p->stats.forwarded);
+      if (!obj || json_array_append_new(list, obj) < 0) {
+        ++bad;
+        break;
+      }
+    }
+    if (bad) {
+      LOG_WARN("Could not format client list");
+      break;
+    }
+    text = json_dumps(list, JSON_COMPACT);
+    if (!text) {
+      LOG_WARN("Could not format client list");
+      break;
+    }
+    size_t need = strlen(text);
+    if (need >= MELIAN_RESPONSE_STATUS) {
+      LOG_WARN("Client list of %zu bytes is too large", need);
+      break;
+    }
+    if (need > state->reply_cap) {
+      unsigned cap = next_power_of_two(need, 4096);
+      uint8_t* reply = realloc(state->reply, cap);
+      if (!reply) {
+        LOG_WARN("Could not allocate %zu bytes for client list", need);
+        break;
+      }
+      state->reply = reply;
+      state->reply_cap = cap;
+    }
+    memcpy(state->reply, text, need);
+    len = (unsigned)need;
+  } while (0);
+  if (text) free(text);
+  if (list) json_decref(list);
+  if (conns) free(conns);
+  return len;
+}
+
+// Whether a request that carries a deadline goes unanswered: EXPIRED once its
+// caller has stopped waiting, SHED while the event loop lags behind the
+// configured threshold and its priority number is high for how far behind
+// it is -- at twice the threshold, 128 and up; at four times, 64 and up.
+static unsigned conn_triage(struct conn_state_t *state) {
+  Server* server = state->server;
+  StatusLoad* load = &server->status->load;
+  if (state->deadline && now_sec() > state->deadline) {
+    ++state->stats.expired;
+    ++load->expired;
+    return MELIAN_STATUS_EXPIRED;
+  }
+  uint64_t threshold_us = (uint64_t)server->config->server.shed_lag * 1000;
+  if (state->priority && threshold_us && load->lag_us > threshold_us &&
+      state->priority >= 256 * threshold_us / load->lag_us) {
+    ++state->stats.shed;
+    ++load->shed;
+    return MELIAN_STATUS_SHED;
+  }
+  return 0;
+}
+
+// The probe runs every half threshold; how late it runs is the loop's lag.
+static void on_lag_probe(evutil_socket_t fd, short what, void *ctx) {
+  UNUSED(fd);
+  UNUSED(what);
+  Server* server = ctx;
+  // Timers fire on a millisecond grid (epoll), so the first millisecond late is not lag
+  double late = now_sec() - server->lag_due - MELIAN_LAG_PROBE_MIN_US * 1e-6;
+  server->status->load.lag_us = late > 0 ? (unsigned)(late * 1000000) : 0;
+  schedule_lag_probe(server);
+}
+
+static void schedule_lag_probe(Server* server) {
+  unsigned period_us = server->config->server.shed_lag * 1000 / 2;
+  if (period_us < MELIAN_LAG_PROBE_MIN_US) period_us = MELIAN_LAG_PROBE_MIN_US;
+  struct timeval tv = { period_us / 1000000, period_us % 1000000 };
+  server->lag_due = now_sec() + period_us * 1e-6;
+  evtimer_add(server->lag_ev, &tv);
+}
+
 static void on_quit(evutil_socket_t fd, short what, void *ctx) {
   UNUSED(fd);
   UNUSED(what);
@@ -11,12 +11,21 @@ typedef struct Server {
   struct evconnlistener *listener_tcp;
   struct event *tev;
   struct event *sev;
+  struct event *lag_ev;               // probes event loop lag, when shedding is on
+  double lag_due;                     // when the probe should run
   struct Config* config;
   struct Status* status;
   struct Data* data;
   struct DB* db;
   struct Cron* cron;
+  struct Search* search;
+  struct Loader* loader;
+  struct Cluster* cluster;            // 0 unless running as a cluster node
+  struct Tls* tls;                    // 0 unless the TCP listener serves TLS
   struct conn_state_t* conn_free;
+  struct conn_state_t* conn_active;  // open connections, newest first
+  unsigned conn_count;
+  unsigned conn_next_id;
   unsigned running;
 } Server;
 
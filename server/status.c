@@ -13,6 +13,11 @@
 #include "config.h"
 #include "protocol.h"
 #include "data.h"
+#include "derived.h"
+#include "push.h"
+#include "loader.h"
+#include "cluster.h"
+#include "tls.h"
 #include "db.h"
 #include "status.h"
 
@@ -24,9 +29,11 @@ static json_t* json_software_info(Status* status, Config* config, const char* dr
 static json_t* json_config_info(Config* config, const char* driver_key);
 static json_t* json_process_info(Status* status);
 static json_t* json_table(Table* table);
+static json_t* json_cluster(Cluster* cluster);
 static json_t* json_table_arena(Arena* arena, unsigned rows);
 static json_t* json_table_hashes(Table* table, struct TableSlot* slot);
 static json_t* json_table_hash(const char* tname, Hash* hash, const char* iname);
+static json_t* json_table_adhoc(Table* table, struct TableSlot* slot);
 
 Status* status_build(struct event_base *base, DB* db) {
   Status* status = 0;
@@ -125,6 +132,30 @@ void status_json(Status* status, Config* config, Data* data) {
   if (!root) goto done;
   server_obj = software_obj = config_obj = process_obj = NULL;
   tables_obj = NULL;
+  json_t* load_obj = json_pack("{s:i,s:I,s:I}",
+                               "lag_us", (int)status->load.lag_us,
+                               "expired", (json_int_t)status->load.expired,
+                               "shed", (json_int_t)status->load.shed);
+  if (!load_obj || json_object_set_new(root, "load", load_obj) < 0) goto done;
+  if (data->loader) {
+    json_t* loader_obj = json_pack("{s:i,s:i,s:i,s:i}",
+                                   "pid", (int)data->loader->pid,
+                                   "loads", (int)data->loader->loads,
+                                   "failures", (int)data->loader->failures,
+                                   "restarts", (int)data->loader->restarts);
+    if (!loader_obj || json_object_set_new(root, "loader", loader_obj) < 0) goto done;
+  }
+  if (status->cluster) {
+    json_t* cluster_obj = json_cluster(status->cluster);
+    if (!cluster_obj || json_object_set_new(root, "cluster", cluster_obj) < 0) goto done;
+  }
+  if (status->tls) {
+    json_t* tls_obj = json_pack("{s:I,s:I,s:I}",
+                                "handshakes", (json_int_t)status->tls->stats.handshakes,
+                                "failures", (json_int_t)status->tls->stats.failures,
+                                "kernel_reads", (json_int_t)status->tls->stats.kernel_reads);
+    if (!tls_obj || json_object_set_new(root, "tls", tls_obj) < 0) goto done;
+  }
 
   dump = json_dumps(root, JSON_COMPACT | JSON_ENSURE_ASCII);
   if (!dump) {
@@ -170,30 +201,130 @@ static json_t* json_table(Table* table) {
   json_t* last_loaded = json_epoch_object(table->stats.last_loaded);
   json_t* arena = json_table_arena(slot->arena, table->stats.rows);
   json_t* hashes = json_table_hashes(table, slot);
-  if (!last_loaded || !arena || !hashes) {
+  json_t* adhoc = json_table_adhoc(table, slot);
+  if (!last_loaded || !arena || !hashes || !adhoc) {
     if (last_loaded) json_decref(last_loaded);
     if (arena) json_decref(arena);
     if (hashes) json_decref(hashes);
+    if (adhoc) json_decref(adhoc);
     return NULL;
   }
-  json_t* obj = json_pack("{s:s,s:i,s:i,s:i,s:i,s:i,s:O,s:O,s:O}",
+  json_t* obj = json_pack("{s:s,s:i,s:i,s:i,s:i,s:i,s:I,s:i,s:O,s:O,s:O,s:O}",
                           "name", table_name(table),
                           "id", (int)table->table_id,
                           "period", (int)table->period,
                           "rows", (int)table->stats.rows,
                           "min_id", (int)table->stats.min_id,
                           "max_id", (int)table->stats.max_id,
+                          "memory_bytes", (json_int_t)table_memory_bytes(table),
+                          "deferrals", (int)table->stats.deferrals,
                           "last_loaded", last_loaded,
                           "arena", arena,
-                          "hashes", hashes);
+                          "hashes", hashes,
+                          "adhoc", adhoc);
   if (!obj) {
     json_decref(last_loaded);
     json_decref(arena);
     json_decref(hashes);
+    json_decref(adhoc);
+    return NULL;
+  }
+  if (table->derived && json_object_set_new(obj, "derived", json_string(table->derived->definition)) < 0) {
+    json_decref(obj);
+    return NULL;
+  }
+  if (table->push) {
+    json_t* push = json_pack("{s:i,s:i,s:i}",
+                             "batches", (int)table->push->stats.batches,
+                             "rows", (int)table->push->stats.rows,
+                             "keys", (int)table->push->stats.keys);
+    if (!push || json_object_set_new(obj, "push", push) < 0) {
+      json_decref(obj);
+      return NULL;
+    }
+  }
+  if (table->remote || table->parts) {
+    json_t* placement = json_pack("{s:b,s:i,s:i}",
+                                  "remote", table->remote ? 1 : 0,
+                                  "part", (int)table->part,
+                                  "parts", (int)(table->parts ? table->parts : 1));
+    if (!placement || json_object_set_new(obj, "placement", placement) < 0) {
+      json_decref(obj);
+      return NULL;
+    }
+  }
+  if (table->period_max) {
+    // Oldest load first: + if it brought new rows, - if not
+    const struct TableRefreshStats* stats = &table->refresh_stats;
+    char history[sizeof(stats->history) * 8 + 1];
+    for (unsigned h = 0; h < stats->history_len; ++h) {
+      history[h] = (stats->history >> (stats->history_len - 1 - h)) & 1 ? '+' : '-';
+    }
+    history[stats->history_len] = '\0';
+    json_t* refresh = json_pack("{s:i,s:i,s:i,s:i,s:s}",
+                                "min_period", (int)table->period_min,
+                                "max_period", (int)table->period_max,
+                                "changed", (int)stats->changed,
+                                "unchanged", (int)stats->unchanged,
+                                "history", history);
+    if (!refresh || json_object_set_new(obj, "refresh", refresh) < 0) {
+      json_decref(obj);
+      return NULL;
+    }
+  }
+  if (table->warm || table->prefault) {
+    const struct TableWarmStats* stats = &table->warm_stats;
+    json_t* warm = json_pack("{s:i,s:i,s:i,s:i}",
+                             "sample", (int)table->warm_keys,
+                             "keys", (int)stats->keys,
+                             "found", (int)stats->found,
+                             "elapsed_us", (int)stats->elapsed_us);
+    if (!warm || json_object_set_new(obj, "warm", warm) < 0) {
+      json_decref(obj);
+      return NULL;
+    }
+  }
+  if (table->tier_idle) {
+    unsigned cold = atomic_load(&table->tier) == TABLE_TIER_COLD;
+    unsigned idle = table->last_active ? (unsigned)time(0) - table->last_active : 0;
+    json_t* tier = json_pack("{s:s,s:i,s:i,s:i,s:i}",
+                             "state", cold ? "cold" : "hot",
+                             "idle_seconds", (int)idle,
+                             "demotions", (int)table->tier_stats.demotions,
+                             "promotions", (int)table->tier_stats.promotions,
+                             "first_access_us", (int)table->tier_stats.first_access_us);
+    if (!tier || json_object_set_new(obj, "tier", tier) < 0) {
+      json_decref(obj);
+      return NULL;
+    }
   }
   return obj;
 }
 
+static json_t* json_cluster(Cluster* cluster) {
+  json_t* nodes = json_array();
+  if (!nodes) return NULL;
+  for (unsigned n = 0; n < cluster->node_count; ++n) {
+    if (n == cluster->self) continue;
+    ClusterNode* node = &cluster->nodes[n];
+    json_t* entry = json_pack("{s:s,s:s,s:b,s:i,s:I,s:I,s:i}",
+                              "name", node->name,
+                              "address", node->address,
+                              "connected", node->fd >= 0 && !node->connecting,
+                              "pending", (int)node->pending,
+                              "forwarded", (json_int_t)node->forwarded,
+                              "failures", (json_int_t)node->failures,
+                              "connects", (int)node->connects);
+    if (!entry || json_array_append_new(nodes, entry) < 0) {
+      json_decref(nodes);
+      return NULL;
+    }
+  }
+  return json_pack("{s:s,s:o}",
+                   "self", cluster->nodes[cluster->self].name,
+                   "nodes", nodes);
+}
+
 static json_t* json_table_arena(Arena* arena, unsigned rows) {
   unsigned arena_cap = arena->capacity;
   unsigned arena_used = arena->used;
@@ -227,6 +358,32 @@ static json_t* json_table_hashes(Table* table, struct TableSlot* slot) {
   return obj;
 }
 
+static json_t* json_table_adhoc(Table* table, struct TableSlot* slot) {
+  static const char* states[] = { "free", "pending", "ready" };
+  json_t* obj = json_object();
+  if (!obj) return NULL;
+  unsigned now = time(0);
+  for (unsigned i = 0; i < MELIAN_MAX_ADHOC_INDEXES; ++i) {
+    TableAdhocIndex* adhoc = &table->adhoc[i];
+    unsigned state = atomic_load(&adhoc->state);
+    if (state == TABLE_ADHOC_FREE || state >= ALEN(states)) continue;
+    Hash* hash = state == TABLE_ADHOC_READY ? slot->adhoc[i] : 0;
+    json_t* entry = json_pack("{s:s,s:s,s:i,s:i,s:i,s:i}",
+                              "state", states[state],
+                              "type", adhoc->int_keys ? "int" : "string",
+                              "builds", (int)adhoc->builds,
+                              "idle_seconds", (int)(now - atomic_load(&adhoc->last_used)),
+                              "keys", hash ? (int)hash->used : 0,
+                              "queries", hash ? (int)hash->stats.queries : 0);
+    if (!entry || json_object_set_new(obj, adhoc->column, entry) < 0) {
+      if (entry) json_decref(entry);
+      json_decref(obj);
+      return NULL;
+    }
+  }
+  return obj;
+}
+
 struct Percentile {
   unsigned needed;
   unsigned pos;
@@ -383,28 +540,38 @@ static json_t* json_config_info(Config* config, const char* driver_key) {
   }
   if (!driver_cfg) return NULL;
 
-  json_t* socket_cfg = json_pack("{s:s,s:i,s:s}",
+  json_t* socket_cfg = json_pack("{s:s,s:i,s:s,s:s}",
                                  "host", config->socket.host,
                                  "port", (int)config->socket.port,
-                                 "path", config->socket.path);
+                                 "path", config->socket.path,
+                                 "tls_cert", config->socket.tls_cert);
   if (!socket_cfg) {
     json_decref(driver_cfg);
     return NULL;
   }
 
-  json_t* table_cfg = json_pack("{s:i,s:s,s:b}",
+  json_t* table_cfg = json_pack("{s:i,s:s,s:b,s:i,s:i,s:s,s:i,s:i,s:b}",
                                 "period", (int)config->table.period,
                                 "schema", safe_string(config->table.schema),
-                                "strip_null", config->table.strip_null ? 1 : 0);
+                                "strip_null", config->table.strip_null ? 1 : 0,
+                                "adhoc_idle", (int)config->table.adhoc_idle,
+                                "tier_idle", (int)config->table.tier_idle,
+                                "tier_dir", safe_string(config->table.tier_dir),
+                                "reload_budget", (int)config->table.reload_budget,
+                                "warm_keys", (int)config->table.warm_keys,
+                                "prefault", config->table.prefault ? 1 : 0);
   if (!table_cfg) {
     json_decref(driver_cfg);
     json_decref(socket_cfg);
     return NULL;
   }
 
-  json_t* server_cfg = json_pack("{s:b,s:b}",
+  json_t* server_cfg = json_pack("{s:b,s:b,s:i,s:b,s:i}",
                                  "show_msgs", config->server.show_msgs ? 1 : 0,
-                                 "tokens", config->server.tokens ? 1 : 0);
+                                 "tokens", config->server.tokens ? 1 : 0,
+                                 "numa_node", config->server.numa_node,
+                                 "loader_process", config->server.loader_process ? 1 : 0,
+                                 "shed_lag", (int)config->server.shed_lag);
   if (!server_cfg) {
     json_decref(driver_cfg);
     json_decref(socket_cfg);
@@ -13,6 +13,8 @@ struct event_base;
 struct Config;
 struct DB;
 struct Data;
+struct Cluster;
+struct Tls;
 
 typedef struct StatusServer {
   char host[MAX_STR_LEN];
@@ -31,6 +33,13 @@ typedef struct StatusProcess {
   unsigned birth;
 } StatusProcess;
 
+// Overload counters, kept by the server thread.
+typedef struct StatusLoad {
+  unsigned lag_us;             // how late the last event loop probe ran
+  unsigned long expired;       // requests answered MELIAN_STATUS_EXPIRED
+  unsigned long shed;          // requests answered MELIAN_STATUS_SHED
+} StatusLoad;
+
 typedef struct StatusJson {
   char jbuf[MAX_JSON_LEN];
   unsigned jlen;
@@ -41,6 +50,9 @@ typedef struct Status {
   StatusProcess process;
   StatusServer server;
   StatusLibevent libevent;
+  StatusLoad load;
+  struct Cluster* cluster;     // 0 unless running as a cluster node
+  struct Tls* tls;             // 0 unless the TCP listener serves TLS
   StatusJson json;
 } Status;
 
@@ -0,0 +1,244 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#ifdef HAVE_OPENSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+#include "util.h"
+#include "log.h"
+#include "tls.h"
+
+#if defined(HAVE_OPENSSL) && defined(__linux__)
+
+static unsigned tls_kernel_check(void);
+static void tls_log_errors(const char* what);
+
+Tls* tls_build(const char* cert, const char* key) {
+  Tls* tls = 0;
+  unsigned bad = 0;
+  do {
+    if (!tls_kernel_check()) {
+      ++bad;
+      break;
+    }
+    tls = calloc(1, sizeof(Tls));
+    if (!tls) {
+      LOG_WARN("Could not allocate Tls object");
+      ++bad;
+      break;
+    }
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx) {
+      tls_log_errors("Could not create TLS context");
+      ++bad;
+      break;
+    }
+    tls->ctx = ctx;
+
+    // Only ciphers the kernel can take over, and nothing for OpenSSL to send
+    // once it has: no session tickets, no renegotiation
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION);
+    SSL_CTX_set_num_tickets(ctx, 0);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    if (SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM:ECDHE+CHACHA20") != 1 ||
+        SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:"
+                                      "TLS_CHACHA20_POLY1305_SHA256") != 1) {
+      tls_log_errors("Could not set TLS ciphers");
+      ++bad;
+      break;
+    }
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1) {
+      tls_log_errors("Could not load TLS certificate");
+      ++bad;
+      break;
+    }
+    const char* key_file = key && key[0] ? key : cert;
+    if (SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+      tls_log_errors("Could not load TLS private key");
+      ++bad;
+      break;
+    }
+    LOG_INFO("TLS on the TCP listener with certificate [%s], encrypted by the kernel", cert);
+  } while (0);
+  if (bad) {
+    tls_destroy(tls);
+    tls = 0;
+  }
+  return tls;
+}
+
+void tls_destroy(Tls* tls) {
+  if (!tls) return;
+  if (tls->ctx) SSL_CTX_free(tls->ctx);
+  free(tls);
+}
+
+struct ssl_st* tls_accept(Tls* tls, int fd) {
+  SSL* ssl = SSL_new(tls->ctx);
+  if (!ssl || SSL_set_fd(ssl, fd) != 1) {
+    tls_log_errors("Could not start TLS handshake");
+    if (ssl) SSL_free(ssl);
+    ++tls->stats.failures;
+    return NULL;
+  }
+  SSL_set_accept_state(ssl);
+  return ssl;
+}
+
+TlsStep tls_handshake(Tls* tls, struct ssl_st** ssl) {
+  SSL* s = *ssl;
+  ERR_clear_error();
+  int rc = SSL_do_handshake(s);
+  if (rc != 1) {
+    switch (SSL_get_error(s, rc)) {
+      case SSL_ERROR_WANT_READ:
+        return TLS_STEP_READ;
+      case SSL_ERROR_WANT_WRITE:
+        return TLS_STEP_WRITE;
+      default:
+        // Port scanners and plain text clients end up here; not worth a warning
+        LOG_DEBUG("TLS handshake failed: %s", ERR_reason_error_string(ERR_peek_last_error()));
+        ERR_clear_error();
+        ++tls->stats.failures;
+        return TLS_STEP_FAILED;
+    }
+  }
+
+  // Replies are written to the socket as they are, so the kernel must encrypt them
+  if (!BIO_get_ktls_send(SSL_get_wbio(s))) {
+    LOG_WARN("TLS connection with cipher %s could not hand encryption to the kernel", SSL_get_cipher_name(s));
+    ++tls->stats.failures;
+    return TLS_STEP_FAILED;
+  }
+  ++tls->stats.handshakes;
+  if (BIO_get_ktls_recv(SSL_get_rbio(s))) {
+    // The socket BIO does not own the descriptor, which stays open
+    SSL_free(s);
+    *ssl = NULL;
+    ++tls->stats.kernel_reads;
+  }
+  return TLS_STEP_DONE;
+}
+
+ssize_t tls_read(struct ssl_st* ssl, void* buf, size_t len) {
+  size_t got = 0;
+  ERR_clear_error();
+  if (SSL_read_ex(ssl, buf, len, &got) == 1) return (ssize_t)got;
+  switch (SSL_get_error(ssl, 0)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      errno = EAGAIN;
+      return -1;
+    case SSL_ERROR_ZERO_RETURN:
+      return 0;
+    default:
+      ERR_clear_error();
+      errno = EIO;
+      return -1;
+  }
+}
+
+unsigned tls_pending(struct ssl_st* ssl) {
+  return ssl && SSL_pending(ssl) > 0;
+}
+
+void tls_close(struct ssl_st* ssl) {
+  if (ssl) SSL_free(ssl);
+}
+
+// kTLS comes from the tls kernel module; attaching it to a connected socket
+// shows whether it can be loaded, before any client finds out the hard way.
+static unsigned tls_kernel_check(void) {
+  int listener = -1;
+  int client = -1;
+  unsigned ok = 0;
+  do {
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(sin);
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&sin, sizeof(sin)) < 0 ||
+        listen(listener, 1) < 0 || getsockname(listener, (struct sockaddr*)&sin, &len) < 0) {
+      LOG_WARN("Could not check for kernel TLS: %s", strerror(errno));
+      break;
+    }
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    if (client < 0 || connect(client, (struct sockaddr*)&sin, sizeof(sin)) < 0) {
+      LOG_WARN("Could not check for kernel TLS: %s", strerror(errno));
+      break;
+    }
+    if (setsockopt(client, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+      LOG_WARN("Kernel TLS is not available (%s); load the tls module to serve TLS", strerror(errno));
+      break;
+    }
+    ok = 1;
+  } while (0);
+  if (client >= 0) close(client);
+  if (listener >= 0) close(listener);
+  return ok;
+}
+
+static void tls_log_errors(const char* what) {
+  unsigned long err = ERR_get_error();
+  LOG_WARN("%s: %s", what, err ? ERR_reason_error_string(err) : "unknown error");
+  ERR_clear_error();
+}
+
+#else
+
+Tls* tls_build(const char* cert, const char* key) {
+  UNUSED(cert);
+  UNUSED(key);
+#ifdef HAVE_OPENSSL
+  LOG_WARN("TLS needs kernel TLS, which only Linux has");
+#else
+  LOG_WARN("TLS requested but not available in this build (no OpenSSL)");
+#endif
+  return NULL;
+}
+
+void tls_destroy(Tls* tls) {
+  free(tls);
+}
+
+struct ssl_st* tls_accept(Tls* tls, int fd) {
+  UNUSED(tls);
+  UNUSED(fd);
+  return NULL;
+}
+
+TlsStep tls_handshake(Tls* tls, struct ssl_st** ssl) {
+  UNUSED(tls);
+  UNUSED(ssl);
+  return TLS_STEP_FAILED;
+}
+
+ssize_t tls_read(struct ssl_st* ssl, void* buf, size_t len) {
+  UNUSED(ssl);
+  UNUSED(buf);
+  UNUSED(len);
+  errno = EIO;
+  return -1;
+}
+
+unsigned tls_pending(struct ssl_st* ssl) {
+  UNUSED(ssl);
+  return 0;
+}
+
+void tls_close(struct ssl_st* ssl) {
+  UNUSED(ssl);
+}
+
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+
+// Tls encrypts the TCP listener without giving up zero-copy replies. OpenSSL
+// runs the handshake on the server thread, then hands the record keys to the
+// kernel (kTLS, TCP_ULP "tls"): from there on write and writev of arena frames
+// work as before, and the kernel encrypts what they send. Requests are read
+// through the kernel too when OpenSSL can hand it the receive keys as well, and
+// through OpenSSL otherwise, which for requests this small costs little.
+// Only Linux has kTLS; a build without OpenSSL cannot use TLS at all.
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct ssl_st;
+struct ssl_ctx_st;
+
+typedef enum TlsStep {
+  TLS_STEP_DONE,               // handshake over, the kernel encrypts from here on
+  TLS_STEP_READ,               // waiting for the socket to be readable
+  TLS_STEP_WRITE,              // waiting for the socket to be writable
+  TLS_STEP_FAILED,             // the connection must be closed
+} TlsStep;
+
+typedef struct TlsStats {
+  unsigned long handshakes;    // completed, with the kernel encrypting replies
+  unsigned long failures;      // handshakes that failed or could not hand over to the kernel
+  unsigned long kernel_reads;  // connections whose requests the kernel decrypts as well
+} TlsStats;
+
+typedef struct Tls {
+  struct ssl_ctx_st* ctx;
+  TlsStats stats;
+} Tls;
+
+// Load the certificate chain and private key (key may be 0 or empty if the
+// certificate file holds it), and check that this kernel has kTLS.
+Tls* tls_build(const char* cert, const char* key);
+void tls_destroy(Tls* tls);
+
+// Start the server side of a handshake on fd.
+struct ssl_st* tls_accept(Tls* tls, int fd);
+// Go on with the handshake of *ssl. Once DONE, *ssl is 0 if the kernel reads
+// as well, so that the connection is plain from then on.
+TlsStep tls_handshake(Tls* tls, struct ssl_st** ssl);
+// Like read(2), for connections the kernel only encrypts.
+ssize_t tls_read(struct ssl_st* ssl, void* buf, size_t len);
+// Whether OpenSSL holds decrypted bytes that the socket will not signal.
+unsigned tls_pending(struct ssl_st* ssl);
+void tls_close(struct ssl_st* ssl);
@@ -0,0 +1,442 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "trigram.h"
+
+enum {
+  TRIGRAM_RADIX_BITS = 12,     // trigrams are 24 bits, sorted in two passes
+};
+
+// The best hits of one search so far: a min-heap, worst hit first.
+struct TrigramTop {
+  unsigned limit;
+  unsigned found;
+  TrigramHit* hits;
+};
+
+static unsigned trigram_grams(const uint8_t* text, unsigned len, uint32_t* grams);
+static void trigram_sort_pairs(uint64_t* pairs, uint64_t* tmp, size_t count);
+static int trigram_cmp_gram(const void* a, const void* b);
+static int trigram_cmp_list(const void* a, const void* b);
+static const TrigramList* trigram_find(const Trigram* trigram, uint32_t gram);
+static unsigned varint_len(unsigned v);
+static uint8_t* varint_put(uint8_t* p, unsigned v);
+static unsigned varint_get(const uint8_t** p);
+static unsigned trigram_intersect(const Trigram* trigram, const TrigramList* list,
+                                  unsigned* rows, unsigned count);
+static void trigram_substring(const Trigram* trigram, const uint8_t* base,
+                              const uint8_t* query, unsigned len,
+                              const uint32_t* grams, unsigned q, struct TrigramTop* top);
+static void trigram_similar(const Trigram* trigram, const uint32_t* grams, unsigned q,
+                            double min_score, struct TrigramTop* top);
+static unsigned trigram_contains(const uint8_t* text, unsigned text_len,
+                                 const uint8_t* query, unsigned len);
+static void trigram_offer(struct TrigramTop* top, const TrigramDoc* doc, double score);
+static unsigned trigram_worse(const TrigramHit* a, const TrigramHit* b);
+static int trigram_cmp_hit(const void* a, const void* b);
+
+static inline uint8_t fold(uint8_t c) {
+  return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+Trigram* trigram_build(TrigramDoc* docs, unsigned count, const uint8_t* base) {
+  Trigram* trigram = 0;
+  uint32_t* grams = 0;
+  unsigned grams_cap = 0;
+  uint64_t* pairs = 0;
+  uint64_t* tmp = 0;
+  size_t pair_count = 0;
+  size_t pair_cap = 0;
+  unsigned bad = 0;
+  do {
+    trigram = calloc(1, sizeof(Trigram));
+    if (!trigram) {
+      LOG_WARN("Could not allocate Trigram object");
+      free(docs);
+      return NULL;
+    }
+    trigram->docs = docs;
+    trigram->doc_count = count;
+
+    // One (trigram, row) pair per distinct trigram of each row, in row order
+    for (unsigned d = 0; d < count; ++d) {
+      unsigned len = docs[d].text_len;
+      docs[d].grams = 0;
+      if (len < 3) continue;
+      if (len - 2 > grams_cap) {
+        grams_cap = len - 2;
+        free(grams);
+        grams = malloc(grams_cap * sizeof(uint32_t));
+        if (!grams) {
+          ++bad;
+          break;
+        }
+      }
+      unsigned n = trigram_grams(base + docs[d].text, len, grams);
+      docs[d].grams = n;
+      if (pair_count + n > pair_cap) {
+        size_t cap = pair_cap ? 2 * pair_cap : 4096;
+        while (cap < pair_count + n) cap *= 2;
+        uint64_t* grown = realloc(pairs, cap * sizeof(uint64_t));
+        if (!grown) {
+          ++bad;
+          break;
+        }
+        pairs = grown;
+        pair_cap = cap;
+      }
+      for (unsigned g = 0; g < n; ++g) pairs[pair_count++] = (uint64_t)grams[g] << 32 | d;
+    }
+    if (bad) break;
+
+    // Stable, so every list stays in row order
+    tmp = malloc((pair_count ? pair_count : 1) * sizeof(uint64_t));
+    if (!tmp) {
+      ++bad;
+      break;
+    }
+    trigram_sort_pairs(pairs, tmp, pair_count);
+
+    size_t postings_len = 0;
+    unsigned list_count = 0;
+    for (size_t p = 0; p < pair_count; ++p) {
+      unsigned first = !p || pairs[p] >> 32 != pairs[p - 1] >> 32;
+      list_count += first;
+      postings_len += varint_len((unsigned)pairs[p] - (first ? 0 : (unsigned)pairs[p - 1]));
+    }
+    trigram->lists = malloc((list_count ? list_count : 1) * sizeof(TrigramList));
+    trigram->postings = malloc(postings_len ? postings_len : 1);
+    if (!trigram->lists || !trigram->postings) {
+      ++bad;
+      break;
+    }
+    trigram->list_count = list_count;
+    trigram->postings_len = postings_len;
+
+    uint8_t* out = trigram->postings;
+    TrigramList* list = trigram->lists - 1;
+    for (size_t p = 0; p < pair_count; ++p) {
+      unsigned first = !p || pairs[p] >> 32 != pairs[p - 1] >> 32;
+      if (first) {
+        ++list;
+        list->gram = (uint32_t)(pairs[p] >> 32);
+        list->count = 0;
+        list->offset = (size_t)(out - trigram->postings);
+      }
+      ++list->count;
+      out = varint_put(out, (unsigned)pairs[p] - (first ? 0 : (unsigned)pairs[p - 1]));
+    }
+  } while (0);
+  free(grams);
+  free(pairs);
+  free(tmp);
+  if (bad) {
+    LOG_WARN("Could not allocate trigram index for %u rows", count);
+    trigram_destroy(trigram);
+    return NULL;
+  }
+  return trigram;
+}
+
+Trigram* trigram_clone(const Trigram* trigram) {
+  Trigram* copy = calloc(1, sizeof(Trigram));
+  if (!copy) return NULL;
+  copy->doc_count = trigram->doc_count;
+  copy->list_count = trigram->list_count;
+  copy->postings_len = trigram->postings_len;
+  copy->docs = malloc((trigram->doc_count ? trigram->doc_count : 1) * sizeof(TrigramDoc));
+  copy->lists = malloc((trigram->list_count ? trigram->list_count : 1) * sizeof(TrigramList));
+  copy->postings = malloc(trigram->postings_len ? trigram->postings_len : 1);
+  if (!copy->docs || !copy->lists || !copy->postings) {
+    trigram_destroy(copy);
+    return NULL;
+  }
+  memcpy(copy->docs, trigram->docs, trigram->doc_count * sizeof(TrigramDoc));
+  memcpy(copy->lists, trigram->lists, trigram->list_count * sizeof(TrigramList));
+  memcpy(copy->postings, trigram->postings, trigram->postings_len);
+  return copy;
+}
+
+void trigram_destroy(Trigram* trigram) {
+  if (!trigram) return;
+  free(trigram->docs);
+  free(trigram->lists);
+  free(trigram->postings);
+  free(trigram);
+}
+
+size_t trigram_bytes(const Trigram* trigram) {
+  if (!trigram) return 0;
+  return (size_t)trigram->doc_count * sizeof(TrigramDoc) +
+         (size_t)trigram->list_count * sizeof(TrigramList) +
+         trigram->postings_len;
+}
+
+unsigned trigram_search(const Trigram* trigram, const uint8_t* base, unsigned substring,
+                        const uint8_t* query, unsigned len, unsigned limit, double min_score,
+                        TrigramHit* hits) {
+  if (!trigram || !trigram->doc_count || !len) return 0;
+  if (len > TRIGRAM_MAX_QUERY) len = TRIGRAM_MAX_QUERY;
+  if (!limit || limit > TRIGRAM_MAX_RESULTS) limit = TRIGRAM_MAX_RESULTS;
+
+  uint32_t grams[TRIGRAM_MAX_QUERY];
+  unsigned q = len >= 3 ? trigram_grams(query, len, grams) : 0;
+  struct TrigramTop top = {
+    .limit = limit,
+    .hits = hits,
+  };
+  if (substring) {
+    trigram_substring(trigram, base, query, len, grams, q, &top);
+  } else if (q) {
+    trigram_similar(trigram, grams, q, min_score, &top);
+  }
+  qsort(hits, top.found, sizeof(TrigramHit), trigram_cmp_hit);
+  return top.found;
+}
+
+// Fill grams with the distinct trigrams of text, sorted; return how many.
+static unsigned trigram_grams(const uint8_t* text, unsigned len, uint32_t* grams) {
+  unsigned n = 0;
+  uint32_t gram = (uint32_t)fold(text[0]) << 8 | fold(text[1]);
+  for (unsigned j = 2; j < len; ++j) {
+    gram = (gram << 8 | fold(text[j])) & 0xffffff;
+    grams[n++] = gram;
+  }
+  qsort(grams, n, sizeof(uint32_t), trigram_cmp_gram);
+  unsigned distinct = 0;
+  for (unsigned j = 0; j < n; ++j) {
+    if (!distinct || grams[j] != grams[distinct - 1]) grams[distinct++] = grams[j];
+  }
+  return distinct;
+}
+
+// LSD radix sort of pairs by trigram, keeping the row order within each trigram.
+static void trigram_sort_pairs(uint64_t* pairs, uint64_t* tmp, size_t count) {
+  static size_t starts[1 << TRIGRAM_RADIX_BITS];
+  const unsigned buckets = 1 << TRIGRAM_RADIX_BITS;
+  uint64_t* from = pairs;
+  uint64_t* to = tmp;
+  for (unsigned shift = 32; shift < 32 + 2 * TRIGRAM_RADIX_BITS; shift += TRIGRAM_RADIX_BITS) {
+    memset(starts, 0, sizeof(starts));
+    for (size_t p = 0; p < count; ++p) ++starts[(from[p] >> shift) & (buckets - 1)];
+    size_t total = 0;
+    for (unsigned b = 0; b < buckets; ++b) {
+      size_t n = starts[b];
+      starts[b] = total;
+      total += n;
+    }
+    for (size_t p = 0; p < count; ++p) to[starts[(from[p] >> shift) & (buckets - 1)]++] = from[p];
+    uint64_t* swap = from;
+    from = to;
+    to = swap;
+  }
+  // An even number of passes leaves the result back in pairs
+}
+
+static int trigram_cmp_gram(const void* a, const void* b) {
+  uint32_t l = *(const uint32_t*)a;
+  uint32_t r = *(const uint32_t*)b;
+  return l < r ? -1 : l > r;
+}
+
+static int trigram_cmp_list(const void* a, const void* b) {
+  unsigned l = (*(const TrigramList* const*)a)->count;
+  unsigned r = (*(const TrigramList* const*)b)->count;
+  return l < r ? -1 : l > r;
+}
+
+static const TrigramList* trigram_find(const Trigram* trigram, uint32_t gram) {
+  unsigned lo = 0;
+  unsigned hi = trigram->list_count;
+  while (lo < hi) {
+    unsigned mid = lo + (hi - lo) / 2;
+    uint32_t at = trigram->lists[mid].gram;
+    if (at == gram) return &trigram->lists[mid];
+    if (at < gram) lo = mid + 1;
+    else hi = mid;
+  }
+  return NULL;
+}
+
+static unsigned varint_len(unsigned v) {
+  unsigned len = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    ++len;
+  }
+  return len;
+}
+
+static uint8_t* varint_put(uint8_t* p, unsigned v) {
+  while (v >= 0x80) {
+    *p++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+static unsigned varint_get(const uint8_t** p) {
+  const uint8_t* q = *p;
+  unsigned v = 0;
+  unsigned shift = 0;
+  while (*q & 0x80) {
+    v |= (unsigned)(*q++ & 0x7f) << shift;
+    shift += 7;
+  }
+  v |= (unsigned)*q++ << shift;
+  *p = q;
+  return v;
+}
+
+// Keep only the rows (count of them, ascending) that are also in list.
+static unsigned trigram_intersect(const Trigram* trigram, const TrigramList* list,
+                                  unsigned* rows, unsigned count) {
+  const uint8_t* p = trigram->postings + list->offset;
+  unsigned row = 0;
+  unsigned kept = 0;
+  unsigned r = 0;
+  for (unsigned j = 0; j < list->count && r < count; ++j) {
+    row += varint_get(&p);
+    while (r < count && rows[r] < row) ++r;
+    if (r < count && rows[r] == row) rows[kept++] = rows[r++];
+  }
+  return kept;
+}
+
+// Rows whose text contains query: those in the lists of all its trigrams,
+// checked against the text itself.
+static void trigram_substring(const Trigram* trigram, const uint8_t* base,
+                              const uint8_t* query, unsigned len,
+                              const uint32_t* grams, unsigned q, struct TrigramTop* top) {
+  if (!q) {
+    // Too short to have a trigram; look at every row
+    for (unsigned d = 0; d < trigram->doc_count; ++d) {
+      const TrigramDoc* doc = &trigram->docs[d];
+      if (!trigram_contains(base + doc->text, doc->text_len, query, len)) continue;
+      trigram_offer(top, doc, (double)len / doc->text_len);
+    }
+    return;
+  }
+
+  const TrigramList* lists[TRIGRAM_MAX_QUERY];
+  for (unsigned g = 0; g < q; ++g) {
+    lists[g] = trigram_find(trigram, grams[g]);
+    if (!lists[g]) return;
+  }
+  // Start from the shortest list, so the candidates only shrink from there
+  qsort(lists, q, sizeof(lists[0]), trigram_cmp_list);
+  unsigned* rows = malloc(lists[0]->count * sizeof(unsigned));
+  if (!rows) {
+    LOG_WARN("Could not allocate %u trigram candidates", lists[0]->count);
+    return;
+  }
+  const uint8_t* p = trigram->postings + lists[0]->offset;
+  unsigned row = 0;
+  for (unsigned j = 0; j < lists[0]->count; ++j) {
+    row += varint_get(&p);
+    rows[j] = row;
+  }
+  unsigned count = lists[0]->count;
+  for (unsigned g = 1; g < q && count; ++g) count = trigram_intersect(trigram, lists[g], rows, count);
+
+  for (unsigned j = 0; j < count; ++j) {
+    const TrigramDoc* doc = &trigram->docs[rows[j]];
+    if (!trigram_contains(base + doc->text, doc->text_len, query, len)) continue;
+    trigram_offer(top, doc, (double)q / doc->grams);
+  }
+  free(rows);
+}
+
+// Rows sharing trigrams with the query, scored by similarity.
+static void trigram_similar(const Trigram* trigram, const uint32_t* grams, unsigned q,
+                            double min_score, struct TrigramTop* top) {
+  // A query has fewer than 256 trigrams, so a byte counts the shared ones
+  uint8_t* shared = calloc(trigram->doc_count, sizeof(uint8_t));
+  unsigned* touched = malloc(trigram->doc_count * sizeof(unsigned));
+  unsigned touched_count = 0;
+  do {
+    if (!shared || !touched) {
+      LOG_WARN("Could not allocate trigram scores for %u rows", trigram->doc_count);
+      break;
+    }
+    for (unsigned g = 0; g < q; ++g) {
+      const TrigramList* list = trigram_find(trigram, grams[g]);
+      if (!list) continue;
+      const uint8_t* p = trigram->postings + list->offset;
+      unsigned row = 0;
+      for (unsigned j = 0; j < list->count; ++j) {
+        row += varint_get(&p);
+        if (!shared[row]++) touched[touched_count++] = row;
+      }
+    }
+    for (unsigned t = 0; t < touched_count; ++t) {
+      const TrigramDoc* doc = &trigram->docs[touched[t]];
+      unsigned c = shared[touched[t]];
+      double score = (double)c / (q + doc->grams - c);
+      if (score >= min_score) trigram_offer(top, doc, score);
+    }
+  } while (0);
+  free(shared);
+  free(touched);
+}
+
+// Whether text contains query, ignoring ASCII case.
+static unsigned trigram_contains(const uint8_t* text, unsigned text_len,
+                                 const uint8_t* query, unsigned len) {
+  if (len > text_len) return 0;
+  uint8_t first = fold(query[0]);
+  for (unsigned j = 0; j + len <= text_len; ++j) {
+    if (fold(text[j]) != first) continue;
+    unsigned k = 1;
+    while (k < len && fold(text[j + k]) == fold(query[k])) ++k;
+    if (k == len) return 1;
+  }
+  return 0;
+}
+
+static void trigram_offer(struct TrigramTop* top, const TrigramDoc* doc, double score) {
+  TrigramHit hit = { .doc = doc, .score = score };
+  TrigramHit* hits = top->hits;
+  if (top->found < top->limit) {
+    // Sift up the new hit
+    unsigned pos = top->found++;
+    while (pos) {
+      unsigned parent = (pos - 1) / 2;
+      if (!trigram_worse(&hit, &hits[parent])) break;
+      hits[pos] = hits[parent];
+      pos = parent;
+    }
+    hits[pos] = hit;
+    return;
+  }
+  if (!trigram_worse(&hits[0], &hit)) return;
+  hits[0] = hit;
+  unsigned pos = 0;
+  while (1) {
+    unsigned worst = pos;
+    unsigned l = 2 * pos + 1;
+    unsigned r = l + 1;
+    if (l < top->found && trigram_worse(&hits[l], &hits[worst])) worst = l;
+    if (r < top->found && trigram_worse(&hits[r], &hits[worst])) worst = r;
+    if (worst == pos) return;
+    TrigramHit tmp = hits[pos];
+    hits[pos] = hits[worst];
+    hits[worst] = tmp;
+    pos = worst;
+  }
+}
+
+// Lower scores are worse; on a tie, later rows are.
+static unsigned trigram_worse(const TrigramHit* a, const TrigramHit* b) {
+  if (a->score != b->score) return a->score < b->score;
+  return a->doc > b->doc;
+}
+
+static int trigram_cmp_hit(const void* a, const void* b) {
+  const TrigramHit* l = a;
+  const TrigramHit* r = b;
+  if (trigram_worse(l, r)) return 1;
+  if (trigram_worse(r, l)) return -1;
+  return 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+// A Trigram index finds rows whose text resembles a query, or contains it.
+// Every run of three bytes (ASCII folded to lower case) in a row's text is a
+// trigram; for each trigram the index keeps the rows holding it as a posting
+// list of row numbers, in order, stored as deltas in a variable-length
+// encoding. Lists are sorted by trigram so a query looks each up by bisection.
+// Similarity is shared trigrams / (query trigrams + row trigrams - shared).
+// Rows and their text are referenced by arena offset, so a Trigram stays
+// valid for a mapped copy of its arena.
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+  TRIGRAM_MAX_RESULTS = 1024,  // most rows one query returns
+  TRIGRAM_MAX_QUERY = 256,     // bytes of query text that are used
+};
+
+typedef struct TrigramDoc {
+  unsigned frame;              // arena offset of the row frame
+  unsigned frame_len;
+  unsigned text;               // arena offset of the indexed text
+  unsigned text_len;
+  unsigned grams;              // distinct trigrams in the text
+} TrigramDoc;
+
+typedef struct TrigramList {
+  uint32_t gram;
+  unsigned count;              // rows holding gram
+  size_t offset;               // start of the list in postings
+} TrigramList;
+
+typedef struct Trigram {
+  unsigned doc_count;
+  TrigramDoc* docs;
+  unsigned list_count;
+  TrigramList* lists;
+  uint8_t* postings;
+  size_t postings_len;
+} Trigram;
+
+typedef struct TrigramHit {
+  const TrigramDoc* doc;
+  double score;
+} TrigramHit;
+
+// Index count docs, whose text lies in base; the Trigram takes ownership of docs.
+Trigram* trigram_build(TrigramDoc* docs, unsigned count, const uint8_t* base);
+Trigram* trigram_clone(const Trigram* trigram);
+void trigram_destroy(Trigram* trigram);
+size_t trigram_bytes(const Trigram* trigram);
+
+// Find up to limit rows (TRIGRAM_MAX_RESULTS if 0) for query, best first.
+// With substring set, only rows whose text contains query (ignoring ASCII
+// case) match, shorter texts ranking higher; otherwise rows match with a
+// similarity of at least min_score. Fill hits and return how many there are.
+unsigned trigram_search(const Trigram* trigram, const uint8_t* base, unsigned substring,
+                        const uint8_t* query, unsigned len, unsigned limit, double min_score,
+                        TrigramHit* hits);
@@ -1,7 +1,9 @@
 #include <string.h>
 #include "xxhash.h"
 
-// xxh3_64.c - Minimal standalone implementation of XXH3_64bits
+// xxh3_64.c - Minimal standalone implementation of XXH3_64bits, following the
+// reference scalar code for every input size, so hashes match other XXH3
+// implementations. Assumes a little-endian host.
 
 // 64-bit primes
 const unsigned long long XXH_PRIME64_1 = 0x9e3779b185ebca87ull;
@@ -10,29 +12,87 @@ const unsigned long long XXH_PRIME64_3 = 0x165667b19e3779f9ull;
 const unsigned long long XXH_PRIME64_4 = 0x85ebca77c2b2ae63ull;
 const unsigned long long XXH_PRIME64_5 = 0x27d4eb2f165667c5ull;
 const unsigned long long XXH_AVALANCHE = 0x165667919E3779F9ull;
+static const uint64_t XXH_PRIME_MX2 = 0x9fb21c651e98df25ull;
 
-static const uint8_t XXH3_kSecret[192] = {
-  0xb8,0xfe,0x6c,0x39,0x23,0xa4,0x4b,0xbe,
-  0x1f,0x22,0x32,0x1c,0x7b,0xe0,0x72,0x91,
-  0x8b,0xea,0x4b,0x61,0xe8,0xcb,0xb3,0x9d,
-  0x4b,0xdb,0x0c,0xa1,0xcb,0x04,0x5f,0x61,
-  0x6b,0xed,0x3d,0x42,0x9a,0xb8,0xbc,0x1e,
-  0xb3,0x82,0xf4,0xda,0x88,0x5b,0x2b,0x99,
-  0x0f,0xac,0x1e,0x6f,0xe4,0x5c,0xca,0xea,
-  0xd2,0x4b,0x6e,0xd0,0x3c,0xcb,0x8b,0x30,
-  // Fill rest with zeros
+enum {
+  XXH3_SECRET_SIZE = 192,
+  XXH3_SECRET_SIZE_MIN = 136,
+  XXH3_MIDSIZE_MAX = 240,
+  XXH3_MIDSIZE_STARTOFFSET = 3,
+  XXH3_MIDSIZE_LASTOFFSET = 17,
+  XXH3_STRIPE_LEN = 64,
+  XXH3_SECRET_CONSUME_RATE = 8,
+  XXH3_SECRET_LASTACC_START = 7,
+  XXH3_SECRET_MERGEACCS_START = 11,
+  XXH3_ACC_NB = 8,
 };
 
+static const uint8_t XXH3_kSecret[XXH3_SECRET_SIZE] = {
+  0xb8,0xfe,0x6c,0x39,0x23,0xa4,0x4b,0xbe, 0x7c,0x01,0x81,0x2c,0xf7,0x21,0xad,0x1c,
+  0xde,0xd4,0x6d,0xe9,0x83,0x90,0x97,0xdb, 0x72,0x40,0xa4,0xa4,0xb7,0xb3,0x67,0x1f,
+  0xcb,0x79,0xe6,0x4e,0xcc,0xc0,0xe5,0x78, 0x82,0x5a,0xd0,0x7d,0xcc,0xff,0x72,0x21,
+  0xb8,0x08,0x46,0x74,0xf7,0x43,0x24,0x8e, 0xe0,0x35,0x90,0xe6,0x81,0x3a,0x26,0x4c,
+  0x3c,0x28,0x52,0xbb,0x91,0xc3,0x00,0xcb, 0x88,0xd0,0x65,0x8b,0x1b,0x53,0x2e,0xa3,
+  0x71,0x64,0x48,0x97,0xa2,0x0d,0xf9,0x4e, 0x38,0x19,0xef,0x46,0xa9,0xde,0xac,0xd8,
+  0xa8,0xfa,0x76,0x3f,0xe3,0x9c,0x34,0x3f, 0xf9,0xdc,0xbb,0xc7,0xc7,0x0b,0x4f,0x1d,
+  0x8a,0x51,0xe0,0x4b,0xcd,0xb4,0x59,0x31, 0xc8,0x9f,0x7e,0xc9,0xd9,0x78,0x73,0x64,
+  0xea,0xc5,0xac,0x83,0x34,0xd3,0xeb,0xc3, 0xc5,0x81,0xa0,0xff,0xfa,0x13,0x63,0xeb,
+  0x17,0x0d,0xdd,0x51,0xb7,0xf0,0xda,0x49, 0xd3,0x16,0x55,0x26,0x29,0xd4,0x68,0x9e,
+  0x2b,0x16,0xbe,0x58,0x7d,0x47,0xa1,0xfc, 0x8f,0xf8,0xb8,0xd1,0x7a,0xd0,0x31,0xce,
+  0x45,0xcb,0x3a,0x8f,0x95,0x16,0x04,0x28, 0xaf,0xd7,0xfb,0xca,0xbb,0x4b,0x40,0x7e,
+};
+
+inline static uint32_t read32(const void* memPtr) {
+  uint32_t val;
+  memcpy(&val, memPtr, sizeof(val));
+  return val;
+}
+
 inline static uint64_t read64(const void* memPtr) {
   uint64_t val;
   memcpy(&val, memPtr, sizeof(val));
   return val;
 }
 
+inline static void write64(void* memPtr, uint64_t val) {
+  memcpy(memPtr, &val, sizeof(val));
+}
+
 inline static uint64_t rol64(uint64_t x, int r) {
   return (x << r) | (x >> (64 - r));
 }
 
+inline static uint64_t swap64(uint64_t x) {
+  return __builtin_bswap64(x);
+}
+
+// Multiply into 128 bits and fold the halves together.
+inline static uint64_t mul128_fold64(uint64_t lhs, uint64_t rhs) {
+#ifdef __SIZEOF_INT128__
+  __extension__ typedef unsigned __int128 uint128;
+  uint128 product = (uint128)lhs * rhs;
+  return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+  uint64_t lo_lo = (lhs & 0xffffffffull) * (rhs & 0xffffffffull);
+  uint64_t hi_lo = (lhs >> 32) * (rhs & 0xffffffffull);
+  uint64_t lo_hi = (lhs & 0xffffffffull) * (rhs >> 32);
+  uint64_t hi_hi = (lhs >> 32) * (rhs >> 32);
+  uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffffull) + lo_hi;
+  uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  uint64_t lower = (cross << 32) | (lo_lo & 0xffffffffull);
+  return lower ^ upper;
+#endif
+}
+
+inline static uint64_t xxh64_avalanche(uint64_t h64) {
+  h64 ^= h64 >> 33;
+  h64 *= XXH_PRIME64_2;
+  h64 ^= h64 >> 29;
+  h64 *= XXH_PRIME64_3;
+  h64 ^= h64 >> 32;
+  return h64;
+}
+
 inline static uint64_t avalanche(uint64_t h64) {
   h64 ^= h64 >> 37;
   h64 *= XXH_AVALANCHE;
@@ -40,60 +100,150 @@ inline static uint64_t avalanche(uint64_t h64) {
   return h64;
 }
 
-inline static uint64_t mix16B(const void* data, const void* key, uint64_t seed) {
-  const uint64_t* d = (const uint64_t*)data;
-  const uint64_t* k = (const uint64_t*)key;
-  uint64_t input_lo = read64(d) ^ (read64(k) + seed);
-  uint64_t input_hi = read64(d + 1) ^ (read64(k + 1) - seed);
-  return rol64(input_lo, 31) * XXH_PRIME64_1 + rol64(input_hi, 27) * XXH_PRIME64_2;
+inline static uint64_t rrmxmx(uint64_t h64, uint64_t len) {
+  h64 ^= rol64(h64, 49) ^ rol64(h64, 24);
+  h64 *= XXH_PRIME_MX2;
+  h64 ^= (h64 >> 35) + len;
+  h64 *= XXH_PRIME_MX2;
+  return h64 ^ (h64 >> 28);
 }
 
-uint64_t XXH3_64bits(const void* input, uint32_t length, uint64_t seed) {
-  const uint8_t* data = (const uint8_t*)input;
+inline static uint64_t mix16B(const uint8_t* data, const uint8_t* key, uint64_t seed) {
+  uint64_t input_lo = read64(data);
+  uint64_t input_hi = read64(data + 8);
+  return mul128_fold64(input_lo ^ (read64(key) + seed), input_hi ^ (read64(key + 8) - seed));
+}
 
-  if (length <= 16) {
-    if (length >= 9) {
-      uint64_t input_lo = read64(data);
-      uint64_t input_hi = read64(data + length - 8);
-      uint64_t bitflip = read64(XXH3_kSecret + 24) ^ read64(XXH3_kSecret + 32);
-      uint64_t keyed = input_lo ^ input_hi ^ bitflip;
-      return avalanche(rol64(keyed, 37) * XXH_PRIME64_1);
-    }
-    if (length >= 4) {
-      uint32_t input1, input2;
-      memcpy(&input1, data, 4);
-      memcpy(&input2, data + length - 4, 4);
-      uint64_t combined = ((uint64_t)input1 << 32) | input2;
-      uint64_t keyed = combined ^ (read64(XXH3_kSecret + 8) + seed);
-      return avalanche(rol64(keyed, 11) * XXH_PRIME64_1);
-    }
-    if (length > 0) {
-      uint8_t c1 = data[0];
-      uint8_t c2 = data[length >> 1];
-      uint8_t c3 = data[length - 1];
-      uint32_t combined = ((uint32_t)c1 << 16) | ((uint32_t)c2 << 8) | c3;
-      uint64_t keyed = combined ^ (read64(XXH3_kSecret) + seed);
-      return avalanche(keyed * XXH_PRIME64_1);
-    }
-    return avalanche(read64(XXH3_kSecret + 56) ^ read64(XXH3_kSecret + 64));
+static uint64_t hash_0to16(const uint8_t* data, uint32_t length, const uint8_t* secret, uint64_t seed) {
+  if (length > 8) {
+    uint64_t bitflip1 = (read64(secret + 24) ^ read64(secret + 32)) + seed;
+    uint64_t bitflip2 = (read64(secret + 40) ^ read64(secret + 48)) - seed;
+    uint64_t input_lo = read64(data) ^ bitflip1;
+    uint64_t input_hi = read64(data + length - 8) ^ bitflip2;
+    uint64_t acc = length + swap64(input_lo) + input_hi + mul128_fold64(input_lo, input_hi);
+    return avalanche(acc);
   }
+  if (length >= 4) {
+    seed ^= (uint64_t)__builtin_bswap32((uint32_t)seed) << 32;
+    uint32_t input1 = read32(data);
+    uint32_t input2 = read32(data + length - 4);
+    uint64_t bitflip = (read64(secret + 8) ^ read64(secret + 16)) - seed;
+    uint64_t input64 = input2 + ((uint64_t)input1 << 32);
+    return rrmxmx(input64 ^ bitflip, length);
+  }
+  if (length > 0) {
+    uint8_t c1 = data[0];
+    uint8_t c2 = data[length >> 1];
+    uint8_t c3 = data[length - 1];
+    uint32_t combined = ((uint32_t)c1 << 16) | ((uint32_t)c2 << 24) | c3 | (length << 8);
+    uint64_t bitflip = (read32(secret) ^ read32(secret + 4)) + seed;
+    return xxh64_avalanche((uint64_t)combined ^ bitflip);
+  }
+  return xxh64_avalanche(seed ^ read64(secret + 56) ^ read64(secret + 64));
+}
 
-  if (length <= 128) {
-    uint64_t acc = length * XXH_PRIME64_1;
-    size_t i;
-    for (i = 0; i < length; i += 16) {
-      acc += mix16B(data + i, XXH3_kSecret + i, seed);
+// 17 to 128 bytes: pairs of stripes from both ends, each with its own key.
+static uint64_t hash_17to128(const uint8_t* data, uint32_t length, const uint8_t* secret, uint64_t seed) {
+  uint64_t acc = length * XXH_PRIME64_1;
+  if (length > 32) {
+    if (length > 64) {
+      if (length > 96) {
+        acc += mix16B(data + 48, secret + 96, seed);
+        acc += mix16B(data + length - 64, secret + 112, seed);
+      }
+      acc += mix16B(data + 32, secret + 64, seed);
+      acc += mix16B(data + length - 48, secret + 80, seed);
     }
-    return avalanche(acc);
+    acc += mix16B(data + 16, secret + 32, seed);
+    acc += mix16B(data + length - 32, secret + 48, seed);
   }
+  acc += mix16B(data, secret, seed);
+  acc += mix16B(data + length - 16, secret + 16, seed);
+  return avalanche(acc);
+}
 
-  // Truncate: for minimal version, just hash the first and last 64 bytes
+// 129 to 240 bytes: every stripe in order, the ones past the eighth keyed at
+// an offset, so no two stripes share a key.
+static uint64_t hash_129to240(const uint8_t* data, uint32_t length, const uint8_t* secret, uint64_t seed) {
   uint64_t acc = length * XXH_PRIME64_1;
-  acc += mix16B(data, XXH3_kSecret, seed);
-  acc += mix16B(data + length - 16, XXH3_kSecret + 16, seed);
+  unsigned rounds = length / 16;
+  for (unsigned i = 0; i < 8; ++i) {
+    acc += mix16B(data + 16 * i, secret + 16 * i, seed);
+  }
+  acc = avalanche(acc);
+  for (unsigned i = 8; i < rounds; ++i) {
+    acc += mix16B(data + 16 * i, secret + 16 * (i - 8) + XXH3_MIDSIZE_STARTOFFSET, seed);
+  }
+  acc += mix16B(data + length - 16, secret + XXH3_SECRET_SIZE_MIN - XXH3_MIDSIZE_LASTOFFSET, seed);
   return avalanche(acc);
 }
 
+static void accumulate_512(uint64_t* acc, const uint8_t* data, const uint8_t* secret) {
+  for (unsigned i = 0; i < XXH3_ACC_NB; ++i) {
+    uint64_t data_val = read64(data + 8 * i);
+    uint64_t data_key = data_val ^ read64(secret + 8 * i);
+    acc[i ^ 1] += data_val;
+    acc[i] += (uint32_t)data_key * (data_key >> 32);
+  }
+}
+
+static void scramble_acc(uint64_t* acc, const uint8_t* secret) {
+  for (unsigned i = 0; i < XXH3_ACC_NB; ++i) {
+    uint64_t acc64 = acc[i];
+    acc64 ^= acc64 >> 47;
+    acc64 ^= read64(secret + 8 * i);
+    acc64 *= 0x9E3779B1u;
+    acc[i] = acc64;
+  }
+}
+
+// Over 240 bytes: eight accumulators over 64-byte stripes, scrambled after
+// every block of 16 stripes.
+static uint64_t hash_long(const uint8_t* data, uint32_t length, const uint8_t* secret) {
+  uint64_t acc[XXH3_ACC_NB] = {
+    0xC2B2AE3Du, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+    XXH_PRIME64_4, 0x85EBCA77u, XXH_PRIME64_5, 0x9E3779B1u,
+  };
+  unsigned stripes_per_block = (XXH3_SECRET_SIZE - XXH3_STRIPE_LEN) / XXH3_SECRET_CONSUME_RATE;
+  uint32_t block_len = XXH3_STRIPE_LEN * stripes_per_block;
+  uint32_t blocks = (length - 1) / block_len;
+  for (uint32_t b = 0; b < blocks; ++b) {
+    for (unsigned s = 0; s < stripes_per_block; ++s) {
+      accumulate_512(acc, data + b * block_len + s * XXH3_STRIPE_LEN, secret + s * XXH3_SECRET_CONSUME_RATE);
+    }
+    scramble_acc(acc, secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN);
+  }
+  unsigned stripes = ((length - 1) - block_len * blocks) / XXH3_STRIPE_LEN;
+  for (unsigned s = 0; s < stripes; ++s) {
+    accumulate_512(acc, data + blocks * block_len + s * XXH3_STRIPE_LEN, secret + s * XXH3_SECRET_CONSUME_RATE);
+  }
+  accumulate_512(acc, data + length - XXH3_STRIPE_LEN,
+                 secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN - XXH3_SECRET_LASTACC_START);
+
+  uint64_t result = length * XXH_PRIME64_1;
+  const uint8_t* merge = secret + XXH3_SECRET_MERGEACCS_START;
+  for (unsigned i = 0; i < 4; ++i) {
+    result += mul128_fold64(acc[2 * i] ^ read64(merge + 16 * i), acc[2 * i + 1] ^ read64(merge + 16 * i + 8));
+  }
+  return avalanche(result);
+}
+
+uint64_t XXH3_64bits(const void* input, uint32_t length, uint64_t seed) {
+  const uint8_t* data = (const uint8_t*)input;
+  if (length <= 16) return hash_0to16(data, length, XXH3_kSecret, seed);
+  if (length <= 128) return hash_17to128(data, length, XXH3_kSecret, seed);
+  if (length <= XXH3_MIDSIZE_MAX) return hash_129to240(data, length, XXH3_kSecret, seed);
+  if (!seed) return hash_long(data, length, XXH3_kSecret);
+
+  // Long inputs with a seed use a secret derived from it
+  uint8_t secret[XXH3_SECRET_SIZE];
+  for (unsigned i = 0; i < XXH3_SECRET_SIZE; i += 16) {
+    write64(secret + i, read64(XXH3_kSecret + i) + seed);
+    write64(secret + i + 8, read64(XXH3_kSecret + i + 8) - seed);
+  }
+  return hash_long(data, length, secret);
+}
+
 // 32-bit primes
 const unsigned long long XXH_PRIME32_1 = 0x9E3779B1u;
 const unsigned long long XXH_PRIME32_2 = 0x85EBCA77u;
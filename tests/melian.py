@@ -0,0 +1,379 @@
+"""Helpers for the server tests.
+
+Each test class gets its own SQLite database and melian-server process on a
+private UNIX socket, configured only through the environment, so the tests
+do not depend on the MELIAN_* variables of whoever runs them. The Client
+class speaks the binary protocol directly, so tests can send what the C
+client never would: pipelined requests, split reads, deadline headers.
+
+Run from the top of the tree, after building:
+
+    python3 -m unittest discover -s tests -v
+
+MELIAN_SERVER points at another server binary (default ./melian-server).
+"""
+
+import json
+import os
+import shutil
+import socket
+import sqlite3
+import struct
+import subprocess
+import tempfile
+import time
+import unittest
+
+TOP = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SERVER = os.environ.get("MELIAN_SERVER", os.path.join(TOP, "melian-server"))
+
+HEADER_VERSION = 0x11
+HEADER_VERSION_DEADLINE = 0x12
+RESPONSE_STATUS = 0x80000000
+
+STATUS_NOT_READY = 1
+STATUS_DENIED = 2
+STATUS_EXPIRED = 3
+STATUS_SHED = 4
+STATUS_UNAVAILABLE = 5
+STATUS_NO_ROOM = 6
+STATUS_SPLIT = 7
+
+ACTION_FETCH = ord("F")
+ACTION_DESCRIBE_SCHEMA = ord("D")
+ACTION_GET_STATISTICS = ord("s")
+ACTION_HELLO = ord("h")
+ACTION_LIST_CLIENTS = ord("c")
+ACTION_NEAREST = ord("N")
+ACTION_SEARCH = ord("S")
+ACTION_INGEST = ord("I")
+ACTION_GROUP = ord("G")
+ACTION_EXPORT = ord("E")
+
+INDEX_ADHOC = 0xFF
+
+VALUE_NULL = 0
+VALUE_INT64 = 1
+VALUE_FLOAT64 = 2
+VALUE_BYTES = 3
+VALUE_DECIMAL = 4
+VALUE_BOOL = 5
+
+# The tables most tests start from: 1000 hosts with a few columns to index.
+HOSTS_SQL = """
+CREATE TABLE hosts (id INTEGER PRIMARY KEY, hostname TEXT, ip TEXT, status TEXT,
+                    site TEXT, attrs TEXT);
+"""
+HOST_STATUSES = ("active", "inactive", "maintenance")
+
+
+def host_rows(count=1000):
+    for i in range(1, count + 1):
+        yield (i, "host-%05d" % i, "10.0.%d.%d" % (i // 256, i % 256),
+               HOST_STATUSES[i % 3], "site-%d" % (i % 10),
+               json.dumps({"sku": "SKU%04d" % i, "rack": i % 7}))
+
+
+def hosts_database(path, count=1000):
+    db = sqlite3.connect(path)
+    db.executescript(HOSTS_SQL)
+    db.executemany("INSERT INTO hosts VALUES (?, ?, ?, ?, ?, ?)", host_rows(count))
+    db.commit()
+    return db
+
+
+def encode_row(fields):
+    """Encode a dict as a row in the binary row format."""
+    out = struct.pack("<I", len(fields))
+    for name, value in fields.items():
+        name = name.encode()
+        if value is None:
+            kind, data = VALUE_NULL, b""
+        elif isinstance(value, bool):
+            kind, data = VALUE_BOOL, bytes([1 if value else 0])
+        elif isinstance(value, int):
+            kind, data = VALUE_INT64, struct.pack("<q", value)
+        elif isinstance(value, float):
+            kind, data = VALUE_FLOAT64, struct.pack("<d", value)
+        else:
+            kind, data = VALUE_BYTES, value.encode() if isinstance(value, str) else value
+        out += struct.pack("<H", len(name)) + name + struct.pack("<BI", kind, len(data)) + data
+    return out
+
+
+def decode_row(data):
+    """Decode a row in the binary row format into a dict."""
+    (count,) = struct.unpack_from("<I", data, 0)
+    pos = 4
+    row = {}
+    for _ in range(count):
+        (name_len,) = struct.unpack_from("<H", data, pos)
+        pos += 2
+        name = data[pos:pos + name_len].decode()
+        pos += name_len
+        kind, value_len = struct.unpack_from("<BI", data, pos)
+        pos += 5
+        value = data[pos:pos + value_len]
+        pos += value_len
+        if kind == VALUE_NULL:
+            row[name] = None
+        elif kind == VALUE_INT64:
+            row[name] = struct.unpack("<q", value)[0]
+        elif kind == VALUE_FLOAT64:
+            row[name] = struct.unpack("<d", value)[0]
+        elif kind == VALUE_BOOL:
+            row[name] = value != b"\0"
+        else:
+            row[name] = value.decode()
+    return row
+
+
+def decode_rows(data, scored):
+    """Decode a NEAREST or SEARCH reply (scored) or a GROUP one into a list of
+    rows, with the distance or score as "_score"."""
+    if not data:
+        return []
+    (count,) = struct.unpack_from("<I", data, 0)
+    pos = 4
+    if not scored:
+        pos += 4  # total
+    rows = []
+    for _ in range(count):
+        score = None
+        if scored:
+            (score,) = struct.unpack_from("<d", data, pos)
+            pos += 8
+        (row_len,) = struct.unpack_from("<I", data, pos)
+        pos += 4
+        row = decode_row(data[pos:pos + row_len])
+        pos += row_len
+        if scored:
+            row["_score"] = score
+        rows.append(row)
+    return rows
+
+
+def request_bytes(action, table_id=0, index_id=0, payload=b"", budget_us=None, priority=0):
+    """The bytes of one request, with a deadline header if a budget or a
+    priority is given."""
+    if budget_us is None and not priority:
+        return struct.pack(">BBBBI", HEADER_VERSION, action, table_id, index_id, len(payload)) + payload
+    head = struct.pack(">BBBBI", HEADER_VERSION_DEADLINE, action, table_id, index_id, len(payload))
+    return head + struct.pack("<IB3x", budget_us or 0, priority) + payload
+
+
+class Reply:
+    def __init__(self, status, data):
+        self.status = status  # 0 for a reply with a payload
+        self.data = data
+
+    def row(self):
+        return decode_row(self.data) if self.data else None
+
+    def json(self):
+        return json.loads(self.data)
+
+
+class Client:
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.settimeout(10)
+        self.sock.connect(path)
+        self.schema = None
+
+    def close(self):
+        self.sock.close()
+
+    def send(self, data):
+        self.sock.sendall(data)
+
+    def recv_exact(self, size):
+        buf = b""
+        while len(buf) < size:
+            chunk = self.sock.recv(size - len(buf))
+            if not chunk:
+                raise ConnectionError("server closed the connection")
+            buf += chunk
+        return buf
+
+    def reply(self):
+        (length,) = struct.unpack(">I", self.recv_exact(4))
+        if length & RESPONSE_STATUS:
+            return Reply(length & ~RESPONSE_STATUS, b"")
+        return Reply(0, self.recv_exact(length))
+
+    def request(self, action, table_id=0, index_id=0, payload=b"", **deadline):
+        self.send(request_bytes(action, table_id, index_id, payload, **deadline))
+        return self.reply()
+
+    def describe(self):
+        if self.schema is None:
+            self.schema = self.request(ACTION_DESCRIBE_SCHEMA).json()
+        return self.schema
+
+    def ids(self, table, index=None):
+        """Table id, and index id if index (a column) is given, from the schema."""
+        for entry in self.describe()["tables"]:
+            if entry["name"] != table:
+                continue
+            if index is None:
+                return entry["id"]
+            for idx in entry["indexes"]:
+                if idx["column"] == index:
+                    return entry["id"], idx["id"]
+        raise KeyError("%s %s not in schema" % (table, index))
+
+    def stats(self):
+        return self.request(ACTION_GET_STATISTICS).json()
+
+    def hello(self, name):
+        return self.request(ACTION_HELLO, payload=name.encode()).json()["id"]
+
+    def clients(self):
+        return self.request(ACTION_LIST_CLIENTS).json()
+
+    def fetch(self, table, index, key, **deadline):
+        table_id, index_id = self.ids(table, index)
+        if isinstance(key, int):
+            key = struct.pack("<I", key)
+        elif isinstance(key, str):
+            key = key.encode()
+        return self.request(ACTION_FETCH, table_id, index_id, key, **deadline)
+
+    def nearest(self, table, index, lat, lon, k=0, radius_km=0.0, **deadline):
+        table_id, index_id = self.ids(table, index)
+        payload = struct.pack("<ddId", lat, lon, k, radius_km)
+        return self.request(ACTION_NEAREST, table_id, index_id, payload, **deadline)
+
+    def search(self, table, index, query, substring=False, k=0, min_score=0.0, **deadline):
+        table_id, index_id = self.ids(table, index)
+        payload = struct.pack("<BId", 1 if substring else 0, k, min_score) + query.encode()
+        return self.request(ACTION_SEARCH, table_id, index_id, payload, **deadline)
+
+    def group(self, table, index, key, offset=0, limit=0, **deadline):
+        table_id, index_id = self.ids(table, index)
+        payload = struct.pack("<II", offset, limit) + str(key).encode()
+        return self.request(ACTION_GROUP, table_id, index_id, payload, **deadline)
+
+    def ingest(self, table, op, payload=b""):
+        """One INGEST request; op is the operation letter, e.g. "B"."""
+        return self.request(ACTION_INGEST, self.ids(table), 0, op.encode() + payload)
+
+    def export(self, table, wait=True):
+        table_id = self.ids(table)
+        for _ in range(100):
+            reply = self.request(ACTION_EXPORT, table_id)
+            if reply.status != STATUS_NOT_READY or not wait:
+                return reply
+            time.sleep(0.1)
+        return reply
+
+    def fetch_adhoc(self, table, column, key, wait=True):
+        payload = bytes([len(column)]) + column.encode() + str(key).encode()
+        table_id = self.ids(table)
+        for _ in range(100):
+            reply = self.request(ACTION_FETCH, table_id, INDEX_ADHOC, payload)
+            if reply.status != STATUS_NOT_READY or not wait:
+                return reply
+            time.sleep(0.1)
+        return reply
+
+
+class Server:
+    def __init__(self, workdir, env, name="melian"):
+        self.workdir = workdir
+        self.socket = os.path.join(workdir, name + ".sock")
+        self.log_path = os.path.join(workdir, name + ".log")
+        self.env = {k: v for k, v in os.environ.items() if not k.startswith("MELIAN_")}
+        self.env.update({
+            "MELIAN_DB_DRIVER": "sqlite",
+            "MELIAN_SQLITE_FILENAME": os.path.join(workdir, "melian.db"),
+            "MELIAN_SOCKET_PATH": self.socket,
+            "MELIAN_TABLE_TIER_DIR": workdir,
+        })
+        self.env.update(env)
+        self.process = None
+
+    def start(self, wait=True):
+        if os.path.exists(self.socket):
+            os.unlink(self.socket)
+        self.log = open(self.log_path, "ab")
+        self.process = subprocess.Popen([SERVER], env=self.env, stdout=self.log,
+                                        stderr=subprocess.STDOUT)
+        if wait:
+            self.wait()
+
+    def wait(self):
+        deadline = time.time() + 30
+        while not os.path.exists(self.socket):
+            if self.process.poll() is not None:
+                raise RuntimeError("melian-server exited:\n" + self.read_log())
+            if time.time() > deadline:
+                raise RuntimeError("melian-server did not start:\n" + self.read_log())
+            time.sleep(0.05)
+
+    def stop(self):
+        if self.process and self.process.poll() is None:
+            self.process.terminate()
+            try:
+                self.process.wait(10)
+            except subprocess.TimeoutExpired:
+                self.process.kill()
+                self.process.wait()
+        if self.process:
+            self.log.close()
+        self.process = None
+
+    def read_log(self):
+        with open(self.log_path, "rb") as f:
+            return f.read().decode(errors="replace")
+
+    def client(self):
+        return Client(self.socket)
+
+
+class MelianTestCase(unittest.TestCase):
+    """A test class running one server for all its tests. Subclasses set env,
+    the server's MELIAN_* variables, and may override make_database()."""
+
+    env = {}
+
+    @classmethod
+    def make_database(cls, path):
+        hosts_database(path).close()
+
+    @classmethod
+    def setUpClass(cls):
+        if not os.access(SERVER, os.X_OK):
+            raise unittest.SkipTest("no server binary at %s; build first or set MELIAN_SERVER" % SERVER)
+        cls.workdir = tempfile.mkdtemp(prefix="melian-test-")
+        cls.make_database(os.path.join(cls.workdir, "melian.db"))
+        cls.server = Server(cls.workdir, cls.env)
+        try:
+            cls.server.start()
+        except Exception:
+            shutil.rmtree(cls.workdir, ignore_errors=True)
+            raise
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.server.stop()
+        shutil.rmtree(cls.workdir, ignore_errors=True)
+
+    def setUp(self):
+        self.client = self.server.client()
+
+    def tearDown(self):
+        self.client.close()
+
+    def table_stats(self, table):
+        return self.client.stats()["tables"][table]
+
+    def wait_for(self, check, timeout=15, message="condition"):
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            value = check()
+            if value:
+                return value
+            time.sleep(0.1)
+        self.fail("timed out waiting for " + message)
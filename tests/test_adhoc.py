@@ -0,0 +1,49 @@
+import unittest
+
+from melian import MelianTestCase, STATUS_NO_ROOM
+
+
+class AdhocIndexTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int",
+    }
+
+    def test_string_column(self):
+        reply = self.client.fetch_adhoc("hosts", "hostname", "host-00042")
+        self.assertEqual(reply.status, 0)
+        self.assertEqual(reply.row()["id"], 42)
+
+    def test_int_column(self):
+        reply = self.client.fetch_adhoc("hosts", "id", 7)
+        self.assertEqual(reply.row()["hostname"], "host-00007")
+
+    def test_missing_key(self):
+        reply = self.client.fetch_adhoc("hosts", "hostname", "no-such-host")
+        self.assertEqual(reply.status, 0)
+        self.assertEqual(reply.data, b"")
+
+    def test_unknown_column_takes_no_entry(self):
+        for column in ("nonexistent_a", "nonexistent_b", "nonexistent_c", "nonexistent_d"):
+            reply = self.client.fetch_adhoc("hosts", column, "x", wait=False)
+            self.assertEqual((reply.status, reply.data), (0, b""))
+        adhoc = self.table_stats("hosts")["adhoc"]
+        self.assertFalse([column for column in adhoc if column.startswith("nonexistent")])
+        reply = self.client.fetch_adhoc("hosts", "site", "site-3")
+        self.assertEqual(reply.row()["site"], "site-3")
+
+
+class AdhocNoRoomTest(MelianTestCase):
+    env = AdhocIndexTest.env
+
+    def test_no_room(self):
+        for column in ("hostname", "ip", "status", "site"):
+            self.assertEqual(self.client.fetch_adhoc("hosts", column, "x").status, 0)
+        self.assertEqual(len(self.table_stats("hosts")["adhoc"]), 4)
+        reply = self.client.fetch_adhoc("hosts", "attrs", "{}", wait=False)
+        self.assertEqual(reply.status, STATUS_NO_ROOM)
+        # Columns that have an index are still served
+        self.assertEqual(self.client.fetch_adhoc("hosts", "ip", "10.0.0.5").row()["id"], 5)
+
+
+if __name__ == "__main__":
+    unittest.main()
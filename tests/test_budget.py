@@ -0,0 +1,69 @@
+import os
+import sqlite3
+import unittest
+
+from melian import MelianTestCase, hosts_database
+
+HOSTS = 20000
+
+
+def update_host(workdir, id, hostname):
+    db = sqlite3.connect(os.path.join(workdir, "melian.db"))
+    db.execute("UPDATE hosts SET hostname = ? WHERE id = ?", (hostname, id))
+    db.commit()
+    db.close()
+
+
+class ReloadBudgetTest(MelianTestCase):
+    # The hosts table holds a few megabytes, more than the whole budget
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|5|id#0:int;hostname#1:string",
+        "MELIAN_TABLE_RELOAD_BUDGET": "1",
+    }
+
+    @classmethod
+    def make_database(cls, path):
+        hosts_database(path, HOSTS).close()
+
+    def test_first_load_not_deferred(self):
+        stats = self.table_stats("hosts")
+        self.assertEqual(stats["rows"], HOSTS)
+        self.assertGreater(stats["memory_bytes"], 1 << 20)
+        self.assertEqual(self.client.fetch("hosts", "id", HOSTS).row()["hostname"], "host-%05d" % HOSTS)
+
+    def test_reload_deferred(self):
+        loaded = self.table_stats("hosts")["last_loaded"]["epoch"]
+        update_host(self.workdir, 3, "renamed-3")
+        deferrals = self.wait_for(lambda: self.table_stats("hosts")["deferrals"], timeout=15,
+                                  message="a deferral")
+        self.wait_for(lambda: self.table_stats("hosts")["deferrals"] > deferrals, timeout=15,
+                      message="another deferral")
+        self.assertIn("Deferring reload of table hosts", self.server.read_log())
+
+        # The old rows keep being served
+        stats = self.table_stats("hosts")
+        self.assertEqual(stats["last_loaded"]["epoch"], loaded)
+        self.assertEqual(stats["rows"], HOSTS)
+        self.assertEqual(self.client.fetch("hosts", "id", 3).row()["hostname"], "host-00003")
+        self.assertEqual(self.client.fetch("hosts", "hostname", "host-00003").row()["id"], 3)
+        self.assertEqual(self.client.fetch("hosts", "hostname", "renamed-3").data, b"")
+
+
+class RoomyReloadBudgetTest(MelianTestCase):
+    # Room for both copies: reloads go ahead
+    env = dict(ReloadBudgetTest.env, MELIAN_TABLE_RELOAD_BUDGET="64")
+
+    @classmethod
+    def make_database(cls, path):
+        hosts_database(path, HOSTS).close()
+
+    def test_reload(self):
+        update_host(self.workdir, 4, "renamed-4")
+        self.wait_for(lambda: self.client.fetch("hosts", "id", 4).row()["hostname"] == "renamed-4",
+                      timeout=15, message="the reload")
+        self.assertEqual(self.table_stats("hosts")["deferrals"], 0)
+        self.assertNotIn("Deferring reload", self.server.read_log())
+
+
+if __name__ == "__main__":
+    unittest.main()
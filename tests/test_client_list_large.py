@@ -0,0 +1,65 @@
+import resource
+import time
+import unittest
+
+from melian import MelianTestCase, ACTION_LIST_CLIENTS, request_bytes
+
+# Enough for the part of the list the socket does not take at once to be
+# larger than a connection's write buffer
+CONNECTIONS = 2500
+
+
+class LargeClientListTest(MelianTestCase):
+    """A client list longer than the socket takes at once stays queued on its
+    connection while other connections ask for theirs."""
+
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int",
+    }
+
+    @classmethod
+    def setUpClass(cls):
+        soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+        want = CONNECTIONS + 100
+        if soft < want:
+            if hard != resource.RLIM_INFINITY and hard < want:
+                raise unittest.SkipTest("needs %d file descriptors" % want)
+            # The server inherits the limit
+            resource.setrlimit(resource.RLIMIT_NOFILE, (want, hard))
+        super().setUpClass()
+
+    def test_reply_outlives_other_lists(self):
+        others = []
+        try:
+            for i in range(CONNECTIONS):
+                conn = self.server.client()
+                others.append(conn)
+                conn.hello("client-%04d-" % i + "x" * 40)
+            reader = self.server.client()
+            reader_id = reader.hello("reader")
+            expected = {reader_id, self.client.hello("writer")}
+            expected.update(entry["id"] for entry in self.client.clients())
+
+            # Queue a list far larger than the socket buffer and read none of it
+            reader.send(request_bytes(ACTION_LIST_CLIENTS))
+            time.sleep(0.2)
+            # Have another connection build lists of the same size but different
+            # names while the first one is still queued
+            for i, conn in enumerate(others):
+                conn.hello("client-%04d-" % i + "y" * 40)
+            for _ in range(5):
+                self.client.clients()
+
+            reply = reader.reply()
+            self.assertGreater(len(reply.data), 64 * 1024)
+            entries = reply.json()
+            self.assertEqual({entry["id"] for entry in entries}, expected)
+            self.assertFalse([entry["name"] for entry in entries if "y" in entry["name"]])
+            reader.close()
+        finally:
+            for conn in others:
+                conn.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,60 @@
+import unittest
+
+from melian import MelianTestCase
+
+
+class ClientListTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int;hostname#1:string",
+    }
+
+    def entry(self, conn_id):
+        for entry in self.client.clients():
+            if entry["id"] == conn_id:
+                return entry
+        self.fail("connection %d not in the client list" % conn_id)
+
+    def test_hello_names_connection(self):
+        conn_id = self.client.hello("worker-1")
+        entry = self.entry(conn_id)
+        self.assertEqual(entry["name"], "worker-1")
+        self.assertIn("age_seconds", entry)
+
+    def test_hello_replaces_unprintable_bytes(self):
+        conn_id = self.client.hello("a\x01b\nc")
+        self.assertEqual(self.entry(conn_id)["name"], "a?b?c")
+
+    def test_counters(self):
+        conn_id = self.client.hello("counter")
+        self.assertEqual(self.client.fetch("hosts", "id", 5).row()["id"], 5)
+        self.assertEqual(self.client.fetch("hosts", "hostname", "no-such-host").data, b"")
+        entry = self.entry(conn_id)
+        self.assertEqual(entry["misses"], 1)
+        # HELLO, DESCRIBE and two fetches, then the list itself
+        self.assertGreaterEqual(entry["requests"], 4)
+        self.assertGreater(entry["bytes_in"], 0)
+        self.assertGreater(entry["bytes_out"], 0)
+
+    def test_sorted_by_requests(self):
+        other = self.server.client()
+        try:
+            other_id = other.hello("busy")
+            for _ in range(20):
+                other.stats()
+            entries = self.client.clients()
+            self.assertEqual(entries[0]["id"], other_id)
+            requests = [entry["requests"] for entry in entries]
+            self.assertEqual(requests, sorted(requests, reverse=True))
+        finally:
+            other.close()
+
+    def test_closed_connection_leaves_list(self):
+        other = self.server.client()
+        other_id = other.hello("short-lived")
+        other.close()
+        self.wait_for(lambda: other_id not in [entry["id"] for entry in self.client.clients()],
+                      message="closed connection to leave the client list")
+
+
+if __name__ == "__main__":
+    unittest.main()
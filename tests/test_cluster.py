@@ -0,0 +1,137 @@
+import os
+import shutil
+import sqlite3
+import struct
+import tempfile
+import unittest
+
+from melian import (SERVER, STATUS_SPLIT, STATUS_UNAVAILABLE, ACTION_EXPORT, ACTION_GROUP,
+                    ACTION_NEAREST, ACTION_SEARCH, Server, decode_rows, hosts_database)
+
+TABLES = ("hosts#0|60|id#0:int;hostname#1:string;ip#2:trigram;status#3:group,"
+          "sites#1|60|site#0:string;city#1:trigram")
+
+
+def cluster_database(path):
+    db = hosts_database(path)
+    db.execute("CREATE TABLE sites (site TEXT PRIMARY KEY, city TEXT)")
+    db.executemany("INSERT INTO sites VALUES (?, ?)",
+                   [("site-%d" % i, city) for i, city in enumerate(
+                       ["Amsterdam", "Berlin", "Cairo", "Dublin", "Essen",
+                        "Florence", "Geneva", "Hamburg", "Istanbul", "Jakarta"])])
+    db.commit()
+    db.close()
+
+
+class ClusterTestCase(unittest.TestCase):
+    """Nodes running as separate melian-server processes on one host, sharing
+    one database. Subclasses list the nodes to start."""
+
+    nodes = ("node1", "node2")
+    started = nodes
+    placement = "hosts=node1,node2;sites=node2"
+
+    @classmethod
+    def setUpClass(cls):
+        if not os.access(SERVER, os.X_OK):
+            raise unittest.SkipTest("no server binary at %s; build first or set MELIAN_SERVER" % SERVER)
+        cls.workdir = tempfile.mkdtemp(prefix="melian-test-")
+        cluster_database(os.path.join(cls.workdir, "melian.db"))
+        sockets = ";".join("%s=%s" % (name, os.path.join(cls.workdir, name + ".sock")) for name in cls.nodes)
+        cls.servers = {}
+        try:
+            for name in cls.started:
+                server = Server(cls.workdir, {
+                    "MELIAN_TABLE_TABLES": TABLES,
+                    "MELIAN_TABLE_PLACEMENT": cls.placement,
+                    "MELIAN_CLUSTER_NODES": sockets,
+                    "MELIAN_CLUSTER_SELF": name,
+                }, name=name)
+                cls.servers[name] = server
+                server.start()
+        except Exception:
+            cls.tearDownClass()
+            raise
+
+    @classmethod
+    def tearDownClass(cls):
+        for server in cls.servers.values():
+            server.stop()
+        shutil.rmtree(cls.workdir, ignore_errors=True)
+
+    def setUp(self):
+        self.clients = {name: server.client() for name, server in self.servers.items()}
+
+    def tearDown(self):
+        for client in self.clients.values():
+            client.close()
+
+
+class ClusterTest(ClusterTestCase):
+    def test_split_table_loads_a_part_on_each_node(self):
+        counts = []
+        for name in self.nodes:
+            stats = self.clients[name].stats()["tables"]["hosts"]
+            self.assertEqual(stats["placement"]["parts"], 2)
+            counts.append(stats["rows"])
+        self.assertEqual(sum(counts), 1000)
+        self.assertTrue(all(counts))
+
+    def test_fetch_by_first_index_from_any_node(self):
+        for name in self.nodes:
+            client = self.clients[name]
+            conn_id = client.hello("fetcher")
+            for key in range(1, 51):
+                self.assertEqual(client.fetch("hosts", "id", key).row()["id"], key)
+            entry = [entry for entry in client.clients() if entry["id"] == conn_id][0]
+            self.assertGreater(entry["forwarded"], 0)
+            self.assertLess(entry["forwarded"], 50)
+
+    def test_fetch_by_other_index_tries_every_part(self):
+        client = self.clients["node1"]
+        for key in range(1, 21):
+            self.assertEqual(client.fetch("hosts", "hostname", "host-%05d" % key).row()["id"], key)
+        self.assertEqual(client.fetch("hosts", "hostname", "no-such-host").data, b"")
+
+    def test_table_held_elsewhere(self):
+        client = self.clients["node1"]
+        self.assertEqual(client.fetch("sites", "site", "site-3").row()["city"], "Dublin")
+        self.assertTrue(client.stats()["tables"]["sites"]["placement"]["remote"])
+        rows = decode_rows(client.search("sites", "city", "burg", substring=True).data, scored=True)
+        self.assertEqual([row["city"] for row in rows], ["Hamburg"])
+        node2 = client.stats()["cluster"]["nodes"][0]
+        self.assertEqual(node2["name"], "node2")
+        self.assertTrue(node2["connected"])
+        self.assertGreater(node2["forwarded"], 0)
+
+    def test_split_table_cannot_rank_or_export(self):
+        for name in self.nodes:
+            client = self.clients[name]
+            table_id, ip = client.ids("hosts", "ip")
+            _, status = client.ids("hosts", "status")
+            requests = [
+                (ACTION_NEAREST, ip, struct.pack("<ddId", 0.0, 0.0, 0, 0.0)),
+                (ACTION_SEARCH, ip, struct.pack("<BId", 1, 0, 0.0) + b"10.0"),
+                (ACTION_GROUP, status, struct.pack("<II", 0, 0) + b"active"),
+                (ACTION_EXPORT, 0, b""),
+            ]
+            for action, index_id, payload in requests:
+                reply = client.request(action, table_id, index_id, payload)
+                self.assertEqual(reply.status, STATUS_SPLIT, "%s on %s" % (chr(action), name))
+
+
+class ClusterNodeDownTest(ClusterTestCase):
+    started = ("node1",)
+
+    def test_rows_on_missing_node_are_unavailable(self):
+        client = self.clients["node1"]
+        statuses = {client.fetch("hosts", "id", key).status for key in range(1, 21)}
+        self.assertEqual(statuses, {0, STATUS_UNAVAILABLE})
+        self.assertEqual(client.fetch("sites", "site", "site-3").status, STATUS_UNAVAILABLE)
+        node2 = client.stats()["cluster"]["nodes"][0]
+        self.assertFalse(node2["connected"])
+        self.assertGreater(node2["failures"], 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,62 @@
+import os
+import shutil
+import tempfile
+import unittest
+
+from melian import MelianTestCase, SERVER, Server, hosts_database
+
+
+class ComputedColumnTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int;host_uc#1:string;site#2:string;rack#3:int",
+        "MELIAN_TABLE_COMPUTED": "hosts=host_uc=upper(trim(hostname)), "
+                                 "site=concat(status, '/', substring(ip, 1, 4)), "
+                                 "rack=cast(substring(hostname, 6), int), "
+                                 "missing=concat(hostname, nosuchcolumn)",
+    }
+
+    def test_columns_stored_with_row(self):
+        row = self.client.fetch("hosts", "id", 7).row()
+        self.assertEqual(row["host_uc"], "HOST-00007")
+        self.assertEqual(row["rack"], 7)
+        self.assertEqual(row["hostname"], "host-00007")
+
+    def test_replaces_loaded_column(self):
+        row = self.client.fetch("hosts", "id", 4).row()
+        self.assertEqual(row["site"], "inactive/10.0")
+
+    def test_null_argument(self):
+        self.assertIsNone(self.client.fetch("hosts", "id", 4).row()["missing"])
+
+    def test_index_on_computed_column(self):
+        reply = self.client.fetch("hosts", "site", "maintenance/10.0")
+        self.assertEqual(reply.row()["status"], "maintenance")
+
+    def test_keys_are_normalized(self):
+        for key in ("HOST-00007", " host-00007 ", "Host-00007"):
+            self.assertEqual(self.client.fetch("hosts", "host_uc", key).row()["id"], 7, key)
+
+    def test_schema_lists_computed(self):
+        schema = self.client.describe()
+        self.assertEqual(schema["tables"][0]["computed"]["host_uc"], "upper(trim(hostname))")
+
+
+class ComputedColumnErrorTest(unittest.TestCase):
+    def test_invalid_expression_is_rejected(self):
+        if not os.access(SERVER, os.X_OK):
+            self.skipTest("no server binary at %s" % SERVER)
+        workdir = tempfile.mkdtemp(prefix="melian-test-")
+        self.addCleanup(shutil.rmtree, workdir, True)
+        hosts_database(os.path.join(workdir, "melian.db")).close()
+        server = Server(workdir, {
+            "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int",
+            "MELIAN_TABLE_COMPUTED": "hosts=bad=upper(",
+        })
+        with self.assertRaises(RuntimeError):
+            server.start()
+        server.stop()
+        self.assertIn("Invalid expression [upper(]", server.read_log())
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,66 @@
+import sqlite3
+import struct
+import time
+import unittest
+
+from melian import (MelianTestCase, ACTION_FETCH, STATUS_EXPIRED, hosts_database, request_bytes)
+
+BLOB_SIZE = 1 << 20
+
+
+class DeadlineTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int,blobs#1|60|id#0:int",
+    }
+
+    @classmethod
+    def make_database(cls, path):
+        hosts_database(path).close()
+        db = sqlite3.connect(path)
+        db.execute("CREATE TABLE blobs (id INTEGER PRIMARY KEY, data TEXT)")
+        db.execute("INSERT INTO blobs VALUES (1, ?)", ("x" * BLOB_SIZE,))
+        db.commit()
+        db.close()
+
+    def fetch_bytes(self, table, key, **deadline):
+        table_id, index_id = self.client.ids(table, "id")
+        return request_bytes(ACTION_FETCH, table_id, index_id, struct.pack("<I", key), **deadline)
+
+    def test_within_budget(self):
+        reply = self.client.fetch("hosts", "id", 3, budget_us=1000000, priority=200)
+        self.assertEqual(reply.row()["id"], 3)
+
+    def test_no_budget(self):
+        self.assertEqual(self.client.fetch("hosts", "id", 3, budget_us=0).row()["id"], 3)
+
+    def test_expired_behind_slow_reply(self):
+        conn_id = self.client.hello("slow-reader")
+        # The blob does not fit in the socket, so the fetch behind it waits
+        # until this client reads, long after its 50 ms
+        self.client.send(self.fetch_bytes("blobs", 1) +
+                         self.fetch_bytes("hosts", 4, budget_us=50000) +
+                         self.fetch_bytes("hosts", 5, budget_us=60000000))
+        time.sleep(0.3)
+        self.assertGreater(len(self.client.reply().data), BLOB_SIZE)
+        self.assertEqual(self.client.reply().status, STATUS_EXPIRED)
+        self.assertEqual(self.client.reply().row()["id"], 5)
+        entry = [entry for entry in self.client.clients() if entry["id"] == conn_id][0]
+        self.assertEqual(entry["expired"], 1)
+        self.assertGreaterEqual(self.client.stats()["load"]["expired"], 1)
+
+    def test_pipelined_requests_split_across_reads(self):
+        # Six requests with a 20 ms budget, sent in chunks 50 ms apart that
+        # end mid-request: each counts from the read that completes it
+        data = b"".join(self.fetch_bytes("hosts", key, budget_us=20000) for key in range(1, 7))
+        size = len(data) // 6
+        cuts = [0] + [size * i + 5 for i in range(1, 6)] + [len(data)]
+        for start, end in zip(cuts, cuts[1:]):
+            self.client.send(data[start:end])
+            time.sleep(0.05)
+        replies = [self.client.reply() for _ in range(6)]
+        self.assertEqual([reply.status for reply in replies], [0] * 6)
+        self.assertEqual([reply.row()["id"] for reply in replies], list(range(1, 7)))
+
+
+if __name__ == "__main__":
+    unittest.main()
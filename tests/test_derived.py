@@ -0,0 +1,100 @@
+import os
+import shutil
+import tempfile
+import unittest
+
+from melian import MelianTestCase, SERVER, Server, hosts_database
+
+
+class DerivedTableTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": ",".join([
+            "hosts#0|60|id#0:int",
+            "sites#1|60|site#0:string",
+            "joined#2|60|id#0:int",
+            "by_status#3|60|status#0:string",
+        ]),
+        "MELIAN_TABLE_DERIVED": "joined=join hosts.site sites.site;"
+                                "by_status=group hosts.status count sum(id) max(id)",
+    }
+
+    @classmethod
+    def make_database(cls, path):
+        db = hosts_database(path, 30)
+        db.execute("CREATE TABLE sites (site TEXT, region TEXT)")
+        # site-9 has no row, so its hosts are left out of the join
+        db.executemany("INSERT INTO sites VALUES (?, ?)",
+                       [("site-%d" % i, "region-%d" % (i % 2)) for i in range(9)])
+        db.commit()
+        db.close()
+
+    def test_join(self):
+        row = self.client.fetch("joined", "id", 12).row()
+        self.assertEqual((row["hostname"], row["site"], row["region"]), ("host-00012", "site-2", "region-0"))
+
+    def test_join_without_match(self):
+        self.assertEqual(self.client.fetch("joined", "id", 19).data, b"")
+        self.assertEqual(self.table_stats("joined")["rows"], 27)
+
+    def test_group(self):
+        row = self.client.fetch("by_status", "status", "active").row()
+        ids = [i for i in range(1, 31) if i % 3 == 0]
+        self.assertEqual((row["count"], row["sum_id"], row["max_id"]), (len(ids), sum(ids), max(ids)))
+        self.assertEqual(self.client.fetch("by_status", "status", "retired").data, b"")
+
+
+class ViewTableTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": ",".join([
+            "hosts#0|60|id#0:int",
+            "up#1|60|hostname#0:string",
+            "down#2|60|id#0:int;status#1:string",
+        ]),
+        "MELIAN_TABLE_DERIVED": "up=view hosts id hostname where status=active;"
+                                "down=view hosts where status!=active",
+    }
+
+    @classmethod
+    def make_database(cls, path):
+        hosts_database(path, 30).close()
+
+    def test_view_keeps_listed_columns(self):
+        row = self.client.fetch("up", "hostname", "host-00009").row()
+        self.assertEqual(row, {"id": 9, "hostname": "host-00009"})
+        self.assertEqual(self.table_stats("up")["rows"], 10)
+
+    def test_view_filter(self):
+        self.assertEqual(self.client.fetch("up", "hostname", "host-00010").data, b"")
+
+    def test_negated_view_keeps_every_column(self):
+        row = self.client.fetch("down", "id", 10).row()
+        self.assertEqual((row["status"], row["site"]), ("inactive", "site-0"))
+        self.assertEqual(self.client.fetch("down", "id", 9).data, b"")
+        self.assertEqual(self.table_stats("down")["rows"], 20)
+
+    def test_views_share_the_source_query(self):
+        # hosts is the only table read from the database
+        log = self.server.read_log()
+        self.assertEqual(log.count("rows from table"), 1)
+        self.assertIn("rows from table hosts", log)
+
+
+class InvalidViewTest(unittest.TestCase):
+    def test_unknown_source_is_rejected(self):
+        if not os.access(SERVER, os.X_OK):
+            self.skipTest("no server binary at %s" % SERVER)
+        workdir = tempfile.mkdtemp(prefix="melian-test-")
+        self.addCleanup(shutil.rmtree, workdir, True)
+        hosts_database(os.path.join(workdir, "melian.db")).close()
+        server = Server(workdir, {
+            "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int,v#1|60|id#0:int",
+            "MELIAN_TABLE_DERIVED": "v=view nosuch id",
+        })
+        with self.assertRaises(RuntimeError):
+            server.start()
+        server.stop()
+        self.assertIn("Invalid view definition [view nosuch id]", server.read_log())
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,108 @@
+import sqlite3
+import struct
+import unittest
+
+from melian import MelianTestCase, ACTION_EXPORT, STATUS_NOT_READY, hosts_database
+
+try:
+    import pyarrow.ipc
+except ImportError:
+    pyarrow = None
+
+CONTINUATION = b"\xff\xff\xff\xff"
+
+
+def body_length(meta):
+    """bodyLength of an Arrow Message flatbuffer: field 3 of the root table."""
+    (table,) = struct.unpack_from("<I", meta, 0)
+    (vtable_back,) = struct.unpack_from("<i", meta, table)
+    vtable = table - vtable_back
+    (vtable_len,) = struct.unpack_from("<H", meta, vtable)
+    if vtable_len <= 10:
+        return 0
+    (field,) = struct.unpack_from("<H", meta, vtable + 10)
+    return struct.unpack_from("<q", meta, table + field)[0] if field else 0
+
+
+def stream_messages(data):
+    """Split an Arrow IPC stream into the metadata of its messages, checking
+    only the framing, for when pyarrow is not installed."""
+    messages = []
+    pos = 0
+    while True:
+        if data[pos:pos + 4] != CONTINUATION:
+            raise ValueError("no continuation marker at %d" % pos)
+        (meta_len,) = struct.unpack_from("<i", data, pos + 4)
+        pos += 8
+        if meta_len == 0:
+            break
+        meta = data[pos:pos + meta_len]
+        messages.append(meta)
+        pos += meta_len + body_length(meta)
+    if pos != len(data):
+        raise ValueError("%d bytes after the end-of-stream marker" % (len(data) - pos))
+    return messages
+
+
+class ExportTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int,mixed#1|60|id#0:int",
+    }
+
+    @classmethod
+    def make_database(cls, path):
+        hosts_database(path).close()
+        db = sqlite3.connect(path)
+        db.execute("CREATE TABLE mixed (id INTEGER PRIMARY KEY, number, note TEXT, raw BLOB)")
+        db.executemany("INSERT INTO mixed VALUES (?, ?, ?, ?)", [
+            (1, 1, "one", b"\xff\xfe"),
+            (2, 2.5, None, b"ok"),
+            (3, None, "three", None),
+        ])
+        db.commit()
+        db.close()
+
+    def test_first_export_is_not_ready(self):
+        reply = self.client.export("mixed", wait=False)
+        self.assertIn(reply.status, (0, STATUS_NOT_READY))
+        self.assertEqual(self.client.export("mixed").status, 0)
+
+    def test_stream_framing(self):
+        data = self.client.export("hosts").data
+        self.assertTrue(data.startswith(CONTINUATION))
+        self.assertTrue(data.endswith(CONTINUATION + b"\0\0\0\0"))
+        messages = stream_messages(data)
+        # The schema, then one record batch
+        self.assertEqual(len(messages), 2)
+        schema = messages[0]
+        for column in (b"id", b"hostname", b"ip", b"status", b"site", b"attrs"):
+            self.assertIn(column, schema)
+
+    def test_unknown_table(self):
+        reply = self.client.request(ACTION_EXPORT, 200)
+        self.assertEqual((reply.status, reply.data), (0, b""))
+
+    @unittest.skipIf(pyarrow is None, "pyarrow is not installed")
+    def test_read_with_pyarrow(self):
+        table = pyarrow.ipc.open_stream(self.client.export("hosts").data).read_all()
+        self.assertEqual(table.num_rows, 1000)
+        self.assertEqual(table.schema.field("id").type, pyarrow.int64())
+        self.assertEqual(table.schema.field("hostname").type, pyarrow.utf8())
+        ids = table.column("id").to_pylist()
+        self.assertEqual(sorted(ids), list(range(1, 1001)))
+        row = ids.index(42)
+        self.assertEqual(table.column("hostname")[row].as_py(), "host-00042")
+
+    @unittest.skipIf(pyarrow is None, "pyarrow is not installed")
+    def test_column_types(self):
+        table = pyarrow.ipc.open_stream(self.client.export("mixed").data).read_all()
+        self.assertEqual(table.schema.field("number").type, pyarrow.float64())
+        self.assertEqual(table.schema.field("raw").type, pyarrow.binary())
+        rows = sorted(table.to_pylist(), key=lambda row: row["id"])
+        self.assertEqual([row["number"] for row in rows], [1.0, 2.5, None])
+        self.assertEqual([row["note"] for row in rows], ["one", None, "three"])
+        self.assertEqual(rows[0]["raw"], b"\xff\xfe")
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,48 @@
+import unittest
+
+from melian import MelianTestCase, hosts_database
+
+
+class FilteredIndexTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int;hostname#1:string?status=active;"
+                               "ip#2:string?status!=inactive;site#3:string?status",
+    }
+
+    @classmethod
+    def make_database(cls, path):
+        db = hosts_database(path)
+        db.execute("INSERT INTO hosts (id, hostname, ip) VALUES (1001, 'host-01001', '10.0.3.233')")
+        db.commit()
+        db.close()
+
+    def test_matching_row(self):
+        # 3 % 3 == 0: active
+        self.assertEqual(self.client.fetch("hosts", "hostname", "host-00003").row()["id"], 3)
+
+    def test_excluded_row(self):
+        # 4 % 3 == 1: inactive, still found through the unfiltered index
+        self.assertEqual(self.client.fetch("hosts", "hostname", "host-00004").data, b"")
+        self.assertEqual(self.client.fetch("hosts", "id", 4).row()["hostname"], "host-00004")
+
+    def test_negated_filter(self):
+        self.assertEqual(self.client.fetch("hosts", "ip", "10.0.0.5").row()["id"], 5)
+        self.assertEqual(self.client.fetch("hosts", "ip", "10.0.0.4").data, b"")
+
+    def test_negated_filter_keeps_null(self):
+        self.assertEqual(self.client.fetch("hosts", "ip", "10.0.3.233").row()["id"], 1001)
+        self.assertEqual(self.client.fetch("hosts", "hostname", "host-01001").data, b"")
+
+    def test_schema_lists_filter(self):
+        indexes = {index["column"]: index for index in self.client.describe()["tables"][0]["indexes"]}
+        self.assertEqual(indexes["hostname"]["where"], "status=active")
+        self.assertEqual(indexes["ip"]["where"], "status!=inactive")
+
+    def test_invalid_filter_drops_index(self):
+        columns = [index["column"] for index in self.client.describe()["tables"][0]["indexes"]]
+        self.assertNotIn("site", columns)
+        self.assertIn("Invalid filter for index site", self.server.read_log())
+
+
+if __name__ == "__main__":
+    unittest.main()
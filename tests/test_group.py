@@ -0,0 +1,59 @@
+import struct
+import unittest
+
+from melian import MelianTestCase, decode_rows, hosts_database
+
+
+class GroupIndexTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int;status#1:group@-id;site#2:group@ip;"
+                               "attrs#3:group;hostname#4:string",
+    }
+
+    @classmethod
+    def make_database(cls, path):
+        db = hosts_database(path, 30)
+        db.execute("INSERT INTO hosts (id, hostname, site) VALUES (31, 'host-00031', 'site-1')")
+        db.commit()
+        db.close()
+
+    def group(self, *args, **kwargs):
+        reply = self.client.group("hosts", *args, **kwargs)
+        self.assertEqual(reply.status, 0)
+        return reply
+
+    def test_rows_of_a_key_sorted_descending(self):
+        reply = self.group("status", "active")
+        (count, total) = struct.unpack_from("<II", reply.data)
+        self.assertEqual((count, total), (10, 10))
+        self.assertEqual([row["id"] for row in decode_rows(reply.data, scored=False)],
+                         list(range(30, 0, -3)))
+
+    def test_page(self):
+        reply = self.group("status", "inactive", offset=2, limit=3)
+        self.assertEqual(struct.unpack_from("<II", reply.data), (3, 10))
+        self.assertEqual([row["id"] for row in decode_rows(reply.data, scored=False)], [22, 19, 16])
+
+    def test_page_past_the_end(self):
+        reply = self.group("status", "inactive", offset=8, limit=5)
+        self.assertEqual([row["id"] for row in decode_rows(reply.data, scored=False)], [4, 1])
+
+    def test_text_order_with_missing_values_last(self):
+        rows = decode_rows(self.group("site", "site-1").data, scored=False)
+        # ip 10.0.0.1, 10.0.0.11, 10.0.0.21, then the row without an ip
+        self.assertEqual([row["id"] for row in rows], [1, 11, 21, 31])
+
+    def test_load_order(self):
+        rows = decode_rows(self.group("attrs", '{"sku": "SKU0007", "rack": 0}').data, scored=False)
+        self.assertEqual([row["id"] for row in rows], [7])
+
+    def test_key_without_rows(self):
+        self.assertEqual(self.client.group("hosts", "status", "retired").data, b"")
+
+    def test_not_a_group_index(self):
+        reply = self.client.group("hosts", "hostname", "host-00001")
+        self.assertEqual((reply.status, reply.data), (0, b""))
+
+
+if __name__ == "__main__":
+    unittest.main()
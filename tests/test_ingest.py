@@ -0,0 +1,117 @@
+import struct
+import time
+import unittest
+
+from melian import MelianTestCase, STATUS_DENIED, STATUS_NOT_READY, encode_row
+
+SECRET = b"s3cret"
+
+
+def rows_payload(rows):
+    out = b""
+    for row in rows:
+        data = encode_row(row)
+        out += struct.pack("<I", len(data)) + data
+    return out
+
+
+def keys_payload(keys):
+    out = b""
+    for key in keys:
+        key = str(key).encode()
+        out += struct.pack("<I", len(key)) + key
+    return out
+
+
+class IngestTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int,feed#5|60|id#0:int;name#1:string",
+        "MELIAN_TABLE_PUSH": "feed=s3cret",
+    }
+
+    def begin(self, client=None, delta=False, secret=SECRET):
+        client = client or self.client
+        return client.ingest("feed", "B", bytes([1 if delta else 0]) + secret)
+
+    def commit(self, client=None):
+        client = client or self.client
+        # The previous batch may still be applied; retry as the README says
+        for _ in range(100):
+            reply = client.ingest("feed", "C")
+            if reply.status != STATUS_NOT_READY:
+                return reply
+            time.sleep(0.1)
+        return reply
+
+    def wait_batches(self, count):
+        self.wait_for(lambda: self.table_stats("feed")["push"]["batches"] >= count,
+                      message="%d batches to be applied" % count)
+
+    def snapshot(self, rows):
+        batches = self.table_stats("feed")["push"]["batches"]
+        self.assertEqual(self.begin().json(), {"rows": 0, "keys": 0})
+        self.assertEqual(self.client.ingest("feed", "R", rows_payload(rows)).json()["rows"], len(rows))
+        self.assertEqual(self.commit().json(), {"rows": len(rows), "keys": 0})
+        self.wait_batches(batches + 1)
+
+    def test_snapshot_then_delta(self):
+        self.snapshot([{"id": i, "name": "item-%d" % i} for i in range(1, 11)])
+        self.assertEqual(self.client.fetch("feed", "name", "item-3").row()["id"], 3)
+
+        batches = self.table_stats("feed")["push"]["batches"]
+        self.assertEqual(self.begin(delta=True).status, 0)
+        self.client.ingest("feed", "R", rows_payload([{"id": 2, "name": "beta"}]))
+        self.assertEqual(self.client.ingest("feed", "X", keys_payload([3])).json(), {"rows": 1, "keys": 1})
+        self.assertEqual(self.commit().json(), {"rows": 1, "keys": 1})
+        self.wait_batches(batches + 1)
+
+        self.assertEqual(self.client.fetch("feed", "id", 2).row()["name"], "beta")
+        self.assertEqual(self.client.fetch("feed", "id", 3).data, b"")
+        self.assertEqual(self.client.fetch("feed", "id", 4).row()["name"], "item-4")
+        self.assertEqual(self.table_stats("feed")["push"]["keys"], 1)
+
+    def test_wrong_secret(self):
+        self.assertEqual(self.begin(secret=b"guess").status, STATUS_DENIED)
+        # Nothing was opened, so rows have no batch to go to
+        self.assertEqual(self.client.ingest("feed", "R", rows_payload([{"id": 1}])).data, b"")
+
+    def test_batch_held_by_another_connection(self):
+        other = self.server.client()
+        try:
+            self.assertEqual(self.begin(other).status, 0)
+            self.assertEqual(self.begin().status, STATUS_NOT_READY)
+        finally:
+            other.close()
+        # Closing the connection dropped its batch
+        self.wait_for(lambda: self.begin().status == 0, message="the batch to be dropped")
+        self.assertEqual(self.client.ingest("feed", "A").json(), {"rows": 0, "keys": 0})
+
+    def test_abort(self):
+        self.snapshot([{"id": 1, "name": "kept"}])
+        self.begin()
+        self.client.ingest("feed", "R", rows_payload([{"id": 1, "name": "dropped"}]))
+        self.client.ingest("feed", "A")
+        self.assertEqual(self.client.ingest("feed", "C").data, b"")
+        self.assertEqual(self.client.fetch("feed", "id", 1).row()["name"], "kept")
+
+    def test_malformed_rows(self):
+        self.begin()
+        self.assertEqual(self.client.ingest("feed", "R", b"\x10\0\0\0abc").data, b"")
+        self.client.ingest("feed", "A")
+
+    def test_malformed_keys(self):
+        self.begin(delta=True)
+        # Two whole keys, then one that claims more bytes than follow
+        payload = keys_payload([1, 2]) + b"\x10\0\0\0abc"
+        self.assertEqual(self.client.ingest("feed", "X", payload).data, b"")
+        # None of them went into the batch
+        self.assertEqual(self.client.ingest("feed", "X", b"").json(), {"rows": 0, "keys": 0})
+        self.client.ingest("feed", "A")
+
+    def test_not_a_push_table(self):
+        reply = self.client.ingest("hosts", "B", b"\0" + SECRET)
+        self.assertEqual((reply.status, reply.data), (0, b""))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,45 @@
+import json
+import unittest
+
+from melian import MelianTestCase, hosts_database
+
+
+class JsonPathIndexTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int;attrs$.sku#1:string;attrs$.rack#2:int",
+    }
+
+    @classmethod
+    def make_database(cls, path):
+        db = hosts_database(path, 100)
+        extra = [
+            (1001, {"sku": "A\"B\u00e9"}),
+            (1002, {"sku": None}),
+            (1003, {"sku": {"nested": 1}}),
+            (1004, {"other": 1}),
+        ]
+        db.executemany("INSERT INTO hosts (id, hostname, attrs) VALUES (?, ?, ?)",
+                       [(i, "extra-%d" % i, json.dumps(attrs)) for i, attrs in extra])
+        db.execute("INSERT INTO hosts (id, hostname, attrs) VALUES (1005, 'broken', '{not json')")
+        db.commit()
+        db.close()
+
+    def test_string_member(self):
+        self.assertEqual(self.client.fetch("hosts", "attrs$.sku", "SKU0042").row()["id"], 42)
+
+    def test_escaped_string(self):
+        self.assertEqual(self.client.fetch("hosts", "attrs$.sku", "A\"Bé").row()["id"], 1001)
+
+    def test_int_member(self):
+        row = self.client.fetch("hosts", "attrs$.rack", 3).row()
+        self.assertEqual(json.loads(row["attrs"])["rack"], 3)
+
+    def test_unindexed_rows(self):
+        # null, objects, missing members and broken JSON are left out
+        used = self.table_stats("hosts")["hashes"]["attrs$.sku"]["used_slots"]
+        self.assertEqual(used, 101)
+        self.assertEqual(self.client.fetch("hosts", "attrs$.sku", "SKU9999").data, b"")
+
+
+if __name__ == "__main__":
+    unittest.main()
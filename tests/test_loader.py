@@ -0,0 +1,65 @@
+import os
+import signal
+import sqlite3
+import unittest
+
+from melian import MelianTestCase
+
+
+class LoaderProcessTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|5|id#0:int;hostname#1:string",
+        "MELIAN_SERVER_LOADER_PROCESS": "true",
+    }
+
+    def loader(self):
+        return self.client.stats()["loader"]
+
+    def update_host(self, id, hostname):
+        db = sqlite3.connect(os.path.join(self.workdir, "melian.db"))
+        db.execute("UPDATE hosts SET hostname = ? WHERE id = ?", (hostname, id))
+        db.commit()
+        db.close()
+
+    def wait_hostname(self, id, hostname):
+        self.wait_for(lambda: self.client.fetch("hosts", "id", id).row()["hostname"] == hostname,
+                      timeout=30, message="host %d to be renamed %s" % (id, hostname))
+
+    def test_load(self):
+        loader = self.loader()
+        self.assertGreater(loader["pid"], 0)
+        self.assertNotEqual(loader["pid"], self.server.process.pid)
+        self.assertGreaterEqual(loader["loads"], 1)
+        self.assertEqual(loader["failures"], 0)
+        self.assertEqual(self.table_stats("hosts")["rows"], 1000)
+        self.assertEqual(self.client.fetch("hosts", "hostname", "host-00042").row()["id"], 42)
+        self.assertIn("Mapped 1000 rows for table hosts", self.server.read_log())
+
+    def test_reload(self):
+        loads = self.loader()["loads"]
+        self.update_host(5, "renamed-5")
+        self.wait_hostname(5, "renamed-5")
+        self.assertEqual(self.client.fetch("hosts", "hostname", "renamed-5").row()["id"], 5)
+        self.assertGreater(self.loader()["loads"], loads)
+
+    def test_restart_after_kill(self):
+        loader = self.loader()
+        os.kill(loader["pid"], signal.SIGKILL)
+        # The next load finds the child gone and starts another one
+        self.wait_for(lambda: self.loader()["restarts"] > loader["restarts"], timeout=30,
+                      message="the loader to restart")
+        self.assertIn("Loader process %d died with signal %d" % (loader["pid"], signal.SIGKILL),
+                      self.server.read_log())
+        restarted = self.loader()
+        self.assertNotEqual(restarted["pid"], loader["pid"])
+        self.assertGreater(restarted["pid"], 0)
+
+        # The old rows were served meanwhile, and the new child loads again
+        self.assertEqual(self.client.fetch("hosts", "id", 6).row()["hostname"], "host-00006")
+        self.update_host(6, "renamed-6")
+        self.wait_hostname(6, "renamed-6")
+        self.assertGreater(self.loader()["loads"], loader["loads"])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,68 @@
+import sqlite3
+import unittest
+
+from melian import MelianTestCase, ACTION_NEAREST, decode_rows
+
+CITIES = [
+    (1, "Amsterdam", 52.3676, 4.9041),
+    (2, "Rotterdam", 51.9244, 4.4777),
+    (3, "Utrecht", 52.0907, 5.1214),
+    (4, "Brussels", 50.8503, 4.3517),
+    (5, "Paris", 48.8566, 2.3522),
+    (6, "Berlin", 52.5200, 13.4050),
+    (7, "Nowhere", None, 4.9),
+]
+
+
+class NearestTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "cities#0|60|id#0:int;lat/lon#1:geo;name#2:string",
+    }
+
+    @classmethod
+    def make_database(cls, path):
+        db = sqlite3.connect(path)
+        db.execute("CREATE TABLE cities (id INTEGER PRIMARY KEY, name TEXT, lat REAL, lon REAL)")
+        db.executemany("INSERT INTO cities VALUES (?, ?, ?, ?)",
+                       [(i, name, lat, lon) for i, name, lat, lon in CITIES])
+        db.commit()
+        db.close()
+
+    def nearest(self, *args, **kwargs):
+        reply = self.client.nearest("cities", "lat/lon", *args, **kwargs)
+        self.assertEqual(reply.status, 0)
+        return decode_rows(reply.data, scored=True)
+
+    def test_nearest_first(self):
+        rows = self.nearest(52.37, 4.89, k=3)
+        self.assertEqual([row["name"] for row in rows], ["Amsterdam", "Utrecht", "Rotterdam"])
+        self.assertLess(rows[0]["_score"], 2)
+        self.assertAlmostEqual(rows[1]["_score"], 36, delta=3)
+
+    def test_radius(self):
+        rows = self.nearest(52.37, 4.89, radius_km=100)
+        self.assertEqual({row["name"] for row in rows}, {"Amsterdam", "Utrecht", "Rotterdam"})
+
+    def test_all_rows_with_a_point(self):
+        rows = self.nearest(52.37, 4.89)
+        self.assertEqual(len(rows), 6)
+        scores = [row["_score"] for row in rows]
+        self.assertEqual(scores, sorted(scores))
+        self.assertEqual(rows[-1]["name"], "Berlin")
+
+    def test_nothing_in_radius(self):
+        reply = self.client.nearest("cities", "lat/lon", 0.0, 0.0, radius_km=10)
+        self.assertEqual(reply.data, b"\0\0\0\0")
+
+    def test_not_a_geo_index(self):
+        reply = self.client.nearest("cities", "name", 52.37, 4.89)
+        self.assertEqual((reply.status, reply.data), (0, b""))
+
+    def test_short_payload(self):
+        table_id, index_id = self.client.ids("cities", "lat/lon")
+        reply = self.client.request(ACTION_NEAREST, table_id, index_id, b"\0" * 20)
+        self.assertEqual((reply.status, reply.data), (0, b""))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,44 @@
+import os
+import sqlite3
+import unittest
+
+from melian import MelianTestCase
+
+
+class AdaptiveRefreshTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|5-40|id#0:int;hostname#1:string",
+    }
+
+    def wait_period(self, period, timeout):
+        def check():
+            stats = self.table_stats("hosts")
+            return stats if stats["period"] == period else None
+        return self.wait_for(check, timeout=timeout, message="a period of %d seconds" % period)
+
+    def test_period_follows_changes(self):
+        stats = self.table_stats("hosts")
+        self.assertEqual(stats["period"], 5)
+        self.assertEqual((stats["refresh"]["min_period"], stats["refresh"]["max_period"]), (5, 40))
+
+        # A reload that brings the same rows doubles the period
+        stats = self.wait_period(10, timeout=20)
+        self.assertEqual(stats["refresh"]["unchanged"], 1)
+        self.assertEqual(stats["refresh"]["changed"], 0)
+        self.assertEqual(stats["refresh"]["history"], "-")
+
+        db = sqlite3.connect(os.path.join(self.workdir, "melian.db"))
+        db.execute("UPDATE hosts SET hostname = 'renamed-9' WHERE id = 9")
+        db.commit()
+        db.close()
+
+        # One that brings anything new halves it again
+        stats = self.wait_period(5, timeout=30)
+        self.assertEqual(stats["refresh"]["changed"], 1)
+        self.assertEqual(stats["refresh"]["history"], "-+")
+        self.assertEqual(self.client.fetch("hosts", "id", 9).row()["hostname"], "renamed-9")
+        self.assertIn("Table hosts changed, reloading every 5 seconds instead of 10", self.server.read_log())
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,55 @@
+import struct
+import unittest
+
+from melian import (MelianTestCase, ACTION_FETCH, ACTION_SEARCH, decode_rows, request_bytes)
+
+
+class SearchTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int;hostname#1:trigram;status#2:string",
+    }
+
+    def search(self, query, **kwargs):
+        reply = self.client.search("hosts", "hostname", query, **kwargs)
+        self.assertEqual(reply.status, 0)
+        return decode_rows(reply.data, scored=True)
+
+    def test_similarity(self):
+        rows = self.search("host-00042", k=5)
+        self.assertEqual(rows[0]["hostname"], "host-00042")
+        self.assertAlmostEqual(rows[0]["_score"], 1.0)
+        scores = [row["_score"] for row in rows]
+        self.assertEqual(scores, sorted(scores, reverse=True))
+        self.assertEqual(len(rows), 5)
+
+    def test_least_score(self):
+        rows = self.search("host-00042", min_score=0.99)
+        self.assertEqual([row["id"] for row in rows], [42])
+
+    def test_substring_ignores_case(self):
+        rows = self.search("ST-0099", substring=True)
+        self.assertEqual(sorted(row["id"] for row in rows), list(range(990, 1000)))
+
+    def test_substring_limit(self):
+        rows = self.search("00", substring=True, k=3)
+        self.assertEqual(len(rows), 3)
+
+    def test_no_match(self):
+        self.assertEqual(self.search("zzzz", substring=True), [])
+
+    def test_pipelined_fetch_waits_for_search(self):
+        table_id, search_id = self.client.ids("hosts", "hostname")
+        _, fetch_id = self.client.ids("hosts", "id")
+        payload = struct.pack("<BId", 1, 0, 0.0) + b"host-"
+        self.client.send(request_bytes(ACTION_SEARCH, table_id, search_id, payload) +
+                         request_bytes(ACTION_FETCH, table_id, fetch_id, struct.pack("<I", 7)))
+        self.assertEqual(len(decode_rows(self.client.reply().data, scored=True)), 1000)
+        self.assertEqual(self.client.reply().row()["id"], 7)
+
+    def test_not_a_trigram_index(self):
+        reply = self.client.search("hosts", "status", "active")
+        self.assertEqual((reply.status, reply.data), (0, b""))
+
+
+if __name__ == "__main__":
+    unittest.main()
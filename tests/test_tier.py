@@ -0,0 +1,45 @@
+import unittest
+
+from melian import MelianTestCase
+
+
+class TierTest(MelianTestCase):
+    env = {
+        "MELIAN_TABLE_TABLES": "hosts#0|60|id#0:int;hostname#1:string",
+        "MELIAN_TABLE_TIER_IDLE": "2",
+    }
+
+    def tier(self):
+        return self.table_stats("hosts")["tier"]
+
+    def test_page_out_and_back(self):
+        self.wait_for(lambda: self.tier()["state"] == "cold", timeout=30, message="table to page out")
+        self.assertEqual(self.tier()["demotions"], 1)
+        self.assertIn("Paged out table hosts", self.server.read_log())
+
+        # Answered from the snapshot mapping, before the table comes back
+        self.assertEqual(self.client.fetch("hosts", "id", 7).row()["hostname"], "host-00007")
+        self.assertEqual(self.client.fetch("hosts", "hostname", "host-00008").row()["id"], 8)
+        self.assertEqual(self.client.fetch("hosts", "id", 5000).data, b"")
+        self.assertGreater(self.tier()["first_access_us"], 0)
+
+        self.wait_for(lambda: self.tier()["promotions"] == 1, timeout=30, message="table to come back")
+        self.assertIn("Promoting table hosts", self.server.read_log())
+        self.assertEqual(self.tier()["state"], "hot")
+        self.assertEqual(self.client.fetch("hosts", "id", 7).row()["hostname"], "host-00007")
+        self.assertEqual(self.table_stats("hosts")["rows"], 1000)
+
+
+class LoaderTierTest(TierTest):
+    # Slots mapped from the loader's image are paged out through their own branch
+    env = dict(TierTest.env, MELIAN_SERVER_LOADER_PROCESS="true")
+
+    def test_page_out_and_back(self):
+        super().test_page_out_and_back()
+        # Promotion reloads through the loader into a fresh image
+        self.wait_for(lambda: self.server.read_log().count("Mapped 1000 rows for table hosts") >= 2,
+                      timeout=15, message="table to be mapped again")
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,39 @@
+import unittest
+
+from melian import MelianTestCase
+
+TABLES = "hosts#0|5|id#0:int;hostname#1:string"
+
+
+def fetch_and_reload(test):
+    # One in every 16 fetches leaves its key in the ring
+    for i in range(1, 161):
+        test.assertEqual(test.client.fetch("hosts", "id", i).row()["hostname"], "host-%05d" % i)
+        test.assertEqual(test.client.fetch("hosts", "hostname", "host-%05d" % i).row()["id"], i)
+    loaded = test.table_stats("hosts")["last_loaded"]["epoch"]
+    test.wait_for(lambda: test.table_stats("hosts")["last_loaded"]["epoch"] > loaded, timeout=20,
+                  message="a reload")
+    return test.table_stats("hosts")
+
+
+class WarmTest(MelianTestCase):
+    env = {"MELIAN_TABLE_TABLES": TABLES}
+
+    def test_reload_warms_fetched_keys(self):
+        warm = fetch_and_reload(self)["warm"]
+        self.assertEqual(warm["sample"], 1024)
+        self.assertGreater(warm["keys"], 0)
+        self.assertLessEqual(warm["keys"], 20)
+        # The reload brought the same rows, so every key is still there
+        self.assertEqual(warm["found"], warm["keys"])
+
+
+class NoWarmTest(MelianTestCase):
+    env = {"MELIAN_TABLE_TABLES": TABLES, "MELIAN_TABLE_WARM_KEYS": "0"}
+
+    def test_no_sampling(self):
+        self.assertNotIn("warm", fetch_and_reload(self))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,135 @@
+// Micro-benchmark for the per-kind Hash lookup paths.
+//
+// Builds one int index and one string index over the same number of rows,
+// then times lookups through the specialized hash_get() of each kind, next
+// to the previous generic path (XXH32 over every key plus a runtime length
+// branch in the key compare) run over an identical table layout.
+//
+// Build and run from the top of the repo:
+//
+//   cc -O2 -std=c11 -D_GNU_SOURCE -Iserver -I. -o hash_bench utils/benchmarks/hash_bench.c
+//      server/hash.c server/arena.c server/xxhash.c server/util.c server/log.c
+//   ./hash_bench [rows] [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "arena.h"
+#include "xxhash.h"
+#include "hash.h"
+
+enum {
+  DEFAULT_ROWS = 100000,
+  DEFAULT_ROUNDS = 50,
+  MAX_HOST_LEN = 32,
+};
+
+// The lookup every index used before key kinds existed.
+static const Bucket* generic_get(Hash *hash, const void *key, uint32_t key_len) {
+  uint64_t h = XXH32(key, key_len, 0);
+  uint8_t tag = (uint8_t)(h >> 56);
+  uint64_t mask = hash->cap - 1;
+  uint64_t idx = h & mask;
+  while (1) {
+    const Bucket *bucket = &hash->tab[idx];
+    if (bucket->key_len == 0) return 0;
+    if (bucket->tag == tag && bucket->hash == h && bucket->key_len == key_len) {
+      int same = 0;
+      if (key_len == 4) {
+        uint32_t x, y;
+        memcpy(&x, bucket->key_ptr, 4);
+        memcpy(&y, key, 4);
+        same = x == y;
+      } else {
+        same = memcmp(bucket->key_ptr, key, key_len) == 0;
+      }
+      if (same) return bucket;
+    }
+    idx = (idx + 1) & mask;
+  }
+}
+
+static void generic_insert(Hash *hash, const void *key, uint32_t key_len) {
+  uint64_t h = XXH32(key, key_len, 0);
+  uint64_t mask = hash->cap - 1;
+  uint64_t idx = h & mask;
+  while (hash->tab[idx].key_len) idx = (idx + 1) & mask;
+  unsigned kindex = arena_store(hash->arena, key, key_len);
+  hash->tab[idx].hash = h;
+  hash->tab[idx].tag = (uint8_t)(h >> 56);
+  hash->tab[idx].key_len = key_len;
+  hash->tab[idx].key_ptr = (uint8_t*)(uintptr_t)kindex;
+  hash->used++;
+}
+
+static unsigned host_key(char* buf, unsigned id) {
+  return (unsigned)snprintf(buf, MAX_HOST_LEN, "host-%08u.example.com", id);
+}
+
+static double run_lookups(const char* label, Hash* hash, unsigned generic,
+                          char (*hosts)[MAX_HOST_LEN], unsigned* host_lens,
+                          unsigned rows, unsigned rounds) {
+  unsigned found = 0;
+  double t0 = now_sec();
+  for (unsigned r = 0; r < rounds; ++r) {
+    for (unsigned id = 1; id <= rows; ++id) {
+      const void* key = &id;
+      unsigned len = sizeof(id);
+      if (hosts) {
+        key = hosts[id - 1];
+        len = host_lens[id - 1];
+      }
+      const Bucket* b = generic ? generic_get(hash, key, len) : hash_get(hash, key, len);
+      found += b != 0;
+    }
+  }
+  double t1 = now_sec();
+  double ns = (t1 - t0) * 1e9 / ((double)rows * rounds);
+  printf("%-22s %10u hits %8.2f ns/lookup\n", label, found, ns);
+  return ns;
+}
+
+int main(int argc, char* argv[]) {
+  unsigned rows = argc > 1 ? (unsigned)atoi(argv[1]) : DEFAULT_ROWS;
+  unsigned rounds = argc > 2 ? (unsigned)atoi(argv[2]) : DEFAULT_ROUNDS;
+  unsigned cap = 2 * next_power_of_two(rows, 1);
+  char (*hosts)[MAX_HOST_LEN] = calloc(rows, MAX_HOST_LEN);
+  unsigned* host_lens = calloc(rows, sizeof(unsigned));
+  if (!hosts || !host_lens) return 1;
+
+  Arena* arena = arena_build(1024);
+  Hash* int_hash = hash_build(cap, arena, HASH_KEY_INT);
+  Hash* str_hash = hash_build(cap, arena, HASH_KEY_BYTES);
+  Hash* gen_int = hash_build(cap, arena, HASH_KEY_BYTES);
+  Hash* gen_str = hash_build(cap, arena, HASH_KEY_BYTES);
+  for (unsigned id = 1; id <= rows; ++id) {
+    char* host = hosts[id - 1];
+    unsigned len = host_lens[id - 1] = host_key(host, id);
+    hash_insert(int_hash, &id, sizeof(id), 0, 0);
+    hash_insert(str_hash, host, len, 0, 0);
+    generic_insert(gen_int, &id, sizeof(id));
+    generic_insert(gen_str, host, len);
+  }
+  hash_finalize_pointers(int_hash);
+  hash_finalize_pointers(str_hash);
+  hash_finalize_pointers(gen_int);
+  hash_finalize_pointers(gen_str);
+
+  printf("rows %u, rounds %u, capacity %u\n", rows, rounds, cap);
+  double gi = run_lookups("int generic (XXH32)", gen_int, 1, NULL, NULL, rows, rounds);
+  double si = run_lookups("int specialized", int_hash, 0, NULL, NULL, rows, rounds);
+  double gs = run_lookups("string generic (XXH32)", gen_str, 1, hosts, host_lens, rows, rounds);
+  double ss = run_lookups("string specialized", str_hash, 0, hosts, host_lens, rows, rounds);
+  printf("int speedup    %.2fx\n", gi / si);
+  printf("string speedup %.2fx\n", gs / ss);
+
+  hash_destroy(int_hash);
+  hash_destroy(str_hash);
+  hash_destroy(gen_int);
+  hash_destroy(gen_str);
+  arena_destroy(arena);
+  free(hosts);
+  free(host_lens);
+  return 0;
+}
@@ -0,0 +1,61 @@
+#!/usr/bin/env bash
+# Compare the PostgreSQL ingest paths: regular query vs. binary COPY.
+# Seeds a table with ROWS rows in a local PostgreSQL, starts melian-server
+# once per path, and reports load rate and peak RSS.
+#
+# Usage: pg_copy_bench.sh [ROWS]
+# Needs psql and a PostgreSQL reachable with the MELIAN_DB_* settings below.
+set -euo pipefail
+
+ROWS=${1:-1000000}
+SERVER=${MELIAN_SERVER:-./melian-server}
+SOCKET=/tmp/melian-pg-bench.sock
+LOG=$(mktemp)
+
+export MELIAN_DB_DRIVER=postgresql
+export MELIAN_DB_HOST=${MELIAN_DB_HOST:-127.0.0.1}
+export MELIAN_DB_PORT=${MELIAN_DB_PORT:-5432}
+export MELIAN_DB_NAME=${MELIAN_DB_NAME:-melian}
+export MELIAN_DB_USER=${MELIAN_DB_USER:-melian}
+export MELIAN_DB_PASSWORD=${MELIAN_DB_PASSWORD:-meliansecret}
+export MELIAN_SOCKET_PATH=$SOCKET
+export MELIAN_TABLE_TABLES='bench_rows#0|3600|id#0:int;name#1:string'
+
+export PGPASSWORD=$MELIAN_DB_PASSWORD
+psql -q -h "$MELIAN_DB_HOST" -p "$MELIAN_DB_PORT" -U "$MELIAN_DB_USER" "$MELIAN_DB_NAME" <<SQL
+DROP TABLE IF EXISTS bench_rows;
+CREATE TABLE bench_rows AS
+SELECT n AS id,
+       'name-' || n AS name,
+       n * 1.5 AS price,
+       (n % 2 = 0) AS active,
+       now() - (n || ' seconds')::interval AS created_at
+FROM generate_series(1, $ROWS) AS n;
+SQL
+
+run() {
+  local copy=$1
+  rm -f "$SOCKET"
+  MELIAN_POSTGRESQL_COPY=$copy "$SERVER" >"$LOG" 2>&1 &
+  local pid=$!
+  until grep -q "Fetched .* rows from table bench_rows" "$LOG"; do
+    if ! kill -0 "$pid" 2>/dev/null; then
+      echo "melian-server exited early:" >&2
+      cat "$LOG" >&2
+      exit 1
+    fi
+    sleep 0.1
+  done
+  local line us rss
+  line=$(grep -m1 "Fetched .* rows from table bench_rows" "$LOG")
+  us=$(sed -E 's/.* in ([0-9]+) us.*/\1/' <<<"$line")
+  rss=$(awk '/VmHWM/ {print $2}' "/proc/$pid/status")
+  kill "$pid"
+  wait "$pid" 2>/dev/null || true
+  printf "copy=%-5s %10d rows %10d us %12.0f rows/s  peak RSS %8d kB\n" \
+    "$copy" "$ROWS" "$us" "$(bc -l <<<"$ROWS * 1000000 / $us")" "$rss"
+}
+
+run false
+run true
+rm -f "$LOG" "$SOCKET"